@@ -397,8 +397,8 @@ int main(int argc, char *argv[])
             <<"RMSD\tID1\tID2\tIDali\tL1\tL2\tLali"<<endl;
 
     /* declare previously global variables */
-    vector<vector<string> >PDB_lines1; // text of chain1
-    vector<vector<string> >PDB_lines2; // text of chain2
+    vector<PDBChain> PDB_lines1; // residues of chain1
+    vector<PDBChain> PDB_lines2; // residues of chain2
     vector<int> mol_vec1;              // molecule type of chain1, RNA if >0
     vector<int> mol_vec2;              // molecule type of chain2, RNA if >0
     vector<string> chainID_list1;      // list of chainID1
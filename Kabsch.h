@@ -11,10 +11,149 @@ rms   - sum of w*(ux+t-y)**2 over all atom pairs            (output)
 u    - u(i,j) is   rotation  matrix for best superposition  (output)
 t    - t(i)   is translation vector for best superposition  (output)
 **************************************************************************/
-bool Kabsch(double **x, double **y, int n, int mode, double *rms,
+
+/* superposition engine used by Kabsch:
+ * 0 - (default) Kabsch_u3b, the eigen-decomposition of TM-align fortran
+ * 1 - Kabsch_QCP, quaternion characteristic polynomial
+ * Only USalign sets it, by -kabsch. KabschCheck compares the two engines */
+int kabsch_opt=0;
+
+/* first and second moments of n atom pairs (x,y), which are all that
+ * Kabsch needs. Sums are over coordinates shifted by -xshift and -yshift,
+ * which limits round-off when the moments come from prefix sums */
+struct KabschMoments
+{
+    int    n;
+    double s1[3], s2[3];     // sum of x and of y
+    double sxy[3][3];        // sxy[i][j]: sum of x[i]*y[j]
+    double e0;               // sum of |x-xc|^2+|y-yc|^2, for rms and QCP
+    double xshift[3], yshift[3];
+};
+
+/* moments of atom pairs x[0...n-1] and y[0...n-1]. e0 is only computed if
+ * need_e0 is true, and is 0 otherwise */
+void get_Kabsch_moments(double **x, double **y, int n, bool need_e0,
+    KabschMoments &mom)
+{
+    int i, j;
+    double c1[3], c2[3];
+    mom.n=n;
+    mom.e0=0;
+    for (i=0;i<3;i++)
+    {
+        mom.s1[i]=mom.s2[i]=0;
+        mom.xshift[i]=mom.yshift[i]=0;
+        for (j=0;j<3;j++) mom.sxy[i][j]=0;
+    }
+    if (n<1) return;
+
+    for (i = 0; i<n; i++)
+    {
+        for (j = 0; j < 3; j++)
+        {
+            c1[j] = x[i][j];
+            c2[j] = y[i][j];
+
+            mom.s1[j] += c1[j];
+            mom.s2[j] += c2[j];
+        }
+
+        for (j = 0; j < 3; j++)
+        {
+            mom.sxy[0][j] += c1[0] * c2[j];
+            mom.sxy[1][j] += c1[1] * c2[j];
+            mom.sxy[2][j] += c1[2] * c2[j];
+        }
+    }
+    if (!need_e0) return;
+
+    double xc[3], yc[3];
+    for (i = 0; i < 3; i++)
+    {
+        xc[i] = mom.s1[i] / n;
+        yc[i] = mom.s2[i] / n;
+    }
+    for (int mm = 0; mm < n; mm++)
+        for (int nn = 0; nn < 3; nn++)
+            mom.e0 += (x[mm][nn] - xc[nn]) * (x[mm][nn] - xc[nn]) + 
+                      (y[mm][nn] - yc[nn]) * (y[mm][nn] - yc[nn]);
+}
+
+/* prefix sums of the moments of atom pairs x[0...n-1] and y[0...n-1] in
+ * P[0...n][0...16], where P[k] holds the sums over the first k pairs of
+ * x, y, x[i]*y[j], |x|^2 and |y|^2. Coordinates are shifted by the centers
+ * of all n pairs, which are saved to P[n+1][0...5]. P has n+2 rows of 17
+ * columns, e.g. AlignWorkspace::moments */
+void Kabsch_prefix(double **x, double **y, int n, double **P)
+{
+    int i, j, k;
+    double c1[3], c2[3];
+    double *xc=P[n+1], *yc=P[n+1]+3;
+    for (i=0;i<3;i++) xc[i]=yc[i]=0;
+    for (k=0;k<n;k++)
+    {
+        for (i=0;i<3;i++)
+        {
+            xc[i]+=x[k][i];
+            yc[i]+=y[k][i];
+        }
+    }
+    for (i=0;i<3 && n>0;i++)
+    {
+        xc[i]/=n;
+        yc[i]/=n;
+    }
+
+    for (j=0;j<17;j++) P[0][j]=0;
+    for (k=0;k<n;k++)
+    {
+        for (i=0;i<3;i++)
+        {
+            c1[i]=x[k][i]-xc[i];
+            c2[i]=y[k][i]-yc[i];
+        }
+        for (i=0;i<3;i++)
+        {
+            P[k+1][i]  =P[k][i]  +c1[i];
+            P[k+1][3+i]=P[k][3+i]+c2[i];
+            for (j=0;j<3;j++) P[k+1][6+3*i+j]=P[k][6+3*i+j]+c1[i]*c2[j];
+        }
+        P[k+1][15]=P[k][15]+c1[0]*c1[0]+c1[1]*c1[1]+c1[2]*c1[2];
+        P[k+1][16]=P[k][16]+c2[0]*c2[0]+c2[1]*c2[1]+c2[2]*c2[2];
+    }
+}
+
+/* moments of the atom pairs start...start+L-1 from the prefix sums P of
+ * Kabsch_prefix for n atom pairs, in O(1) time */
+void get_Kabsch_moments(double **P, int n, int start, int L,
+    KabschMoments &mom)
+{
+    int i, j;
+    const double *P0=P[start], *P1=P[start+L];
+    mom.n=L;
+    for (i=0;i<3;i++)
+    {
+        mom.s1[i]=P1[i]-P0[i];
+        mom.s2[i]=P1[3+i]-P0[3+i];
+        for (j=0;j<3;j++) mom.sxy[i][j]=P1[6+3*i+j]-P0[6+3*i+j];
+        mom.xshift[i]=P[n+1][i];
+        mom.yshift[i]=P[n+1][3+i];
+    }
+    mom.e0=0;
+    if (L<1) return;
+    mom.e0=(P1[15]-P0[15])+(P1[16]-P0[16])-(
+        mom.s1[0]*mom.s1[0]+mom.s1[1]*mom.s1[1]+mom.s1[2]*mom.s1[2]+
+        mom.s2[0]*mom.s2[0]+mom.s2[1]*mom.s2[1]+mom.s2[2]*mom.s2[2])/L;
+    if (mom.e0<0) mom.e0=0;
+}
+
+/* Kabsch by the eigenvalues and eigenvectors of trans(r)*r, as in the
+ * u3b subroutine of TM-align fortran */
+bool Kabsch_u3b(const KabschMoments &mom, int mode, double *rms,
     double t[3], double u[3][3])
 {
     int i, j, m, m1, l, k;
+    int n = mom.n;
     double e0, rms1, d, h, g;
     double cth, sth, sqrth, p, det, sigma;
     double xc[3], yc[3];
@@ -29,19 +168,7 @@ bool Kabsch(double **x, double **y, int n, int mode, double *rms,
     //initialization
     *rms = 0;
     rms1 = 0;
-    e0 = 0;
-    double c1[3], c2[3];
-    double s1[3], s2[3];
-    double sx[3], sy[3], sz[3];
-    for (i = 0; i < 3; i++)
-    {
-        s1[i] = 0.0;
-        s2[i] = 0.0;
-
-        sx[i] = 0.0;
-        sy[i] = 0.0;
-        sz[i] = 0.0;
-    }
+    e0 = mom.e0;
 
     for (i = 0; i<3; i++)
     {
@@ -64,39 +191,16 @@ bool Kabsch(double **x, double **y, int n, int mode, double *rms,
     if (n<1) return false;
 
     //compute centers for vector sets x, y
-    for (i = 0; i<n; i++)
-    {
-        for (j = 0; j < 3; j++)
-        {
-            c1[j] = x[i][j];
-            c2[j] = y[i][j];
-
-            s1[j] += c1[j];
-            s2[j] += c2[j];
-        }
-
-        for (j = 0; j < 3; j++)
-        {
-            sx[j] += c1[0] * c2[j];
-            sy[j] += c1[1] * c2[j];
-            sz[j] += c1[2] * c2[j];
-        }
-    }
     for (i = 0; i < 3; i++)
     {
-        xc[i] = s1[i] / n;
-        yc[i] = s2[i] / n;
+        xc[i] = mom.s1[i] / n + mom.xshift[i];
+        yc[i] = mom.s2[i] / n + mom.yshift[i];
     }
-    if (mode == 2 || mode == 0)
-        for (int mm = 0; mm < n; mm++)
-            for (int nn = 0; nn < 3; nn++)
-                e0 += (x[mm][nn] - xc[nn]) * (x[mm][nn] - xc[nn]) + 
-                      (y[mm][nn] - yc[nn]) * (y[mm][nn] - yc[nn]);
     for (j = 0; j < 3; j++)
     {
-        r[j][0] = sx[j] - s1[0] * s2[j] / n;
-        r[j][1] = sy[j] - s1[1] * s2[j] / n;
-        r[j][2] = sz[j] - s1[2] * s2[j] / n;
+        r[j][0] = mom.sxy[0][j] - mom.s1[0] * mom.s2[j] / n;
+        r[j][1] = mom.sxy[1][j] - mom.s1[1] * mom.s2[j] / n;
+        r[j][2] = mom.sxy[2][j] - mom.s1[2] * mom.s2[j] / n;
     }
 
     //compute determinant of matrix r
@@ -332,3 +436,157 @@ bool Kabsch(double **x, double **y, int n, int mode, double *rms,
     *rms = rms1;
     return true;
 }
+
+/* determinant of the 3x3 matrix formed by rows i0,i1,i2 and columns
+ * j0,j1,j2 of the 4x4 matrix A */
+inline double QCP_minor(double A[4][4], const int i0, const int i1,
+    const int i2, const int j0, const int j1, const int j2)
+{
+    return A[i0][j0]*(A[i1][j1]*A[i2][j2]-A[i1][j2]*A[i2][j1])
+          -A[i0][j1]*(A[i1][j0]*A[i2][j2]-A[i1][j2]*A[i2][j0])
+          +A[i0][j2]*(A[i1][j0]*A[i2][j1]-A[i1][j1]*A[i2][j0]);
+}
+
+/* Kabsch by the quaternion characteristic polynomial (QCP) method
+ * [Theobald, Acta Cryst A 61:478 (2005); Liu et al, J Comput Chem 31:1561
+ * (2010)], with the same input and output as Kabsch_u3b. The largest
+ * eigenvalue of the 4x4 key matrix K is found by Newton iterations on its
+ * characteristic polynomial, and the optimal rotation is the quaternion
+ * given by a column of the adjugate of K-lambda*I. When this column is
+ * ill-defined, e.g. for collinear atoms, Kabsch_u3b is used instead. */
+bool Kabsch_QCP(const KabschMoments &mom, int mode, double *rms,
+    double t[3], double u[3][3])
+{
+    int i, j, k;
+    int n=mom.n;
+    double xc[3], yc[3], r[3][3];
+    double K[4][4], q[4];
+    double e0=mom.e0;
+
+    //initialization
+    *rms=0;
+    for (i=0;i<3;i++)
+    {
+        t[i]=0;
+        for (j=0;j<3;j++) u[i][j]=(i==j)?1.0:0.0;
+    }
+    if (n<1) return false;
+
+    //centers and r[i][j]=sum x[i]*y[j] over centered atom pairs
+    for (i=0;i<3;i++)
+    {
+        xc[i]=mom.s1[i]/n+mom.xshift[i];
+        yc[i]=mom.s2[i]/n+mom.yshift[i];
+    }
+    for (i=0;i<3;i++)
+        for (j=0;j<3;j++)
+            r[i][j]=mom.sxy[i][j]-mom.s1[i]*mom.s2[j]/n;
+
+    //key matrix, whose largest eigenvalue is max sum y*(u*x)
+    K[0][0]= r[0][0]+r[1][1]+r[2][2];
+    K[0][1]= r[1][2]-r[2][1];
+    K[0][2]= r[2][0]-r[0][2];
+    K[0][3]= r[0][1]-r[1][0];
+    K[1][1]= r[0][0]-r[1][1]-r[2][2];
+    K[1][2]= r[0][1]+r[1][0];
+    K[1][3]= r[2][0]+r[0][2];
+    K[2][2]=-r[0][0]+r[1][1]-r[2][2];
+    K[2][3]= r[1][2]+r[2][1];
+    K[3][3]=-r[0][0]-r[1][1]+r[2][2];
+    for (i=1;i<4;i++)
+        for (j=0;j<i;j++)
+            K[i][j]=K[j][i];
+
+    //characteristic polynomial lambda^4+c2*lambda^2+c1*lambda+c0
+    double c2=0;
+    for (i=0;i<3;i++)
+        for (j=0;j<3;j++)
+            c2+=r[i][j]*r[i][j];
+    c2*=-2;
+    double c1=-8*(r[0][0]*(r[1][1]*r[2][2]-r[1][2]*r[2][1])
+                 -r[0][1]*(r[1][0]*r[2][2]-r[1][2]*r[2][0])
+                 +r[0][2]*(r[1][0]*r[2][1]-r[1][1]*r[2][0]));
+    double c0=K[0][0]*QCP_minor(K,1,2,3,1,2,3)
+             -K[0][1]*QCP_minor(K,1,2,3,0,2,3)
+             +K[0][2]*QCP_minor(K,1,2,3,0,1,3)
+             -K[0][3]*QCP_minor(K,1,2,3,0,1,2);
+
+    //Newton iterations from the upper bound e0/2 of the largest eigenvalue
+    double lambda=e0/2, lambda_old, x2, a, b;
+    for (k=0;k<50;k++)
+    {
+        lambda_old=lambda;
+        x2=lambda*lambda;
+        b=(x2+c2)*lambda;
+        a=b+c1;
+        lambda-=(a*lambda+c0)/(2*x2*lambda+b+a);
+        if (fabs(lambda-lambda_old)<fabs(1e-11*lambda)) break;
+    }
+
+    if (mode==2 || mode==0)
+    {
+        *rms=e0-2*lambda;
+        if (*rms<0) *rms=0;
+    }
+    if (mode==0) return true;
+
+    //the quaternion is the longest column of the adjugate of K-lambda*I
+    for (i=0;i<4;i++) K[i][i]-=lambda;
+    static const int rest[4][3]={{1,2,3},{0,2,3},{0,1,3},{0,1,2}};
+    double adj[4], qsqr=0, adj_sqr;
+    for (j=0;j<4;j++)
+    {
+        adj_sqr=0;
+        for (i=0;i<4;i++)
+        {
+            adj[i]=QCP_minor(K,rest[i][0],rest[i][1],rest[i][2],
+                               rest[j][0],rest[j][1],rest[j][2]);
+            if ((i+j)%2) adj[i]=-adj[i];
+            adj_sqr+=adj[i]*adj[i];
+        }
+        if (adj_sqr<=qsqr) continue;
+        qsqr=adj_sqr;
+        for (i=0;i<4;i++) q[i]=adj[i];
+    }
+    double e03=e0*e0*e0;
+    if (qsqr<=1e-20*e03*e03)
+    {
+        double rms_u3b;
+        return Kabsch_u3b(mom, 1, &rms_u3b, t, u);
+    }
+    double qnorm=1/sqrt(qsqr);
+    for (i=0;i<4;i++) q[i]*=qnorm;
+
+    //rotation matrix of the quaternion
+    u[0][0]=q[0]*q[0]+q[1]*q[1]-q[2]*q[2]-q[3]*q[3];
+    u[0][1]=2*(q[1]*q[2]-q[0]*q[3]);
+    u[0][2]=2*(q[1]*q[3]+q[0]*q[2]);
+    u[1][0]=2*(q[1]*q[2]+q[0]*q[3]);
+    u[1][1]=q[0]*q[0]-q[1]*q[1]+q[2]*q[2]-q[3]*q[3];
+    u[1][2]=2*(q[2]*q[3]-q[0]*q[1]);
+    u[2][0]=2*(q[1]*q[3]-q[0]*q[2]);
+    u[2][1]=2*(q[2]*q[3]+q[0]*q[1]);
+    u[2][2]=q[0]*q[0]-q[1]*q[1]-q[2]*q[2]+q[3]*q[3];
+
+    //compute t
+    for (i=0;i<3;i++)
+        t[i]=((yc[i]-u[i][0]*xc[0])-u[i][1]*xc[1])-u[i][2]*xc[2];
+    return true;
+}
+
+/* Kabsch from precomputed moments, e.g. from get_Kabsch_moments. e0 is
+ * needed for rms and for Kabsch_QCP */
+bool Kabsch(const KabschMoments &mom, int mode, double *rms,
+    double t[3], double u[3][3])
+{
+    if (kabsch_opt==1) return Kabsch_QCP(mom, mode, rms, t, u);
+    return Kabsch_u3b(mom, mode, rms, t, u);
+}
+
+bool Kabsch(double **x, double **y, int n, int mode, double *rms,
+    double t[3], double u[3][3])
+{
+    KabschMoments mom;
+    get_Kabsch_moments(x, y, n, mode!=1 || kabsch_opt==1, mom);
+    return Kabsch(mom, mode, rms, t, u);
+}
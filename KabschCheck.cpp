@@ -0,0 +1,137 @@
+/* Check that the QCP superposition engine (-kabsch 1) gives the same
+ * rotation, translation and RMSD as the eigen-decomposition of TM-align
+ * (-kabsch 0), for the first chain of two structures and for random
+ * fragments of them. Moments are also taken from the prefix sums of
+ * Kabsch_prefix, as in TMscore8_search. */
+#include "basic_fun.h"
+#include "Kabsch.h"
+
+using namespace std;
+
+void print_help()
+{
+    cout <<
+"Compare the QCP superposition (USalign -kabsch 1) with the default\n"
+"eigen-decomposition (USalign -kabsch 0). Residue i of structure_1 is\n"
+"paired with residue i of structure_2.\n"
+"\n"
+"Usage: KabschCheck PDB1.pdb PDB2.pdb\n"
+"\n"
+"    -n       Number of random fragments (default 10000)\n"
+"\n"
+"    -tol     Tolerance of rotation matrix elements, of translation\n"
+"             vectors in Angstrom, and of the sum of squared deviations\n"
+"             relative to that of the unsuperposed fragments after\n"
+"             centering (default 1e-6)\n"
+"\n"
+"The exit status is 0 if all differences are within the tolerance and\n"
+"1 otherwise.\n"
+    <<endl;
+    exit(EXIT_SUCCESS);
+}
+
+/* read the first chain of a structure file into a[0...len-1] */
+int read_first_chain(const string &name, double ***a)
+{
+    vector<vector<string> >PDB_lines;
+    vector<string> chainID_list;
+    vector<int> mol_vec;
+    vector<string> resi_vec;
+    vector<string> chain2parse;
+    vector<string> model2parse;
+    if (get_PDB_lines(name, PDB_lines, chainID_list, mol_vec, 3, -1,
+        "auto", true, 0, 0, chain2parse, model2parse)==0 ||
+        PDB_lines[0].size()==0)
+        PrintErrorAndQuit("ERROR! Cannot parse file: "+name);
+    int len=PDB_lines[0].size();
+    char *seq=new char[len+1];
+    NewArray(a, len, 3);
+    read_PDB(PDB_lines[0], *a, seq, resi_vec, 0);
+    delete [] seq;
+    return len;
+}
+
+/* superpose x[0...L-1] onto y[0...L-1] by both engines, using the moments
+ * mom, and update the largest differences */
+void compare_engines(const KabschMoments &mom, double &du, double &dt,
+    double &drms)
+{
+    double rms0, rms1, t0[3], t1[3], u0[3][3], u1[3][3];
+    int i, j;
+    Kabsch_u3b(mom, 2, &rms0, t0, u0);
+    Kabsch_QCP(mom, 2, &rms1, t1, u1);
+    for (i=0;i<3;i++)
+    {
+        dt=max(dt, fabs(t0[i]-t1[i]));
+        for (j=0;j<3;j++) du=max(du, fabs(u0[i][j]-u1[i][j]));
+    }
+    drms=max(drms, fabs(rms0-rms1)/max(mom.e0, 1.0));
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 3) print_help();
+
+    string xname="";
+    string yname="";
+    int    n_frag=10000;
+    double tol=1e-6;
+    for (int i = 1; i < argc; i++)
+    {
+        if ( !strcmp(argv[i],"-n") && i < (argc-1) )
+        {
+            n_frag=atoi(argv[i + 1]); i++;
+        }
+        else if ( !strcmp(argv[i],"-tol") && i < (argc-1) )
+        {
+            tol=atof(argv[i + 1]); i++;
+        }
+        else if (xname.size()==0) xname=argv[i];
+        else yname=argv[i];
+    }
+    if (yname.size()==0) print_help();
+
+    double **xa, **ya;
+    int xlen=read_first_chain(xname, &xa);
+    int ylen=read_first_chain(yname, &ya);
+    int len=min(xlen, ylen);
+    if (len<3)
+        PrintErrorAndQuit("ERROR! Chains must have at least 3 residues");
+
+    /* whole chain, and random fragments of 3 to len residues */
+    double du=0, dt=0, drms=0;
+    KabschMoments mom;
+    get_Kabsch_moments(xa, ya, len, true, mom);
+    compare_engines(mom, du, dt, drms);
+
+    double **P;
+    NewArray(&P, len+2, 17);
+    Kabsch_prefix(xa, ya, len, P);
+    srand(1);
+    for (int k=0;k<n_frag;k++)
+    {
+        int L=3+rand()%(len-2);
+        int start=rand()%(len-L+1);
+        get_Kabsch_moments(xa+start, ya+start, L, true, mom);
+        compare_engines(mom, du, dt, drms);
+        get_Kabsch_moments(P, len, start, L, mom);
+        compare_engines(mom, du, dt, drms);
+    }
+
+    cout<<"Residue pairs:         "<<len<<endl;
+    cout<<"Random fragments:      "<<n_frag<<endl;
+    cout<<"Max rotation diff:     "<<du<<endl;
+    cout<<"Max translation diff:  "<<dt<<endl;
+    cout<<"Max relative rms diff: "<<drms<<endl;
+
+    DeleteArray(&xa, xlen);
+    DeleteArray(&ya, ylen);
+    DeleteArray(&P, len+2);
+    if (du>tol || dt>tol || drms>tol)
+    {
+        cout<<"FAIL"<<endl;
+        return 1;
+    }
+    cout<<"PASS"<<endl;
+    return 0;
+}
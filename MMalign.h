@@ -716,22 +716,12 @@ size_t get_full_PDB_lines(const string filename,
     
     int compress_type=0; // uncompressed file
     ifstream fin;
-#ifndef REDI_PSTREAM_H_SEEN
+#ifndef GZSTREAM_H_SEEN
     ifstream fin_gz;
 #else
-    redi::ipstream fin_gz; // if file is compressed
-    if (filename.size()>=3 && 
-        filename.substr(filename.size()-3,3)==".gz")
-    {
-        fin_gz.open("gunzip -c '"+filename+"'");
-        compress_type=1;
-    }
-    else if (filename.size()>=4 && 
-        filename.substr(filename.size()-4,4)==".bz2")
-    {
-        fin_gz.open("bzcat '"+filename+"'");
-        compress_type=2;
-    }
+    gzistream fin_gz; // if file is compressed
+    compress_type=gz_compress_type(filename);
+    if (compress_type) fin_gz.open(filename);
     else
 #endif
         fin.open(filename.c_str());
@@ -1963,9 +1953,10 @@ void MMalign_iter(double & max_total_score, const int max_iter,
 /* Input: vectors x, y, rotation matrix t, u, scale factor d02, and gap_open
  * Output: j2i[1:len2] \in {1:len1} U {-1}
  * path[0:len1, 0:len2]=1,2,3, from diagonal, horizontal, vertical */
-void NWDP_TM_dimer(bool **path, double **val, double **x, double **y,
+void NWDP_TM_dimer(PathMatrix &path, double **val, double **x, double **y,
     int len1, int len2, bool **mask,
-    double t[3], double u[3][3], double d02, double gap_open, int j2i[])
+    double t[3], double u[3][3], double d02, double gap_open, int j2i[],
+    AlignWorkspace *ws=NULL)
 {
     int i, j;
     double h, v, d;
@@ -1988,41 +1979,61 @@ void NWDP_TM_dimer(bool **path, double **val, double **x, double **y,
     double xx[3], dij;
 
 
-    //decide matrix and path
-    for(i=1; i<=len1; i++)
+    if (dp_opt==1)
     {
-        transform(t, u, &x[i-1][0], xx);
-        for(j=1; j<=len2; j++)
+        AlignWorkspace local_ws;  // only used if the caller has no workspace
+        if (ws==NULL) ws=&local_ws;
+        double **xs=ws->xs.get(3, len1);
+        double **yr=ws->yr.get(3, len2);
+        for(i=0; i<len1; i++)
         {
-            d=FLT_MIN;
-            if (mask[i][j])
+            transform(t, u, &x[i][0], xx);
+            xs[0][i]=xx[0];
+            xs[1][i]=xx[1];
+            xs[2][i]=xx[2];
+        }
+        coord2soa_reverse(y, len2, yr);
+        NWDP_wavefront(path, val, NULL, xs, yr, mask, len1, len2,
+            d02, gap_open, ws);
+    }
+    else
+    {
+        //decide matrix and path
+        for(i=1; i<=len1; i++)
+        {
+            transform(t, u, &x[i-1][0], xx);
+            for(j=1; j<=len2; j++)
             {
-                dij=dist(xx, &y[j-1][0]);    
-                d=val[i-1][j-1] +  1.0/(1+dij/d02);
-            } 
+                d=FLT_MIN;
+                if (mask[i][j])
+                {
+                    dij=dist(xx, &y[j-1][0]);    
+                    d=val[i-1][j-1] +  1.0/(1+dij/d02);
+                } 
 
-            //symbol insertion in horizontal (= a gap in vertical)
-            h=val[i-1][j];
-            if(path[i-1][j]) h += gap_open; //aligned in last position
+                //symbol insertion in horizontal (= a gap in vertical)
+                h=val[i-1][j];
+                if(path[i-1][j]) h += gap_open; //aligned in last position
 
-            //symbol insertion in vertical
-            v=val[i][j-1];
-            if(path[i][j-1]) v += gap_open; //aligned in last position
+                //symbol insertion in vertical
+                v=val[i][j-1];
+                if(path[i][j-1]) v += gap_open; //aligned in last position
 
 
-            if(d>=h && d>=v)
-            {
-                path[i][j]=true; //from diagonal
-                val[i][j]=d;
-            }
-            else 
-            {
-                path[i][j]=false; //from horizontal
-                if(v>=h) val[i][j]=v;
-                else val[i][j]=h;
-            }
-        } //for i
-    } //for j
+                if(d>=h && d>=v)
+                {
+                    path[i][j]=true; //from diagonal
+                    val[i][j]=d;
+                }
+                else 
+                {
+                    path[i][j]=false; //from horizontal
+                    if(v>=h) val[i][j]=v;
+                    else val[i][j]=h;
+                }
+            } //for i
+        } //for j
+    }
 
     //trace back to extract the alignment
     i=len1;
@@ -2053,7 +2064,7 @@ void NWDP_TM_dimer(bool **path, double **val, double **x, double **y,
  * Input: secondary structure secx, secy, and gap_open
  * Output: j2i[1:len2] \in {1:len1} U {-1}
  * path[0:len1, 0:len2]=1,2,3, from diagonal, horizontal, vertical */
-void NWDP_TM_dimer(bool **path, double **val, const char *secx, const char *secy,
+void NWDP_TM_dimer(PathMatrix &path, double **val, const char *secx, const char *secy,
     const int len1, const int len2, bool **mask, const double gap_open, int j2i[])
 {
 
@@ -2137,10 +2148,11 @@ void NWDP_TM_dimer(bool **path, double **val, const char *secx, const char *secy
 //       vectors x and y, d0
 //output: best alignment that maximizes the TMscore, will be stored in invmap
 double DP_iter_dimer(double **r1, double **r2, double **xtm, double **ytm,
-    double **xt, bool **path, double **val, double **x, double **y,
+    PathMatrix &path, double **val, double **x, double **y,
     int xlen, int ylen, bool **mask, double t[3], double u[3][3], int invmap0[],
     int g1, int g2, int iteration_max, double local_d0_search,
-    double D0_MIN, double Lnorm, double d0, double score_d8)
+    double D0_MIN, double Lnorm, double d0, double score_d8,
+    AlignWorkspace *ws=NULL)
 {
     double gap_open[2]={-0.6, 0};
     double rmsd; 
@@ -2158,7 +2170,7 @@ double DP_iter_dimer(double **r1, double **r2, double **xtm, double **ytm,
         for(iteration=0; iteration<iteration_max; iteration++)
         {           
             NWDP_TM_dimer(path, val, x, y, xlen, ylen, mask,
-                t, u, d02, gap_open[g], invmap);
+                t, u, d02, gap_open[g], invmap, ws);
             
             k=0;
             for(j=0; j<ylen; j++) 
@@ -2178,9 +2190,9 @@ double DP_iter_dimer(double **r1, double **r2, double **xtm, double **ytm,
                 }
             }
 
-            tmscore = TMscore8_search(r1, r2, xtm, ytm, xt, k, t, u,
+            tmscore = TMscore8_search(r1, r2, xtm, ytm, k, t, u,
                 simplify_step, score_sum_method, &rmsd, local_d0_search,
-                Lnorm, score_d8, d0);
+                Lnorm, score_d8, d0, ws);
 
            
             if(tmscore>tmscore_max)
@@ -2203,7 +2215,7 @@ double DP_iter_dimer(double **r1, double **r2, double **xtm, double **ytm,
     return tmscore_max;
 }
 
-void get_initial_ss_dimer(bool **path, double **val, const char *secx,
+void get_initial_ss_dimer(PathMatrix &path, double **val, const char *secx,
     const char *secy, int xlen, int ylen, bool **mask, int *y2x)
 {
     double gap_open=-1.0;
@@ -2211,9 +2223,10 @@ void get_initial_ss_dimer(bool **path, double **val, const char *secx,
 }
 
 bool get_initial5_dimer( double **r1, double **r2, double **xtm, double **ytm,
-    bool **path, double **val, double **x, double **y, int xlen, int ylen,
+    PathMatrix &path, double **val, double **x, double **y, int xlen, int ylen,
     bool **mask, int *y2x,
-    double d0, double d0_search, const bool fast_opt, const double D0_MIN)
+    double d0, double d0_search, const bool fast_opt, const double D0_MIN,
+    AlignWorkspace *ws=NULL)
 {
     double GL, rmsd;
     double t[3];
@@ -2292,7 +2305,7 @@ bool get_initial5_dimer( double **r1, double **r2, double **xtm, double **ytm,
 
                 double gap_open = 0.0;
                 NWDP_TM_dimer(path, val, x, y, xlen, ylen, mask,
-                    t, u, d02, gap_open, invmap);
+                    t, u, d02, gap_open, invmap, ws);
                 GL = get_score_fast(r1, r2, xtm, ytm, x, y, xlen, ylen,
                     invmap, d0, d0_search, t, u);
                 if (GL>GLmax)
@@ -2310,7 +2323,7 @@ bool get_initial5_dimer( double **r1, double **r2, double **xtm, double **ytm,
 }
 
 void get_initial_ssplus_dimer(double **r1, double **r2, double **score,
-    bool **path, double **val, const char *secx, const char *secy,
+    PathMatrix &path, double **val, const char *secx, const char *secy,
     double **x, double **y, int xlen, int ylen, bool **mask,
     int *y2x0, int *y2x, const double D0_MIN, double d0)
 {
@@ -2343,25 +2356,27 @@ int TMalign_dimer_main(double **xa, double **ya,
     const vector<string> sequence, const double Lnorm_ass,
     const double d0_scale, const int i_opt, const int a_opt,
     const bool u_opt, const bool d_opt, const bool fast_opt,
-    const int mol_type, const double TMcut=-1)
+    const int mol_type, const double TMcut=-1, AlignWorkspace *ws=NULL)
 {
     double D0_MIN;        //for d0
     double Lnorm;         //normalization length
     double score_d8,d0,d0_search,dcu0;//for TMscore search
     double t[3], u[3][3]; //Kabsch translation vector and rotation matrix
     double **score;       // Input score table for dynamic programming
-    bool   **path;        // for dynamic programming  
+    PathMatrix path;      // for dynamic programming  
     double **val;         // for dynamic programming  
     double **xtm, **ytm;  // for TMscore search engine
     double **xt;          //for saving the superposed version of r_1 or xtm
     double **r1, **r2;    // for Kabsch rotation
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
 
     /***********************/
     /* allocate memory     */
     /***********************/
     int minlen = min(xlen, ylen);
     NewArray(&score, xlen+1, ylen+1);
-    NewArray(&path, xlen+1, ylen+1);
+    path.get(xlen+1, ylen+1);
     NewArray(&val, xlen+1, ylen+1);
     NewArray(&xtm, minlen, 3);
     NewArray(&ytm, minlen, 3);
@@ -2419,14 +2434,15 @@ int TMalign_dimer_main(double **xa, double **ya,
         double prevD0_MIN = D0_MIN;// stored for later use
         int prevLnorm = Lnorm;
         double prevd0 = d0;
-        TM_ali = standard_TMscore(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
+        TM_ali = standard_TMscore(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
             invmap, L_ali, rmsd_ali, D0_MIN, Lnorm, d0, d0_search, score_d8,
-            t, u, mol_type);
+            t, u, mol_type, ws);
         D0_MIN = prevD0_MIN;
         Lnorm = prevLnorm;
         d0 = prevd0;
-        TM = detailed_search_standard(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
-            invmap, t, u, 40, 8, local_d0_search, true, Lnorm, score_d8, d0);
+        TM = detailed_search_standard(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
+            invmap, t, u, 40, 8, local_d0_search, true, Lnorm, score_d8, d0,
+            ws);
         if (TM > TMmax)
         {
             TMmax = TM;
@@ -2442,15 +2458,15 @@ int TMalign_dimer_main(double **xa, double **ya,
     {
         get_initial(r1, r2, xtm, ytm, xa, ya, xlen, ylen, invmap0, d0,
             d0_search, fast_opt, t, u);
-        TM = detailed_search(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen, invmap0,
+        TM = detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen, invmap0,
             t, u, simplify_step, score_sum_method, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         if (TM>TMmax) TMmax = TM;
         if (TMcut>0) copy_t_u(t, u, t0, u0);
         //run dynamic programing iteratively to find the best alignment
-        TM = DP_iter_dimer(r1, r2, xtm, ytm, xt, path, val, xa, ya, xlen, ylen,
+        TM = DP_iter_dimer(r1, r2, xtm, ytm, path, val, xa, ya, xlen, ylen,
              mask, t, u, invmap, 0, 2, (fast_opt)?2:30,
-             local_d0_search, D0_MIN, Lnorm, d0, score_d8);
+             local_d0_search, D0_MIN, Lnorm, d0, score_d8, ws);
         if (TM>TMmax)
         {
             TMmax = TM;
@@ -2476,9 +2492,9 @@ int TMalign_dimer_main(double **xa, double **ya,
         /*    get initial alignment based on secondary structure    */
         /************************************************************/
         get_initial_ss_dimer(path, val, secx, secy, xlen, ylen, mask, invmap);
-        TM = detailed_search(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen, invmap,
+        TM = detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen, invmap,
             t, u, simplify_step, score_sum_method, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         if (TM>TMmax)
         {
             TMmax = TM;
@@ -2487,9 +2503,10 @@ int TMalign_dimer_main(double **xa, double **ya,
         }
         if (TM > TMmax*0.2)
         {
-            TM = DP_iter_dimer(r1, r2, xtm, ytm, xt, path, val, xa, ya,
+            TM = DP_iter_dimer(r1, r2, xtm, ytm, path, val, xa, ya,
                 xlen, ylen, mask, t, u, invmap, 0, 2,
-                (fast_opt)?2:30, local_d0_search, D0_MIN, Lnorm, d0, score_d8);
+                (fast_opt)?2:30, local_d0_search, D0_MIN, Lnorm, d0, score_d8,
+                ws);
             if (TM>TMmax)
             {
                 TMmax = TM;
@@ -2517,11 +2534,11 @@ int TMalign_dimer_main(double **xa, double **ya,
         /************************************************************/
         //=initial5 in original TM-align
         if (get_initial5_dimer( r1, r2, xtm, ytm, path, val, xa, ya,
-            xlen, ylen, mask, invmap, d0, d0_search, fast_opt, D0_MIN))
+            xlen, ylen, mask, invmap, d0, d0_search, fast_opt, D0_MIN, ws))
         {
-            TM = detailed_search(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
+            TM = detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
                 invmap, t, u, simplify_step, score_sum_method,
-                local_d0_search, Lnorm, score_d8, d0);
+                local_d0_search, Lnorm, score_d8, d0, ws);
             if (TM>TMmax)
             {
                 TMmax = TM;
@@ -2530,9 +2547,9 @@ int TMalign_dimer_main(double **xa, double **ya,
             }
             if (TM > TMmax*ddcc)
             {
-                TM = DP_iter_dimer(r1, r2, xtm, ytm, xt, path, val, xa, ya,
+                TM = DP_iter_dimer(r1, r2, xtm, ytm, path, val, xa, ya,
                     xlen, ylen, mask, t, u, invmap, 0, 2, 2,
-                    local_d0_search, D0_MIN, Lnorm, d0, score_d8);
+                    local_d0_search, D0_MIN, Lnorm, d0, score_d8, ws);
                 if (TM>TMmax)
                 {
                     TMmax = TM;
@@ -2564,9 +2581,9 @@ int TMalign_dimer_main(double **xa, double **ya,
         //=initial3 in original TM-align
         get_initial_ssplus_dimer(r1, r2, score, path, val, secx, secy, xa, ya,
             xlen, ylen, mask, invmap0, invmap, D0_MIN, d0);
-        TM = detailed_search(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen, invmap,
+        TM = detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen, invmap,
              t, u, simplify_step, score_sum_method, local_d0_search, Lnorm,
-             score_d8, d0);
+             score_d8, d0, ws);
         if (TM>TMmax)
         {
             TMmax = TM;
@@ -2575,9 +2592,10 @@ int TMalign_dimer_main(double **xa, double **ya,
         }
         if (TM > TMmax*ddcc)
         {
-            TM = DP_iter_dimer(r1, r2, xtm, ytm, xt, path, val, xa, ya,
+            TM = DP_iter_dimer(r1, r2, xtm, ytm, path, val, xa, ya,
                 xlen, ylen, mask, t, u, invmap, 0, 2,
-                (fast_opt)?2:30, local_d0_search, D0_MIN, Lnorm, d0, score_d8);
+                (fast_opt)?2:30, local_d0_search, D0_MIN, Lnorm, d0, score_d8,
+                ws);
             if (TM>TMmax)
             {
                 TMmax = TM;
@@ -2606,9 +2624,9 @@ int TMalign_dimer_main(double **xa, double **ya,
         //=initial4 in original TM-align
         get_initial_fgt(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
             invmap, d0, d0_search, dcu0, fast_opt, t, u);
-        TM = detailed_search(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen, invmap,
+        TM = detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen, invmap,
             t, u, simplify_step, score_sum_method, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         if (TM>TMmax)
         {
             TMmax = TM;
@@ -2617,9 +2635,9 @@ int TMalign_dimer_main(double **xa, double **ya,
         }
         if (TM > TMmax*ddcc)
         {
-            TM = DP_iter_dimer(r1, r2, xtm, ytm, xt, path, val, xa, ya,
+            TM = DP_iter_dimer(r1, r2, xtm, ytm, path, val, xa, ya,
                 xlen, ylen, mask, t, u, invmap, 1, 2, 2,
-                local_d0_search, D0_MIN, Lnorm, d0, score_d8);
+                local_d0_search, D0_MIN, Lnorm, d0, score_d8, ws);
             if (TM>TMmax)
             {
                 TMmax = TM;
@@ -2671,25 +2689,26 @@ int TMalign_dimer_main(double **xa, double **ya,
             double prevD0_MIN = D0_MIN;// stored for later use
             int prevLnorm = Lnorm;
             double prevd0 = d0;
-            TM_ali = standard_TMscore(r1, r2, xtm, ytm, xt, xa, ya,
+            TM_ali = standard_TMscore(r1, r2, xtm, ytm, xa, ya,
                 xlen, ylen, invmap, L_ali, rmsd_ali, D0_MIN, Lnorm, d0,
-                d0_search, score_d8, t, u, mol_type);
+                d0_search, score_d8, t, u, mol_type, ws);
             D0_MIN = prevD0_MIN;
             Lnorm = prevLnorm;
             d0 = prevd0;
 
-            TM = detailed_search_standard(r1, r2, xtm, ytm, xt, xa, ya,
+            TM = detailed_search_standard(r1, r2, xtm, ytm, xa, ya,
                 xlen, ylen, invmap, t, u, 40, 8, local_d0_search, true, Lnorm,
-                score_d8, d0);
+                score_d8, d0, ws);
             if (TM > TMmax)
             {
                 TMmax = TM;
                 for (i = 0; i<ylen; i++) invmap0[i] = invmap[i];
             }
             // Different from get_initial, get_initial_ss and get_initial_ssplus
-            TM = DP_iter_dimer(r1, r2, xtm, ytm, xt, path, val, xa, ya,
+            TM = DP_iter_dimer(r1, r2, xtm, ytm, path, val, xa, ya,
                 xlen, ylen, mask, t, u, invmap, 0, 2,
-                (fast_opt)?2:30, local_d0_search, D0_MIN, Lnorm, d0, score_d8);
+                (fast_opt)?2:30, local_d0_search, D0_MIN, Lnorm, d0, score_d8,
+                ws);
             if (TM>TMmax)
             {
                 TMmax = TM;
@@ -2744,9 +2763,9 @@ int TMalign_dimer_main(double **xa, double **ya,
     simplify_step=1;
     if (fast_opt) simplify_step=40;
     score_sum_method=8;
-    TM = detailed_search_standard(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
+    TM = detailed_search_standard(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
         invmap0, t, u, simplify_step, score_sum_method, local_d0_search,
-        false, Lnorm, score_d8, d0);
+        false, Lnorm, score_d8, d0, ws);
 
     //select pairs with dis<d8 for final TMscore computation and output alignment
     int k=0;
@@ -2808,16 +2827,16 @@ int TMalign_dimer_main(double **xa, double **ya,
     d0A=d0;
     d0_0=d0A;
     local_d0_search = d0_search;
-    TM1 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0, simplify_step,
-        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0);
+    TM1 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0, simplify_step,
+        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0, ws);
     TM_0 = TM1;
 
     //normalized by length of structure B
     parameter_set4final(xlen+0.0, D0_MIN, Lnorm, d0, d0_search, mol_type);
     d0B=d0;
     local_d0_search = d0_search;
-    TM2 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t, u, simplify_step,
-        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0);
+    TM2 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t, u, simplify_step,
+        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0, ws);
 
     double Lnorm_d0;
     if (a_opt>0)
@@ -2829,9 +2848,9 @@ int TMalign_dimer_main(double **xa, double **ya,
         d0_0=d0a;
         local_d0_search = d0_search;
 
-        TM3 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM3 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM3;
     }
     if (u_opt)
@@ -2843,9 +2862,9 @@ int TMalign_dimer_main(double **xa, double **ya,
         d0_0=d0u;
         Lnorm_0=Lnorm_ass;
         local_d0_search = d0_search;
-        TM4 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM4 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM4;
     }
     if (d_opt)
@@ -2857,9 +2876,9 @@ int TMalign_dimer_main(double **xa, double **ya,
         //Lnorm_0=ylen;
         Lnorm_d0=Lnorm_0;
         local_d0_search = d0_search;
-        TM5 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM5 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM5;
     }
 
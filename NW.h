@@ -11,11 +11,125 @@
  * values) caused by the NWPD_TM implement.
  */
 
+/* order in which NWDP_TM, NWDP_SE and NWDP_TM_dimer fill the DP matrix
+ * 0 - (default) row by row
+ * 1 - by anti-diagonals (wavefront). All cells of an anti-diagonal only
+ *     depend on the previous two anti-diagonals, so that they are scored and
+ *     filled by vector instructions. The alignment is identical to 0.
+ * Only USalign sets it, by -dp */
+int dp_opt=0;
+
+/* Fill val[1:len1][1:len2] and path[1:len1][1:len2] anti-diagonal by
+ * anti-diagonal, i.e., for k=i+j=2,3,...,len1+len2. val[i][0], val[0][j],
+ * path[i][0] and path[0][j] must be initialized by the caller.
+ * The score of cell (i,j) is score[i][j] if score is not NULL. Otherwise,
+ * it is 1/(1+dij/d02), where dij is the squared distance between
+ * xs[0..2][i-1] and yr[0..2][len2-j], i.e., xs is x in SoA layout and yr is
+ * y in SoA layout in reverse order, so that both are read contiguously
+ * along an anti-diagonal. If mask is not NULL, the diagonal move into
+ * (i,j) scores FLT_MIN where mask[i][j] is false, as in NWDP_TM_dimer. */
+void NWDP_wavefront(PathMatrix &path, double **val, double **score,
+    double **xs, double **yr, bool **mask, const int len1, const int len2,
+    const double d02, const double gap_open, AlignWorkspace *ws=NULL)
+{
+    int i, k, lo, hi;
+    double h, v, d;
+    bool p;
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
+
+    /* V0, V1, V2: val on anti-diagonals k, k-1, k-2; P0, P1: path on
+     * anti-diagonals k, k-1; S: score on anti-diagonal k; M: mask on
+     * anti-diagonal k. All are indexed by i */
+    double **diag=ws->diag.get(4, len1+1);
+    bool **diag_path=ws->diag_path.get(3, len1+1);
+    double *V0=diag[0];
+    double *V1=diag[1];
+    double *V2=diag[2];
+    double *S =diag[3];
+    bool   *P0=diag_path[0];
+    bool   *P1=diag_path[1];
+    bool   *M =diag_path[2];
+    double *tmp_V;
+    bool   *tmp_P;
+    double *xp[3], *yp[3];
+
+    for (i=0;i<=len1;i++) M[i]=true;
+    V1[0]=val[0][0];
+    P1[0]=path[0][0];
+    for (k=2;k<=len1+len2;k++)
+    {
+        /* anti-diagonal k-2 becomes V2, k-1 becomes V1 */
+        tmp_V=V2; V2=V1; V1=V0; V0=tmp_V;
+        tmp_P=P1; P1=P0; P0=tmp_P;
+        if (k-1<=len2)
+        {
+            V1[0]=val[0][k-1];
+            P1[0]=path[0][k-1];
+        }
+        if (k-1<=len1)
+        {
+            V1[k-1]=val[k-1][0];
+            P1[k-1]=path[k-1][0];
+        }
+
+        lo=(k-len2>1)?(k-len2):1;
+        hi=(k-1<len1)?(k-1):len1;
+
+        if (score) for (i=lo;i<=hi;i++) S[i]=score[i][k-i];
+        else
+        {
+            for (int c=0;c<3;c++)
+            {
+                xp[c]=xs[c]+lo-1;
+                yp[c]=yr[c]+len2-k+lo;
+            }
+            score_pair_TM(xp, yp, hi-lo+1, d02, S+lo);
+        }
+        if (mask) for (i=lo;i<=hi;i++) M[i]=mask[i][k-i];
+
+        for (i=lo;i<=hi;i++)
+        {
+            d=M[i]?(V2[i-1]+S[i]):FLT_MIN;
+
+            //symbol insertion in horizontal (= a gap in vertical)
+            h=V1[i-1];
+            if(P1[i-1]) h += gap_open; //aligned in last position
+
+            //symbol insertion in vertical
+            v=V1[i];
+            if(P1[i]) v += gap_open; //aligned in last position
+
+            p=(d>=h)&(d>=v);
+            P0[i]=p;
+            V0[i]=p?d:((v>=h)?v:h);
+        }
+
+        for (i=lo;i<=hi;i++)
+        {
+            val[i][k-i]=V0[i];
+            path[i][k-i]=P0[i];
+        }
+    }
+}
+
+/* copy coordinates y[0..n-1][0..2] into yr[0..2][0..n-1] in reverse order,
+ * as needed by NWDP_wavefront */
+void coord2soa_reverse(double **y, const int n, double **yr)
+{
+    for (int j=0;j<n;j++)
+    {
+        yr[0][n-1-j]=y[j][0];
+        yr[1][n-1-j]=y[j][1];
+        yr[2][n-1-j]=y[j][2];
+    }
+}
+
 /* Input: score[1:len1, 1:len2], and gap_open
  * Output: j2i[1:len2] \in {1:len1} U {-1}
  * path[0:len1, 0:len2]=1,2,3, from diagonal, horizontal, vertical */
-void NWDP_TM(double **score, bool **path, double **val,
-    int len1, int len2, double gap_open, int j2i[])
+void NWDP_TM(double **score, PathMatrix &path, double **val,
+    int len1, int len2, double gap_open, int j2i[], AlignWorkspace *ws=NULL)
 {
 
     int i, j;
@@ -38,35 +152,43 @@ void NWDP_TM(double **score, bool **path, double **val,
     }      
 
 
-    //decide matrix and path
-    for(i=1; i<=len1; i++)
+    if (dp_opt==1)
     {
-        for(j=1; j<=len2; j++)
+        NWDP_wavefront(path, val, score, NULL, NULL, NULL, len1, len2,
+            0, gap_open, ws);
+    }
+    else
+    {
+        //decide matrix and path
+        for(i=1; i<=len1; i++)
         {
-            d=val[i-1][j-1]+score[i][j]; //diagonal
-
-            //symbol insertion in horizontal (= a gap in vertical)
-            h=val[i-1][j];
-            if(path[i-1][j]) h += gap_open; //aligned in last position
-
-            //symbol insertion in vertical
-            v=val[i][j-1];
-            if(path[i][j-1]) v += gap_open; //aligned in last position
-
-
-            if(d>=h && d>=v)
-            {
-                path[i][j]=true; //from diagonal
-                val[i][j]=d;
-            }
-            else 
+            for(j=1; j<=len2; j++)
             {
-                path[i][j]=false; //from horizontal
-                if(v>=h) val[i][j]=v;
-                else val[i][j]=h;
-            }
-        } //for i
-    } //for j
+                d=val[i-1][j-1]+score[i][j]; //diagonal
+
+                //symbol insertion in horizontal (= a gap in vertical)
+                h=val[i-1][j];
+                if(path[i-1][j]) h += gap_open; //aligned in last position
+
+                //symbol insertion in vertical
+                v=val[i][j-1];
+                if(path[i][j-1]) v += gap_open; //aligned in last position
+
+
+                if(d>=h && d>=v)
+                {
+                    path[i][j]=true; //from diagonal
+                    val[i][j]=d;
+                }
+                else 
+                {
+                    path[i][j]=false; //from horizontal
+                    if(v>=h) val[i][j]=v;
+                    else val[i][j]=h;
+                }
+            } //for i
+        } //for j
+    }
 
     //trace back to extract the alignment
     i=len1;
@@ -95,13 +217,19 @@ void NWDP_TM(double **score, bool **path, double **val,
 
 /* Input: vectors x, y, rotation matrix t, u, scale factor d02, and gap_open
  * Output: j2i[1:len2] \in {1:len1} U {-1}
- * path[0:len1, 0:len2]=1,2,3, from diagonal, horizontal, vertical */
-void NWDP_TM(bool **path, double **val, double **x, double **y,
+ * path[0:len1, 0:len2]=1,2,3, from diagonal, horizontal, vertical
+ * Each row of the score matrix is first filled into val[i][1:len2] by the
+ * SIMD kernel score_row_TM, using y in SoA layout, and then overwritten by
+ * the DP sweep of that row, which reads the score of cell (i,j) before
+ * writing val[i][j]. */
+void NWDP_TM(PathMatrix &path, double **val, double **x, double **y,
     int len1, int len2, double t[3], double u[3][3],
-    double d02, double gap_open, int j2i[])
+    double d02, double gap_open, int j2i[], AlignWorkspace *ws=NULL)
 {
     int i, j;
     double h, v, d;
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
 
     //initialization. use old val[i][0] and val[0][j] initialization
     //to minimize difference from TMalign fortran version
@@ -119,40 +247,61 @@ void NWDP_TM(bool **path, double **val, double **x, double **y,
         path[0][j]=false; //not from diagonal
         j2i[j]=-1;    //all are not aligned, only use j2i[1:len2]
     }      
-    double xx[3], dij;
+    double xx[3];
 
 
-    //decide matrix and path
-    for(i=1; i<=len1; i++)
+    if (dp_opt==1)
     {
-        transform(t, u, &x[i-1][0], xx);
-        for(j=1; j<=len2; j++)
+        double **xs=ws->xs.get(3, len1);
+        double **yr=ws->yr.get(3, len2);
+        for(i=0; i<len1; i++)
         {
-            dij=dist(xx, &y[j-1][0]);    
-            d=val[i-1][j-1] +  1.0/(1+dij/d02);
-
-            //symbol insertion in horizontal (= a gap in vertical)
-            h=val[i-1][j];
-            if(path[i-1][j]) h += gap_open; //aligned in last position
-
-            //symbol insertion in vertical
-            v=val[i][j-1];
-            if(path[i][j-1]) v += gap_open; //aligned in last position
-
+            transform(t, u, &x[i][0], xx);
+            xs[0][i]=xx[0];
+            xs[1][i]=xx[1];
+            xs[2][i]=xx[2];
+        }
+        coord2soa_reverse(y, len2, yr);
+        NWDP_wavefront(path, val, NULL, xs, yr, NULL, len1, len2,
+            d02, gap_open, ws);
+    }
+    else
+    {
+        double **ys=ws->ys.get(3, len2);
+        coord2soa(y, len2, ys);
 
-            if(d>=h && d>=v)
-            {
-                path[i][j]=true; //from diagonal
-                val[i][j]=d;
-            }
-            else 
+        //decide matrix and path
+        for(i=1; i<=len1; i++)
+        {
+            transform(t, u, &x[i-1][0], xx);
+            score_row_TM(xx, ys, len2, d02, val[i]+1);
+            for(j=1; j<=len2; j++)
             {
-                path[i][j]=false; //from horizontal
-                if(v>=h) val[i][j]=v;
-                else val[i][j]=h;
-            }
-        } //for i
-    } //for j
+                d=val[i-1][j-1] + val[i][j];
+
+                //symbol insertion in horizontal (= a gap in vertical)
+                h=val[i-1][j];
+                if(path[i-1][j]) h += gap_open; //aligned in last position
+
+                //symbol insertion in vertical
+                v=val[i][j-1];
+                if(path[i][j-1]) v += gap_open; //aligned in last position
+
+
+                if(d>=h && d>=v)
+                {
+                    path[i][j]=true; //from diagonal
+                    val[i][j]=d;
+                }
+                else 
+                {
+                    path[i][j]=false; //from horizontal
+                    if(v>=h) val[i][j]=v;
+                    else val[i][j]=h;
+                }
+            } //for i
+        } //for j
+    }
 
     //trace back to extract the alignment
     i=len1;
@@ -183,8 +332,9 @@ void NWDP_TM(bool **path, double **val, double **x, double **y,
  * Input: vectors x, y, scale factor d02, and gap_open
  * Output: j2i[1:len2] \in {1:len1} U {-1}
  * path[0:len1, 0:len2]=1,2,3, from diagonal, horizontal, vertical */
-void NWDP_SE(bool **path, double **val, double **x, double **y,
-    int len1, int len2, double d02, double gap_open, int j2i[])
+void NWDP_SE(PathMatrix &path, double **val, double **x, double **y,
+    int len1, int len2, double d02, double gap_open, int j2i[],
+    AlignWorkspace *ws=NULL)
 {
     int i, j;
     double h, v, d;
@@ -203,36 +353,50 @@ void NWDP_SE(bool **path, double **val, double **x, double **y,
     }      
     double dij;
 
-    //decide matrix and path
-    for(i=1; i<=len1; i++)
+    if (dp_opt==1)
     {
-        for(j=1; j<=len2; j++)
+        AlignWorkspace local_ws;  // only used if the caller has no workspace
+        if (ws==NULL) ws=&local_ws;
+        double **xs=ws->xs.get(3, len1);
+        double **yr=ws->yr.get(3, len2);
+        coord2soa(x, len1, xs);
+        coord2soa_reverse(y, len2, yr);
+        NWDP_wavefront(path, val, NULL, xs, yr, NULL, len1, len2,
+            d02, gap_open, ws);
+    }
+    else
+    {
+        //decide matrix and path
+        for(i=1; i<=len1; i++)
         {
-            dij=dist(&x[i-1][0], &y[j-1][0]);    
-            d=val[i-1][j-1] +  1.0/(1+dij/d02);
-
-            //symbol insertion in horizontal (= a gap in vertical)
-            h=val[i-1][j];
-            if(path[i-1][j]) h += gap_open; //aligned in last position
-
-            //symbol insertion in vertical
-            v=val[i][j-1];
-            if(path[i][j-1]) v += gap_open; //aligned in last position
-
-
-            if(d>=h && d>=v)
-            {
-                path[i][j]=true; //from diagonal
-                val[i][j]=d;
-            }
-            else 
+            for(j=1; j<=len2; j++)
             {
-                path[i][j]=false; //from horizontal
-                if(v>=h) val[i][j]=v;
-                else val[i][j]=h;
-            }
-        } //for i
-    } //for j
+                dij=dist(&x[i-1][0], &y[j-1][0]);    
+                d=val[i-1][j-1] +  1.0/(1+dij/d02);
+
+                //symbol insertion in horizontal (= a gap in vertical)
+                h=val[i-1][j];
+                if(path[i-1][j]) h += gap_open; //aligned in last position
+
+                //symbol insertion in vertical
+                v=val[i][j-1];
+                if(path[i][j-1]) v += gap_open; //aligned in last position
+
+
+                if(d>=h && d>=v)
+                {
+                    path[i][j]=true; //from diagonal
+                    val[i][j]=d;
+                }
+                else 
+                {
+                    path[i][j]=false; //from horizontal
+                    if(v>=h) val[i][j]=v;
+                    else val[i][j]=h;
+                }
+            } //for i
+        } //for j
+    }
 
     //trace back to extract the alignment
     i=len1;
@@ -259,13 +423,13 @@ void NWDP_SE(bool **path, double **val, double **x, double **y,
     }
 }
 
-void NWDP_SE(bool **path, double **val, double **x, double **y,
+void NWDP_SE(PathMatrix &path, double **val, double **x, double **y,
     int len1, int len2, double d02, double gap_open, int j2i[],
-    const int hinge)
+    const int hinge, AlignWorkspace *ws=NULL)
 {
     if (hinge==0)
     {
-        NWDP_SE(path, val, x, y, len1, len2, d02, gap_open, j2i);
+        NWDP_SE(path, val, x, y, len1, len2, d02, gap_open, j2i, ws);
         return;
     }
     int i, j;
@@ -357,7 +521,7 @@ void NWDP_SE(bool **path, double **val, double **x, double **y,
  * Input: secondary structure secx, secy, and gap_open
  * Output: j2i[1:len2] \in {1:len1} U {-1}
  * path[0:len1, 0:len2]=1,2,3, from diagonal, horizontal, vertical */
-void NWDP_TM(bool **path, double **val, const char *secx, const char *secy,
+void NWDP_TM(PathMatrix &path, double **val, const char *secx, const char *secy,
     const int len1, const int len2, const double gap_open, int j2i[])
 {
 
@@ -102,12 +102,12 @@ void find_highest_align_score( int **S, int **P,
  */
 int calculate_score_gotoh(const int xlen,const int ylen, int **S,
     int** JumpH, int** JumpV, int **P, const int gapopen,const int gapext,
-    const int glocal=0, const int alt_init=1)
+    const int glocal=0, const int alt_init=1, AlignWorkspace *ws=NULL)
 {
-    int **H;
-    int **V;
-    NewArray(&H,xlen+1,ylen+1); // penalty score for horizontal long gap
-    NewArray(&V,xlen+1,ylen+1); // penalty score for vertical long gap
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
+    int **H=ws->H.get(xlen+1,ylen+1); // penalty score for horizontal long gap
+    int **V=ws->V.get(xlen+1,ylen+1); // penalty score for vertical long gap
     
     // fill first row/colum of JumpH,jumpV and path matrix P
     int i,j;
@@ -183,9 +183,6 @@ int calculate_score_gotoh(const int xlen,const int ylen, int **S,
     if (glocal>=3)
         find_highest_align_score(S,P,aln_score,xlen,ylen);
 
-    // release memory
-    DeleteArray(&H,xlen+1);
-    DeleteArray(&V,xlen+1);
     return aln_score; // final alignment score
 }
 
@@ -381,16 +378,15 @@ void trace_back_sw(const char *seqx, const char *seqy,
  *               2: return seqxA, seqyA and invmap */
 int NWalign_main(const char *seqx, const char *seqy, const int xlen,
     const int ylen, string & seqxA, string & seqyA, const int mol_type,
-    int *invmap, const int invmap_only=0, const int glocal=0)
+    int *invmap, const int invmap_only=0, const int glocal=0,
+    AlignWorkspace *ws=NULL)
 {
-    int **JumpH;
-    int **JumpV;
-    int **P;
-    int **S;
-    NewArray(&JumpH,xlen+1,ylen+1);
-    NewArray(&JumpV,xlen+1,ylen+1);
-    NewArray(&P,xlen+1,ylen+1);
-    NewArray(&S,xlen+1,ylen+1);
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
+    int **JumpH=ws->JumpH.get(xlen+1,ylen+1);
+    int **JumpV=ws->JumpV.get(xlen+1,ylen+1);
+    int **P=ws->P.get(xlen+1,ylen+1);
+    int **S=ws->S.get(xlen+1,ylen+1);
     
     int aln_score;
     int gapopen=gapopen_blosum62;
@@ -417,7 +413,7 @@ int NWalign_main(const char *seqx, const char *seqy, const int xlen,
     }
 
     aln_score=calculate_score_gotoh(xlen, ylen, S, JumpH, JumpV, P,
-        gapopen, gapext, glocal);
+        gapopen, gapext, glocal, 1, ws);
 
     seqxA.clear();
     seqyA.clear();
@@ -427,10 +423,6 @@ int NWalign_main(const char *seqx, const char *seqy, const int xlen,
     else trace_back_sw(seqx, seqy, JumpH, JumpV, P, seqxA, seqyA,
             xlen, ylen, invmap, invmap_only);
 
-    DeleteArray(&JumpH, xlen+1);
-    DeleteArray(&JumpV, xlen+1);
-    DeleteArray(&P, xlen+1);
-    DeleteArray(&S, xlen+1);
     return aln_score; // aligment score
 }
 
@@ -215,31 +215,33 @@ int soi_se_main(
     const double Lnorm_ass, const double d0_scale, const bool i_opt,
     const bool a_opt, const int u_opt, const bool d_opt, const int mol_type,
     const int outfmt_opt, int *invmap, double *dist_list,
-    int **secx_bond, int **secy_bond, const int mm_opt)
+    int **secx_bond, int **secy_bond, const int mm_opt,
+    AlignWorkspace *ws=NULL)
 {
     double D0_MIN;        //for d0
     double Lnorm;         //normalization length
     double score_d8,d0,d0_search,dcu0;//for TMscore search
     double **score;       // score for aligning a residue pair
-    bool   **path;        // for dynamic programming  
     double **val;         // for dynamic programming  
 
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
     int *m1=NULL;
     int *m2=NULL;
     int i,j;
     double d;
     if (outfmt_opt<2)
     {
-        m1=new int[xlen]; //alignd index in x
-        m2=new int[ylen]; //alignd index in y
+        m1=ws->m1.get(xlen); //alignd index in x
+        m2=ws->m2.get(ylen); //alignd index in y
     }
 
     /***********************/
     /* allocate memory     */
     /***********************/
-    NewArray(&score, xlen+1, ylen+1);
-    NewArray(&path,  xlen+1, ylen+1);
-    NewArray(&val,   xlen+1, ylen+1);
+    score=ws->score.get(xlen+1, ylen+1);
+    PathMatrix &path=ws->path.get(xlen+1, ylen+1); // DP traceback
+    val  =ws->val.get(xlen+1, ylen+1);
     //int *invmap          = new int[ylen+1];
 
     /* set d0 */
@@ -318,11 +320,7 @@ int soi_se_main(
     TM5/=ylen;
     if (n_ali8) rmsd0=sqrt(rmsd0/n_ali8);
 
-    if (outfmt_opt>=2)
-    {
-        DeleteArray(&score, xlen+1);
-        return 0;
-    }
+    if (outfmt_opt>=2) return 0;
 
     /* extract aligned sequence */
     int ali_len=xlen+ylen;
@@ -331,7 +329,7 @@ int soi_se_main(
     seqM.assign( ali_len,' ');
     seqyA.assign(ali_len,'-');
 
-    int *fwdmap = new int [xlen+1];
+    int *fwdmap = ws->fwdmap0.get(xlen+1);
     for (i=0;i<xlen;i++) fwdmap[i]=-1;
     for (j=0;j<ylen;j++)
     {
@@ -354,13 +352,6 @@ int soi_se_main(
         k++;
     }
 
-    /* free memory */
-    delete [] fwdmap;
-    delete [] m1;
-    delete [] m2;
-    DeleteArray(&score, xlen+1);
-    DeleteArray(&path, xlen+1);
-    DeleteArray(&val, xlen+1);
     return 0; // zero for no exception
 }
 
@@ -387,11 +378,12 @@ inline void SOI_super2score(double **xt, double **ya, const int xlen,
 //       vectors x and y, d0
 //output: best alignment that maximizes the TMscore, will be stored in invmap
 double SOI_iter(double **r1, double **r2, double **xtm, double **ytm,
-    double **xt, double **score, bool **path, double **val, double **xa, double **ya,
+    double **xt, double **score, PathMatrix &path, double **val, double **xa, double **ya,
     int xlen, int ylen, double t[3], double u[3][3], int *invmap0,
     int iteration_max, double local_d0_search,
     double Lnorm, double d0, double score_d8,
-    int **secx_bond, int **secy_bond, const int mm_opt, const bool init_invmap=false)
+    int **secx_bond, int **secy_bond, const int mm_opt,
+    const bool init_invmap=false, AlignWorkspace *ws=NULL)
 {
     double rmsd; 
     int *invmap=new int[ylen+1];
@@ -411,7 +403,8 @@ double SOI_iter(double **r1, double **r2, double **xtm, double **ytm,
         else
         {
             for (j=0; j<ylen; j++) invmap[j]=-1;
-            if (mm_opt==6) NWDP_TM(score, path, val, xlen, ylen, -0.6, invmap);
+            if (mm_opt==6) NWDP_TM(score, path, val, xlen, ylen, -0.6, invmap,
+                ws);
         }
         soi_egs(score, xlen, ylen, invmap, secx_bond, secy_bond, mm_opt);
     
@@ -431,8 +424,8 @@ double SOI_iter(double **r1, double **r2, double **xtm, double **ytm,
             k++;
         }
 
-        tmscore = TMscore8_search(r1, r2, xtm, ytm, xt, k, t, u,
-            40, 8, &rmsd, local_d0_search, Lnorm, score_d8, d0);
+        tmscore = TMscore8_search(r1, r2, xtm, ytm, k, t, u,
+            40, 8, &rmsd, local_d0_search, Lnorm, score_d8, d0, ws);
 
         if (tmscore>tmscore_max)
         {
@@ -451,7 +444,7 @@ double SOI_iter(double **r1, double **r2, double **xtm, double **ytm,
 }
 
 void get_SOI_initial_assign(double **xk, double **yk, const int closeK_opt,
-    double **score, bool **path, double **val, const int xlen, const int ylen,
+    double **score, PathMatrix &path, double **val, const int xlen, const int ylen,
     double t[3], double u[3][3], int invmap[], 
     double local_d0_search, double d0, double score_d8,
     int **secx_bond, int **secy_bond, const int mm_opt)
@@ -517,7 +510,8 @@ void get_SOI_initial_assign(double **xk, double **yk, const int closeK_opt,
 void SOI_assign2super(double **r1, double **r2, double **xtm, double **ytm,
     double **xt, double **xa, double **ya,
     const int xlen, const int ylen, double t[3], double u[3][3], int invmap[], 
-    double local_d0_search, double Lnorm, double d0, double score_d8)
+    double local_d0_search, double Lnorm, double d0, double score_d8,
+    AlignWorkspace *ws=NULL)
 {
     int i,j,k;
     double rmsd;
@@ -539,8 +533,8 @@ void SOI_assign2super(double **r1, double **r2, double **xtm, double **ytm,
         ytm[k][2]=ya[j][2];
         k++;
     }
-    TMscore8_search(r1, r2, xtm, ytm, xt, k, t, u,
-        40, 8, &rmsd, local_d0_search, Lnorm, score_d8, d0);
+    TMscore8_search(r1, r2, xtm, ytm, k, t, u,
+        40, 8, &rmsd, local_d0_search, Lnorm, score_d8, d0, ws);
     do_rotation(xa, xt, xlen, t, u);
 }
 
@@ -561,7 +555,8 @@ int SOIalign_main(double **xa, double **ya,
     const double d0_scale, const int i_opt, const int a_opt,
     const bool u_opt, const bool d_opt, const bool fast_opt,
     const int mol_type, double *dist_list, 
-    int **secx_bond, int **secy_bond, const int mm_opt)
+    int **secx_bond, int **secy_bond, const int mm_opt,
+    AlignWorkspace *ws=NULL)
 {
     double D0_MIN;        //for d0
     double Lnorm;         //normalization length
@@ -569,29 +564,12 @@ int SOIalign_main(double **xa, double **ya,
     double t[3], u[3][3]; //Kabsch translation vector and rotation matrix
     double **score;       // Input score table for enhanced greedy search
     double **scoret;      // Transposed score table for enhanced greedy search
-    bool   **path;        // for dynamic programming  
     double **val;         // for dynamic programming  
     double **xtm, **ytm;  // for TMscore search engine
     double **xt;          //for saving the superposed version of r_1 or xtm
     double **yt;          //for saving the superposed version of r_2 or ytm
     double **r1, **r2;    // for Kabsch rotation
 
-    /***********************/
-    /* allocate memory     */
-    /***********************/
-    int minlen = min(xlen, ylen);
-    int maxlen = (xlen>ylen)?xlen:ylen;
-    NewArray(&score,  xlen+1, ylen+1);
-    NewArray(&scoret, ylen+1, xlen+1);
-    NewArray(&path, maxlen+1, maxlen+1);
-    NewArray(&val,  maxlen+1, maxlen+1);
-    NewArray(&xtm, minlen, 3);
-    NewArray(&ytm, minlen, 3);
-    NewArray(&xt, xlen, 3);
-    NewArray(&yt, ylen, 3);
-    NewArray(&r1, minlen, 3);
-    NewArray(&r2, minlen, 3);
-
     /***********************/
     /*    parameter set    */
     /***********************/
@@ -601,12 +579,7 @@ int SOIalign_main(double **xa, double **ya,
     int score_sum_method = 8;  //for scoring method, whether only sum over pairs with dis<score_d8
 
     int i,j;
-    int *fwdmap0         = new int[xlen+1];
-    int *invmap0         = new int[ylen+1];
-    
     double TMmax=-1, TM=-1;
-    for(i=0; i<xlen; i++) fwdmap0[i]=-1;
-    for(j=0; j<ylen; j++) invmap0[j]=-1;
     double local_d0_search = d0_search;
     int iteration_max=(fast_opt)?2:30;
     //if (mm_opt==6) iteration_max=1;
@@ -621,8 +594,32 @@ int SOIalign_main(double **xa, double **ya,
         do_vec, rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
         xlen, ylen, sequence, Lnorm_ass, d0_scale,
         i_opt, a_opt, u_opt, d_opt, fast_opt,
-        mol_type,-1);
+        mol_type,-1,ws);
     do_vec.clear();
+
+    /***********************/
+    /* allocate memory     */
+    /***********************/
+    /* buffers are taken from the workspace after CPalign_main, which
+     * uses the same workspace */
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
+    int minlen = min(xlen, ylen);
+    int maxlen = (xlen>ylen)?xlen:ylen;
+    score =ws->score.get(xlen+1, ylen+1);
+    scoret=ws->scoret.get(ylen+1, xlen+1);
+    PathMatrix &path=ws->path.get(maxlen+1, maxlen+1); // DP traceback
+    val   =ws->val.get(maxlen+1, maxlen+1);
+    xtm   =ws->xtm.get(minlen, 3);
+    ytm   =ws->ytm.get(minlen, 3);
+    xt    =ws->xt.get(xlen, 3);
+    yt    =ws->yt.get(ylen, 3);
+    r1    =ws->r1.get(minlen, 3);
+    r2    =ws->r2.get(minlen, 3);
+    int *fwdmap0         = ws->fwdmap0.get(xlen+1);
+    int *invmap0         = ws->invmap0.get(ylen+1);
+    for(i=0; i<xlen; i++) fwdmap0[i]=-1;
+    for(j=0; j<ylen; j++) invmap0[j]=-1;
     if (mm_opt==6)
     {
         i=0;
@@ -654,10 +651,12 @@ int SOIalign_main(double **xa, double **ya,
     for (i=0;i<xlen;i++) for (j=0;j<ylen;j++) scoret[j+1][i+1]=score[i+1][j+1];
     TMmax=SOI_iter(r1, r2, xtm, ytm, xt, score, path, val, xa, ya,
         xlen, ylen, t0, u0, invmap0, iteration_max,
-        local_d0_search, Lnorm, d0, score_d8, secx_bond, secy_bond, mm_opt, true);
+        local_d0_search, Lnorm, d0, score_d8, secx_bond, secy_bond, mm_opt,
+        true, ws);
     TM   =SOI_iter(r2, r1, ytm, xtm, yt,scoret, path, val, ya, xa,
         ylen, xlen, t0, u0, fwdmap0, iteration_max,
-        local_d0_search, Lnorm, d0, score_d8, secy_bond, secx_bond, mm_opt, true);
+        local_d0_search, Lnorm, d0, score_d8, secy_bond, secx_bond, mm_opt,
+        true, ws);
     //cout<<"TM2="<<TM2<<"\tTM1="<<TM1<<"\tTMmax="<<TMmax<<"\tTM="<<TM<<endl;
     if (TM>TMmax)
     {
@@ -681,10 +680,12 @@ int SOIalign_main(double **xa, double **ya,
         for (i=0;i<xlen;i++) for (j=0;j<ylen;j++) scoret[j+1][i+1]=score[i+1][j+1];
 
         SOI_assign2super(r1, r2, xtm, ytm, xt, xa, ya,
-            xlen, ylen, t, u, invmap, local_d0_search, Lnorm, d0, score_d8);
+            xlen, ylen, t, u, invmap, local_d0_search, Lnorm, d0, score_d8,
+            ws);
         TM=SOI_iter(r1, r2, xtm, ytm, xt, score, path, val, xa, ya,
             xlen, ylen, t, u, invmap, iteration_max,
-            local_d0_search, Lnorm, d0, score_d8, secx_bond, secy_bond, mm_opt);
+            local_d0_search, Lnorm, d0, score_d8, secx_bond, secy_bond, mm_opt,
+            false, ws);
         if (TM>TMmax)
         {
             TMmax = TM;
@@ -692,12 +693,15 @@ int SOIalign_main(double **xa, double **ya,
         }
 
         for (i=0;i<xlen;i++) fwdmap0[i]=-1;
-        if (mm_opt==6) NWDP_TM(scoret, path, val, ylen, xlen, -0.6, fwdmap0);
+        if (mm_opt==6) NWDP_TM(scoret, path, val, ylen, xlen, -0.6, fwdmap0,
+            ws);
         soi_egs(scoret, ylen, xlen, fwdmap0, secy_bond, secx_bond, mm_opt);
         SOI_assign2super(r2, r1, ytm, xtm, yt, ya, xa,
-            ylen, xlen, t, u, fwdmap0, local_d0_search, Lnorm, d0, score_d8);
+            ylen, xlen, t, u, fwdmap0, local_d0_search, Lnorm, d0, score_d8,
+            ws);
         TM=SOI_iter(r2, r1, ytm, xtm, yt, scoret, path, val, ya, xa, ylen, xlen, t, u,
-            fwdmap0, iteration_max, local_d0_search, Lnorm, d0, score_d8,secy_bond, secx_bond, mm_opt);
+            fwdmap0, iteration_max, local_d0_search, Lnorm, d0, score_d8,secy_bond, secx_bond, mm_opt,
+            false, ws);
         if (TM>TMmax)
         {
             TMmax = TM;
@@ -743,9 +747,9 @@ int SOIalign_main(double **xa, double **ya,
     simplify_step=1;
     if (fast_opt) simplify_step=40;
     score_sum_method=8;
-    TM = detailed_search_standard(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
+    TM = detailed_search_standard(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
         invmap0, t, u, simplify_step, score_sum_method, local_d0_search,
-        false, Lnorm, score_d8, d0);
+        false, Lnorm, score_d8, d0, ws);
     
     double rmsd;
     simplify_step=1;
@@ -756,8 +760,8 @@ int SOIalign_main(double **xa, double **ya,
     int k=0;
     int *m1, *m2;
     double d;
-    m1=new int[xlen]; //alignd index in x
-    m2=new int[ylen]; //alignd index in y
+    m1=ws->m1.get(xlen); //alignd index in x
+    m2=ws->m2.get(ylen); //alignd index in y
     copy_t_u(t, u, t0, u0);
     
     //****************************************//
@@ -808,8 +812,8 @@ int SOIalign_main(double **xa, double **ya,
     parameter_set4final(xlen+0.0, D0_MIN, Lnorm, d0, d0_search, mol_type);
     d0B=d0;
     local_d0_search = d0_search;
-    TM2 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t, u, simplify_step,
-        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0);
+    TM2 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t, u, simplify_step,
+        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0, ws);
 
     //****************************************//
     //              Final TMscore 2           //
@@ -854,8 +858,8 @@ int SOIalign_main(double **xa, double **ya,
     d0A=d0;
     d0_0=d0A;
     local_d0_search = d0_search;
-    TM1 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0, simplify_step,
-        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0);
+    TM1 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0, simplify_step,
+        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0, ws);
     TM_0 = TM1;
 
     if (a_opt>0)
@@ -867,9 +871,9 @@ int SOIalign_main(double **xa, double **ya,
         d0_0=d0a;
         local_d0_search = d0_search;
 
-        TM3 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM3 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM3;
     }
     if (u_opt)
@@ -881,9 +885,9 @@ int SOIalign_main(double **xa, double **ya,
         d0_0=d0u;
         Lnorm_0=Lnorm_ass;
         local_d0_search = d0_search;
-        TM4 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM4 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM4;
     }
     if (d_opt)
@@ -894,9 +898,9 @@ int SOIalign_main(double **xa, double **ya,
         d0_0=d0_scale;
         //Lnorm_0=ylen;
         local_d0_search = d0_search;
-        TM5 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM5 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM5;
     }
 
@@ -939,22 +943,6 @@ int SOIalign_main(double **xa, double **ya,
         //<<rmsd0<<'\t'
         //<<100.*SO<<endl;
 
-
-    /* clean up */
-    DeleteArray(&score, xlen+1);
-    DeleteArray(&scoret,ylen+1);
-    DeleteArray(&path,maxlen+1);
-    DeleteArray(&val, maxlen+1);
-    DeleteArray(&xtm, minlen);
-    DeleteArray(&ytm, minlen);
-    DeleteArray(&xt,xlen);
-    DeleteArray(&yt,ylen);
-    DeleteArray(&r1, minlen);
-    DeleteArray(&r2, minlen);
-    delete[]invmap0;
-    delete[]fwdmap0;
-    delete[]m1;
-    delete[]m2;
     return 0;
 }
 #endif
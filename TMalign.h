@@ -4,9 +4,17 @@
 #define TMalign_h 1
 
 #include "param_set.h"
+#include "simd_score.h"
 #include "NW.h"
 #include "Kabsch.h"
 #include "NWalign.h"
+#include "sec_str.h"
+
+/* number of threads used inside one structure alignment, i.e., for the
+ * shifts of get_initial, the fragment grid of get_initial5 and the
+ * initial alignments of TMalign_main. Only effective when compiled with
+ * -fopenmp */
+int pair_nthreads=1;
 
 //     1, collect those residues with dis<d;
 //     2, calculate TMscore
@@ -98,10 +106,57 @@ int score_fun8_standard(double **xa, double **ya, int n_ali, double d,
     return n_cut;
 }
 
+/* same as score_fun8, but for squared distances di and TM-score terms
+ * term computed by rotate_score8 */
+int score_fun8(const double *di, const double *term, int n_ali, double d,
+    int i_ali[], double *score1, const double Lnorm)
+{
+    double score_sum=0;
+    double d_tmp=d*d;
+
+    int i, n_cut, inc=0;
+
+    while(1)
+    {
+        n_cut=0;
+        score_sum=0;
+        for(i=0; i<n_ali; i++)
+        {
+            if(di[i]<d_tmp)
+            {
+                i_ali[n_cut]=i;
+                n_cut++;
+            }
+            score_sum += term[i];
+        }
+        //there are not enough feasible pairs, relieve the threshold         
+        if(n_cut<3 && n_ali>3)
+        {
+            inc++;
+            double dinc=(d+inc*0.5);
+            d_tmp = dinc * dinc;
+        }
+        else break;
+    }  
+
+    *score1=score_sum/Lnorm;
+    return n_cut;
+}
+
+/* same as score_fun8_standard, but for squared distances di and TM-score
+ * terms term computed by rotate_score8 */
+int score_fun8_standard(const double *di, const double *term, int n_ali,
+    double d, int i_ali[], double *score1)
+{
+    int n_cut=score_fun8(di, term, n_ali, d, i_ali, score1, 1);
+    *score1/=n_ali;
+    return n_cut;
+}
+
 double TMscore8_search(double **r1, double **r2, double **xtm, double **ytm,
-    double **xt, int Lali, double t0[3], double u0[3][3], int simplify_step,
+    int Lali, double t0[3], double u0[3][3], int simplify_step,
     int score_sum_method, double *Rcomm, double local_d0_search, double Lnorm,
-    double score_d8, double d0)
+    double score_d8, double d0, AlignWorkspace *ws=NULL)
 {
     int i, m;
     double score_max, score, rmsd;    
@@ -110,6 +165,14 @@ double TMscore8_search(double **r1, double **r2, double **xtm, double **ytm,
     double t[3];
     double u[3][3];
     double d;
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
+    double **soa=ws->soa.get(8, Lali); // xtm and ytm in SoA layout, scores
+    coord2soa(xtm, Lali, soa);
+    coord2soa(ytm, Lali, soa+3);
+    double **P=ws->moments.get(Lali+2, 17); // prefix sums of the moments
+    Kabsch_prefix(xtm, ytm, Lali, P);
+    KabschMoments mom;
     
 
     //iterative parameters
@@ -155,28 +218,21 @@ double TMscore8_search(double **r1, double **r2, double **xtm, double **ytm,
             for(k=0; k<L_frag; k++)
             {
                 int kk=k+i;
-                r1[k][0]=xtm[kk][0];  
-                r1[k][1]=xtm[kk][1]; 
-                r1[k][2]=xtm[kk][2];   
-                
-                r2[k][0]=ytm[kk][0];  
-                r2[k][1]=ytm[kk][1]; 
-                r2[k][2]=ytm[kk][2];
-                
                 k_ali[ka]=kk;
                 ka++;
             }
             
             //extract rotation matrix based on the fragment
-            Kabsch(r1, r2, L_frag, 1, &rmsd, t, u);
+            get_Kabsch_moments(P, Lali, i, L_frag, mom);
+            Kabsch(mom, 1, &rmsd, t, u);
             if (simplify_step != 1)
                 *Rcomm = 0;
-            do_rotation(xtm, xt, Lali, t, u);
+            rotate_score8(soa, soa+3, Lali, t, u, score_sum_method,
+                score_d8, d0, soa[6], soa[7]);
             
             //get subsegment of this fragment
             d = local_d0_search - 1;
-            n_cut=score_fun8(xt, ytm, Lali, d, i_ali, &score, 
-                score_sum_method, Lnorm, score_d8, d0);
+            n_cut=score_fun8(soa[6], soa[7], Lali, d, i_ali, &score, Lnorm);
             if(score>score_max)
             {
                 score_max=score;
@@ -212,9 +268,10 @@ double TMscore8_search(double **r1, double **r2, double **xtm, double **ytm,
                 } 
                 //extract rotation matrix based on the fragment                
                 Kabsch(r1, r2, n_cut, 1, &rmsd, t, u);
-                do_rotation(xtm, xt, Lali, t, u);
-                n_cut=score_fun8(xt, ytm, Lali, d, i_ali, &score, 
-                    score_sum_method, Lnorm, score_d8, d0);
+                rotate_score8(soa, soa+3, Lali, t, u, score_sum_method,
+                    score_d8, d0, soa[6], soa[7]);
+                n_cut=score_fun8(soa[6], soa[7], Lali, d, i_ali, &score,
+                    Lnorm);
                 if(score>score_max)
                 {
                     score_max=score;
@@ -254,9 +311,10 @@ double TMscore8_search(double **r1, double **r2, double **xtm, double **ytm,
 
 
 double TMscore8_search_standard( double **r1, double **r2,
-    double **xtm, double **ytm, double **xt, int Lali,
+    double **xtm, double **ytm, int Lali,
     double t0[3], double u0[3][3], int simplify_step, int score_sum_method,
-    double *Rcomm, double local_d0_search, double score_d8, double d0)
+    double *Rcomm, double local_d0_search, double score_d8, double d0,
+    AlignWorkspace *ws=NULL)
 {
     int i, m;
     double score_max, score, rmsd;
@@ -265,6 +323,14 @@ double TMscore8_search_standard( double **r1, double **r2,
     double t[3];
     double u[3][3];
     double d;
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
+    double **soa=ws->soa.get(8, Lali); // xtm and ytm in SoA layout, scores
+    coord2soa(xtm, Lali, soa);
+    coord2soa(ytm, Lali, soa+3);
+    double **P=ws->moments.get(Lali+2, 17); // prefix sums of the moments
+    Kabsch_prefix(xtm, ytm, Lali, P);
+    KabschMoments mom;
 
     //iterative parameters
     int n_it = 20;            //maximum number of iterations
@@ -309,27 +375,21 @@ double TMscore8_search_standard( double **r1, double **r2,
             for (k = 0; k<L_frag; k++)
             {
                 int kk = k + i;
-                r1[k][0] = xtm[kk][0];
-                r1[k][1] = xtm[kk][1];
-                r1[k][2] = xtm[kk][2];
-
-                r2[k][0] = ytm[kk][0];
-                r2[k][1] = ytm[kk][1];
-                r2[k][2] = ytm[kk][2];
-
                 k_ali[ka] = kk;
                 ka++;
             }
             //extract rotation matrix based on the fragment
-            Kabsch(r1, r2, L_frag, 1, &rmsd, t, u);
+            get_Kabsch_moments(P, Lali, i, L_frag, mom);
+            Kabsch(mom, 1, &rmsd, t, u);
             if (simplify_step != 1)
                 *Rcomm = 0;
-            do_rotation(xtm, xt, Lali, t, u);
+            rotate_score8(soa, soa+3, Lali, t, u, score_sum_method,
+                score_d8, d0, soa[6], soa[7]);
 
             //get subsegment of this fragment
             d = local_d0_search - 1;
-            n_cut = score_fun8_standard(xt, ytm, Lali, d, i_ali, &score,
-                score_sum_method, score_d8, d0);
+            n_cut = score_fun8_standard(soa[6], soa[7], Lali, d, i_ali,
+                &score);
 
             if (score>score_max)
             {
@@ -366,9 +426,10 @@ double TMscore8_search_standard( double **r1, double **r2,
                 }
                 //extract rotation matrix based on the fragment                
                 Kabsch(r1, r2, n_cut, 1, &rmsd, t, u);
-                do_rotation(xtm, xt, Lali, t, u);
-                n_cut = score_fun8_standard(xt, ytm, Lali, d, i_ali, &score,
-                    score_sum_method, score_d8, d0);
+                rotate_score8(soa, soa+3, Lali, t, u, score_sum_method,
+                    score_d8, d0, soa[6], soa[7]);
+                n_cut = score_fun8_standard(soa[6], soa[7], Lali, d, i_ali,
+                &score);
                 if (score>score_max)
                 {
                     score_max = score;
@@ -414,10 +475,10 @@ double TMscore8_search_standard( double **r1, double **r2,
 //                            8 for socre over the pairs with dist<score_d8
 // output:  the best rotaion matrix t, u that results in highest TMscore
 double detailed_search(double **r1, double **r2, double **xtm, double **ytm,
-    double **xt, double **x, double **y, int xlen, int ylen, 
+    double **x, double **y, int xlen, int ylen, 
     int invmap0[], double t[3], double u[3][3], int simplify_step,
     int score_sum_method, double local_d0_search, double Lnorm,
-    double score_d8, double d0)
+    double score_d8, double d0, AlignWorkspace *ws=NULL)
 {
     //x is model, y is template, try to superpose onto y
     int i, j, k;     
@@ -442,16 +503,17 @@ double detailed_search(double **r1, double **r2, double **xtm, double **ytm,
     }
 
     //detailed search 40-->1
-    tmscore = TMscore8_search(r1, r2, xtm, ytm, xt, k, t, u, simplify_step,
-        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0);
+    tmscore = TMscore8_search(r1, r2, xtm, ytm, k, t, u, simplify_step,
+        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0, ws);
     return tmscore;
 }
 
 double detailed_search_standard( double **r1, double **r2,
-    double **xtm, double **ytm, double **xt, double **x, double **y,
+    double **xtm, double **ytm, double **x, double **y,
     int xlen, int ylen, int invmap0[], double t[3], double u[3][3],
     int simplify_step, int score_sum_method, double local_d0_search,
-    const bool& bNormalize, double Lnorm, double score_d8, double d0)
+    const bool& bNormalize, double Lnorm, double score_d8, double d0,
+    AlignWorkspace *ws=NULL)
 {
     //x is model, y is template, try to superpose onto y
     int i, j, k;     
@@ -476,8 +538,9 @@ double detailed_search_standard( double **r1, double **r2,
     }
 
     //detailed search 40-->1
-    tmscore = TMscore8_search_standard( r1, r2, xtm, ytm, xt, k, t, u,
-        simplify_step, score_sum_method, &rmsd, local_d0_search, score_d8, d0);
+    tmscore = TMscore8_search_standard( r1, r2, xtm, ytm, k, t, u,
+        simplify_step, score_sum_method, &rmsd, local_d0_search, score_d8, d0,
+        ws);
     if (bNormalize)// "-i", to use standard_TMscore, then bNormalize=true, else bNormalize=false; 
         tmscore = tmscore * k / Lnorm;
 
@@ -654,27 +717,92 @@ double get_initial(double **r1, double **r2, double **xtm, double **ytm,
     n2 = xlen-min_ali;
 
     int i, j, k, k_best;
-    double tmscore, tmscore_max=-1;
+    double tmscore_max=-1;
+
+    /* get_score_fast sums one term <=1 per aligned pair, so the number of
+     * aligned pairs bounds the score of a shift. Shifts are evaluated in
+     * order of decreasing bound, and skipped once the bound is below the
+     * best score. Ties go to the largest shift, as in a scan by
+     * increasing shift, so that the result does not depend on the order
+     * or on the number of threads */
+    vector<pair<int,int> > shift_list; // (-number of aligned pairs, shift)
+    for(k=n1; k<=n2; k+=(fast_opt)?5:1)
+    {
+        i=getmin(ylen, xlen-k)-((k<0)?-k:0);
+        shift_list.push_back(make_pair(-i, k));
+    }
+    sort(shift_list.begin(), shift_list.end());
+    const int n_shift=shift_list.size();
 
     k_best=n1;
-    for(k=n1; k<=n2; k+=(fast_opt)?5:1)
+#ifdef _OPENMP
+#pragma omp parallel num_threads(pair_nthreads) if(pair_nthreads>1) \
+    private(i, j, k)
+#endif
     {
-        //get the map
-        for(j=0; j<ylen; j++)
+        /* a single thread uses the buffers of the caller */
+        const bool own_buf=(pair_nthreads>1);
+        double **r1_t=r1, **r2_t=r2, **xtm_t=xtm, **ytm_t=ytm;
+        int *y2x_t=y2x;
+        if (own_buf)
         {
-            i=j+k;
-            if(i>=0 && i<xlen) y2x[j]=i;
-            else y2x[j]=-1;
+            NewArray(&r1_t, min_len, 3);
+            NewArray(&r2_t, min_len, 3);
+            NewArray(&xtm_t, min_len, 3);
+            NewArray(&ytm_t, min_len, 3);
+            y2x_t=new int[ylen];
         }
-        
-        //evaluate the map quickly in three iterations
-        //this is not real tmscore, it is used to evaluate the goodness of the initial alignment
-        tmscore=get_score_fast(r1, r2, xtm, ytm,
-            x, y, xlen, ylen, y2x, d0,d0_search, t, u);
-        if(tmscore>=tmscore_max)
+        double t_t[3], u_t[3][3], tmscore, tmscore_cur;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for(int s=0; s<n_shift; s++)
         {
-            tmscore_max=tmscore;
-            k_best=k;
+#ifdef _OPENMP
+#pragma omp atomic read
+#endif
+            tmscore_cur=tmscore_max;
+            if(-shift_list[s].first<tmscore_cur) continue;
+
+            //get the map
+            k=shift_list[s].second;
+            for(j=0; j<ylen; j++)
+            {
+                i=j+k;
+                if(i>=0 && i<xlen) y2x_t[j]=i;
+                else y2x_t[j]=-1;
+            }
+
+            //evaluate the map quickly in three iterations
+            //this is not real tmscore, it is used to evaluate the goodness of the initial alignment
+            tmscore=get_score_fast(r1_t, r2_t, xtm_t, ytm_t,
+                x, y, xlen, ylen, y2x_t, d0,d0_search, t_t, u_t);
+#ifdef _OPENMP
+#pragma omp critical(get_initial)
+#endif
+            if(tmscore>tmscore_max || (tmscore==tmscore_max && k>k_best))
+            {
+#ifdef _OPENMP
+#pragma omp atomic write
+#endif
+                tmscore_max=tmscore;
+                k_best=k;
+                for(i=0; i<3; i++)
+                {
+                    t[i]=t_t[i];
+                    for(j=0; j<3; j++) u[i][j]=u_t[i][j];
+                }
+            }
+        }
+
+        if (own_buf)
+        {
+            DeleteArray(&r1_t, min_len);
+            DeleteArray(&r2_t, min_len);
+            DeleteArray(&xtm_t, min_len);
+            DeleteArray(&ytm_t, min_len);
+            delete [] y2x_t;
         }
     }
     
@@ -734,198 +862,13 @@ void smooth(int *sec, int len)
 
 }
 
-char sec_str(double dis13, double dis14, double dis15,
-            double dis24, double dis25, double dis35)
-{
-    char s='C';
-    
-    double delta=2.1;
-    if (fabs(dis15-6.37)<delta && fabs(dis14-5.18)<delta && 
-        fabs(dis25-5.18)<delta && fabs(dis13-5.45)<delta &&
-        fabs(dis24-5.45)<delta && fabs(dis35-5.45)<delta)
-    {
-        s='H'; //helix                        
-        return s;
-    }
-
-    delta=1.42;
-    if (fabs(dis15-13  )<delta && fabs(dis14-10.4)<delta &&
-        fabs(dis25-10.4)<delta && fabs(dis13-6.1 )<delta &&
-        fabs(dis24-6.1 )<delta && fabs(dis35-6.1 )<delta)
-    {
-        s='E'; //strand
-        return s;
-    }
-
-    if (dis15 < 8) s='T'; //turn
-    return s;
-}
-
-
-/* secondary structure assignment for protein:
- * 1->coil, 2->helix, 3->turn, 4->strand */
-void make_sec(double **x, int len, char *sec)
-{
-    int j1, j2, j3, j4, j5;
-    double d13, d14, d15, d24, d25, d35;
-    for(int i=0; i<len; i++)
-    {     
-        sec[i]='C';
-        j1=i-2;
-        j2=i-1;
-        j3=i;
-        j4=i+1;
-        j5=i+2;        
-        
-        if(j1>=0 && j5<len)
-        {
-            d13=sqrt(dist(x[j1], x[j3]));
-            d14=sqrt(dist(x[j1], x[j4]));
-            d15=sqrt(dist(x[j1], x[j5]));
-            d24=sqrt(dist(x[j2], x[j4]));
-            d25=sqrt(dist(x[j2], x[j5]));
-            d35=sqrt(dist(x[j3], x[j5]));
-            sec[i]=sec_str(d13, d14, d15, d24, d25, d35);            
-        }    
-    } 
-    sec[len]=0;
-}
-
-/* a c d b: a paired to b, c paired to d */
-bool overlap(const int a1,const int b1,const int c1,const int d1,
-             const int a2,const int b2,const int c2,const int d2)
-{
-    return (a2>=a1&&a2<=c1)||(c2>=a1&&c2<=c1)||
-           (d2>=a1&&d2<=c1)||(b2>=a1&&b2<=c1)||
-           (a2>=d1&&a2<=b1)||(c2>=d1&&c2<=b1)||
-           (d2>=d1&&d2<=b1)||(b2>=d1&&b2<=b1);
-}
-
-/* find base pairing stacks in RNA*/
-void sec_str(int len,char *seq, const vector<vector<bool> >&bp, 
-    int a, int b,int &c, int &d)
-{
-    int i;
-    
-    for (i=0;i<len;i++)
-    {
-        if (a+i<len-3 && b-i>0)
-        {
-            if (a+i<b-i && bp[a+i][b-i]) continue;
-            break;
-        }
-    }
-    c=a+i-1;d=b-i+1;
-}
-
-/* secondary structure assignment for RNA:
- * 1->unpair, 2->paired with upstream, 3->paired with downstream */
-void make_sec(char *seq, double **x, int len, char *sec,const string atom_opt)
-{
-    int ii,jj,i,j;
-
-    float lb=12.5; // lower bound for " C3'"
-    float ub=15.0; // upper bound for " C3'"
-    if     (atom_opt==" C4'") {lb=14.0;ub=16.0;}
-    else if(atom_opt==" C5'") {lb=16.0;ub=18.0;}
-    else if(atom_opt==" O3'") {lb=13.5;ub=16.5;}
-    else if(atom_opt==" O5'") {lb=15.5;ub=18.5;}
-    else if(atom_opt==" P  ") {lb=16.5;ub=21.0;}
-
-    float dis;
-    vector<bool> bp_tmp(len,false);
-    vector<vector<bool> > bp(len,bp_tmp);
-    bp_tmp.clear();
-    for (i=0; i<len; i++)
-    {
-        sec[i]='.';
-        for (j=i+1; j<len; j++)
-        {
-            if (((seq[i]=='u'||seq[i]=='t')&&(seq[j]=='a'             ))||
-                ((seq[i]=='a'             )&&(seq[j]=='u'||seq[j]=='t'))||
-                ((seq[i]=='g'             )&&(seq[j]=='c'||seq[j]=='u'))||
-                ((seq[i]=='c'||seq[i]=='u')&&(seq[j]=='g'             )))
-            {
-                dis=sqrt(dist(x[i], x[j]));
-                bp[j][i]=bp[i][j]=(dis>lb && dis<ub);
-            }
-        }
-    }
-    
-    // From 5' to 3': A0_var C0_var D0_var B0_var: A0_var paired to B0_var, C0_var paired to D0_var
-    vector<int> A0_var,B0_var,C0_var,D0_var;
-    for (i=0; i<len-2; i++)
-    {
-        for (j=i+3; j<len; j++)
-        {
-            if (!bp[i][j]) continue;
-            if (i>0 && j+1<len && bp[i-1][j+1]) continue;
-            if (!bp[i+1][j-1]) continue;
-            sec_str(len,seq, bp, i,j,ii,jj);
-            if (jj<i || j<ii)
-            {
-                ii=i;
-                jj=j;
-            }
-            A0_var.push_back(i);
-            B0_var.push_back(j);
-            C0_var.push_back(ii);
-            D0_var.push_back(jj);
-        }
-    }
-    
-    //int sign;
-    for (i=0;i<A0_var.size();i++)
-    {
-        /*
-        sign=0;
-        if(C0_var[i]-A0_var[i]<=1)
-        {
-            for(j=0;j<A0_var.size();j++)
-            {
-                if(i==j) continue;
-
-                if((A0_var[j]>=A0_var[i]&&A0_var[j]<=C0_var[i])||
-                   (C0_var[j]>=A0_var[i]&&C0_var[j]<=C0_var[i])||
-                   (D0_var[j]>=A0_var[i]&&D0_var[j]<=C0_var[i])||
-                   (B0_var[j]>=A0_var[i]&&B0_var[j]<=C0_var[i])||
-                   (A0_var[j]>=D0_var[i]&&A0_var[j]<=B0_var[i])||
-                   (C0_var[j]>=D0_var[i]&&C0_var[j]<=B0_var[i])||
-                   (D0_var[j]>=D0_var[i]&&D0_var[j]<=B0_var[i])||
-                   (B0_var[j]>=D0_var[i]&&B0_var[j]<=B0_var[i]))
-                {
-                    sign=-1;
-                    break;
-                }
-            }
-        }
-        if(sign!=0) continue;
-        */
-
-        for (j=0;;j++)
-        {
-            if(A0_var[i]+j>C0_var[i]) break;
-            sec[A0_var[i]+j]='<';
-            sec[D0_var[i]+j]='>';
-        }
-    }
-    sec[len]=0;
-
-    /* clean up */
-    A0_var.clear();
-    B0_var.clear();
-    C0_var.clear();
-    D0_var.clear();
-    bp.clear();
-}
-
 //get initial alignment from secondary structure alignment
 //input: x, y, xlen, ylen
 //output: y2x stores the best alignment: e.g., 
 //y2x[j]=i means:
 //the jth element in y is aligned to the ith element in x if i>=0 
 //the jth element in y is aligned to a gap in x if i==-1
-void get_initial_ss(bool **path, double **val,
+void get_initial_ss(PathMatrix &path, double **val,
     const char *secx, const char *secy, int xlen, int ylen, int *y2x)
 {
     double gap_open=-1.0;
@@ -941,14 +884,11 @@ void get_initial_ss(bool **path, double **val,
 //the jth element in y is aligned to the ith element in x if i>=0 
 //the jth element in y is aligned to a gap in x if i==-1
 bool get_initial5( double **r1, double **r2, double **xtm, double **ytm,
-    bool **path, double **val,
+    PathMatrix &path, double **val,
     double **x, double **y, int xlen, int ylen, int *y2x,
-    double d0, double d0_search, const bool fast_opt, const double D0_MIN)
+    double d0, double d0_search, const bool fast_opt, const double D0_MIN,
+    AlignWorkspace *ws=NULL)
 {
-    double GL, rmsd;
-    double t[3];
-    double u[3][3];
-
     double d01 = d0 + 1.5;
     if (d01 < D0_MIN) d01 = D0_MIN;
     double d02 = d01*d01;
@@ -996,7 +936,9 @@ bool get_initial5( double **r1, double **r2, double **xtm, double **ytm,
         n_jump1*=5;
         n_jump2*=5;
     }
-    bool flag = false;
+    /* cells (i_frag, i, j) of the search grid, in the order of the serial
+     * search, which keeps the first cell with the highest score */
+    vector<int> cell_list;
     for (int i_frag = 0; i_frag < 2; i_frag++)
     {
         int m1 = xlen - n_frag[i_frag] + 1;
@@ -1006,34 +948,102 @@ bool get_initial5( double **r1, double **r2, double **xtm, double **ytm,
         {
             for (int j = 0; j<m2; j = j + n_jump2)
             {
-                for (int k = 0; k<n_frag[i_frag]; k++) //fragment in y
-                {
-                    r1[k][0] = x[k + i][0];
-                    r1[k][1] = x[k + i][1];
-                    r1[k][2] = x[k + i][2];
+                cell_list.push_back(i_frag);
+                cell_list.push_back(i);
+                cell_list.push_back(j);
+            }
+        }
+    }
+    const int n_cell=cell_list.size()/3;
+
+    /* The cells are independent. Each thread keeps the first of its best
+     * cells, and the best cell over all threads is the one with the
+     * smallest index among equal scores, which equals the serial search */
+    int c_best=-1;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(pair_nthreads) if(pair_nthreads>1)
+#endif
+    {
+        /* a single thread uses the buffers of the caller */
+        const bool own_buf=(pair_nthreads>1);
+        double **r1_t=r1, **r2_t=r2, **xtm_t=xtm, **ytm_t=ytm, **val_t=val;
+        PathMatrix path_own;
+        PathMatrix &path_t=own_buf?path_own.get(xlen+1, ylen+1):path;
+        int *invmap_t=invmap;
+        int *y2x_t=y2x;
+        AlignWorkspace ws_own;
+        AlignWorkspace *ws_t=own_buf?&ws_own:ws;
+        if (own_buf)
+        {
+            NewArray(&r1_t, aL, 3);
+            NewArray(&r2_t, aL, 3);
+            NewArray(&xtm_t, aL, 3);
+            NewArray(&ytm_t, aL, 3);
+            NewArray(&val_t, xlen+1, ylen+1);
+            invmap_t=new int[ylen+1];
+            y2x_t=new int[ylen+1];
+        }
+        double GL_t=0, rmsd_t, t_t[3], u_t[3][3], GL;
+        int c_t=-1;
 
-                    r2[k][0] = y[k + j][0];
-                    r2[k][1] = y[k + j][1];
-                    r2[k][2] = y[k + j][2];
-                }
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic)
+#endif
+        for (int c=0; c<n_cell; c++)
+        {
+            int i_frag=cell_list[3*c];
+            int i=cell_list[3*c+1];
+            int j=cell_list[3*c+2];
+            for (int k = 0; k<n_frag[i_frag]; k++) //fragment in y
+            {
+                r1_t[k][0] = x[k + i][0];
+                r1_t[k][1] = x[k + i][1];
+                r1_t[k][2] = x[k + i][2];
 
-                // superpose the two structures and rotate it
-                Kabsch(r1, r2, n_frag[i_frag], 1, &rmsd, t, u);
+                r2_t[k][0] = y[k + j][0];
+                r2_t[k][1] = y[k + j][1];
+                r2_t[k][2] = y[k + j][2];
+            }
 
-                double gap_open = 0.0;
-                NWDP_TM(path, val, x, y, xlen, ylen,
-                    t, u, d02, gap_open, invmap);
-                GL = get_score_fast(r1, r2, xtm, ytm, x, y, xlen, ylen,
-                    invmap, d0, d0_search, t, u);
-                if (GL>GLmax)
-                {
-                    GLmax = GL;
-                    for (int ii = 0; ii<ylen; ii++) y2x[ii] = invmap[ii];
-                    flag = true;
-                }
+            // superpose the two structures and rotate it
+            Kabsch(r1_t, r2_t, n_frag[i_frag], 1, &rmsd_t, t_t, u_t);
+
+            double gap_open = 0.0;
+            NWDP_TM(path_t, val_t, x, y, xlen, ylen,
+                t_t, u_t, d02, gap_open, invmap_t, ws_t);
+            GL = get_score_fast(r1_t, r2_t, xtm_t, ytm_t, x, y, xlen, ylen,
+                invmap_t, d0, d0_search, t_t, u_t);
+            if (GL>GL_t || (GL==GL_t && c_t>=0 && c<c_t))
+            {
+                GL_t = GL;
+                c_t = c;
+                for (int ii = 0; ii<ylen; ii++) y2x_t[ii] = invmap_t[ii];
             }
         }
+
+#ifdef _OPENMP
+#pragma omp critical(get_initial5)
+#endif
+        if (c_t>=0 && (GL_t>GLmax || (GL_t==GLmax && c_t<c_best)))
+        {
+            GLmax = GL_t;
+            c_best = c_t;
+            if (y2x_t!=y2x)
+                for (int ii = 0; ii<ylen; ii++) y2x[ii] = y2x_t[ii];
+        }
+
+        if (own_buf)
+        {
+            DeleteArray(&r1_t, aL);
+            DeleteArray(&r2_t, aL);
+            DeleteArray(&xtm_t, aL);
+            DeleteArray(&ytm_t, aL);
+            DeleteArray(&val_t, xlen+1);
+            delete [] invmap_t;
+            delete [] y2x_t;
+        }
     }
+    bool flag = (c_best>=0);
 
     delete[] invmap;
     return flag;
@@ -1091,7 +1101,7 @@ void score_matrix_rmsd_sec( double **r1, double **r2, double **score,
 //y2x[j]=i means:
 //the jth element in y is aligned to the ith element in x if i>=0 
 //the jth element in y is aligned to a gap in x if i==-1
-void get_initial_ssplus(double **r1, double **r2, double **score, bool **path,
+void get_initial_ssplus(double **r1, double **r2, double **score, PathMatrix &path,
     double **val, const char *secx, const char *secy, double **x, double **y,
     int xlen, int ylen, int *y2x0, int *y2x, const double D0_MIN, double d0)
 {
@@ -1406,10 +1416,11 @@ double get_initial_fgt(double **r1, double **r2, double **xtm, double **ytm,
 //       vectors x and y, d0
 //output: best alignment that maximizes the TMscore, will be stored in invmap
 double DP_iter(double **r1, double **r2, double **xtm, double **ytm,
-    double **xt, bool **path, double **val, double **x, double **y,
+    PathMatrix &path, double **val, double **x, double **y,
     int xlen, int ylen, double t[3], double u[3][3], int invmap0[],
     int g1, int g2, int iteration_max, double local_d0_search,
-    double D0_MIN, double Lnorm, double d0, double score_d8)
+    double D0_MIN, double Lnorm, double d0, double score_d8,
+    AlignWorkspace *ws=NULL)
 {
     double gap_open[2]={-0.6, 0};
     double rmsd; 
@@ -1427,7 +1438,7 @@ double DP_iter(double **r1, double **r2, double **xtm, double **ytm,
         for(iteration=0; iteration<iteration_max; iteration++)
         {           
             NWDP_TM(path, val, x, y, xlen, ylen,
-                t, u, d02, gap_open[g], invmap);
+                t, u, d02, gap_open[g], invmap, ws);
             
             k=0;
             for(j=0; j<ylen; j++) 
@@ -1447,9 +1458,9 @@ double DP_iter(double **r1, double **r2, double **xtm, double **ytm,
                 }
             }
 
-            tmscore = TMscore8_search(r1, r2, xtm, ytm, xt, k, t, u,
+            tmscore = TMscore8_search(r1, r2, xtm, ytm, k, t, u,
                 simplify_step, score_sum_method, &rmsd, local_d0_search,
-                Lnorm, score_d8, d0);
+                Lnorm, score_d8, d0, ws);
 
            
             if(tmscore>tmscore_max)
@@ -1483,22 +1494,12 @@ void output_pymol(const string xname, const string yname,
 {
     int compress_type=0; // uncompressed file
     ifstream fin;
-#ifndef REDI_PSTREAM_H_SEEN
+#ifndef GZSTREAM_H_SEEN
     ifstream fin_gz;
 #else
-    redi::ipstream fin_gz; // if file is compressed
-    if (xname.size()>=3 && 
-        xname.substr(xname.size()-3,3)==".gz")
-    {
-        fin_gz.open("gunzip -c "+xname);
-        compress_type=1;
-    }
-    else if (xname.size()>=4 && 
-        xname.substr(xname.size()-4,4)==".bz2")
-    {
-        fin_gz.open("bzcat "+xname);
-        compress_type=2;
-    }
+    gzistream fin_gz; // if file is compressed
+    compress_type=gz_compress_type(xname);
+    if (compress_type) fin_gz.open(xname);
     else
 #endif
         fin.open(xname.c_str());
@@ -1927,22 +1928,12 @@ void output_mTMalign_pymol(const vector<string>&chain_list,
         name=chain_list[m];
 
         ifstream fin;
-#ifndef REDI_PSTREAM_H_SEEN
+#ifndef GZSTREAM_H_SEEN
         ifstream fin_gz;
 #else
-        redi::ipstream fin_gz; // if file is compressed
-        if (name.size()>=3 && 
-            name.substr(name.size()-3,3)==".gz")
-        {
-            fin_gz.open("gunzip -c "+name);
-            compress_type=1;
-        }
-        else if (name.size()>=4 && 
-            name.substr(name.size()-4,4)==".bz2")
-        {
-            fin_gz.open("bzcat "+name);
-            compress_type=2;
-        }
+        gzistream fin_gz; // if file is compressed
+        compress_type=gz_compress_type(name);
+        if (compress_type) fin_gz.open(name);
         else
 #endif
         fin.open(name.c_str());
@@ -3000,10 +2991,10 @@ void output_mTMalign_results(const string xname, const string yname,
 }
 
 double standard_TMscore(double **r1, double **r2, double **xtm, double **ytm,
-    double **xt, double **x, double **y, int xlen, int ylen, int invmap[],
+    double **x, double **y, int xlen, int ylen, int invmap[],
     int& L_ali, double& RMSD, double D0_MIN, double Lnorm, double d0,
     double d0_search, double score_d8, double t[3], double u[3][3],
-    const int mol_type)
+    const int mol_type, AlignWorkspace *ws=NULL)
 {
     D0_MIN = 0.5;
     Lnorm = ylen;
@@ -3061,9 +3052,9 @@ double standard_TMscore(double **r1, double **r2, double **xtm, double **ytm,
     int temp_score_sum_method = 0;
     d0_search = d0_input;
     double rms = 0.0;
-    tmscore = TMscore8_search_standard(r1, r2, xtm, ytm, xt, n_al, t, u,
+    tmscore = TMscore8_search_standard(r1, r2, xtm, ytm, n_al, t, u,
         temp_simplify_step, temp_score_sum_method, &rms, d0_input,
-        score_d8, d0);
+        score_d8, d0, ws);
     tmscore = tmscore * n_al / (1.0*Lnorm);
 
     return tmscore;
@@ -3080,6 +3071,61 @@ void copy_t_u(double t[3], double u[3][3], double t0[3], double u0[3][3])
     }
 }
 
+/* TMcut pruning in TMalign_main. After each initial alignment stage,
+ * approx_TM of the best alignment so far divided by the factor of the
+ * stage is used as an estimate of the final TM-score. It is not an upper
+ * bound, so that a pair may be pruned even if its final TM-score would
+ * reach TMcut. The pair is pruned if this estimate is below TMcut, and
+ * TMalign_main returns 2 plus the index of the stage. */
+const int TMcut_stage_num=6;
+const char *TMcut_stage_name[TMcut_stage_num]={
+    "gapless threading",
+    "secondary structure",
+    "local superposition",
+    "local superposition+secondary structure",
+    "fragment gapless threading",
+    "all initial alignments",
+};
+const double TMcut_factor_default[TMcut_stage_num]={
+    0.50,0.52,0.54,0.56,0.58,0.60};
+double TMcut_factor[TMcut_stage_num]={0.50,0.52,0.54,0.56,0.58,0.60};
+
+/* set TMcut_factor by pruning policy.
+ * 0 - (default) the factors of TM-align
+ * 1 - conservative, prune fewer pairs
+ * 2 - aggressive, prune more pairs
+ * Otherwise, policy is a file of TMcut_stage_num factors, e.g., calibrated
+ * on a benchmark set. Return false if the file cannot be read. */
+bool set_TMcut_policy(const string &policy)
+{
+    int stage;
+    if (policy=="0" || policy=="1" || policy=="2")
+    {
+        double shift=0;
+        if (policy=="1") shift=-0.1;
+        else if (policy=="2") shift=0.1;
+        for (stage=0;stage<TMcut_stage_num;stage++)
+            TMcut_factor[stage]=TMcut_factor_default[stage]+shift;
+        return true;
+    }
+    ifstream fin(policy.c_str());
+    double factor[TMcut_stage_num];
+    for (stage=0;stage<TMcut_stage_num;stage++)
+        if (!(fin>>factor[stage]) || factor[stage]<=0) return false;
+    fin.close();
+    for (stage=0;stage<TMcut_stage_num;stage++)
+        TMcut_factor[stage]=factor[stage];
+    return true;
+}
+
+/* whether to prune a pair after stage, given the approximate TM-score
+ * TMtmp of the best alignment so far */
+inline bool TMcut_prune(const double TMtmp, const double TMcut,
+    const int stage)
+{
+    return TMtmp<TMcut_factor[stage]*TMcut;
+}
+
 /* calculate approximate TM-score given rotation matrix */
 double approx_TM(const int xlen, const int ylen, const int a_opt,
     double **xa, double **ya, double t[3], double u[3][3],
@@ -3115,13 +3161,13 @@ double approx_TM(const int xlen, const int ylen, const int a_opt,
 }
 
 void clean_up_after_approx_TM(int *invmap0, int *invmap,
-    double **score, bool **path, double **val, double **xtm, double **ytm,
+    double **score, PathMatrix &path, double **val, double **xtm, double **ytm,
     double **xt, double **r1, double **r2, const int xlen, const int minlen)
 {
     delete [] invmap0;
     delete [] invmap;
     DeleteArray(&score, xlen+1);
-    DeleteArray(&path, xlen+1);
+    path.clear();
     DeleteArray(&val, xlen+1);
     DeleteArray(&xtm, minlen);
     DeleteArray(&ytm, minlen);
@@ -3131,10 +3177,66 @@ void clean_up_after_approx_TM(int *invmap0, int *invmap,
     return;
 }
 
+/* Result of one independent seed of TMalign_main: the initial alignment
+ * refined by detailed_search, and then by DP_iter */
+struct TMalignSeed
+{
+    bool   ok;              // false if the initial alignment failed
+    double TM_ds, TM_dp;    // TM-score after detailed_search and DP_iter
+    vector<int> invmap_ds;  // alignment scored by TM_ds
+    vector<int> invmap_dp;  // alignment scored by TM_dp
+};
+
+/* Compute seed 0 (gapless threading), 1 (secondary structure), 2 (local
+ * superposition, get_initial5) or 3 (fragment gapless threading) of
+ * TMalign_main, using only the buffers of ws. DP_iter is always run,
+ * while TMalign_main only runs it if TM_ds is high enough, so that the
+ * seeds can be computed in parallel and combined afterwards. */
+void TMalign_seed(const int seed, TMalignSeed &res, AlignWorkspace *ws,
+    double **xa, double **ya, const char *secx, const char *secy,
+    const int xlen, const int ylen, const double d0, const double d0_search,
+    const double dcu0, const double D0_MIN, const double Lnorm,
+    const double score_d8, const double local_d0_search,
+    const int simplify_step, const int score_sum_method, const bool fast_opt)
+{
+    int minlen=min(xlen, ylen);
+    PathMatrix &path=ws->path.get(xlen+1, ylen+1); // DP traceback
+    double **val=ws->val.get(xlen+1, ylen+1);
+    double **xtm=ws->xtm.get(minlen, 3);
+    double **ytm=ws->ytm.get(minlen, 3);
+    double **r1 =ws->r1.get(minlen, 3);
+    double **r2 =ws->r2.get(minlen, 3);
+    int *invmap =ws->invmap.get(ylen+1);
+    double t[3], u[3][3];
+
+    res.ok=true;
+    if (seed==0) get_initial(r1, r2, xtm, ytm, xa, ya, xlen, ylen, invmap,
+        d0, d0_search, fast_opt, t, u);
+    else if (seed==1) get_initial_ss(path, val, secx, secy, xlen, ylen,
+        invmap);
+    else if (seed==2) res.ok=get_initial5(r1, r2, xtm, ytm, path, val,
+        xa, ya, xlen, ylen, invmap, d0, d0_search, fast_opt, D0_MIN, ws);
+    else get_initial_fgt(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
+        invmap, d0, d0_search, dcu0, fast_opt, t, u);
+    if (!res.ok) return;
+
+    res.TM_ds=detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
+        invmap, t, u, simplify_step, score_sum_method, local_d0_search,
+        Lnorm, score_d8, d0, ws);
+    res.invmap_ds.assign(invmap, invmap+ylen);
+
+    int g1=(seed==3)?1:0;
+    int iteration_max=(seed>=2 || fast_opt)?2:30;
+    res.TM_dp=DP_iter(r1, r2, xtm, ytm, path, val, xa, ya, xlen, ylen,
+        t, u, invmap, g1, 2, iteration_max, local_d0_search, D0_MIN, Lnorm,
+        d0, score_d8, ws);
+    res.invmap_dp.assign(invmap, invmap+ylen);
+}
+
 /* Entry function for TM-align. Return TM-score calculation status:
  * 0   - full TM-score calculation 
  * 1   - terminated due to exception
- * 2-7 - pre-terminated due to low TM-score */
+ * 2-7 - pre-terminated due to low TM-score after TMcut stage 0-5 */
 int TMalign_main(double **xa, double **ya,
     const char *seqx, const char *seqy, const char *secx, const char *secy,
     double t0[3], double u0[3][3],
@@ -3148,14 +3250,13 @@ int TMalign_main(double **xa, double **ya,
     const vector<string> sequence, const double Lnorm_ass,
     const double d0_scale, const int i_opt, const int a_opt,
     const bool u_opt, const bool d_opt, const bool fast_opt,
-    const int mol_type, const double TMcut=-1)
+    const int mol_type, const double TMcut=-1, AlignWorkspace *ws=NULL)
 {
     double D0_MIN;        //for d0
     double Lnorm;         //normalization length
     double score_d8,d0,d0_search,dcu0;//for TMscore search
     double t[3], u[3][3]; //Kabsch translation vector and rotation matrix
     double **score;       // Input score table for dynamic programming
-    bool   **path;        // for dynamic programming  
     double **val;         // for dynamic programming  
     double **xtm, **ytm;  // for TMscore search engine
     double **xt;          //for saving the superposed version of r_1 or xtm
@@ -3164,15 +3265,17 @@ int TMalign_main(double **xa, double **ya,
     /***********************/
     /* allocate memory     */
     /***********************/
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
     int minlen = min(xlen, ylen);
-    NewArray(&score, xlen+1, ylen+1);
-    NewArray(&path, xlen+1, ylen+1);
-    NewArray(&val, xlen+1, ylen+1);
-    NewArray(&xtm, minlen, 3);
-    NewArray(&ytm, minlen, 3);
-    NewArray(&xt, xlen, 3);
-    NewArray(&r1, minlen, 3);
-    NewArray(&r2, minlen, 3);
+    score=ws->score.get(xlen+1, ylen+1);
+    PathMatrix &path=ws->path.get(xlen+1, ylen+1); // DP traceback
+    val  =ws->val.get(xlen+1, ylen+1);
+    xtm  =ws->xtm.get(minlen, 3);
+    ytm  =ws->ytm.get(minlen, 3);
+    xt   =ws->xt.get(xlen, 3);
+    r1   =ws->r1.get(minlen, 3);
+    r2   =ws->r2.get(minlen, 3);
 
     /***********************/
     /*    parameter set    */
@@ -3183,8 +3286,8 @@ int TMalign_main(double **xa, double **ya,
     int score_sum_method = 8;  //for scoring method, whether only sum over pairs with dis<score_d8
 
     int i;
-    int *invmap0         = new int[ylen+1];
-    int *invmap          = new int[ylen+1];
+    int *invmap0         = ws->invmap0.get(ylen+1);
+    int *invmap          = ws->invmap.get(ylen+1);
     double TM, TMmax=-1;
     for(i=0; i<ylen; i++) invmap0[i]=-1;
 
@@ -3223,14 +3326,15 @@ int TMalign_main(double **xa, double **ya,
         double prevD0_MIN = D0_MIN;// stored for later use
         int prevLnorm = Lnorm;
         double prevd0 = d0;
-        TM_ali = standard_TMscore(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
+        TM_ali = standard_TMscore(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
             invmap, L_ali, rmsd_ali, D0_MIN, Lnorm, d0, d0_search, score_d8,
-            t, u, mol_type);
+            t, u, mol_type, ws);
         D0_MIN = prevD0_MIN;
         Lnorm = prevLnorm;
         d0 = prevd0;
-        TM = detailed_search_standard(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
-            invmap, t, u, 40, 8, local_d0_search, true, Lnorm, score_d8, d0);
+        TM = detailed_search_standard(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
+            invmap, t, u, 40, 8, local_d0_search, true, Lnorm, score_d8, d0,
+            ws);
         if (TM > TMmax)
         {
             TMmax = TM;
@@ -3241,19 +3345,94 @@ int TMalign_main(double **xa, double **ya,
     /******************************************************/
     /*    get initial alignment with gapless threading    */
     /******************************************************/
-    if (i_opt<=1)
+    if (i_opt<=1 && pair_nthreads>1 && TMcut<=0)
+    {
+        /* The four independent seeds run in parallel with separate
+         * workspaces. They are then combined in the same order and with
+         * the same tests as below, which gives the same TMmax and invmap0.
+         * TMcut needs the serial order for early termination.
+         * Seed 2 runs afterwards on its own because the fragment grid of
+         * get_initial5 is itself split over all threads */
+        TMalignSeed seed_res[4];
+        AlignWorkspace seed_ws[3]; // seed 0 uses ws
+        const int seed_list[3]={0, 1, 3};
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(pair_nthreads) schedule(dynamic)
+#endif
+        for (int s=0; s<3; s++)
+        {
+            int seed=seed_list[s];
+            TMalign_seed(seed, seed_res[seed], seed?(seed_ws+seed-1):ws,
+                xa, ya, secx, secy, xlen, ylen, d0, d0_search, dcu0,
+                D0_MIN, Lnorm, score_d8, local_d0_search, simplify_step,
+                score_sum_method, fast_opt);
+        }
+        TMalign_seed(2, seed_res[2], seed_ws+1,
+            xa, ya, secx, secy, xlen, ylen, d0, d0_search, dcu0,
+            D0_MIN, Lnorm, score_d8, local_d0_search, simplify_step,
+            score_sum_method, fast_opt);
+
+        const double TM_dp_cut[4]={0, 0.2, ddcc, ddcc};
+        for (int seed=0; seed<4; seed++)
+        {
+            TMalignSeed &res=seed_res[seed];
+            if (!res.ok) cerr << "\n\nWarning: initial alignment from local superposition fail!\n\n" << endl;
+            else
+            {
+                /* gapless threading always sets invmap0 */
+                if (res.TM_ds>TMmax || seed==0)
+                {
+                    if (res.TM_ds>TMmax) TMmax = res.TM_ds;
+                    for (i = 0; i<ylen; i++) invmap0[i] = res.invmap_ds[i];
+                }
+                /* DP_iter always follows gapless threading */
+                if ((seed==0 || res.TM_ds > TMmax*TM_dp_cut[seed]) &&
+                    res.TM_dp>TMmax)
+                {
+                    TMmax = res.TM_dp;
+                    for (i = 0; i<ylen; i++) invmap0[i] = res.invmap_dp[i];
+                }
+            }
+
+            if (seed!=2) continue;
+            /* get_initial_ssplus starts from the best alignment of the
+             * first three seeds */
+            get_initial_ssplus(r1, r2, score, path, val, secx, secy, xa, ya,
+                xlen, ylen, invmap0, invmap, D0_MIN, d0);
+            TM = detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
+                invmap, t, u, simplify_step, score_sum_method,
+                local_d0_search, Lnorm, score_d8, d0, ws);
+            if (TM>TMmax)
+            {
+                TMmax = TM;
+                for (i = 0; i<ylen; i++) invmap0[i] = invmap[i];
+            }
+            if (TM > TMmax*ddcc)
+            {
+                TM = DP_iter(r1, r2, xtm, ytm, path, val, xa, ya,
+                    xlen, ylen, t, u, invmap, 0, 2, (fast_opt)?2:30,
+                    local_d0_search, D0_MIN, Lnorm, d0, score_d8, ws);
+                if (TM>TMmax)
+                {
+                    TMmax = TM;
+                    for (i = 0; i<ylen; i++) invmap0[i] = invmap[i];
+                }
+            }
+        }
+    }
+    else if (i_opt<=1)
     {
         get_initial(r1, r2, xtm, ytm, xa, ya, xlen, ylen, invmap0, d0,
             d0_search, fast_opt, t, u);
-        TM = detailed_search(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen, invmap0,
+        TM = detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen, invmap0,
             t, u, simplify_step, score_sum_method, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         if (TM>TMmax) TMmax = TM;
         if (TMcut>0) copy_t_u(t, u, t0, u0);
         //run dynamic programing iteratively to find the best alignment
-        TM = DP_iter(r1, r2, xtm, ytm, xt, path, val, xa, ya, xlen, ylen,
+        TM = DP_iter(r1, r2, xtm, ytm, path, val, xa, ya, xlen, ylen,
              t, u, invmap, 0, 2, (fast_opt)?2:30, local_d0_search,
-             D0_MIN, Lnorm, d0, score_d8);
+             D0_MIN, Lnorm, d0, score_d8, ws);
         if (TM>TMmax)
         {
             TMmax = TM;
@@ -3266,11 +3445,9 @@ int TMalign_main(double **xa, double **ya,
             double TMtmp=approx_TM(xlen, ylen, a_opt,
                 xa, ya, t0, u0, invmap0, mol_type);
 
-            if (TMtmp<0.5*TMcut)
+            if (TMcut_prune(TMtmp, TMcut, 0))
             {
                 TM1=TM2=TM3=TM4=TM5=TMtmp;
-                clean_up_after_approx_TM(invmap0, invmap, score, path, val,
-                    xtm, ytm, xt, r1, r2, xlen, minlen);
                 return 2;
             }
         }
@@ -3279,9 +3456,9 @@ int TMalign_main(double **xa, double **ya,
         /*    get initial alignment based on secondary structure    */
         /************************************************************/
         get_initial_ss(path, val, secx, secy, xlen, ylen, invmap);
-        TM = detailed_search(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen, invmap,
+        TM = detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen, invmap,
             t, u, simplify_step, score_sum_method, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         if (TM>TMmax)
         {
             TMmax = TM;
@@ -3290,9 +3467,9 @@ int TMalign_main(double **xa, double **ya,
         }
         if (TM > TMmax*0.2)
         {
-            TM = DP_iter(r1, r2, xtm, ytm, xt, path, val, xa, ya,
+            TM = DP_iter(r1, r2, xtm, ytm, path, val, xa, ya,
                 xlen, ylen, t, u, invmap, 0, 2, (fast_opt)?2:30,
-                local_d0_search, D0_MIN, Lnorm, d0, score_d8);
+                local_d0_search, D0_MIN, Lnorm, d0, score_d8, ws);
             if (TM>TMmax)
             {
                 TMmax = TM;
@@ -3306,11 +3483,9 @@ int TMalign_main(double **xa, double **ya,
             double TMtmp=approx_TM(xlen, ylen, a_opt,
                 xa, ya, t0, u0, invmap0, mol_type);
 
-            if (TMtmp<0.52*TMcut)
+            if (TMcut_prune(TMtmp, TMcut, 1))
             {
                 TM1=TM2=TM3=TM4=TM5=TMtmp;
-                clean_up_after_approx_TM(invmap0, invmap, score, path, val,
-                    xtm, ytm, xt, r1, r2, xlen, minlen);
                 return 3;
             }
         }
@@ -3320,11 +3495,11 @@ int TMalign_main(double **xa, double **ya,
         /************************************************************/
         //=initial5 in original TM-align
         if (get_initial5( r1, r2, xtm, ytm, path, val, xa, ya,
-            xlen, ylen, invmap, d0, d0_search, fast_opt, D0_MIN))
+            xlen, ylen, invmap, d0, d0_search, fast_opt, D0_MIN, ws))
         {
-            TM = detailed_search(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
+            TM = detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
                 invmap, t, u, simplify_step, score_sum_method,
-                local_d0_search, Lnorm, score_d8, d0);
+                local_d0_search, Lnorm, score_d8, d0, ws);
             if (TM>TMmax)
             {
                 TMmax = TM;
@@ -3333,9 +3508,9 @@ int TMalign_main(double **xa, double **ya,
             }
             if (TM > TMmax*ddcc)
             {
-                TM = DP_iter(r1, r2, xtm, ytm, xt, path, val, xa, ya,
+                TM = DP_iter(r1, r2, xtm, ytm, path, val, xa, ya,
                     xlen, ylen, t, u, invmap, 0, 2, 2, local_d0_search,
-                    D0_MIN, Lnorm, d0, score_d8);
+                    D0_MIN, Lnorm, d0, score_d8, ws);
                 if (TM>TMmax)
                 {
                     TMmax = TM;
@@ -3352,11 +3527,9 @@ int TMalign_main(double **xa, double **ya,
             double TMtmp=approx_TM(xlen, ylen, a_opt,
                 xa, ya, t0, u0, invmap0, mol_type);
 
-            if (TMtmp<0.54*TMcut)
+            if (TMcut_prune(TMtmp, TMcut, 2))
             {
                 TM1=TM2=TM3=TM4=TM5=TMtmp;
-                clean_up_after_approx_TM(invmap0, invmap, score, path, val,
-                    xtm, ytm, xt, r1, r2, xlen, minlen);
                 return 4;
             }
         }
@@ -3367,9 +3540,9 @@ int TMalign_main(double **xa, double **ya,
         //=initial3 in original TM-align
         get_initial_ssplus(r1, r2, score, path, val, secx, secy, xa, ya,
             xlen, ylen, invmap0, invmap, D0_MIN, d0);
-        TM = detailed_search(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen, invmap,
+        TM = detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen, invmap,
              t, u, simplify_step, score_sum_method, local_d0_search, Lnorm,
-             score_d8, d0);
+             score_d8, d0, ws);
         if (TM>TMmax)
         {
             TMmax = TM;
@@ -3378,9 +3551,9 @@ int TMalign_main(double **xa, double **ya,
         }
         if (TM > TMmax*ddcc)
         {
-            TM = DP_iter(r1, r2, xtm, ytm, xt, path, val, xa, ya,
+            TM = DP_iter(r1, r2, xtm, ytm, path, val, xa, ya,
                 xlen, ylen, t, u, invmap, 0, 2, (fast_opt)?2:30,
-                local_d0_search, D0_MIN, Lnorm, d0, score_d8);
+                local_d0_search, D0_MIN, Lnorm, d0, score_d8, ws);
             if (TM>TMmax)
             {
                 TMmax = TM;
@@ -3394,11 +3567,9 @@ int TMalign_main(double **xa, double **ya,
             double TMtmp=approx_TM(xlen, ylen, a_opt,
                 xa, ya, t0, u0, invmap0, mol_type);
 
-            if (TMtmp<0.56*TMcut)
+            if (TMcut_prune(TMtmp, TMcut, 3))
             {
                 TM1=TM2=TM3=TM4=TM5=TMtmp;
-                clean_up_after_approx_TM(invmap0, invmap, score, path, val,
-                    xtm, ytm, xt, r1, r2, xlen, minlen);
                 return 5;
             }
         }
@@ -3409,9 +3580,9 @@ int TMalign_main(double **xa, double **ya,
         //=initial4 in original TM-align
         get_initial_fgt(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
             invmap, d0, d0_search, dcu0, fast_opt, t, u);
-        TM = detailed_search(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen, invmap,
+        TM = detailed_search(r1, r2, xtm, ytm, xa, ya, xlen, ylen, invmap,
             t, u, simplify_step, score_sum_method, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         if (TM>TMmax)
         {
             TMmax = TM;
@@ -3420,9 +3591,9 @@ int TMalign_main(double **xa, double **ya,
         }
         if (TM > TMmax*ddcc)
         {
-            TM = DP_iter(r1, r2, xtm, ytm, xt, path, val, xa, ya,
+            TM = DP_iter(r1, r2, xtm, ytm, path, val, xa, ya,
                 xlen, ylen, t, u, invmap, 1, 2, 2, local_d0_search, D0_MIN,
-                Lnorm, d0, score_d8);
+                Lnorm, d0, score_d8, ws);
             if (TM>TMmax)
             {
                 TMmax = TM;
@@ -3436,11 +3607,9 @@ int TMalign_main(double **xa, double **ya,
             double TMtmp=approx_TM(xlen, ylen, a_opt,
                 xa, ya, t0, u0, invmap0, mol_type);
 
-            if (TMtmp<0.58*TMcut)
+            if (TMcut_prune(TMtmp, TMcut, 4))
             {
                 TM1=TM2=TM3=TM4=TM5=TMtmp;
-                clean_up_after_approx_TM(invmap0, invmap, score, path, val,
-                    xtm, ytm, xt, r1, r2, xlen, minlen);
                 return 6;
             }
         }
@@ -3475,25 +3644,25 @@ int TMalign_main(double **xa, double **ya,
         double prevD0_MIN = D0_MIN;// stored for later use
         int prevLnorm = Lnorm;
         double prevd0 = d0;
-        TM_ali = standard_TMscore(r1, r2, xtm, ytm, xt, xa, ya,
+        TM_ali = standard_TMscore(r1, r2, xtm, ytm, xa, ya,
             xlen, ylen, invmap, L_ali, rmsd_ali, D0_MIN, Lnorm, d0,
-            d0_search, score_d8, t, u, mol_type);
+            d0_search, score_d8, t, u, mol_type, ws);
         D0_MIN = prevD0_MIN;
         Lnorm = prevLnorm;
         d0 = prevd0;
 
-        TM = detailed_search_standard(r1, r2, xtm, ytm, xt, xa, ya,
+        TM = detailed_search_standard(r1, r2, xtm, ytm, xa, ya,
             xlen, ylen, invmap, t, u, 40, 8, local_d0_search, true, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         if (TM > TMmax)
         {
             TMmax = TM;
             for (i = 0; i<ylen; i++) invmap0[i] = invmap[i];
         }
         // Different from get_initial, get_initial_ss and get_initial_ssplus
-        TM = DP_iter(r1, r2, xtm, ytm, xt, path, val, xa, ya,
+        TM = DP_iter(r1, r2, xtm, ytm, path, val, xa, ya,
             xlen, ylen, t, u, invmap, 0, 2, (fast_opt)?2:30,
-            local_d0_search, D0_MIN, Lnorm, d0, score_d8);
+            local_d0_search, D0_MIN, Lnorm, d0, score_d8, ws);
         if (TM>TMmax)
         {
             TMmax = TM;
@@ -3530,11 +3699,9 @@ int TMalign_main(double **xa, double **ya,
         double TMtmp=approx_TM(xlen, ylen, a_opt,
             xa, ya, t0, u0, invmap0, mol_type);
 
-        if (TMtmp<0.6*TMcut)
+        if (TMcut_prune(TMtmp, TMcut, 5))
         {
             TM1=TM2=TM3=TM4=TM5=TMtmp;
-            clean_up_after_approx_TM(invmap0, invmap, score, path, val,
-                xtm, ytm, xt, r1, r2, xlen, minlen);
             return 7;
         }
     }
@@ -3547,16 +3714,16 @@ int TMalign_main(double **xa, double **ya,
     simplify_step=1;
     if (fast_opt) simplify_step=40;
     score_sum_method=8;
-    TM = detailed_search_standard(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
+    TM = detailed_search_standard(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
         invmap0, t, u, simplify_step, score_sum_method, local_d0_search,
-        false, Lnorm, score_d8, d0);
+        false, Lnorm, score_d8, d0, ws);
 
     //select pairs with dis<d8 for final TMscore computation and output alignment
     int k=0;
     int *m1, *m2;
     double d;
-    m1=new int[xlen]; //alignd index in x
-    m2=new int[ylen]; //alignd index in y
+    m1=ws->m1.get(xlen); //alignd index in x
+    m2=ws->m2.get(ylen); //alignd index in y
     do_rotation(xa, xt, xlen, t, u);
     k=0;
     for(int j=0; j<ylen; j++)
@@ -3611,16 +3778,16 @@ int TMalign_main(double **xa, double **ya,
     d0A=d0;
     d0_0=d0A;
     local_d0_search = d0_search;
-    TM1 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0, simplify_step,
-        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0);
+    TM1 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0, simplify_step,
+        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0, ws);
     TM_0 = TM1;
 
     //normalized by length of structure B
     parameter_set4final(xlen+0.0, D0_MIN, Lnorm, d0, d0_search, mol_type);
     d0B=d0;
     local_d0_search = d0_search;
-    TM2 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t, u, simplify_step,
-        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0);
+    TM2 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t, u, simplify_step,
+        score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0, ws);
 
     double Lnorm_d0;
     if (a_opt>0)
@@ -3632,9 +3799,9 @@ int TMalign_main(double **xa, double **ya,
         d0_0=d0a;
         local_d0_search = d0_search;
 
-        TM3 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM3 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM3;
     }
     if (u_opt)
@@ -3646,9 +3813,9 @@ int TMalign_main(double **xa, double **ya,
         d0_0=d0u;
         Lnorm_0=Lnorm_ass;
         local_d0_search = d0_search;
-        TM4 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM4 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM4;
     }
     if (d_opt)
@@ -3660,9 +3827,9 @@ int TMalign_main(double **xa, double **ya,
         //Lnorm_0=ylen;
         Lnorm_d0=Lnorm_0;
         local_d0_search = d0_search;
-        TM5 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM5 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM5;
     }
 
@@ -3740,16 +3907,12 @@ int TMalign_main(double **xa, double **ya,
     seqyA=seqyA.substr(0,kk);
     seqM =seqM.substr(0,kk);
 
-    /* free memory */
-    clean_up_after_approx_TM(invmap0, invmap, score, path, val,
-        xtm, ytm, xt, r1, r2, xlen, minlen);
-    delete [] m1;
-    delete [] m2;
     return 0; // zero for no exception
 }
 
 /* entry function for TM-align with circular permutation
- * i_opt, a_opt, u_opt, d_opt, TMcut are not implemented yet */
+ * i_opt, a_opt, u_opt, d_opt are not implemented yet. TMcut is only used
+ * by the final alignment, whose TMalign_main return value is returned */
 int CPalign_main(double **xa, double **ya,
     const char *seqx, const char *seqy, const char *secx, const char *secy,
     double t0[3], double u0[3][3],
@@ -3763,7 +3926,7 @@ int CPalign_main(double **xa, double **ya,
     const vector<string> sequence, const double Lnorm_ass,
     const double d0_scale, const int i_opt, const int a_opt,
     const bool u_opt, const bool d_opt, const bool fast_opt,
-    const int mol_type, const double TMcut=-1)
+    const int mol_type, const double TMcut=-1, AlignWorkspace *ws=NULL)
 {
     char   *seqx_cp; // for the protein sequence 
     char   *secx_cp; // for the secondary structure 
@@ -3797,7 +3960,7 @@ int CPalign_main(double **xa, double **ya,
         d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out, seqM, seqxA_cp, seqyA_cp,
         do_vec, rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
         xlen*2, ylen, sequence, Lnorm_tmp, d0_scale,
-        0, false, true, false, true, mol_type, -1);
+        0, false, true, false, true, mol_type, -1, ws);
 
     /* delete gap in seqxA_cp */
     r=0;
@@ -3842,7 +4005,7 @@ int CPalign_main(double **xa, double **ya,
         d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out, seqM, seqxA, seqyA,
         do_vec, rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
         xlen, ylen, sequence, Lnorm_tmp, d0_scale,
-        0, false, true, false, true, mol_type, -1);
+        0, false, true, false, true, mol_type, -1, ws);
 
     /* do not use circular permutation of number of aligned residues is not
      * larger than sequence-order dependent alignment */
@@ -3878,7 +4041,7 @@ int CPalign_main(double **xa, double **ya,
             d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out, seqM, seqxA_cp, seqyA_cp,
             do_vec, rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, cp_aln_best,
             xlen, ylen, sequence, Lnorm_tmp, d0_scale,
-            0, false, true, false, true, mol_type, -1);
+            0, false, true, false, true, mol_type, -1, ws);
         //cout<<"cp: aln="<<cp_aln_best<<"\tTM="<<TM4_cp<<endl;
         if (n_ali8>=cp_aln_best || TM4>=TM4_cp)
         {
@@ -3895,12 +4058,12 @@ int CPalign_main(double **xa, double **ya,
     }
 
     /* full TM-align */
-    TMalign_main(xa_cp, ya, seqx_cp, seqy, secx_cp, secy,
+    int status=TMalign_main(xa_cp, ya, seqx_cp, seqy, secx_cp, secy,
         t0, u0, TM1, TM2, TM3, TM4, TM5,
         d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out, seqM, seqxA_cp, seqyA_cp,
         do_vec, rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
         xlen, ylen, sequence, Lnorm_ass, d0_scale,
-        i_opt, a_opt, u_opt, d_opt, fast_opt, mol_type, TMcut);
+        i_opt, a_opt, u_opt, d_opt, fast_opt, mol_type, TMcut, ws);
 
     /* correct alignment
      * r - residue index in the original unaligned sequence 
@@ -3933,7 +4096,7 @@ int CPalign_main(double **xa, double **ya,
     DeleteArray(&xa_cp,xlen*2);
     seqxA_cp.clear();
     seqyA_cp.clear();
-    return cp_point;
+    return status;
 }
 
 bool output_cp(const string&xname, const string&yname,
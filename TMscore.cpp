@@ -1,4 +1,5 @@
 #include "TMscore.h"
+#include "struct_db.h"
 
 using namespace std;
 
@@ -86,6 +87,9 @@ void print_extra_help()
 "             1: SPICKER format\n"
 "             2: xyz format\n"
 "             3: PDBx/mmCIF format\n"
+"             4: binary structure database built by pdb2db. Structures are\n"
+"                listed by -dir, -dir1 or -dir2, or all structures of the\n"
+"                database are used if it is given as chain1 or chain2\n"
     <<endl;
 }
 
@@ -365,14 +369,50 @@ int main(int argc, char *argv[])
     if (m_opt && fname_matrix == "") // Output rotation matrix: matrix.txt
         PrintErrorAndQuit("ERROR! Please provide a file name for option -m!");
 
+    /* -infmt 4 reads structures from a database built by pdb2db. A
+     * database given as structure_1 or structure_2 is compared as if all
+     * its structures were listed by -dir1 or -dir2 */
+    StructDB db1, db2;
+    if (infmt1_opt==4 || infmt2_opt==4)
+    {
+        if (m_opt || o_opt)
+            PrintErrorAndQuit("ERROR! -infmt1 4 and -infmt2 4 cannot be used with -m or -o");
+        if (suffix_opt.size())
+            PrintErrorAndQuit("ERROR! -infmt1 4 and -infmt2 4 cannot be used with -suffix");
+        if (dir_opt.size() && infmt1_opt!=infmt2_opt)
+            PrintErrorAndQuit("ERROR! -dir needs -infmt1 4 and -infmt2 4");
+        if (infmt1_opt==4)
+        {
+            if (dir_opt.size()+dir1_opt.size()==0)
+            {
+                dir1_opt=xname;
+                xname.clear();
+            }
+            if (!db1.open(dir_opt+dir1_opt)) PrintErrorAndQuit(
+                "ERROR! Cannot read structure database "+dir_opt+dir1_opt);
+        }
+        if (infmt2_opt==4)
+        {
+            if (dir_opt.size()+dir2_opt.size()==0)
+            {
+                dir2_opt=yname;
+                yname.clear();
+            }
+            if (!db2.open(dir_opt+dir2_opt)) PrintErrorAndQuit(
+                "ERROR! Cannot read structure database "+dir_opt+dir2_opt);
+        }
+    }
+
     /* parse file list */
     if (dir1_opt.size()+dir_opt.size()==0) chain1_list.push_back(xname);
+    else if (infmt1_opt==4) db2chainlist(chain1_list, xname, db1);
     else file2chainlist(chain1_list, xname, dir_opt+dir1_opt, suffix_opt);
 
     if (dir_opt.size())
         for (int i=0;i<chain1_list.size();i++)
             chain2_list.push_back(chain1_list[i]);
     else if (dir2_opt.size()==0) chain2_list.push_back(yname);
+    else if (infmt2_opt==4) db2chainlist(chain2_list, yname, db2);
     else file2chainlist(chain2_list, yname, dir2_opt, suffix_opt);
 
     if (byresi_opt>=4)
@@ -385,8 +425,8 @@ int main(int argc, char *argv[])
             <<"RMSD\tID1\tID2\tIDali\tL1\tL2\tLali"<<endl;
 
     /* declare previously global variables */
-    vector<vector<string> >PDB_lines1; // text of chain1
-    vector<vector<string> >PDB_lines2; // text of chain2
+    vector<PDBChain> PDB_lines1; // residues of chain1
+    vector<PDBChain> PDB_lines2; // residues of chain2
     vector<int> mol_vec1;              // molecule type of chain1, RNA if >0
     vector<int> mol_vec2;              // molecule type of chain2, RNA if >0
     vector<string> chainID_list1;      // list of chainID1
@@ -403,15 +443,23 @@ int main(int argc, char *argv[])
                                // --> superpose xa onto ya
     vector<string> resi_vec1;  // residue index for chain1
     vector<string> resi_vec2;  // residue index for chain2
+    vector<size_t> db_chain1;  // chain index in db1 for -infmt1 4
+    vector<size_t> db_chain2;  // chain index in db2 for -infmt2 4
 
     /* loop over file names */
     for (i=0;i<chain1_list.size();i++)
     {
         /* parse chain 1 */
         xname=chain1_list[i];
-        xchainnum=get_PDB_lines(xname, PDB_lines1, chainID_list1, mol_vec1,
-            ter_opt, infmt1_opt, atom_opt, autojustify, split_opt, het_opt,
-            chain2parse1, model2parse1);
+        if (infmt1_opt==4)
+        {
+            xchainnum=db1.get_chains(xname, db_chain1, chainID_list1,
+                mol_vec1);
+            PDB_lines1.resize(xchainnum);
+        }
+        else xchainnum=get_PDB_lines(xname, PDB_lines1, chainID_list1,
+            mol_vec1, ter_opt, infmt1_opt, atom_opt, autojustify, split_opt,
+            het_opt, chain2parse1, model2parse1);
         if (!xchainnum)
         {
             cerr<<"Warning! Cannot parse file: "<<xname
@@ -420,7 +468,8 @@ int main(int argc, char *argv[])
         }
         for (chain_i=0;chain_i<xchainnum;chain_i++)
         {
-            xlen=PDB_lines1[chain_i].size();
+            xlen=(infmt1_opt==4)?db1.get_len(db_chain1[chain_i]):
+                PDB_lines1[chain_i].size();
             if (mol_opt=="RNA") mol_vec1[chain_i]=1;
             else if (mol_opt=="protein") mol_vec1[chain_i]=-1;
             if (!xlen)
@@ -436,7 +485,9 @@ int main(int argc, char *argv[])
             }
             NewArray(&xa, xlen, 3);
             seqx = new char[xlen + 1];
-            xlen = read_PDB(PDB_lines1[chain_i], xa, seqx, 
+            if (infmt1_opt==4) xlen = db1.read_chain(db_chain1[chain_i],
+                xa, seqx, NULL, resi_vec1, byresi_opt);
+            else xlen = read_PDB(PDB_lines1[chain_i], xa, seqx, 
                 resi_vec1, byresi_opt);
             if (mirror_opt) for (r=0;r<xlen;r++) xa[r][2]=-xa[r][2];
 
@@ -446,9 +497,17 @@ int main(int argc, char *argv[])
                 if (PDB_lines2.size()==0)
                 {
                     yname=chain2_list[j];
-                    ychainnum=get_PDB_lines(yname, PDB_lines2, chainID_list2,
-                        mol_vec2, ter_opt, infmt2_opt, atom_opt, autojustify,
-                        split_opt, het_opt, chain2parse2, model2parse2);
+                    if (infmt2_opt==4)
+                    {
+                        db_chain2.clear();
+                        ychainnum=db2.get_chains(yname, db_chain2,
+                            chainID_list2, mol_vec2);
+                        PDB_lines2.resize(ychainnum);
+                    }
+                    else ychainnum=get_PDB_lines(yname, PDB_lines2,
+                        chainID_list2, mol_vec2, ter_opt, infmt2_opt,
+                        atom_opt, autojustify, split_opt, het_opt,
+                        chain2parse2, model2parse2);
                     if (!ychainnum)
                     {
                         cerr<<"Warning! Cannot parse file: "<<yname
@@ -458,7 +517,8 @@ int main(int argc, char *argv[])
                 }
                 for (chain_j=0;chain_j<ychainnum;chain_j++)
                 {
-                    ylen=PDB_lines2[chain_j].size();
+                    ylen=(infmt2_opt==4)?db2.get_len(db_chain2[chain_j]):
+                        PDB_lines2[chain_j].size();
                     if (mol_opt=="RNA") mol_vec2[chain_j]=1;
                     else if (mol_opt=="protein") mol_vec2[chain_j]=-1;
                     if (!ylen)
@@ -474,7 +534,10 @@ int main(int argc, char *argv[])
                     }
                     NewArray(&ya, ylen, 3);
                     seqy = new char[ylen + 1];
-                    ylen = read_PDB(PDB_lines2[chain_j], ya, seqy,
+                    if (infmt2_opt==4) ylen = db2.read_chain(
+                        db_chain2[chain_j], ya, seqy, NULL, resi_vec2,
+                        byresi_opt);
+                    else ylen = read_PDB(PDB_lines2[chain_j], ya, seqy,
                         resi_vec2, byresi_opt);
 
                     if (byresi_opt) extract_aln_from_resi(sequence,
@@ -560,6 +623,7 @@ int main(int argc, char *argv[])
         PDB_lines1.clear();
         chainID_list1.clear();
         mol_vec1.clear();
+        db_chain1.clear();
     } // i
     if (chain2_list.size()==1)
     {
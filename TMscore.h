@@ -144,10 +144,65 @@ int score_fun8_standard(double **xa, double **ya, int n_ali, double d,
     return n_cut;
 }
 
+/* GDT and maxsub counts of squared distances di[0..n_ali-1] */
+void score_GDT_maxsub(const double *di, int n_ali,
+    double GDT_list_tmp[5], double &maxsub_tmp)
+{
+    int i;
+    for (i=0;i<5;i++) GDT_list_tmp[i]=0;
+    maxsub_tmp=0;
+    for (i=0;i<n_ali;i++)
+    {
+        if (di[i]<64) // 8*8=64
+        {
+            GDT_list_tmp[4]+=1;
+            if (di[i]<16) // 4*4=16
+            {
+                GDT_list_tmp[3]+=1;
+                if (di[i]<12.25) // 3.5^2=12.25
+                {
+                    maxsub_tmp+=1/(1+di[i]/12.25);
+                    if (di[i]<4) // 2*2=4
+                    {
+                        GDT_list_tmp[2]+=1;
+                        if (di[i]<1) // 1*1=1
+                        {
+                            GDT_list_tmp[1]+=1;
+                            if (di[i]<0.25) // 0.5*0.5=0.25
+                                GDT_list_tmp[0]+=1;
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/* same as score_fun8 with GDT and maxsub, but for squared distances di and
+ * TM-score terms term computed by rotate_score8 */
+int score_fun8(const double *di, const double *term, int n_ali, double d,
+    int i_ali[], double *score1, const double Lnorm,
+    double GDT_list_tmp[5], double &maxsub_tmp)
+{
+    int n_cut=score_fun8(di, term, n_ali, d, i_ali, score1, Lnorm);
+    score_GDT_maxsub(di, n_ali, GDT_list_tmp, maxsub_tmp);
+    return n_cut;
+}
+
+int score_fun8_standard(const double *di, const double *term, int n_ali,
+    double d, int i_ali[], double *score1,
+    double GDT_list_tmp[5], double &maxsub_tmp)
+{
+    int n_cut=score_fun8_standard(di, term, n_ali, d, i_ali, score1);
+    score_GDT_maxsub(di, n_ali, GDT_list_tmp, maxsub_tmp);
+    return n_cut;
+}
+
 double TMscore8_search(double **r1, double **r2, double **xtm, double **ytm,
-    double **xt, int Lali, double t0[3], double u0[3][3], int simplify_step,
+    int Lali, double t0[3], double u0[3][3], int simplify_step,
     int score_sum_method, double *Rcomm, double local_d0_search, double Lnorm,
-    double score_d8, double d0, double GDT_list[5], double &maxsub)
+    double score_d8, double d0, double GDT_list[5], double &maxsub,
+    AlignWorkspace *ws=NULL)
 {
     double GDT_list_tmp[5]={0,0,0,0,0};
     double maxsub_tmp=0;
@@ -158,6 +213,14 @@ double TMscore8_search(double **r1, double **r2, double **xtm, double **ytm,
     double t[3];
     double u[3][3];
     double d;
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
+    double **soa=ws->soa.get(8, Lali); // xtm and ytm in SoA layout, scores
+    coord2soa(xtm, Lali, soa);
+    coord2soa(ytm, Lali, soa+3);
+    double **P=ws->moments.get(Lali+2, 17); // prefix sums of the moments
+    Kabsch_prefix(xtm, ytm, Lali, P);
+    KabschMoments mom;
     
 
     //iterative parameters
@@ -203,28 +266,21 @@ double TMscore8_search(double **r1, double **r2, double **xtm, double **ytm,
             for(k=0; k<L_frag; k++)
             {
                 int kk=k+i;
-                r1[k][0]=xtm[kk][0];  
-                r1[k][1]=xtm[kk][1]; 
-                r1[k][2]=xtm[kk][2];   
-                
-                r2[k][0]=ytm[kk][0];  
-                r2[k][1]=ytm[kk][1]; 
-                r2[k][2]=ytm[kk][2];
-                
                 k_ali[ka]=kk;
                 ka++;
             }
             
             //extract rotation matrix based on the fragment
-            Kabsch(r1, r2, L_frag, 1, &rmsd, t, u);
+            get_Kabsch_moments(P, Lali, i, L_frag, mom);
+            Kabsch(mom, 1, &rmsd, t, u);
             if (simplify_step != 1)
                 *Rcomm = 0;
-            do_rotation(xtm, xt, Lali, t, u);
+            rotate_score8(soa, soa+3, Lali, t, u, score_sum_method,
+                score_d8, d0, soa[6], soa[7]);
             
             //get subsegment of this fragment
             d = local_d0_search - 1;
-            n_cut=score_fun8(xt, ytm, Lali, d, i_ali, &score, 
-                score_sum_method, Lnorm, score_d8, d0, 
+            n_cut=score_fun8(soa[6], soa[7], Lali, d, i_ali, &score, Lnorm,
                 GDT_list_tmp, maxsub_tmp);
             if(score>score_max)
             {
@@ -265,9 +321,10 @@ double TMscore8_search(double **r1, double **r2, double **xtm, double **ytm,
                 } 
                 //extract rotation matrix based on the fragment                
                 Kabsch(r1, r2, n_cut, 1, &rmsd, t, u);
-                do_rotation(xtm, xt, Lali, t, u);
-                n_cut=score_fun8(xt, ytm, Lali, d, i_ali, &score, 
-                    score_sum_method, Lnorm, score_d8, d0);
+                rotate_score8(soa, soa+3, Lali, t, u, score_sum_method,
+                    score_d8, d0, soa[6], soa[7]);
+                n_cut=score_fun8(soa[6], soa[7], Lali, d, i_ali, &score,
+                    Lnorm);
                 if(score>score_max)
                 {
                     score_max=score;
@@ -311,10 +368,10 @@ double TMscore8_search(double **r1, double **r2, double **xtm, double **ytm,
 
 
 double TMscore8_search_standard( double **r1, double **r2,
-    double **xtm, double **ytm, double **xt, int Lali,
+    double **xtm, double **ytm, int Lali,
     double t0[3], double u0[3][3], int simplify_step, int score_sum_method,
     double *Rcomm, double local_d0_search, double score_d8, double d0,
-    double GDT_list[5], double &maxsub)
+    double GDT_list[5], double &maxsub, AlignWorkspace *ws=NULL)
 {
     double GDT_list_tmp[5]={0,0,0,0,0};
     double maxsub_tmp=0;
@@ -325,6 +382,14 @@ double TMscore8_search_standard( double **r1, double **r2,
     double t[3];
     double u[3][3];
     double d;
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
+    double **soa=ws->soa.get(8, Lali); // xtm and ytm in SoA layout, scores
+    coord2soa(xtm, Lali, soa);
+    coord2soa(ytm, Lali, soa+3);
+    double **P=ws->moments.get(Lali+2, 17); // prefix sums of the moments
+    Kabsch_prefix(xtm, ytm, Lali, P);
+    KabschMoments mom;
 
     //iterative parameters
     int n_it = 20;            //maximum number of iterations
@@ -369,27 +434,21 @@ double TMscore8_search_standard( double **r1, double **r2,
             for (k = 0; k<L_frag; k++)
             {
                 int kk = k + i;
-                r1[k][0] = xtm[kk][0];
-                r1[k][1] = xtm[kk][1];
-                r1[k][2] = xtm[kk][2];
-
-                r2[k][0] = ytm[kk][0];
-                r2[k][1] = ytm[kk][1];
-                r2[k][2] = ytm[kk][2];
-
                 k_ali[ka] = kk;
                 ka++;
             }
             //extract rotation matrix based on the fragment
-            Kabsch(r1, r2, L_frag, 1, &rmsd, t, u);
+            get_Kabsch_moments(P, Lali, i, L_frag, mom);
+            Kabsch(mom, 1, &rmsd, t, u);
             if (simplify_step != 1)
                 *Rcomm = 0;
-            do_rotation(xtm, xt, Lali, t, u);
+            rotate_score8(soa, soa+3, Lali, t, u, score_sum_method,
+                score_d8, d0, soa[6], soa[7]);
 
             //get subsegment of this fragment
             d = local_d0_search - 1;
-            n_cut = score_fun8_standard(xt, ytm, Lali, d, i_ali, &score,
-                score_sum_method, score_d8, d0, GDT_list_tmp, maxsub_tmp);
+            n_cut = score_fun8_standard(soa[6], soa[7], Lali, d, i_ali,
+                &score, GDT_list_tmp, maxsub_tmp);
 
             if (score>score_max)
             {
@@ -430,9 +489,10 @@ double TMscore8_search_standard( double **r1, double **r2,
                 }
                 //extract rotation matrix based on the fragment                
                 Kabsch(r1, r2, n_cut, 1, &rmsd, t, u);
-                do_rotation(xtm, xt, Lali, t, u);
-                n_cut = score_fun8_standard(xt, ytm, Lali, d, i_ali, &score,
-                    score_sum_method, score_d8, d0, GDT_list_tmp, maxsub_tmp);
+                rotate_score8(soa, soa+3, Lali, t, u, score_sum_method,
+                    score_d8, d0, soa[6], soa[7]);
+                n_cut = score_fun8_standard(soa[6], soa[7], Lali, d, i_ali,
+                    &score, GDT_list_tmp, maxsub_tmp);
                 if (score>score_max)
                 {
                     score_max = score;
@@ -475,11 +535,11 @@ double TMscore8_search_standard( double **r1, double **r2,
 }
 
 double detailed_search_standard( double **r1, double **r2,
-    double **xtm, double **ytm, double **xt, double **x, double **y,
+    double **xtm, double **ytm, double **x, double **y,
     int xlen, int ylen, int invmap0[], double t[3], double u[3][3],
     int simplify_step, int score_sum_method, double local_d0_search,
     const bool& bNormalize, double Lnorm, double score_d8, double d0,
-    double GDT_list[5], double &maxsub)
+    double GDT_list[5], double &maxsub, AlignWorkspace *ws=NULL)
 {
     //x is model, y is template, try to superpose onto y
     int i, j, k;     
@@ -504,9 +564,9 @@ double detailed_search_standard( double **r1, double **r2,
     }
 
     //detailed search 40-->1
-    tmscore = TMscore8_search_standard( r1, r2, xtm, ytm, xt, k, t, u,
+    tmscore = TMscore8_search_standard( r1, r2, xtm, ytm, k, t, u,
         simplify_step, score_sum_method, &rmsd, local_d0_search, score_d8, d0,
-        GDT_list, maxsub);
+        GDT_list, maxsub, ws);
     if (bNormalize)// "-i", to use standard_TMscore, then bNormalize=true, else bNormalize=false; 
         tmscore = tmscore * k / Lnorm;
 
@@ -530,25 +590,27 @@ int TMscore_main(double **xa, double **ya,
     const double d0_scale, const int a_opt,
     const bool u_opt, const bool d_opt, const bool fast_opt,
     const int mol_type, double GDT_list[5], double &maxsub,
-    const double TMcut=-1)
+    const double TMcut=-1, AlignWorkspace *ws=NULL)
 {
     double D0_MIN;        //for d0
     double Lnorm;         //normalization length
     double score_d8,d0,d0_search,dcu0;//for TMscore search
     double t[3], u[3][3]; //Kabsch translation vector and rotation matrix
     double **score;       // Input score table for dynamic programming
-    bool   **path;        // for dynamic programming  
+    PathMatrix path;      // for dynamic programming  
     double **val;         // for dynamic programming  
     double **xtm, **ytm;  // for TMscore search engine
     double **xt;          //for saving the superposed version of r_1 or xtm
     double **r1, **r2;    // for Kabsch rotation
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
 
     /***********************/
     /* allocate memory     */
     /***********************/
     int minlen = min(xlen, ylen);
     NewArray(&score, xlen+1, ylen+1);
-    NewArray(&path, xlen+1, ylen+1);
+    path.get(xlen+1, ylen+1);
     NewArray(&val, xlen+1, ylen+1);
     NewArray(&xtm, minlen, 3);
     NewArray(&ytm, minlen, 3);
@@ -600,14 +662,15 @@ int TMscore_main(double **xa, double **ya,
     double prevD0_MIN = D0_MIN;// stored for later use
     int prevLnorm = Lnorm;
     double prevd0 = d0;
-    TM_ali = standard_TMscore(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
+    TM_ali = standard_TMscore(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
         invmap, L_ali, rmsd_ali, D0_MIN, Lnorm, d0, d0_search, score_d8,
-        t, u, mol_type);
+        t, u, mol_type, ws);
     D0_MIN = prevD0_MIN;
     Lnorm = prevLnorm;
     d0 = prevd0;
-    TM = detailed_search_standard(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
-        invmap, t, u, 40, 8, local_d0_search, true, Lnorm, score_d8, d0);
+    TM = detailed_search_standard(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
+        invmap, t, u, 40, 8, local_d0_search, true, Lnorm, score_d8, d0,
+        ws);
     if (TM > TMmax)
     {
         TMmax = TM;
@@ -657,10 +720,10 @@ int TMscore_main(double **xa, double **ya,
     simplify_step=1;
     if (fast_opt) simplify_step=40;
     score_sum_method=8;
-    TM = detailed_search_standard(r1, r2, xtm, ytm, xt, xa, ya, xlen, ylen,
+    TM = detailed_search_standard(r1, r2, xtm, ytm, xa, ya, xlen, ylen,
         invmap0, t, u, simplify_step, score_sum_method, local_d0_search,
         false, Lnorm, score_d8, d0,
-        GDT_list, maxsub);
+        GDT_list, maxsub, ws);
 
     //select pairs with dis<d8 for final TMscore computation and output alignment
     int k=0;
@@ -719,9 +782,9 @@ int TMscore_main(double **xa, double **ya,
     d0A=d0;
     d0_0=d0A;
     local_d0_search = d0_search;
-    TM1 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0, simplify_step,
+    TM1 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0, simplify_step,
         score_sum_method, &rmsd, local_d0_search, Lnorm, score_d8, d0,
-        GDT_list, maxsub);
+        GDT_list, maxsub, ws);
     TM_0 = TM1;
 
     double Lnorm_d0;
@@ -734,9 +797,9 @@ int TMscore_main(double **xa, double **ya,
         d0_0=d0a;
         local_d0_search = d0_search;
 
-        TM3 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM3 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM3;
     }
     if (u_opt)
@@ -748,9 +811,9 @@ int TMscore_main(double **xa, double **ya,
         d0_0=d0u;
         Lnorm_0=Lnorm_ass;
         local_d0_search = d0_search;
-        TM4 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM4 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM4;
     }
     if (d_opt)
@@ -762,9 +825,9 @@ int TMscore_main(double **xa, double **ya,
         //Lnorm_0=ylen;
         Lnorm_d0=Lnorm_0;
         local_d0_search = d0_search;
-        TM5 = TMscore8_search(r1, r2, xtm, ytm, xt, n_ali8, t0, u0,
+        TM5 = TMscore8_search(r1, r2, xtm, ytm, n_ali8, t0, u0,
             simplify_step, score_sum_method, &rmsd, local_d0_search, Lnorm,
-            score_d8, d0);
+            score_d8, d0, ws);
         TM_0=TM5;
     }
 
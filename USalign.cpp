@@ -3,6 +3,8 @@
 #include "MMalign.h"
 #include "SOIalign.h"
 #include "flexalign.h"
+#include "thread_pool.h"
+#include "struct_db.h"
 
 using namespace std;
 
@@ -51,6 +53,43 @@ void print_extra_help()
 " -suffix  (Only when -dir1 and/or -dir2 are set, default is empty)\n"
 "          add file name suffix to files listed by chain1_list or chain2_list\n"
 "\n"
+"      -t  Number of threads (default 1). For -dir, -dir1 and -dir2,\n"
+"          structure pairs are aligned in parallel but printed in the same\n"
+"          order as with one thread, which is currently only used for\n"
+"          -mm 0. Otherwise, the initial alignments of each structure pair\n"
+"          are searched in parallel, which gives the same result as with\n"
+"          one thread\n"
+"\n"
+"   -topk  (Only for -dir, -dir1 and -dir2) print only the K structure\n"
+"          pairs with the highest TM-score, normalized as set by -a, from\n"
+"          the highest to the lowest. Once K pairs are found, the K-th\n"
+"          highest TM-score is used as -TMcut for the remaining pairs.\n"
+"          The N-th pair uses the K-th highest TM-score of the first\n"
+"          N-1024 pairs, so that the result does not depend on -t.\n"
+"          $ USalign chain1 -dir2 chain2_folder/ chain2_list -topk 10\n"
+"\n"
+"     -dp  Order in which the dynamic programming matrix is filled\n"
+"           0: (default) row by row\n"
+"           1: by anti-diagonals (wavefront), which is faster for long\n"
+"              chains and gives the same alignment as 0\n"
+"          Only USalign has this option. TMalign, MMalign and SE always\n"
+"          use 0.\n"
+"\n"
+" -kabsch  Algorithm for the optimal superposition of residue pairs\n"
+"           0: (default) eigen-decomposition as in TM-align\n"
+"           1: quaternion characteristic polynomial (QCP), which may\n"
+"              differ from 0 in the last digits of TM-score\n"
+"          Only USalign has this option. Other programs always use 0.\n"
+"          'make check' runs KabschCheck, which compares 1 with 0.\n"
+"\n"
+"   -simd  SIMD kernel of the TM-score search engine\n"
+"          -1: (default) the fastest kernel supported by the CPU\n"
+"           0: scalar\n"
+"           1: AVX2\n"
+"           2: AVX-512\n"
+"          All kernels give the same result. If the CPU does not support\n"
+"          the requested kernel, the fastest supported one is used.\n"
+"\n"
 "   -atom  4-character atom name used to represent a residue.\n"
 "          Default is \" C3'\" for RNA/DNA and \" CA \" for proteins\n"
 "          (note the spaces before and after CA).\n"
@@ -76,6 +115,16 @@ void print_extra_help()
 "           0: (default, same as F) normalized by second structure\n"
 "           1: same as T, normalized by average structure length\n"
 "\n"
+"-TMcut_policy  When to stop aligning a structure pair for -TMcut.\n"
+"          After each initial alignment, the pair is stopped if its\n"
+"          approximate TM-score is below TMcut times a factor of this stage\n"
+"           0: (default) factors 0.50 0.52 0.54 0.56 0.58 0.60 of TM-align\n"
+"           1: conservative, each factor minus 0.1\n"
+"           2: aggressive, each factor plus 0.1\n"
+"          Otherwise, a file of six factors, e.g., calibrated on your own\n"
+"          benchmark set. For -dir, -dir1 and -dir2, the number of pairs\n"
+"          stopped at each stage is printed to standard error.\n"
+"\n"
 " -mirror  Whether to align the mirror image of input structure\n"
 "           0: (default) do not align mirrored structure\n"
 "           1: align mirror of Structure_1 to origin Structure_2,\n"
@@ -105,6 +154,11 @@ void print_extra_help()
 "           1: SPICKER format\n"
 //"           2: xyz format\n"
 "           3: PDBx/mmCIF format\n"
+"           4: binary structure database built by pdb2db, which can be\n"
+"              searched with -dir, -dir1 and -dir2 by listing the structure\n"
+"              names in the database, or as a whole by giving it as\n"
+"              structure_1 or structure_2. Only for -mm 0\n"
+"              $ USalign query.pdb chain.db -infmt2 4\n"
 "\n"
 "-chainmap (only useful for -mm 1) use the final chain mapping 'chainmap.txt'\n"
 "          specified by user. 'chainmap.txt' is a tab-seperated text with two\n"
@@ -231,7 +285,7 @@ void print_help(bool h_opt=false)
 "\n"
 //"      -h  Print the full help message, including additional options\n"
 //"\n"
-"Example usages ('gunzip' program is needed to read .gz compressed files):\n"
+"Example usages (.gz and .bz2 compressed files are read directly):\n"
 "    USalign 101m.cif.gz 1mba.pdb             # pairwise monomeric protein alignment\n"
 "    USalign 1qf6.cif 5yyn.pdb.gz -mol RNA    # pairwise monomeric RNA alignment\n"
 "    USalign model.pdb native.pdb -TMscore 1  # calculate TM-score between two conformations of a monomer\n"
@@ -246,6 +300,534 @@ void print_help(bool h_opt=false)
     exit(EXIT_SUCCESS);
 }
 
+/* a parsed chain, which is shared by all structure pairs that use it */
+struct TMalignChain
+{
+    string name;               // file name
+    string chainID;
+    int    len;                // chain length
+    int    mol_type;           // RNA if >0
+    double **xa;               // coordinates xa[0...len-1][0..2]
+    char   *seq;               // protein sequence
+    char   *sec;               // secondary structure
+    vector<string> resi_vec;   // residue index
+    vector<string> PDB_lines;  // text of chain, only kept for -do and -mm 3
+
+    TMalignChain()
+    {
+        len=mol_type=0;
+        xa=NULL;
+        seq=sec=NULL;
+    }
+
+    ~TMalignChain()
+    {
+        if (xa) DeleteArray(&xa, len);
+        if (seq) delete [] seq;
+        if (sec) delete [] sec;
+    }
+};
+
+/* parse all chains of one structure file and append them to chain_vec.
+ * Chains shorter than 3 residues are skipped. Return the number of chains
+ * appended.
+ * read_resi - whether to read residue index
+ * keep_lines - whether to keep the PDB text for printing aligned atoms
+ * db - database to read the chains from for -infmt 4 */
+size_t parse_TMalign_chains(const string &filename,
+    vector<shared_ptr<TMalignChain> >&chain_vec, const int ter_opt,
+    const int infmt_opt, const string &atom_opt, const bool autojustify,
+    const int split_opt, const int het_opt, const vector<string>&chain2parse,
+    const vector<string>&model2parse, const string &mol_opt,
+    const int read_resi, const int mirror_opt, const bool keep_lines,
+    const StructDB *db)
+{
+    vector<vector<string> >PDB_lines; // text of chains, only for keep_lines
+    vector<PDBChain> PDB_chains;      // residues of chains
+    vector<int> mol_vec;              // molecule type of chains, RNA if >0
+    vector<string> chainID_list;      // list of chainID
+    vector<size_t> db_chain;          // chain index in db
+    size_t old_size=chain_vec.size();
+    int chainnum;
+    if (db)
+    {
+        chainnum=db->get_chains(filename, db_chain, chainID_list, mol_vec);
+        PDB_lines.resize(chainnum);
+    }
+    else if (keep_lines) chainnum=get_PDB_lines(filename, PDB_lines,
+        chainID_list, mol_vec, ter_opt, infmt_opt, atom_opt, autojustify,
+        split_opt, het_opt, chain2parse, model2parse);
+    else chainnum=get_PDB_lines(filename, PDB_chains, chainID_list, mol_vec,
+        ter_opt, infmt_opt, atom_opt, autojustify, split_opt, het_opt,
+        chain2parse, model2parse);
+    if (!chainnum)
+    {
+        cerr<<"Warning! Cannot parse file: "<<filename
+            <<". Chain number 0."<<endl;
+        return 0;
+    }
+    int chain_i,r;
+    int len;
+    for (chain_i=0;chain_i<chainnum;chain_i++)
+    {
+        if (db) len=db->get_len(db_chain[chain_i]);
+        else if (keep_lines) len=PDB_lines[chain_i].size();
+        else len=PDB_chains[chain_i].size();
+        int db_mol_type=mol_vec[chain_i];
+        if (mol_opt=="RNA") mol_vec[chain_i]=1;
+        else if (mol_opt=="protein") mol_vec[chain_i]=-1;
+        if (!len)
+        {
+            cerr<<"Warning! Cannot parse file: "<<filename
+                <<". Chain length 0."<<endl;
+            continue;
+        }
+        else if (len<3)
+        {
+            cerr<<"Sequence is too short <3!: "<<filename<<endl;
+            continue;
+        }
+        shared_ptr<TMalignChain> chain(new TMalignChain);
+        chain->name=filename;
+        chain->chainID=chainID_list[chain_i];
+        chain->mol_type=mol_vec[chain_i];
+        NewArray(&chain->xa, len, 3);
+        chain->seq = new char[len + 1];
+        chain->sec = new char[len + 1];
+        if (db) chain->len = db->read_chain(db_chain[chain_i], chain->xa,
+            chain->seq, chain->sec, chain->resi_vec, read_resi);
+        else if (keep_lines) chain->len = read_PDB(PDB_lines[chain_i],
+            chain->xa, chain->seq, chain->resi_vec, read_resi);
+        else
+        {
+            chain->len = read_PDB(PDB_chains[chain_i], chain->xa, chain->seq,
+                chain->resi_vec, read_resi);
+            PDB_chains[chain_i].clear();
+        }
+        if (mirror_opt) for (r=0;r<len;r++) chain->xa[r][2]=-chain->xa[r][2];
+        /* the secondary structure in db is kept unless it changes */
+        if (db && !mirror_opt && (db_mol_type>0)==(chain->mol_type>0)) ;
+        else if (chain->mol_type>0) make_sec(chain->seq, chain->xa, len,
+            chain->sec, atom_opt);
+        else make_sec(chain->xa, len, chain->sec);
+        if (keep_lines) chain->PDB_lines.swap(PDB_lines[chain_i]);
+        chain_vec.push_back(chain);
+    }
+    return chain_vec.size()-old_size;
+}
+
+/* Chains parsed from structure files on one side of the alignment. Each
+ * file is parsed at most once while it is cached, so that all-against-all
+ * -dir runs and -dir1/-dir2 searches do not parse the same file again for
+ * every structure on the other side. */
+class TMalignChainStore
+{
+public:
+    TMalignChainStore(const int ter_opt, const int infmt_opt,
+        const string &atom_opt, const bool autojustify, const int split_opt,
+        const int het_opt, const vector<string>&chain2parse,
+        const vector<string>&model2parse, const string &mol_opt,
+        const int read_resi, const int mirror_opt, const bool keep_lines,
+        const StructDB *db=NULL):
+        ter_opt(ter_opt), infmt_opt(infmt_opt), atom_opt(atom_opt),
+        autojustify(autojustify), split_opt(split_opt), het_opt(het_opt),
+        chain2parse(chain2parse), model2parse(model2parse), mol_opt(mol_opt),
+        read_resi(read_resi), mirror_opt(mirror_opt), keep_lines(keep_lines),
+        db(db)
+        {}
+
+    /* append chains of filename to chain_vec. The file is parsed if it is
+     * not cached, and is then cached if 'cache' is true.
+     * return the number of chains appended */
+    size_t load(const string &filename,
+        vector<shared_ptr<TMalignChain> >&chain_vec, const bool cache)
+    {
+        map<string,vector<shared_ptr<TMalignChain> > >::iterator it=
+            chain_map.find(filename);
+        if (it!=chain_map.end())
+        {
+            chain_vec.insert(chain_vec.end(),
+                it->second.begin(), it->second.end());
+            return it->second.size();
+        }
+        size_t chainnum=parse_TMalign_chains(filename, chain_vec, ter_opt,
+            infmt_opt, atom_opt, autojustify, split_opt, het_opt,
+            chain2parse, model2parse, mol_opt, read_resi, mirror_opt,
+            keep_lines, db);
+        if (cache) chain_map[filename].assign(
+            chain_vec.end()-chainnum, chain_vec.end());
+        return chainnum;
+    }
+
+    /* remove filename from cache. The chains are freed once no pair
+     * uses them */
+    void release(const string &filename)
+    {
+        chain_map.erase(filename);
+    }
+
+    /* whether both stores parse a file into the same chains */
+    bool same_input(const TMalignChainStore &other) const
+    {
+        return infmt_opt==other.infmt_opt && mirror_opt==other.mirror_opt &&
+            chain2parse==other.chain2parse && model2parse==other.model2parse &&
+            db==other.db;
+    }
+
+private:
+    map<string,vector<shared_ptr<TMalignChain> > >chain_map;
+    const int ter_opt;
+    const int infmt_opt;
+    const string atom_opt;
+    const bool autojustify;
+    const int split_opt;
+    const int het_opt;
+    const vector<string> chain2parse;
+    const vector<string> model2parse;
+    const string mol_opt;
+    const int read_resi;
+    const int mirror_opt;
+    const bool keep_lines;
+    const StructDB *db;           // for -infmt 4
+};
+
+/* a pair of chains to align by TMalign and its alignment result */
+struct TMalignPair
+{
+    shared_ptr<TMalignChain> x;      // structure_1
+    shared_ptr<TMalignChain> y;      // structure_2
+    vector<string> sequence;         // for -i, -I and -TMscore
+
+    double t0[3], u0[3][3];
+    double TM1, TM2;
+    double TM3, TM4, TM5;            // for a_opt, u_opt, d_opt
+    double d0_0, TM_0;
+    double d0A, d0B, d0u, d0a;
+    double d0_out;
+    string seqM, seqxA, seqyA;       // for output alignment
+    double rmsd0;
+    int L_ali;                       // Aligned length in standard_TMscore
+    double Liden;
+    double TM_ali, rmsd_ali;         // TMscore and rmsd in standard_TMscore
+    int n_ali;
+    int n_ali8;
+    vector<double> do_vec;
+    bool done;                       // whether the alignment is finished
+    int status;                      // nonzero if TMalign_main stopped early
+    double TMcut;                    // TMcut of this pair, for -topk
+
+    TMalignPair()
+    {
+        d0_out=5.0;
+        rmsd0=0.0;
+        Liden=0;
+        n_ali=n_ali8=0;
+        done=false;
+        status=0;
+        TMcut=-1;
+    }
+};
+
+/* align one structure pair by TMalign_main, CPalign_main or se_main.
+ * This is called by worker threads when -t is set. ws is the workspace
+ * of the calling thread. */
+void TMalign_pair(TMalignPair &p, AlignWorkspace *ws, const double Lnorm_ass,
+    const double d0_scale, const int i_opt, const int a_opt,
+    const bool u_opt, const bool d_opt, const double TMcut,
+    const int outfmt_opt, const bool fast_opt, const int cp_opt,
+    const int byresi_opt, const bool se_opt)
+{
+    TMalignChain &x=*p.x;
+    TMalignChain &y=*p.y;
+    int xlen=x.len;
+    int ylen=y.len;
+    int mol_type=x.mol_type+y.mol_type;
+    if (byresi_opt) extract_aln_from_resi(p.sequence,
+        x.seq,y.seq,x.resi_vec,y.resi_vec,byresi_opt);
+
+    bool force_fast_opt=(getmin(xlen,ylen)>1500)?true:fast_opt;
+
+    /* entry function for structure alignment */
+    if (cp_opt) p.status=CPalign_main(
+        x.xa, y.xa, x.seq, y.seq, x.sec, y.sec,
+        p.t0, p.u0, p.TM1, p.TM2, p.TM3, p.TM4, p.TM5,
+        p.d0_0, p.TM_0, p.d0A, p.d0B, p.d0u, p.d0a, p.d0_out,
+        p.seqM, p.seqxA, p.seqyA, p.do_vec,
+        p.rmsd0, p.L_ali, p.Liden, p.TM_ali, p.rmsd_ali, p.n_ali, p.n_ali8,
+        xlen, ylen, p.sequence, Lnorm_ass, d0_scale,
+        i_opt, a_opt, u_opt, d_opt, force_fast_opt, mol_type, TMcut, ws);
+    else if (se_opt)
+    {
+        int *invmap = new int[ylen+1];
+        p.u0[0][0]=p.u0[1][1]=p.u0[2][2]=1;
+        p.u0[0][1]=           p.u0[0][2]=
+        p.u0[1][0]=           p.u0[1][2]=
+        p.u0[2][0]=           p.u0[2][1]=
+        p.t0[0]   =p.t0[1]   =p.t0[2]   =0;
+        se_main(x.xa, y.xa, x.seq, y.seq, p.TM1, p.TM2, p.TM3, p.TM4, p.TM5,
+            p.d0_0, p.TM_0, p.d0A, p.d0B, p.d0u, p.d0a, p.d0_out,
+            p.seqM, p.seqxA, p.seqyA, p.do_vec,
+            p.rmsd0, p.L_ali, p.Liden, p.TM_ali, p.rmsd_ali, p.n_ali, p.n_ali8,
+            xlen, ylen, p.sequence, Lnorm_ass, d0_scale,
+            i_opt, a_opt, u_opt, d_opt, mol_type, outfmt_opt, invmap, 0, ws);
+        if (outfmt_opt>=2) 
+        {
+            p.Liden=p.L_ali=0;
+            int r1,r2;
+            for (r2=0;r2<ylen;r2++)
+            {
+                r1=invmap[r2];
+                if (r1<0) continue;
+                p.L_ali+=1;
+                p.Liden+=(x.seq[r1]==y.seq[r2]);
+            }
+        }
+        delete [] invmap;
+    }
+    else p.status=TMalign_main(
+        x.xa, y.xa, x.seq, y.seq, x.sec, y.sec,
+        p.t0, p.u0, p.TM1, p.TM2, p.TM3, p.TM4, p.TM5,
+        p.d0_0, p.TM_0, p.d0A, p.d0B, p.d0u, p.d0a, p.d0_out,
+        p.seqM, p.seqxA, p.seqyA, p.do_vec,
+        p.rmsd0, p.L_ali, p.Liden, p.TM_ali, p.rmsd_ali, p.n_ali, p.n_ali8,
+        xlen, ylen, p.sequence, Lnorm_ass, d0_scale,
+        i_opt, a_opt, u_opt, d_opt, force_fast_opt, mol_type, TMcut, ws);
+}
+
+/* print the alignment of one structure pair */
+void output_TMalign_pair(TMalignPair &p, const string &fname_super,
+    const string &fname_matrix, const double Lnorm_ass,
+    const double d0_scale, const bool m_opt, const int i_opt,
+    const int o_opt, const int a_opt, const bool u_opt, const bool d_opt,
+    const int ter_opt, const int split_opt, const int outfmt_opt,
+    const int cp_opt, const int mirror_opt, const string &dir_opt,
+    const string &dirpair_opt, const string &dir1_opt,
+    const string &dir2_opt, const bool do_opt)
+{
+    TMalignChain &x=*p.x;
+    TMalignChain &y=*p.y;
+    const string &xname=x.name;
+    const string &yname=y.name;
+
+    if (outfmt_opt==0) print_version();
+    int left_num=0;
+    int right_num=0;
+    int left_aln_num=0;
+    int right_aln_num=0;
+    bool after_cp=false;
+    if (cp_opt) after_cp=output_cp(
+        xname.substr(dir1_opt.size()+dir_opt.size()),
+        yname.substr(dir2_opt.size()+dir_opt.size()),
+        p.seqxA,p.seqyA,outfmt_opt,left_num,right_num,
+        left_aln_num,right_aln_num);
+    output_results(
+        xname.substr(dir1_opt.size()+dir_opt.size()+dirpair_opt.size()),
+        yname.substr(dir2_opt.size()+dir_opt.size()+dirpair_opt.size()),
+        x.chainID, y.chainID,
+        x.len, y.len, p.t0, p.u0, p.TM1, p.TM2, p.TM3, p.TM4, p.TM5,
+        p.rmsd0, p.d0_out, p.seqM.c_str(),
+        p.seqxA.c_str(), p.seqyA.c_str(), p.Liden,
+        p.n_ali8, p.L_ali, p.TM_ali, p.rmsd_ali, p.TM_0, p.d0_0,
+        p.d0A, p.d0B, Lnorm_ass, d0_scale, p.d0a, p.d0u, 
+        (m_opt?fname_matrix:"").c_str(),
+        outfmt_opt, ter_opt, false, split_opt, o_opt,
+        fname_super, i_opt, a_opt, u_opt, d_opt, mirror_opt,
+        x.resi_vec, y.resi_vec);
+    if (do_opt || (cp_opt && outfmt_opt<=0))
+    {
+        cout<<"###############\t###############\t#########"<<endl;
+        cout<<"#Aligned atom 1\tAligned atom 2 \tDistance#"<<endl;
+        size_t r1=right_num;
+        size_t r2=0;
+        size_t r;
+        int    postcp=0;
+        for (r=0;r<p.seqxA.size();r++)
+        {
+            r1+=p.seqxA[r]!='-';
+            r2+=p.seqyA[r]!='-';
+            if (p.seqxA[r]=='*')
+            {
+                cout<<"###### Circular\tPermutation ###\t#########\n";
+                r1=0;
+                postcp=1;
+            }
+            else if (p.seqxA[r]!='-' && p.seqyA[r]!='-')
+            {
+                cout<<x.PDB_lines[r1-1].substr(12,15)<<'\t'
+                    <<y.PDB_lines[r2-1].substr(12,15)<<'\t'
+                    <<setw(9)<<setiosflags(ios::fixed)<<setprecision(3)
+                    <<p.do_vec[r-postcp]<<'\n';
+            }
+        }
+        cout<<"###############\t###############\t#########"<<endl;
+    }
+}
+
+/* Structure pairs are aligned by a pool of worker threads, and are returned
+ * to the calling thread in the order in which they were submitted, so that
+ * printing them in this order gives the same output as a serial run. */
+class TMalignScheduler
+{
+public:
+    TMalignScheduler(const int nthreads): pool(nthreads) {}
+
+    /* queue pair p, which is then aligned by align(p,tid) in worker
+     * thread tid */
+    void submit(TMalignPair *p,
+        const function<void(TMalignPair*,int)> &align)
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            pair_queue.push_back(p);
+        }
+        pool.submit([this,p,align](int tid)
+        {
+            align(p, tid);
+            {
+                lock_guard<mutex> lock(mtx);
+                p->done=true;
+            }
+            cv.notify_all();
+        });
+    }
+
+    /* remove and return the oldest pair if it is already aligned. If more
+     * than max_queue pairs are queued, wait for the oldest pair instead.
+     * Return NULL if no pair is returned. */
+    TMalignPair *pop(const size_t max_queue)
+    {
+        unique_lock<mutex> lock(mtx);
+        if (pair_queue.empty()) return NULL;
+        while (!pair_queue.front()->done && pair_queue.size()>max_queue)
+            cv.wait(lock);
+        if (!pair_queue.front()->done) return NULL;
+        TMalignPair *p=pair_queue.front();
+        pair_queue.pop_front();
+        return p;
+    }
+
+private:
+    ThreadPool pool;
+    deque<TMalignPair*> pair_queue; // pairs not yet returned by pop
+    mutex mtx;
+    condition_variable cv;
+};
+
+/* The best K pairs of a -topk search. Once K pairs are kept, the lowest
+ * kept TM-score is used as TMcut for the pairs aligned afterwards, so
+ * that pairs which cannot enter the top K stop at the approx_TM
+ * checkpoints of TMalign_main. The TMcut of the n-th pair is taken after
+ * exactly n-TMcut_lag pairs are added, so that the same pairs are pruned
+ * for any number of threads and any thread timing. The class is only
+ * used by the thread that submits the pairs. */
+class TMalignTopK
+{
+public:
+    static const size_t TMcut_lag=1024;
+
+    TMalignTopK(const int K, const int a_opt, const double TMcut):
+        K(K), a_opt(a_opt), TMcut(TMcut), pair_num(0), TMcut_num(0)
+    {
+        TMcut_deque.push_back(TMcut);
+    }
+
+    ~TMalignTopK()
+    {
+        for (size_t k=0;k<heap.size();k++) delete heap[k].p;
+    }
+
+    /* whether enough pairs are added for the TMcut of the n-th pair */
+    bool has_TMcut(const size_t n) const
+    {
+        return n<TMcut_lag || pair_num>=n-TMcut_lag;
+    }
+
+    /* TMcut of the n-th pair. n must not decrease between calls */
+    double get_TMcut(const size_t n)
+    {
+        size_t m=(n<TMcut_lag)?0:n-TMcut_lag; // number of pairs added
+        while (TMcut_num<m)
+        {
+            TMcut_deque.pop_front();
+            TMcut_num++;
+        }
+        return TMcut_deque.front();
+    }
+
+    /* keep pair p if it is among the best K pairs so far, and free the
+     * pair that is no longer kept. Pairs must be added in the order of
+     * the serial run, which breaks ties between equal TM-scores. */
+    void add(TMalignPair *p)
+    {
+        TopKEntry e;
+        e.TM=get_TM(*p);
+        e.idx=pair_num++;
+        e.p=p;
+        if (p->status) delete p; // stopped early by TMcut
+        else if (heap.size()<K)
+        {
+            heap.push_back(e);
+            push_heap(heap.begin(), heap.end(), better);
+        }
+        else if (better(e,heap[0]))
+        {
+            pop_heap(heap.begin(), heap.end(), better);
+            delete heap.back().p;
+            heap.back()=e;
+            push_heap(heap.begin(), heap.end(), better);
+        }
+        else delete p;
+
+        /* TMcut after pair_num pairs */
+        if (heap.size()<K || heap[0].TM<=TMcut)
+            TMcut_deque.push_back(TMcut);
+        else TMcut_deque.push_back(heap[0].TM);
+    }
+
+    /* remove and return the kept pairs from the best to the worst */
+    vector<TMalignPair*> release()
+    {
+        sort(heap.begin(), heap.end(), better);
+        vector<TMalignPair*> pair_vec;
+        for (size_t k=0;k<heap.size();k++) pair_vec.push_back(heap[k].p);
+        heap.clear();
+        return pair_vec;
+    }
+
+private:
+    struct TopKEntry
+    {
+        double TM;
+        size_t idx;          // order of the pair in the serial run
+        TMalignPair *p;
+    };
+
+    /* whether a is better than b. As the comparison of the heap, this
+     * keeps the worst pair at the front */
+    static bool better(const TopKEntry &a, const TopKEntry &b)
+    {
+        return a.TM>b.TM || (a.TM==b.TM && a.idx<b.idx);
+    }
+
+    /* TM-score normalized as set by -a, which is also how TMcut is
+     * normalized */
+    double get_TM(const TMalignPair &p) const
+    {
+        if (a_opt==-2) return min(p.TM1,p.TM2); // longer
+        if (a_opt==-1) return max(p.TM1,p.TM2); // shorter
+        if (a_opt== 1) return p.TM3;            // average
+        return p.TM1;                           // second structure
+    }
+
+    const size_t K;
+    const int a_opt;
+    const double TMcut;
+    size_t pair_num;           // number of pairs added
+    vector<TopKEntry> heap;
+    deque<double> TMcut_deque; // TMcut after TMcut_num, ..., pair_num pairs
+    size_t TMcut_num;
+};
+
 /* TMalign, RNAalign, CPalign, TMscore */
 int TMalign(string &xname, string &yname, const string &fname_super,
     const string &fname_lign, const string &fname_matrix,
@@ -261,276 +843,172 @@ int TMalign(string &xname, string &yname, const string &fname_super,
     const vector<string> &chain2parse2, const vector<string> &model2parse1,
     const vector<string> &model2parse2, const int byresi_opt,
     const vector<string> &chain1_list, const vector<string> &chain2_list,
-    const bool se_opt, const bool do_opt)
+    const bool se_opt, const bool do_opt, const int nthreads,
+    const int topk_opt, const StructDB *db1, const StructDB *db2)
 {
-    /* declare previously global variables */
-    vector<vector<string> >PDB_lines1; // text of chain1
-    vector<vector<string> >PDB_lines2; // text of chain2
-    vector<int> mol_vec1;              // molecule type of chain1, RNA if >0
-    vector<int> mol_vec2;              // molecule type of chain2, RNA if >0
-    vector<string> chainID_list1;      // list of chainID1
-    vector<string> chainID_list2;      // list of chainID2
+    vector<shared_ptr<TMalignChain> > chain1_vec; // chains in file 1
+    vector<shared_ptr<TMalignChain> > chain2_vec; // chains in file 2
     int    i,j;                // file index
-    int    chain_i,chain_j;    // chain index
-    int    r;                  // residue index
-    int    xlen, ylen;         // chain length
-    int    xchainnum,ychainnum;// number of chains in a PDB file
-    char   *seqx, *seqy;       // for the protein sequence 
-    char   *secx, *secy;       // for the secondary structure 
-    double **xa, **ya;         // for input vectors xa[0...xlen-1][0..2] and
-                               // ya[0...ylen-1][0..2], in general,
-                               // ya is regarded as native structure 
-                               // --> superpose xa onto ya
-    vector<string> resi_vec1;  // residue index for chain1
-    vector<string> resi_vec2;  // residue index for chain2
+    size_t chain_i,chain_j;    // chain index
     int read_resi=byresi_opt;  // whether to read residue index
     if (byresi_opt==0 && o_opt) read_resi=2;
+    bool keep_lines=(do_opt || (cp_opt && outfmt_opt<=0));
+
+    /* when -t is set, pairs are aligned by worker threads. At most
+     * max_queue aligned pairs wait to be printed. */
+    TMalignScheduler *sched=NULL;
+    size_t max_queue=0;
+    if (nthreads>1)
+    {
+        sched=new TMalignScheduler(nthreads);
+        max_queue=16*nthreads;
+    }
+    /* when -topk is set, only the best pairs are printed at the end */
+    TMalignTopK *topk=NULL;
+    if (topk_opt>0) topk=new TMalignTopK(topk_opt, a_opt, TMcut);
+    AlignWorkspace *ws_vec=new AlignWorkspace[nthreads]; // one per thread
+    function<void(TMalignPair*,int)> align=[&](TMalignPair *p, int tid)
+    {
+        TMalign_pair(*p, ws_vec+tid, Lnorm_ass, d0_scale, i_opt, a_opt, u_opt, d_opt,
+            p->TMcut, outfmt_opt, fast_opt, cp_opt,
+            byresi_opt, se_opt);
+    };
+    TMalignPair *p;
+    size_t pair_num=0;         // number of pairs submitted
+    size_t status_count[2+TMcut_stage_num]={}; // pairs by TMalign_main return
+
+    /* In -dir runs, file j is used as structure_2 by all i<j. In
+     * -dir1 -dir2 runs, and in -dir2 runs where structure_1 has multiple
+     * chains, each structure_2 is used more than once. Keep the parsed
+     * structure_2 in these cases. */
+    TMalignChainStore store1(ter_opt, infmt1_opt, atom_opt, autojustify,
+        split_opt, het_opt, chain2parse1, model2parse1, mol_opt, read_resi,
+        mirror_opt, keep_lines, db1);
+    TMalignChainStore store2(ter_opt, infmt2_opt, atom_opt, autojustify,
+        split_opt, het_opt, chain2parse2, model2parse2, mol_opt, read_resi,
+        0, keep_lines, db2);
+    bool cache2=false;
 
     /* loop over file names */
     for (i=0;i<chain1_list.size();i++)
     {
-        /* parse chain 1 */
+        /* parse chain 1, which was already parsed as chain 2 in -dir */
         xname=chain1_list[i];
-        xchainnum=get_PDB_lines(xname, PDB_lines1, chainID_list1, mol_vec1,
-            ter_opt, infmt1_opt, atom_opt, autojustify, split_opt, het_opt,
-            chain2parse1,model2parse1);
-        if (!xchainnum)
+        if (dir_opt.size() && store1.same_input(store2))
+            store2.load(xname, chain1_vec, false);
+        else store1.load(xname, chain1_vec, false);
+        if (dir_opt.size()) store2.release(xname);
+        if (chain1_vec.size()==0) continue;
+        cache2=(dirpair_opt.size()==0 && chain2_list.size()>1 &&
+            (chain1_list.size()>1 || chain1_vec.size()>1));
+        for (chain_i=0;chain_i<chain1_vec.size();chain_i++)
         {
-            cerr<<"Warning! Cannot parse file: "<<xname
-                <<". Chain number 0."<<endl;
-            continue;
-        }
-        for (chain_i=0;chain_i<xchainnum;chain_i++)
-        {
-            xlen=PDB_lines1[chain_i].size();
-            if (mol_opt=="RNA") mol_vec1[chain_i]=1;
-            else if (mol_opt=="protein") mol_vec1[chain_i]=-1;
-            if (!xlen)
-            {
-                cerr<<"Warning! Cannot parse file: "<<xname
-                    <<". Chain length 0."<<endl;
-                continue;
-            }
-            else if (xlen<3)
-            {
-                cerr<<"Sequence is too short <3!: "<<xname<<endl;
-                continue;
-            }
-            NewArray(&xa, xlen, 3);
-            seqx = new char[xlen + 1];
-            secx = new char[xlen + 1];
-            xlen = read_PDB(PDB_lines1[chain_i], xa, seqx, 
-                resi_vec1, read_resi);
-            if (mirror_opt) for (r=0;r<xlen;r++) xa[r][2]=-xa[r][2];
-            if (mol_vec1[chain_i]>0) make_sec(seqx,xa, xlen, secx,atom_opt);
-            else make_sec(xa, xlen, secx); // secondary structure assignment
-
             for (j=(dir_opt.size()>0)*(i+1);j<chain2_list.size();j++)
             {
                 if (dirpair_opt.size() && j!=i) continue;
                 /* parse chain 2 */
-                if (PDB_lines2.size()==0)
+                if (chain2_vec.size()==0)
                 {
                     yname=chain2_list[j];
-                    ychainnum=get_PDB_lines(yname, PDB_lines2, chainID_list2,
-                        mol_vec2, ter_opt, infmt2_opt, atom_opt, autojustify,
-                        split_opt, het_opt, chain2parse2, model2parse2);
-                    if (!ychainnum)
-                    {
-                        cerr<<"Warning! Cannot parse file: "<<yname
-                            <<". Chain number 0."<<endl;
-                        continue;
-                    }
+                    if (!store2.load(yname, chain2_vec, cache2)) continue;
                 }
-                for (chain_j=0;chain_j<ychainnum;chain_j++)
+                for (chain_j=0;chain_j<chain2_vec.size();chain_j++)
                 {
-                    ylen=PDB_lines2[chain_j].size();
-                    if (mol_opt=="RNA") mol_vec2[chain_j]=1;
-                    else if (mol_opt=="protein") mol_vec2[chain_j]=-1;
-                    if (!ylen)
+                    p=new TMalignPair;
+                    p->x=chain1_vec[chain_i];
+                    p->y=chain2_vec[chain_j];
+                    p->sequence=sequence;
+                    p->TMcut=TMcut;
+                    if (topk)
                     {
-                        cerr<<"Warning! Cannot parse file: "<<yname
-                            <<". Chain length 0."<<endl;
-                        continue;
-                    }
-                    else if (ylen<3)
-                    {
-                        cerr<<"Sequence is too short <3!: "<<yname<<endl;
-                        continue;
-                    }
-                    NewArray(&ya, ylen, 3);
-                    seqy = new char[ylen + 1];
-                    secy = new char[ylen + 1];
-                    ylen = read_PDB(PDB_lines2[chain_j], ya, seqy,
-                        resi_vec2, read_resi);
-                    if (mol_vec2[chain_j]>0)
-                         make_sec(seqy, ya, ylen, secy, atom_opt);
-                    else make_sec(ya, ylen, secy);
-
-                    if (byresi_opt) extract_aln_from_resi(sequence,
-                        seqx,seqy,resi_vec1,resi_vec2,byresi_opt);
-
-                    /* declare variable specific to this pair of TMalign */
-                    double t0[3], u0[3][3];
-                    double TM1, TM2;
-                    double TM3, TM4, TM5;     // for a_opt, u_opt, d_opt
-                    double d0_0, TM_0;
-                    double d0A, d0B, d0u, d0a;
-                    double d0_out=5.0;
-                    string seqM, seqxA, seqyA;// for output alignment
-                    double rmsd0 = 0.0;
-                    int L_ali;                // Aligned length in standard_TMscore
-                    double Liden=0;
-                    double TM_ali, rmsd_ali;  // TMscore and rmsd in standard_TMscore
-                    int n_ali=0;
-                    int n_ali8=0;
-                    bool force_fast_opt=(getmin(xlen,ylen)>1500)?true:fast_opt;
-                    vector<double> do_vec;
-
-                    /* entry function for structure alignment */
-                    if (cp_opt) CPalign_main(
-                        xa, ya, seqx, seqy, secx, secy,
-                        t0, u0, TM1, TM2, TM3, TM4, TM5,
-                        d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out,
-                        seqM, seqxA, seqyA, do_vec,
-                        rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
-                        xlen, ylen, sequence, Lnorm_ass, d0_scale,
-                        i_opt, a_opt, u_opt, d_opt, force_fast_opt,
-                        mol_vec1[chain_i]+mol_vec2[chain_j],TMcut);
-                    else if (se_opt)
-                    {
-                        int *invmap = new int[ylen+1];
-                        u0[0][0]=u0[1][1]=u0[2][2]=1;
-                        u0[0][1]=         u0[0][2]=
-                        u0[1][0]=         u0[1][2]=
-                        u0[2][0]=         u0[2][1]=
-                        t0[0]   =t0[1]   =t0[2]   =0;
-                        se_main(xa, ya, seqx, seqy, TM1, TM2, TM3, TM4, TM5,
-                            d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out,
-                            seqM, seqxA, seqyA, do_vec,
-                            rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
-                            xlen, ylen, sequence, Lnorm_ass, d0_scale,
-                            i_opt, a_opt, u_opt, d_opt,
-                            mol_vec1[chain_i]+mol_vec2[chain_j], 
-                            outfmt_opt, invmap);
-                        if (outfmt_opt>=2) 
+                        /* wait for the pairs that decide the TMcut */
+                        while (!topk->has_TMcut(pair_num))
                         {
-                            Liden=L_ali=0;
-                            int r1,r2;
-                            for (r2=0;r2<ylen;r2++)
-                            {
-                                r1=invmap[r2];
-                                if (r1<0) continue;
-                                L_ali+=1;
-                                Liden+=(seqx[r1]==seqy[r2]);
-                            }
+                            TMalignPair *q=sched->pop(0);
+                            status_count[q->status]++;
+                            topk->add(q);
                         }
-                        delete [] invmap;
+                        p->TMcut=topk->get_TMcut(pair_num);
                     }
-                    else TMalign_main(
-                        xa, ya, seqx, seqy, secx, secy,
-                        t0, u0, TM1, TM2, TM3, TM4, TM5,
-                        d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out,
-                        seqM, seqxA, seqyA, do_vec,
-                        rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
-                        xlen, ylen, sequence, Lnorm_ass, d0_scale,
-                        i_opt, a_opt, u_opt, d_opt, force_fast_opt,
-                        mol_vec1[chain_i]+mol_vec2[chain_j],TMcut);
+                    pair_num++;
+                    if (sched) sched->submit(p, align);
+                    else align(p, 0);
 
                     /* print result */
-                    if (outfmt_opt==0) print_version();
-                    int left_num=0;
-                    int right_num=0;
-                    int left_aln_num=0;
-                    int right_aln_num=0;
-                    bool after_cp=false;
-                    if (cp_opt) after_cp=output_cp(
-                        xname.substr(dir1_opt.size()+dir_opt.size()),
-                        yname.substr(dir2_opt.size()+dir_opt.size()),
-                        seqxA,seqyA,outfmt_opt,left_num,right_num,
-                        left_aln_num,right_aln_num);
-                    output_results(
-                        xname.substr(dir1_opt.size()+dir_opt.size()+dirpair_opt.size()),
-                        yname.substr(dir2_opt.size()+dir_opt.size()+dirpair_opt.size()),
-                        chainID_list1[chain_i], chainID_list2[chain_j],
-                        xlen, ylen, t0, u0, TM1, TM2, TM3, TM4, TM5,
-                        rmsd0, d0_out, seqM.c_str(),
-                        seqxA.c_str(), seqyA.c_str(), Liden,
-                        n_ali8, L_ali, TM_ali, rmsd_ali, TM_0, d0_0,
-                        d0A, d0B, Lnorm_ass, d0_scale, d0a, d0u, 
-                        (m_opt?fname_matrix:"").c_str(),
-                        outfmt_opt, ter_opt, false, split_opt, o_opt,
-                        fname_super, i_opt, a_opt, u_opt, d_opt, mirror_opt,
-                        resi_vec1, resi_vec2);
-                    if (do_opt || (cp_opt && outfmt_opt<=0))
+                    while (sched?(p=sched->pop(max_queue)):p)
                     {
-                        cout<<"###############\t###############\t#########"<<endl;
-                        cout<<"#Aligned atom 1\tAligned atom 2 \tDistance#"<<endl;
-                        size_t r1=right_num;
-                        size_t r2=0;
-                        size_t r;
-                        int    postcp=0;
-                        for (r=0;r<seqxA.size();r++)
+                        status_count[p->status]++;
+                        if (topk) topk->add(p);
+                        else
                         {
-                            r1+=seqxA[r]!='-';
-                            r2+=seqyA[r]!='-';
-                            if (seqxA[r]=='*')
-                            {
-                                cout<<"###### Circular\tPermutation ###\t#########\n";
-                                r1=0;
-                                postcp=1;
-                            }
-                            else if (seqxA[r]!='-' && seqyA[r]!='-')
-                            {
-                                cout<<PDB_lines1[chain_i][r1-1].substr(12,15)<<'\t'
-                                    <<PDB_lines2[chain_j][r2-1].substr(12,15)<<'\t'
-                                    <<setw(9)<<setiosflags(ios::fixed)<<setprecision(3)
-                                    <<do_vec[r-postcp]<<'\n';
-                            }
+                            output_TMalign_pair(*p, fname_super,
+                                fname_matrix, Lnorm_ass, d0_scale, m_opt,
+                                i_opt, o_opt, a_opt, u_opt, d_opt, ter_opt,
+                                split_opt, outfmt_opt, cp_opt, mirror_opt,
+                                dir_opt, dirpair_opt, dir1_opt, dir2_opt,
+                                do_opt);
+                            delete p;
                         }
-                        cout<<"###############\t###############\t#########"<<endl;
+                        if (!sched) break;
                     }
-
-                    /* Done! Free memory */
-                    seqM.clear();
-                    seqxA.clear();
-                    seqyA.clear();
-                    DeleteArray(&ya, ylen);
-                    delete [] seqy;
-                    delete [] secy;
-                    resi_vec2.clear();
-                    do_vec.clear();
                 } // chain_j
                 if (chain2_list.size()>1)
                 {
                     yname.clear();
-                    for (chain_j=0;chain_j<ychainnum;chain_j++)
-                        PDB_lines2[chain_j].clear();
-                    PDB_lines2.clear();
-                    chainID_list2.clear();
-                    mol_vec2.clear();
+                    chain2_vec.clear();
                 }
             } // j
-            PDB_lines1[chain_i].clear();
-            DeleteArray(&xa, xlen);
-            delete [] seqx;
-            delete [] secx;
-            resi_vec1.clear();
         } // chain_i
         xname.clear();
-        PDB_lines1.clear();
-        chainID_list1.clear();
-        mol_vec1.clear();
+        chain1_vec.clear();
     } // i
+
+    /* print the remaining pairs */
+    if (sched)
+    {
+        while ((p=sched->pop(0)))
+        {
+            status_count[p->status]++;
+            if (topk)
+            {
+                topk->add(p);
+                continue;
+            }
+            output_TMalign_pair(*p, fname_super, fname_matrix, Lnorm_ass,
+                d0_scale, m_opt, i_opt, o_opt, a_opt, u_opt, d_opt,
+                ter_opt, split_opt, outfmt_opt, cp_opt, mirror_opt,
+                dir_opt, dirpair_opt, dir1_opt, dir2_opt, do_opt);
+            delete p;
+        }
+        delete sched;
+    }
+    if (topk)
+    {
+        vector<TMalignPair*> pair_vec=topk->release();
+        for (size_t k=0;k<pair_vec.size();k++)
+        {
+            output_TMalign_pair(*pair_vec[k], fname_super, fname_matrix,
+                Lnorm_ass, d0_scale, m_opt, i_opt, o_opt, a_opt, u_opt,
+                d_opt, ter_opt, split_opt, outfmt_opt, cp_opt, mirror_opt,
+                dir_opt, dirpair_opt, dir1_opt, dir2_opt, do_opt);
+            delete pair_vec[k];
+        }
+        delete topk;
+    }
+    if ((TMcut>0 || topk_opt>0) &&
+        (chain1_list.size()>1 || chain2_list.size()>1))
+    {
+        cerr<<"#Pairs aligned: "<<status_count[0]<<endl;
+        cerr<<"#Pairs without initial alignment: "<<status_count[1]<<endl;
+        for (int stage=0;stage<TMcut_stage_num;stage++)
+            cerr<<"#Pairs pruned after "<<TMcut_stage_name[stage]<<": "
+                <<status_count[2+stage]<<endl;
+    }
+    delete [] ws_vec;
     if (chain2_list.size()==1)
     {
         yname.clear();
-        for (chain_j=0;chain_j<ychainnum;chain_j++)
-            PDB_lines2[chain_j].clear();
-        PDB_lines2.clear();
-        resi_vec2.clear();
-        chainID_list2.clear();
-        mol_vec2.clear();
+        chain2_vec.clear();
     }
     return 0;
 }
@@ -2464,6 +2942,7 @@ int SOIalign(string &xname, string &yname, const string &fname_super,
     vector<string> resi_vec2;  // residue index for chain2
     int read_resi=0;  // whether to read residue index
     if (o_opt) read_resi=2;
+    AlignWorkspace ws;         // buffers reused by all structure pairs
 
     /* loop over file names */
     for (i=0;i<chain1_list.size();i++)
@@ -2594,7 +3073,7 @@ int SOIalign(string &xname, string &yname, const string &fname_super,
                             i_opt, a_opt, u_opt, d_opt,
                             mol_vec1[chain_i]+mol_vec2[chain_j], 
                             outfmt_opt, invmap, dist_list,
-                            secx_bond, secy_bond, mm_opt);
+                            secx_bond, secy_bond, mm_opt, &ws);
                         if (outfmt_opt>=2) 
                         {
                             Liden=L_ali=0;
@@ -2617,7 +3096,7 @@ int SOIalign(string &xname, string &yname, const string &fname_super,
                         xlen, ylen, sequence, Lnorm_ass, d0_scale,
                         i_opt, a_opt, u_opt, d_opt, force_fast_opt,
                         mol_vec1[chain_i]+mol_vec2[chain_j], dist_list,
-                        secx_bond, secy_bond, mm_opt);
+                        secx_bond, secy_bond, mm_opt, &ws);
 
                     /* print result */
                     if (outfmt_opt==0) print_version();
@@ -3021,6 +3500,8 @@ int main(int argc, char *argv[])
                              // 5 and 0 for -mm 5 and 6
     int    hinge_opt =9;     // maximum number of hinge allowed for flexible
     int    mirror_opt=0;     // do not align mirror
+    int    nthreads  =1;     // number of threads for batch alignment
+    int    topk_opt  =0;     // print all pairs of a batch alignment
     int    het_opt=0;        // do not read HETATM residues
     int    mm_opt=0;         // do not perform MM-align
     string atom_opt  ="auto";// use C alpha atom for protein and C3' for RNA
@@ -3204,6 +3685,52 @@ int main(int argc, char *argv[])
                 PrintErrorAndQuit("ERROR! Missing value for -m");
             fname_matrix = argv[i + 1];    m_opt = true; i++;
         }// get filename for rotation matrix
+        else if (!strcmp(argv[i], "-t"))
+        {
+            if (i>=(argc-1)) 
+                PrintErrorAndQuit("ERROR! Missing value for -t");
+            nthreads=atoi(argv[i + 1]); i++;
+            if (nthreads<1) PrintErrorAndQuit("ERROR! -t must be >=1");
+        }
+        else if (!strcmp(argv[i], "-TMcut_policy"))
+        {
+            if (i>=(argc-1)) 
+                PrintErrorAndQuit("ERROR! Missing value for -TMcut_policy");
+            if (!set_TMcut_policy(argv[i + 1])) PrintErrorAndQuit(
+                "ERROR! Cannot read "+string(argv[i + 1]));
+            i++;
+        }
+        else if (!strcmp(argv[i], "-topk"))
+        {
+            if (i>=(argc-1)) 
+                PrintErrorAndQuit("ERROR! Missing value for -topk");
+            topk_opt=atoi(argv[i + 1]); i++;
+            if (topk_opt<1) PrintErrorAndQuit("ERROR! -topk must be >=1");
+        }
+        else if (!strcmp(argv[i], "-dp"))
+        {
+            if (i>=(argc-1)) 
+                PrintErrorAndQuit("ERROR! Missing value for -dp");
+            dp_opt=atoi(argv[i + 1]); i++;
+            if (dp_opt!=0 && dp_opt!=1)
+                PrintErrorAndQuit("ERROR! -dp must be 0 or 1");
+        }
+        else if (!strcmp(argv[i], "-kabsch"))
+        {
+            if (i>=(argc-1)) 
+                PrintErrorAndQuit("ERROR! Missing value for -kabsch");
+            kabsch_opt=atoi(argv[i + 1]); i++;
+            if (kabsch_opt!=0 && kabsch_opt!=1)
+                PrintErrorAndQuit("ERROR! -kabsch must be 0 or 1");
+        }
+        else if (!strcmp(argv[i], "-simd"))
+        {
+            if (i>=(argc-1)) 
+                PrintErrorAndQuit("ERROR! Missing value for -simd");
+            simd_opt=atoi(argv[i + 1]); i++;
+            if (simd_opt<-1 || simd_opt>2)
+                PrintErrorAndQuit("ERROR! -simd must be -1, 0, 1 or 2");
+        }
         else if (!strcmp(argv[i], "-fast"))
         {
             fast_opt = true;
@@ -3217,16 +3744,16 @@ int main(int argc, char *argv[])
             if (i>=(argc-1)) 
                 PrintErrorAndQuit("ERROR! Missing value for -infmt1");
             infmt1_opt=atoi(argv[i + 1]); i++;
-            if (infmt1_opt<-1 || infmt1_opt>3)
-                PrintErrorAndQuit("ERROR! -infmt1 can only be -1, 0, 1, 2, or 3");
+            if (infmt1_opt<-1 || infmt1_opt>4)
+                PrintErrorAndQuit("ERROR! -infmt1 can only be -1, 0, 1, 2, 3 or 4");
         }
         else if ( !strcmp(argv[i],"-infmt2") )
         {
             if (i>=(argc-1)) 
                 PrintErrorAndQuit("ERROR! Missing value for -infmt2");
             infmt2_opt=atoi(argv[i + 1]); i++;
-            if (infmt2_opt<-1 || infmt2_opt>3)
-                PrintErrorAndQuit("ERROR! -infmt2 can only be -1, 0, 1, 2, or 3");
+            if (infmt2_opt<-1 || infmt2_opt>4)
+                PrintErrorAndQuit("ERROR! -infmt2 can only be -1, 0, 1, 2, 3 or 4");
         }
         else if ( !strcmp(argv[i],"-ter") )
         {
@@ -3470,6 +3997,59 @@ int main(int argc, char *argv[])
     if (mm_opt==7 && hinge_opt>=10)
         PrintErrorAndQuit("ERROR! -hinge must be <10");
 
+    /* -infmt 4 reads structures from a database built by pdb2db. A
+     * database given as structure_1 or structure_2 is searched as if all
+     * its structures were listed by -dir1 or -dir2 */
+    StructDB db1, db2;
+    if (infmt1_opt==4 || infmt2_opt==4)
+    {
+        if (mm_opt!=0 || cp_opt || dirpair_opt.size() || byresi_opt>=6)
+            PrintErrorAndQuit("ERROR! -infmt1 4 and -infmt2 4 can only be used with -mm 0");
+        if (do_opt || o_opt)
+            PrintErrorAndQuit("ERROR! -infmt1 4 and -infmt2 4 cannot be used with -do, -o, -rasmol or -chimerax");
+        if (suffix_opt.size())
+            PrintErrorAndQuit("ERROR! -infmt1 4 and -infmt2 4 cannot be used with -suffix");
+        if (dir_opt.size() && infmt1_opt!=infmt2_opt)
+            PrintErrorAndQuit("ERROR! -dir needs -infmt1 4 and -infmt2 4");
+        if (infmt1_opt==4)
+        {
+            if (dir_opt.size()+dir1_opt.size()==0)
+            {
+                dir1_opt=xname;
+                xname.clear();
+            }
+            if (!db1.open(dir_opt+dir1_opt)) PrintErrorAndQuit(
+                "ERROR! Cannot read structure database "+dir_opt+dir1_opt);
+        }
+        if (infmt2_opt==4 && dir_opt.size()==0)
+        {
+            if (dir2_opt.size()==0)
+            {
+                dir2_opt=yname;
+                yname.clear();
+            }
+            if (!db2.open(dir2_opt)) PrintErrorAndQuit(
+                "ERROR! Cannot read structure database "+dir2_opt);
+        }
+    }
+
+    if (nthreads>1 && dir_opt.size()+dir1_opt.size()+dir2_opt.size()+
+        dirpair_opt.size()==0)
+    {
+        pair_nthreads=nthreads; // parallel search within one pair
+        nthreads=1;
+    }
+    if (nthreads>1 && mm_opt!=0)
+    {
+        cerr<<"WARNING! -t is ignored for -mm "<<mm_opt<<endl;
+        nthreads=1;
+    }
+
+    if (topk_opt && mm_opt!=0)
+        PrintErrorAndQuit("ERROR! -topk can only be used with -mm 0 or 3");
+    if (topk_opt && dir_opt.size()+dir1_opt.size()+dir2_opt.size()==0)
+        PrintErrorAndQuit("ERROR! -topk can only be used with -dir, -dir1 or -dir2");
+
     if (chainmapfile.size() && mm_opt!=1)
         PrintErrorAndQuit("ERROR! -chainmap must be used with -mm 1");
 
@@ -3490,12 +4070,14 @@ int main(int argc, char *argv[])
     else
     {
         if (dir1_opt.size()+dir_opt.size()==0) chain1_list.push_back(xname);
+        else if (infmt1_opt==4) db2chainlist(chain1_list, xname, db1);
         else file2chainlist(chain1_list, xname, dir_opt+dir1_opt, suffix_opt);
 
         if (dir_opt.size())
             for (i=0;i<chain1_list.size();i++)
                 chain2_list.push_back(chain1_list[i]);
         else if (dir2_opt.size()==0) chain2_list.push_back(yname);
+        else if (infmt2_opt==4) db2chainlist(chain2_list, yname, db2);
         else file2chainlist(chain2_list, yname, dir2_opt, suffix_opt);
     }
 
@@ -3514,7 +4096,9 @@ int main(int argc, char *argv[])
         split_opt, outfmt_opt, fast_opt, cp_opt, mirror_opt, het_opt,
         atom_opt, autojustify, mol_opt, dir_opt, dirpair_opt, dir1_opt,
         dir2_opt, chain2parse1, chain2parse2, model2parse1, model2parse2,
-        byresi_opt, chain1_list, chain2_list, se_opt, do_opt);
+        byresi_opt, chain1_list, chain2_list, se_opt, do_opt, nthreads,
+        topk_opt, (infmt1_opt==4)?&db1:NULL, (infmt2_opt==4)?
+        (dir_opt.size()?&db1:&db2):NULL);
     else if (mm_opt==1)
     { 
         if (dirpair_opt.size()==0) MMalign(xname, yname, fname_super,
@@ -5,7 +5,7 @@
 #include <string>
 #include <vector>
 #include <cstdlib>
-#include "pstream.h"
+#include "gzstream.h" // For reading gzip and bz2 compressed files
 
 using namespace std;
 
@@ -44,11 +44,11 @@ void addChainID(const string &infile,const string &outfile,
 {
     stringstream buf;
     if (infile=="-") buf<<cin.rdbuf();
-#if defined(REDI_PSTREAM_H_SEEN)
-    else if (infile.size()>3 && infile.substr(infile.size()-3)==".gz")
+#if defined(GZSTREAM_H_SEEN)
+    else if (gz_compress_type(infile))
     {
-        redi::ipstream fp_gz; // if file is compressed
-        fp_gz.open("gunzip -c "+infile);
+        gzistream fp_gz; // if file is compressed
+        fp_gz.open(infile);
         buf<<fp_gz.rdbuf();
         fp_gz.close();
     }
@@ -5,9 +5,13 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <float.h>
 #include <time.h>
 #include <string.h>
 //#include <malloc.h>
+#ifdef _WIN32
+#include <malloc.h> // for _aligned_malloc
+#endif
 
 #include <sstream>
 #include <iostream>
@@ -19,8 +23,10 @@
 #include <string>
 #include <iomanip>
 #include <map>
+#include <new>
 
-#include "pstream.h" // For reading gzip and bz2 compressed files
+#include "gzstream.h" // For reading gzip and bz2 compressed files
+#include "cif_reader.h"
 
 using namespace std;
 
@@ -36,20 +42,274 @@ template <typename T> inline T getmin(const T &a, const T &b)
     return b<a?b:a;
 }
 
+/* alignment in bytes of 2D arrays, which is the cache line size */
+#define ARRAY_ALIGN 64
+
+inline void *AlignedMalloc(const size_t size)
+{
+    void *ptr=NULL;
+#ifdef _WIN32
+    ptr=_aligned_malloc(size?size:1, ARRAY_ALIGN);
+#else
+    if (posix_memalign(&ptr, ARRAY_ALIGN, size?size:1)) ptr=NULL;
+#endif
+    if (ptr==NULL) throw bad_alloc();
+    return ptr;
+}
+
+inline void AlignedFree(void *ptr)
+{
+#ifdef _WIN32
+    _aligned_free(ptr);
+#else
+    free(ptr);
+#endif
+}
+
+/* number of elements between the starts of two consecutive rows. Rows of
+ * at least ARRAY_ALIGN bytes are padded to a multiple of ARRAY_ALIGN bytes
+ * so that every row starts at an aligned address, while short rows such as
+ * coordinates are packed without padding */
+template <class A> inline size_t ArrayRowStride(const int Narray2)
+{
+    size_t row_bytes=(size_t)Narray2*sizeof(A);
+    if (row_bytes<ARRAY_ALIGN || ARRAY_ALIGN%sizeof(A)) return Narray2;
+    return (row_bytes+ARRAY_ALIGN-1)/ARRAY_ALIGN*ARRAY_ALIGN/sizeof(A);
+}
+
+/* point rows[0...Narray1-1] to consecutive rows of data */
+template <class A> inline void SetArrayRows(A **rows, A *data,
+    const int Narray1, const int Narray2)
+{
+    size_t stride=ArrayRowStride<A>(Narray2);
+    for (int i=0; i<Narray1; i++) rows[i]=data+i*stride;
+}
+
+/* Allocate an Narray1*Narray2 array as a single block. The row pointers
+ * are at the start of the block and are followed by the elements, which
+ * start at an ARRAY_ALIGN byte boundary, so that array[i][j] is stored
+ * contiguously. Only for plain data types. */
 template <class A> void NewArray(A *** array, int Narray1, int Narray2)
 {
-    *array=new A* [Narray1];
-    for(int i=0; i<Narray1; i++) *(*array+i)=new A [Narray2];
+    size_t head=((size_t)Narray1*sizeof(A*)+ARRAY_ALIGN-1)/ARRAY_ALIGN*
+        ARRAY_ALIGN;
+    size_t body=(size_t)Narray1*ArrayRowStride<A>(Narray2)*sizeof(A);
+    char *block=(char *)AlignedMalloc(head+body);
+    *array=(A **)block;
+    SetArrayRows(*array, (A *)(block+head), Narray1, Narray2);
 }
 
+/* free an array allocated by NewArray. Narray is not used, because the
+ * whole array is one block, and is kept for compatibility */
 template <class A> void DeleteArray(A *** array, int Narray)
 {
-    for(int i=0; i<Narray; i++)
-        if(*(*array+i)) delete [] *(*array+i);
-    if(Narray) delete [] (*array);
+    if (*array) AlignedFree(*array);
     (*array)=NULL;
 }
 
+/* 2D array that is kept across calls and only grows. get(n1,n2) returns
+ * n1 row pointers into one aligned block, laid out as by NewArray. The
+ * block is only reallocated when it is too small. Elements are not
+ * initialized. Only for plain data types. */
+template <class A> class WorkArray
+{
+public:
+    WorkArray()
+    {
+        rows=NULL;
+        data=NULL;
+        row_cap=0;
+        data_cap=0;
+    }
+
+    ~WorkArray()
+    {
+        if (rows) delete [] rows;
+        if (data) AlignedFree(data);
+    }
+
+    A **get(const int n1, const int n2)
+    {
+        size_t n=(size_t)n1*ArrayRowStride<A>(n2);
+        if (n1>row_cap)
+        {
+            if (rows) delete [] rows;
+            row_cap=n1;
+            rows=new A* [row_cap];
+        }
+        if (n>data_cap)
+        {
+            if (data) AlignedFree(data);
+            data=NULL;
+            data=(A *)AlignedMalloc(n*sizeof(A));
+            data_cap=n;
+        }
+        SetArrayRows(rows, data, n1, n2);
+        return rows;
+    }
+
+private:
+    A    **rows;
+    A    *data;
+    int    row_cap;
+    size_t data_cap;
+
+    WorkArray(const WorkArray &);
+    WorkArray &operator=(const WorkArray &);
+};
+
+/* 1D counterpart of WorkArray */
+template <class A> class WorkVector
+{
+public:
+    WorkVector()
+    {
+        data=NULL;
+        data_cap=0;
+    }
+
+    ~WorkVector()
+    {
+        if (data) delete [] data;
+    }
+
+    A *get(const int n)
+    {
+        if (n>data_cap)
+        {
+            if (data) delete [] data;
+            data_cap=n;
+            data=new A [data_cap];
+        }
+        return data;
+    }
+
+private:
+    A   *data;
+    int  data_cap;
+
+    WorkVector(const WorkVector &);
+    WorkVector &operator=(const WorkVector &);
+};
+
+/* Traceback matrix of the NWDP routines, which only records whether cell
+ * (i,j) is reached from the diagonal. Each cell is one bit, so that the
+ * matrix takes 1/8 of the memory of bool**. path[i][j] is read and
+ * assigned as with bool**. Rows are padded to whole 64-bit words. Like
+ * WorkArray, get(n1,n2) only reallocates when the matrix is too small, and
+ * elements are not initialized. */
+class PathMatrix
+{
+public:
+    class Bit
+    {
+    public:
+        Bit(unsigned long long *w, const int b): word(w), mask(1ULL<<b) {}
+        operator bool() const { return (*word & mask)!=0; }
+        Bit &operator=(const bool p)
+        {
+            if (p) *word|=mask;
+            else   *word&=~mask;
+            return *this;
+        }
+        Bit &operator=(const Bit &b) { return *this=(bool)b; }
+    private:
+        unsigned long long *word;
+        unsigned long long mask;
+    };
+
+    class Row
+    {
+    public:
+        Row(unsigned long long *w): words(w) {}
+        Bit operator[](const int j) const { return Bit(words+(j>>6), j&63); }
+    private:
+        unsigned long long *words;
+    };
+
+    PathMatrix()
+    {
+        data=NULL;
+        data_cap=0;
+        stride=0;
+    }
+
+    ~PathMatrix()
+    {
+        if (data) AlignedFree(data);
+    }
+
+    PathMatrix &get(const int n1, const int n2)
+    {
+        stride=((size_t)n2+63)/64;
+        size_t n=(size_t)n1*stride;
+        if (n>data_cap)
+        {
+            if (data) AlignedFree(data);
+            data=NULL;
+            data=(unsigned long long *)AlignedMalloc(n*
+                sizeof(unsigned long long));
+            data_cap=n;
+        }
+        return *this;
+    }
+
+    /* release the memory before the matrix goes out of scope */
+    void clear()
+    {
+        if (data) AlignedFree(data);
+        data=NULL;
+        data_cap=0;
+    }
+
+    Row operator[](const int i) const { return Row(data+i*stride); }
+
+private:
+    unsigned long long *data;
+    size_t data_cap;
+    size_t stride;  // number of 64-bit words per row
+
+    PathMatrix(const PathMatrix &);
+    PathMatrix &operator=(const PathMatrix &);
+};
+
+/* Buffers for the alignment engines TMalign_main, se_main, SOIalign_main
+ * and NWalign_main. Each thread owns one workspace and passes it to all
+ * the alignments it performs, so that the buffers are only allocated when
+ * a longer structure pair is met. Buffers are only valid until the next
+ * engine call with the same workspace. */
+struct AlignWorkspace
+{
+    WorkArray<double> score;  // dynamic programming
+    WorkArray<double> scoret;
+    PathMatrix        path;   // bit-packed traceback
+    WorkArray<double> val;
+    WorkArray<double> xtm;    // TMscore search engine
+    WorkArray<double> ytm;
+    WorkArray<double> xt;     // superposed structure
+    WorkArray<double> yt;
+    WorkArray<double> r1;     // Kabsch rotation
+    WorkArray<double> r2;
+    WorkArray<double> soa;    // TMscore8_search: SoA coordinates, scores
+    WorkArray<double> moments;// TMscore8_search: prefix sums for Kabsch
+    WorkArray<double> ys;     // NWDP_TM: y in SoA layout
+    WorkArray<double> xs;     // NWDP_wavefront: x in SoA layout
+    WorkArray<double> yr;     // NWDP_wavefront: reversed y in SoA layout
+    WorkArray<double> diag;   // NWDP_wavefront: val and score diagonals
+    WorkArray<bool>   diag_path; // NWDP_wavefront: path and mask diagonals
+    WorkVector<int>   invmap0;
+    WorkVector<int>   invmap;
+    WorkVector<int>   fwdmap0;
+    WorkVector<int>   m1;
+    WorkVector<int>   m2;
+    WorkArray<int>    JumpH;  // NWalign_main and calculate_score_gotoh
+    WorkArray<int>    JumpV;
+    WorkArray<int>    P;
+    WorkArray<int>    S;
+    WorkArray<int>    H;
+    WorkArray<int>    V;
+};
+
 string AAmap(char A)
 {
     if (A=='A') return "ALA";
@@ -148,39 +408,288 @@ string Trim(const string &inputString)
     return result;
 }
 
-size_t get_PDB_lines(const string filename,
-    vector<vector<string> >&PDB_lines, vector<string> &chainID_list,
+/* residues of one chain, decoded from the fixed columns of the ATOM
+ * records. It can replace the text of the chain in get_PDB_lines and
+ * read_PDB, and takes about 1/3 of the memory */
+struct PDBChain
+{
+    vector<double> xyz; // coordinates, columns 31-54
+    string seq;         // one letter residue name, columns 18-20
+    string resi;        // 6 characters per residue, columns 23-27 and 22
+
+    size_t size() const { return seq.size(); }
+
+    void clear()
+    {
+        vector<double>().swap(xyz);
+        string().swap(seq);
+        string().swap(resi);
+    }
+};
+
+/* append an ATOM record to the text of a chain */
+inline void add_PDB_record(vector<string> &PDB_lines, const string &line)
+{
+    PDB_lines.push_back(line);
+}
+
+/* decode an ATOM record in the same way as read_PDB */
+inline void add_PDB_record(PDBChain &chain, const string &line)
+{
+    char buf[9];
+    size_t pos,n;
+    for (pos=30;pos<54;pos+=8)
+    {
+        n=(pos<line.size())?line.copy(buf,8,pos):0;
+        buf[n]=0;
+        chain.xyz.push_back(atof(buf));
+    }
+    chain.seq+=AAmap(line.substr(17,3));
+    chain.resi.append(line,22,5);
+    chain.resi+=line[21];
+}
+
+/* whether the atom names of residue resn (3 characters) are re-padded
+ * when autojustify is set */
+inline bool is_std_resn(const char *resn)
+{
+    static const char std_resn[]="  A DA  C DC  G DG  U PSU  I DI  T"
+        "ALACYSASPGLUPHEGLYHISILELYSLEUMETMSEASNPROGLNARGSERTHRVALTRPTYR"
+        "ASXGLXSECPYL";
+    for (size_t k=0;k+3<sizeof(std_resn);k+=3)
+        if (memcmp(std_resn+k,resn,3)==0) return true;
+    return false;
+}
+
+inline bool is_space(const char c)
+{
+    return c==' ' || c=='\n' || c=='\r' || c=='\t';
+}
+
+/* re-pad 4-character atom name as PDB columns 13-16, where a trailing '*'
+ * is the old notation of "'" */
+inline void justify_atom_name(char *atom)
+{
+    int b=0,e=4;
+    while (b<4 && is_space(atom[b])) b++;
+    if (b==4) return;
+    while (is_space(atom[e-1])) e--;
+    char name[4];
+    int n=e-b;
+    memcpy(name,atom+b,n);
+    if (n>=2 && name[n-1]=='*') name[n-1]='\'';
+    if (n==4) memcpy(atom,name,4);
+    else
+    {
+        memset(atom,' ',4);
+        memcpy(atom+1,name,n);
+    }
+}
+
+/* read the _atom_site loop of PDBx/mmCIF file, as get_PDB_lines with
+ * infmt_opt=3 */
+template <class T> size_t get_mmCIF_lines(const string filename,
+    vector<T>&PDB_lines, vector<string> &chainID_list,
+    vector<int> &mol_vec, const int ter_opt, const string atom_opt,
+    const int split_opt, const int het_opt,
+    const vector<string>&chain2parse, const vector<string>&model2parse)
+{
+    size_t i=0; // atom index
+    string line;
+    bool select_atom=false;
+    string resi="";
+    string alt_id=".";  // alternative location indicator
+    string asym_id="."; // this is similar to chainID, except that
+                        // chainID is char while asym_id is a string
+                        // with possibly multiple char
+    string prev_asym_id="";
+    string AA="";       // residue name
+    string atom="";
+    string prev_resi="";
+    string model_index=""; // the same as model_idx but type is string
+    stringstream i8_stream;
+    map<string, string> alt_id_dict; // resi -> alt_id
+    string resi_chain;
+
+    CIFAtomSiteReader cif;
+    if (!cif.open(filename))
+        PrintErrorAndQuit("Can not open file: "+filename);
+    while (cif.next_row())
+    {
+        if ((!cif.equal(CIF_group_PDB,"ATOM") &&
+             !cif.equal(CIF_group_PDB,"HETATM")) ||
+            (cif.equal(CIF_group_PDB,"HETATM") &&
+             (het_opt==0 || 
+             (het_opt==2 && !cif.equal(CIF_label_comp_id,"MSE"))))
+            ) continue;
+        
+        atom=cif.str(CIF_label_atom_id);
+        if (atom[0]=='"') atom=atom.substr(1);
+        if (atom.size() && atom[atom.size()-1]=='"')
+            atom=atom.substr(0,atom.size()-1);
+        if (atom.size()>=3 && atom[0]=='\'' && atom[atom.size()-1]=='\'')
+            atom=atom.substr(1,atom.size()-2);
+        if (atom.size()==0) continue;
+        if      (atom.size()==1) atom=" "+atom+"  ";
+        else if (atom.size()==2) atom=" "+atom+" "; // wrong for sidechain H
+        else if (atom.size()==3) atom=" "+atom;
+        else if (atom.size()>=5) continue;
+
+        AA=cif.str(CIF_label_comp_id); // residue name
+        if      (AA.size()==1) AA="  "+AA;
+        else if (AA.size()==2) AA=" " +AA;
+        else if (AA.size()>=4) continue;
+
+        if (atom_opt=="auto")
+        {
+            if (AA[0]==' ' && (AA[1]=='D'||AA[1]==' ')) // DNA || RNA
+                 select_atom=(atom==" C3'");
+            else select_atom=(atom==" CA ");
+        }
+        else if (atom_opt=="PC4'")
+        {
+            line=cif.line();
+            if (line[17]==' ' && (line[18]=='D'||line[18]==' '))
+                 select_atom=(line.compare(12,4," P  ")==0
+                          )||(line.compare(12,4," C4'")==0);
+            else select_atom=(line.compare(12,4," CA ")==0);
+        }
+        else     select_atom=(atom==atom_opt);
+
+        if (!select_atom) continue;
+
+        if (cif.has(CIF_auth_asym_id))
+             asym_id=cif.str(CIF_auth_asym_id);
+        else asym_id=cif.str(CIF_label_asym_id);
+        if (asym_id==".") asym_id=" ";
+
+        if (chain2parse.size() && ( (asym_id==" " && 
+            find(chain2parse.begin(),chain2parse.end(), "_"
+            )==chain2parse.end())|| (asym_id!=" " && 
+            find(chain2parse.begin(), chain2parse.end(),asym_id
+            )==chain2parse.end()))) continue;
+
+        if (model2parse.size() && cif.has(CIF_pdbx_PDB_model_num) &&
+            find(model2parse.begin(), model2parse.end(),
+                cif.str(CIF_pdbx_PDB_model_num))==model2parse.end()) continue;
+
+        if (cif.has(CIF_pdbx_PDB_model_num) && 
+            !cif.equal(CIF_pdbx_PDB_model_num, model_index))
+        {
+            model_index=cif.str(CIF_pdbx_PDB_model_num);
+
+            if (PDB_lines.size() && ter_opt>=1) break;
+            if (PDB_lines.size()==0 || split_opt>=1)
+            {
+                PDB_lines.push_back(T());
+                mol_vec.push_back(0);
+                prev_asym_id=asym_id;
+
+                if (split_opt==1 && ter_opt==0) chainID_list.push_back(
+                    ':'+model_index);
+                else if (split_opt==2 && ter_opt==0)
+                    chainID_list.push_back(':'+model_index+','+asym_id);
+                else //if (split_opt==2 && ter_opt==1)
+                    chainID_list.push_back(':'+asym_id);
+                //else
+                    //chainID_list.push_back("");
+            }
+            map<string, string>().swap(alt_id_dict);
+        }
+        
+        if (cif.has(CIF_auth_seq_id))
+             resi=cif.str(CIF_auth_seq_id);
+        else resi=cif.str(CIF_label_seq_id);
+        if (cif.has(CIF_pdbx_PDB_ins_code) && 
+            !cif.equal(CIF_pdbx_PDB_ins_code,"?"))
+            resi+=cif.str(CIF_pdbx_PDB_ins_code,1);
+        else resi+=" ";
+        
+        if (cif.has(CIF_label_alt_id)) // in 39.4 % of entries
+        {
+            alt_id=cif.str(CIF_label_alt_id);
+            resi_chain=asym_id+resi;
+            if (alt_id_dict.count(resi_chain)==0)
+                alt_id_dict[resi_chain]=alt_id;
+            else if (alt_id_dict.count(resi_chain) && alt_id!=alt_id_dict[resi_chain])
+                continue;
+            //if (alt_id!="." && alt_id!="A") continue;
+        }
+
+        if (prev_asym_id!=asym_id)
+        {
+            if (prev_asym_id!="" && ter_opt>=2) break;
+            if (split_opt>=2)
+            {
+                PDB_lines.push_back(T());
+                mol_vec.push_back(0);
+
+                if (split_opt==1 && ter_opt==0) chainID_list.push_back(
+                    ':'+model_index);
+                else if (split_opt==2 && ter_opt==0)
+                    chainID_list.push_back(':'+model_index+','+asym_id);
+                else //if (split_opt==2 && ter_opt==1)
+                    chainID_list.push_back(':'+asym_id);
+                //else
+                    //chainID_list.push_back("");
+            }
+        }
+        if (prev_asym_id!=asym_id) prev_asym_id=asym_id;
+
+        if (AA[0]==' ' && (AA[1]=='D'||AA[1]==' ')) mol_vec.back()++;
+        else mol_vec.back()--;
+
+        if (prev_resi==resi && atom_opt!="PC4'")
+            cerr<<"Warning! Duplicated residue "<<resi<<endl;
+        prev_resi=resi;
+
+        i++;
+        i8_stream<<"ATOM  "
+            <<setw(5)<<i<<" "<<atom<<" "<<AA<<" "<<asym_id[0]
+            <<setw(5)<<resi.substr(0,5)<<"   "
+            <<setw(8)<<cif.str(CIF_Cartn_x,8)
+            <<setw(8)<<cif.str(CIF_Cartn_y,8)
+            <<setw(8)<<cif.str(CIF_Cartn_z,8);
+        add_PDB_record(PDB_lines.back(), i8_stream.str());
+        i8_stream.str(string());
+    }
+    if (cif.is_truncated())
+        PrintErrorAndQuit("ERROR! Unexpected end of "+filename);
+    cif.close();
+    line.clear();
+    if (!split_opt) chainID_list.push_back("");
+    return PDB_lines.size();
+}
+
+/* read structure file into the text (vector<string>) or the decoded
+ * residues (PDBChain) of each chain. PDB files are read in a single pass,
+ * without copying any field that is not needed to select the atoms */
+template <class T> size_t get_PDB_lines(const string filename,
+    vector<T>&PDB_lines, vector<string> &chainID_list,
     vector<int> &mol_vec, const int ter_opt, const int infmt_opt,
     const string atom_opt, const bool autojustify, const int split_opt, 
     const int het_opt, const vector<string>&chain2parse,
     const vector<string>&model2parse)
 {
+    if (infmt_opt==3) return get_mmCIF_lines(filename, PDB_lines,
+        chainID_list, mol_vec, ter_opt, atom_opt, split_opt, het_opt,
+        chain2parse, model2parse);
+
     size_t i=0; // resi i.e. atom index
     string line;
     char chainID=0;
     string resi="";
     bool select_atom=false;
     size_t model_idx=0;
-    vector<string> tmp_str_vec;
 
     int compress_type=0; // uncompressed file
     ifstream fin;
-#ifndef REDI_PSTREAM_H_SEEN
+#ifndef GZSTREAM_H_SEEN
     ifstream fin_gz;
 #else
-    redi::ipstream fin_gz; // if file is compressed
-    if (filename.size()>=3 && 
-        filename.substr(filename.size()-3,3)==".gz")
-    {
-        fin_gz.open("gunzip -c '"+filename+"'");
-        compress_type=1;
-    }
-    else if (filename.size()>=4 && 
-        filename.substr(filename.size()-4,4)==".bz2")
-    {
-        fin_gz.open("bzcat '"+filename+"'");
-        compress_type=2;
-    }
+    gzistream fin_gz; // if file is compressed
+    compress_type=gz_compress_type(filename);
+    if (compress_type) fin_gz.open(filename);
     else
 #endif
     {
@@ -190,49 +699,19 @@ size_t get_PDB_lines(const string filename,
 
     if (infmt_opt==0||infmt_opt==-1) // PDB format
     {
-        map<string,char> aa3to1;
-        aa3to1["  A"]=aa3to1[" DA"]='a';
-        aa3to1["  C"]=aa3to1[" DC"]='c';
-        aa3to1["  G"]=aa3to1[" DG"]='g';
-        aa3to1["  U"]=aa3to1["PSU"]='u';
-        aa3to1["  I"]=aa3to1[" DI"]='i';
-        aa3to1["  T"]='t';
-        aa3to1["ALA"]='A';
-        aa3to1["CYS"]='C';
-        aa3to1["ASP"]='D';
-        aa3to1["GLU"]='E';
-        aa3to1["PHE"]='F';
-        aa3to1["GLY"]='G';
-        aa3to1["HIS"]='H';
-        aa3to1["ILE"]='I';
-        aa3to1["LYS"]='K';
-        aa3to1["LEU"]='L';
-        aa3to1["MET"]=aa3to1["MSE"]='M';
-        aa3to1["ASN"]='N';
-        aa3to1["PRO"]='P';
-        aa3to1["GLN"]='Q';
-        aa3to1["ARG"]='R';
-        aa3to1["SER"]='S';
-        aa3to1["THR"]='T';
-        aa3to1["VAL"]='V'; 
-        aa3to1["TRP"]='W';
-        aa3to1["TYR"]='Y';
-        aa3to1["ASX"]='B';
-        aa3to1["GLX"]='Z';
-        aa3to1["SEC"]='U';
-        aa3to1["PYL"]='O';
-
-
-        string atom;
-        string resn;
+        istream &fin_pdb=(compress_type==-1)?cin:
+            (compress_type?(istream &)fin_gz:fin);
+        const int atom_mode=(atom_opt=="auto")?1:((atom_opt=="PC4'")?2:0);
+        char atom[5]; // atom name, columns 13-16
+        atom[4]=0;
+        bool is_NA;   // DNA or RNA residue
         string model_index="1";
         map<string, char> alt_id_dict; // resi -> alt_id
         string resi_chain;
-        while ((compress_type==-1)?cin.good():(compress_type?fin_gz.good():fin.good()))
+        map<string, char>::iterator alt_id_it;
+        while (fin_pdb.good())
         {
-            if  (compress_type==-1) getline(cin, line);
-            else if (compress_type) getline(fin_gz, line);
-            else                    getline(fin, line);
+            getline(fin_pdb, line);
             if (infmt_opt==-1 && (line.compare(0,5,"loop_")==0 || 
                                   line.compare(0,1,"#")==0)) // PDBx/mmCIF
                 return get_PDB_lines(filename,PDB_lines,chainID_list, mol_vec,
@@ -261,42 +740,33 @@ size_t get_PDB_lines(const string filename,
                 (line.compare(0, 6, "HETATM")==0 && het_opt==2 && 
                  line.compare(17,3, "MSE")==0)))
             {
-                atom=line.substr(12,4);
-                if (autojustify)
-                {
-                    resn=line.substr(17,3);
-                    if (aa3to1.count(resn))
-                    {
-                        atom=Trim(atom);
-                        if (atom.size())
-                        {
-                            if (atom.size()>=2 && atom[atom.size()-1]=='*')
-                                atom=atom.substr(0,atom.size()-1)+"'";
-                            if (atom.size()==1) atom=" "+atom+"  ";
-                            else if (atom.size()==2) atom=" "+atom+" ";
-                            else if (atom.size()==3) atom=" "+atom;
-                        }
-                    }
-                }
-                if (atom_opt=="auto")
+                /* atom name in columns 13-16 and residue name in
+                 * columns 18-20, padded by spaces if the line is short */
+                size_t n=(line.size()>12)?line.copy(atom,4,12):0;
+                memset(atom+n,' ',4-n);
+                if (autojustify && line.size()>=20 &&
+                    is_std_resn(line.c_str()+17))
+                    justify_atom_name(atom);
+                is_NA=(line[17]==' ' && (line[18]=='D'||line[18]==' '));
+                if (atom_mode==1)
                 {
-                    if (line[17]==' ' && (line[18]=='D'||line[18]==' '))
-                         select_atom=(atom==" C3'");
-                    else select_atom=(atom==" CA ");
+                    if (is_NA) select_atom=(memcmp(atom," C3'",4)==0);
+                    else       select_atom=(memcmp(atom," CA ",4)==0);
                 }
-                else if (atom_opt=="PC4'")
+                else if (atom_mode==2)
                 {
-                    if (line[17]==' ' && (line[18]=='D'||line[18]==' '))
-                         select_atom=(atom==" P  ")||(atom==" C4'");
-                    else select_atom=(atom==" CA ");
+                    if (is_NA) select_atom=(memcmp(atom," P  ",4)==0)||
+                                           (memcmp(atom," C4'",4)==0);
+                    else       select_atom=(memcmp(atom," CA ",4)==0);
                 }
-                else     select_atom=(atom==atom_opt);
+                else select_atom=(atom_opt.compare(atom)==0);
                 if (select_atom)
                 {
-                    resi_chain=line.substr(21,6);
-                    if (alt_id_dict.count(resi_chain)==0)
+                    resi_chain.assign(line,21,6);
+                    alt_id_it=alt_id_dict.find(resi_chain);
+                    if (alt_id_it==alt_id_dict.end())
                         alt_id_dict[resi_chain]=line[16];
-                    else if (alt_id_dict[resi_chain]!=line[16]) continue;
+                    else if (alt_id_it->second!=line[16]) continue;
 
                     if (chain2parse.size() && ( (line[21]==' ' && 
                         find(chain2parse.begin(),chain2parse.end(), "_"
@@ -329,7 +799,7 @@ size_t get_PDB_lines(const string filename,
                             i8_stream << ':' << model_idx;
                             chainID_list.push_back(i8_stream.str());
                         }
-                        PDB_lines.push_back(tmp_str_vec);
+                        PDB_lines.push_back(T());
                         mol_vec.push_back(0);
                     }
                     else if (ter_opt>=2 && chainID!=line[21]) break;
@@ -349,23 +819,22 @@ size_t get_PDB_lines(const string filename,
                             else i8_stream<<':'<<model_idx<<','<<chainID;
                         }
                         chainID_list.push_back(i8_stream.str());
-                        PDB_lines.push_back(tmp_str_vec);
+                        PDB_lines.push_back(T());
                         mol_vec.push_back(0);
                     }
 
-                    if (resi==line.substr(22,5) && atom_opt!="PC4'")
+                    if (line.compare(22,5,resi)==0 && atom_mode!=2)
                         cerr<<"Warning! Duplicated residue "<<resi<<endl;
-                    resi=line.substr(22,5); // including insertion code
+                    resi.assign(line,22,5); // including insertion code
 
-                    PDB_lines.back().push_back(line);
-                    if (line[17]==' ' && (line[18]=='D'||line[18]==' ')) mol_vec.back()++;
+                    add_PDB_record(PDB_lines.back(), line);
+                    if (is_NA) mol_vec.back()++;
                     else mol_vec.back()--;
                     i++;
                 }
             }
         }
 
-        map<string,char>().swap(aa3to1);
         map<string, char>().swap(alt_id_dict); // resi -> alt_id
         string ().swap(resi_chain);
     }
@@ -398,7 +867,7 @@ size_t get_PDB_lines(const string filename,
             stringstream i8_stream;
             i8_stream << ':' << model_idx;
             chainID_list.push_back(i8_stream.str());
-            PDB_lines.push_back(tmp_str_vec);
+            PDB_lines.push_back(T());
             mol_vec.push_back(0);
             for (i=0;i<L;i++)
             {
@@ -410,7 +879,7 @@ size_t get_PDB_lines(const string filename,
                     <<setw(8)<<x<<setw(8)<<y<<setw(8)<<z;
                 line=i8_stream.str();
                 i8_stream.str(string());
-                PDB_lines.back().push_back(line);
+                add_PDB_record(PDB_lines.back(), line);
             }
             if  (compress_type==-1) getline(cin, line);
             else if (compress_type) getline(fin_gz, line);
@@ -434,7 +903,7 @@ size_t get_PDB_lines(const string filename,
                 if (line[i]==' '||line[i]=='\t') break;
             if (!((compress_type==-1)?cin.good():(compress_type?fin_gz.good():fin.good()))) break;
             chainID_list.push_back(':'+line.substr(0,i));
-            PDB_lines.push_back(tmp_str_vec);
+            PDB_lines.push_back(T());
             mol_vec.push_back(0);
             for (i=0;i<L;i++)
             {
@@ -446,242 +915,12 @@ size_t get_PDB_lines(const string filename,
                     <<line.substr(2,8)<<line.substr(11,8)<<line.substr(20,8);
                 line=i8_stream.str();
                 i8_stream.str(string());
-                PDB_lines.back().push_back(line);
+                add_PDB_record(PDB_lines.back(), line);
                 if (line[0]>='a' && line[0]<='z') mol_vec.back()++; // RNA
                 else mol_vec.back()--;
             }
         }
     }
-    else if (infmt_opt==3) // PDBx/mmCIF format
-    {
-        bool loop_ = false; // not reading following content
-        map<string,int> _atom_site;
-        int atom_site_pos;
-        vector<string> line_vec;
-        string alt_id=".";  // alternative location indicator
-        string asym_id="."; // this is similar to chainID, except that
-                            // chainID is char while asym_id is a string
-                            // with possibly multiple char
-        string prev_asym_id="";
-        string AA="";       // residue name
-        string atom="";
-        string prev_resi="";
-        string model_index=""; // the same as model_idx but type is string
-        stringstream i8_stream;
-        map<string, string> alt_id_dict; // resi -> alt_id
-        string resi_chain;
-        while ((compress_type==-1)?cin.good():(compress_type?fin_gz.good():fin.good()))
-        {
-            if (compress_type==-1)  getline(cin, line);
-            else if (compress_type) getline(fin_gz, line);
-            else                    getline(fin, line);
-            if (line.size()==0) continue;
-            if (loop_) loop_ = (line.size()>=2)?(line.compare(0,2,"# ")):(line.compare(0,1,"#"));
-            if (!loop_)
-            {
-                if (line.compare(0,5,"loop_")) continue;
-                while(1)
-                {
-                    if (compress_type==-1)
-                    {
-                        if (cin.good()) getline(cin, line);
-                        else PrintErrorAndQuit("ERROR! Unexpected end of -");
-                    }
-                    else if (compress_type)
-                    {
-                        if (fin_gz.good()) getline(fin_gz, line);
-                        else PrintErrorAndQuit("ERROR! Unexpected end of "+filename);
-                    }
-                    else
-                    {
-                        if (fin.good()) getline(fin, line);
-                        else PrintErrorAndQuit("ERROR! Unexpected end of "+filename);
-                    }
-                    if (line.size()) break;
-                }
-                if (line.compare(0,11,"_atom_site.")) continue;
-
-                loop_=true;
-                _atom_site.clear();
-                atom_site_pos=0;
-                _atom_site[Trim(line.substr(11))]=atom_site_pos;
-
-                while(1)
-                {
-                    if  (compress_type==-1) getline(cin, line);
-                    else if (compress_type) getline(fin_gz, line);
-                    else                    getline(fin, line);
-                    if (line.size()==0) continue;
-                    if (line.compare(0,11,"_atom_site.")) break;
-                    _atom_site[Trim(line.substr(11))]=++atom_site_pos;
-                }
-
-
-                if (_atom_site.count("group_PDB")*
-                    _atom_site.count("label_atom_id")*
-                    _atom_site.count("label_comp_id")*
-                   (_atom_site.count("auth_asym_id")+
-                    _atom_site.count("label_asym_id"))*
-                   (_atom_site.count("auth_seq_id")+
-                    _atom_site.count("label_seq_id"))*
-                    _atom_site.count("Cartn_x")*
-                    _atom_site.count("Cartn_y")*
-                    _atom_site.count("Cartn_z")==0)
-                {
-                    loop_ = false;
-                    cerr<<"Warning! Missing one of the following _atom_site data items: group_PDB, label_atom_id, label_comp_id, auth_asym_id/label_asym_id, auth_seq_id/label_seq_id, Cartn_x, Cartn_y, Cartn_z"<<endl;
-                    continue;
-                }
-            }
-
-            line_vec.clear();
-            split(line,line_vec);
-            if ((line_vec[_atom_site["group_PDB"]]!="ATOM" &&
-                 line_vec[_atom_site["group_PDB"]]!="HETATM") ||
-                (line_vec[_atom_site["group_PDB"]]=="HETATM" &&
-                 (het_opt==0 || 
-                 (het_opt==2 && line_vec[_atom_site["label_comp_id"]]!="MSE")))
-                ) continue;
-            
-            atom=line_vec[_atom_site["label_atom_id"]];
-            if (atom[0]=='"') atom=atom.substr(1);
-            if (atom.size() && atom[atom.size()-1]=='"')
-                atom=atom.substr(0,atom.size()-1);
-            if (atom.size()>=3 && atom[0]=='\'' && atom[atom.size()-1]=='\'')
-                atom=atom.substr(1,atom.size()-2);
-            if (atom.size()==0) continue;
-            if      (atom.size()==1) atom=" "+atom+"  ";
-            else if (atom.size()==2) atom=" "+atom+" "; // wrong for sidechain H
-            else if (atom.size()==3) atom=" "+atom;
-            else if (atom.size()>=5) continue;
-
-            AA=line_vec[_atom_site["label_comp_id"]]; // residue name
-            if      (AA.size()==1) AA="  "+AA;
-            else if (AA.size()==2) AA=" " +AA;
-            else if (AA.size()>=4) continue;
-
-            if (atom_opt=="auto")
-            {
-                if (AA[0]==' ' && (AA[1]=='D'||AA[1]==' ')) // DNA || RNA
-                     select_atom=(atom==" C3'");
-                else select_atom=(atom==" CA ");
-            }
-            else if (atom_opt=="PC4'")
-            {
-                if (line[17]==' ' && (line[18]=='D'||line[18]==' '))
-                     select_atom=(line.compare(12,4," P  ")==0
-                              )||(line.compare(12,4," C4'")==0);
-                else select_atom=(line.compare(12,4," CA ")==0);
-            }
-            else     select_atom=(atom==atom_opt);
-
-            if (!select_atom) continue;
-
-            if (_atom_site.count("auth_asym_id"))
-                 asym_id=line_vec[_atom_site["auth_asym_id"]];
-            else asym_id=line_vec[_atom_site["label_asym_id"]];
-            if (asym_id==".") asym_id=" ";
-
-            if (chain2parse.size() && ( (asym_id==" " && 
-                find(chain2parse.begin(),chain2parse.end(), "_"
-                )==chain2parse.end())|| (asym_id!=" " && 
-                find(chain2parse.begin(), chain2parse.end(),asym_id
-                )==chain2parse.end()))) continue;
-
-            if (model2parse.size() && _atom_site.count("pdbx_PDB_model_num") &&
-                find(model2parse.begin(), model2parse.end(),
-                    line_vec[_atom_site["pdbx_PDB_model_num"]]
-                    )==model2parse.end()) continue;
-
-            if (_atom_site.count("pdbx_PDB_model_num") && 
-                model_index!=line_vec[_atom_site["pdbx_PDB_model_num"]])
-            {
-                model_index=line_vec[_atom_site["pdbx_PDB_model_num"]];
-
-                if (PDB_lines.size() && ter_opt>=1) break;
-                if (PDB_lines.size()==0 || split_opt>=1)
-                {
-                    PDB_lines.push_back(tmp_str_vec);
-                    mol_vec.push_back(0);
-                    prev_asym_id=asym_id;
-
-                    if (split_opt==1 && ter_opt==0) chainID_list.push_back(
-                        ':'+model_index);
-                    else if (split_opt==2 && ter_opt==0)
-                        chainID_list.push_back(':'+model_index+','+asym_id);
-                    else //if (split_opt==2 && ter_opt==1)
-                        chainID_list.push_back(':'+asym_id);
-                    //else
-                        //chainID_list.push_back("");
-                }
-                map<string, string>().swap(alt_id_dict);
-            }
-            
-            if (_atom_site.count("auth_seq_id"))
-                 resi=line_vec[_atom_site["auth_seq_id"]];
-            else resi=line_vec[_atom_site["label_seq_id"]];
-            if (_atom_site.count("pdbx_PDB_ins_code") && 
-                line_vec[_atom_site["pdbx_PDB_ins_code"]]!="?")
-                resi+=line_vec[_atom_site["pdbx_PDB_ins_code"]][0];
-            else resi+=" ";
-            
-            if (_atom_site.count("label_alt_id")) // in 39.4 % of entries
-            {
-                alt_id=line_vec[_atom_site["label_alt_id"]];
-                resi_chain=asym_id+resi;
-                if (alt_id_dict.count(resi_chain)==0)
-                    alt_id_dict[resi_chain]=alt_id;
-                else if (alt_id_dict.count(resi_chain) && alt_id!=alt_id_dict[resi_chain])
-                    continue;
-                //if (alt_id!="." && alt_id!="A") continue;
-            }
-
-            if (prev_asym_id!=asym_id)
-            {
-                if (prev_asym_id!="" && ter_opt>=2) break;
-                if (split_opt>=2)
-                {
-                    PDB_lines.push_back(tmp_str_vec);
-                    mol_vec.push_back(0);
-
-                    if (split_opt==1 && ter_opt==0) chainID_list.push_back(
-                        ':'+model_index);
-                    else if (split_opt==2 && ter_opt==0)
-                        chainID_list.push_back(':'+model_index+','+asym_id);
-                    else //if (split_opt==2 && ter_opt==1)
-                        chainID_list.push_back(':'+asym_id);
-                    //else
-                        //chainID_list.push_back("");
-                }
-            }
-            if (prev_asym_id!=asym_id) prev_asym_id=asym_id;
-
-            if (AA[0]==' ' && (AA[1]=='D'||AA[1]==' ')) mol_vec.back()++;
-            else mol_vec.back()--;
-
-            if (prev_resi==resi && atom_opt!="PC4'")
-                cerr<<"Warning! Duplicated residue "<<resi<<endl;
-            prev_resi=resi;
-
-            i++;
-            i8_stream<<"ATOM  "
-                <<setw(5)<<i<<" "<<atom<<" "<<AA<<" "<<asym_id[0]
-                <<setw(5)<<resi.substr(0,5)<<"   "
-                <<setw(8)<<line_vec[_atom_site["Cartn_x"]].substr(0,8)
-                <<setw(8)<<line_vec[_atom_site["Cartn_y"]].substr(0,8)
-                <<setw(8)<<line_vec[_atom_site["Cartn_z"]].substr(0,8);
-            PDB_lines.back().push_back(i8_stream.str());
-            i8_stream.str(string());
-        }
-        _atom_site.clear();
-        line_vec.clear();
-        alt_id.clear();
-        asym_id.clear();
-        AA.clear();
-        map<string, string>().swap(alt_id_dict);
-        resi_chain.clear();
-    }
-
     if      (compress_type>=1) fin_gz.close();
     else if (compress_type==0) fin.close();
     line.clear();
@@ -705,22 +944,12 @@ size_t get_FASTA_lines(const string filename,
     
     int compress_type=0; // uncompressed file
     ifstream fin;
-#ifndef REDI_PSTREAM_H_SEEN
+#ifndef GZSTREAM_H_SEEN
     ifstream fin_gz;
 #else
-    redi::ipstream fin_gz; // if file is compressed
-    if (filename.size()>=3 && 
-        filename.substr(filename.size()-3,3)==".gz")
-    {
-        fin_gz.open("gunzip -c '"+filename+"'");
-        compress_type=1;
-    }
-    else if (filename.size()>=4 && 
-        filename.substr(filename.size()-4,4)==".bz2")
-    {
-        fin_gz.open("bzcat '"+filename+"'");
-        compress_type=2;
-    }
+    gzistream fin_gz; // if file is compressed
+    compress_type=gz_compress_type(filename);
+    if (compress_type) fin_gz.open(filename);
     else 
 #endif
     {
@@ -786,6 +1015,24 @@ int read_PDB(const vector<string> &PDB_lines, double **a, char *seq,
     return i;
 }
 
+int read_PDB(const PDBChain &chain, double **a, char *seq,
+    vector<string> &resi_vec, const int read_resi)
+{
+    size_t i;
+    for (i=0;i<chain.size();i++)
+    {
+        a[i][0] = chain.xyz[3*i];
+        a[i][1] = chain.xyz[3*i+1];
+        a[i][2] = chain.xyz[3*i+2];
+        seq[i]  = chain.seq[i];
+
+        if (read_resi>=2) resi_vec.push_back(chain.resi.substr(6*i,6));
+        if (read_resi==1) resi_vec.push_back(chain.resi.substr(6*i,5));
+    }
+    seq[i]='\0'; 
+    return i;
+}
+
 double dist(double x[3], double y[3])
 {
     double d1=x[0]-y[0];
@@ -0,0 +1,216 @@
+/* Parallel reader of the structure files clustered by qTMclust and
+ * qTMclust+. Files are parsed, including secondary structure assignment,
+ * by a pool of threads while the main thread appends the chains of each
+ * file in the order of chain_list, so that chain indices and log messages
+ * are the same as reading the files one by one. At most a few files per
+ * thread are parsed ahead of the main thread, which bounds the memory used
+ * by parsed but not yet appended chains. */
+#ifndef TMalign_chain_reader_h
+#define TMalign_chain_reader_h 1
+
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+
+#include "TMalign.h"
+#include "struct_db.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+/* chains parsed from one structure file */
+struct ParsedFile
+{
+    vector<string> chainID_list;
+    vector<int>    mol_vec;
+    vector<vector<char> > seq_vec;
+    vector<vector<char> > sec_vec;
+    vector<vector<vector<float> > >xyz_vec;
+    bool done;
+
+    ParsedFile(): done(false) {}
+
+    void clear()
+    {
+        vector<string>().swap(chainID_list);
+        vector<int>().swap(mol_vec);
+        vector<vector<char> >().swap(seq_vec);
+        vector<vector<char> >().swap(sec_vec);
+        vector<vector<vector<float> > >().swap(xyz_vec);
+        done=false;
+    }
+};
+
+class ChainReader
+{
+public:
+    /* db is only used for -infmt 4 */
+    ChainReader(const StructDB *db, const int ter_opt, const int infmt_opt,
+        const string &atom_opt, const string &mol_opt, const int split_opt,
+        const int het_opt, const int byresi_opt,
+        const vector<string> &chain2parse, const vector<string> &model2parse):
+        db(db), ter_opt(ter_opt), infmt_opt(infmt_opt), atom_opt(atom_opt),
+        mol_opt(mol_opt), split_opt(split_opt), het_opt(het_opt),
+        byresi_opt(byresi_opt), chain2parse(chain2parse),
+        model2parse(model2parse) {}
+
+    /* parse the files of chain_list with nthreads threads and append their
+     * chains to chainID_list, mol_vec, seq_vec, sec_vec, xyz_vec and
+     * chainLen_list. Chain IDs are prefixed by the file name without
+     * dir_opt and suffix_opt. Return the number of chains */
+    size_t read(const vector<string> &chain_list, const string &dir_opt,
+        const string &suffix_opt, const int nthreads,
+        vector<string> &chainID_list, vector<int> &mol_vec,
+        vector<vector<char> > &seq_vec, vector<vector<char> > &sec_vec,
+        vector<vector<vector<float> > > &xyz_vec,
+        vector<pair<int,size_t> > &chainLen_list)
+    {
+        const size_t file_num=chain_list.size();
+        const size_t window=4*nthreads;
+        const size_t progress_step=1000; // files between progress reports
+        vector<ParsedFile> slot_vec(min(window,file_num));
+        chrono::steady_clock::time_point start=chrono::steady_clock::now();
+        size_t chain_num=0;
+        size_t i,j,k;
+        string chain_name;
+
+        ThreadPool pool(nthreads);
+        for (i=0;i<slot_vec.size();i++) submit(pool, chain_list, i, slot_vec);
+        for (i=0;i<file_num;i++)
+        {
+            ParsedFile &slot=slot_vec[i%slot_vec.size()];
+            {
+                unique_lock<mutex> lock(mtx);
+                while (!slot.done) cv_done.wait(lock);
+            }
+
+            const string &xname=chain_list[i];
+            if (slot.chainID_list.size()==0) cerr<<"Warning! Cannot parse "
+                <<"file: "<<xname<<". Chain number 0."<<endl;
+            chain_name=xname.substr(dir_opt.size(),
+                xname.size()-dir_opt.size()-suffix_opt.size());
+            for (j=0;j<slot.chainID_list.size();j++)
+            {
+                k=chainID_list.size();
+                chainID_list.push_back(chain_name+slot.chainID_list[j]);
+                mol_vec.push_back(slot.mol_vec[j]);
+                seq_vec.push_back(vector<char>());
+                seq_vec.back().swap(slot.seq_vec[j]);
+                sec_vec.push_back(vector<char>());
+                sec_vec.back().swap(slot.sec_vec[j]);
+                xyz_vec.push_back(vector<vector<float> >());
+                xyz_vec.back().swap(slot.xyz_vec[j]);
+                chainLen_list.push_back(make_pair(xyz_vec[k].size(),k));
+                cout<<"Parsing "<<xname<<'\t'<<chainID_list[k]
+                    <<" ("<<xyz_vec[k].size()<<" residues)."<<endl;
+            }
+            chain_num+=slot.chainID_list.size();
+            slot.clear();
+            if (i+window<file_num) submit(pool, chain_list, i+window, slot_vec);
+
+            if ((i+1)%progress_step==0 || i+1==file_num)
+            {
+                double sec=chrono::duration<double>(
+                    chrono::steady_clock::now()-start).count();
+                ios::fmtflags flags=cout.flags();
+                streamsize precision=cout.precision();
+                cout<<"Read "<<i+1<<" of "<<file_num<<" files ("<<chain_num
+                    <<" chains) in "<<setiosflags(ios::fixed)<<setprecision(2)
+                    <<sec<<" seconds, "<<(i+1)/max(sec,1e-6)<<" files/s, "
+                    <<chain_num/max(sec,1e-6)<<" chains/s."<<endl;
+                cout.flags(flags);
+                cout.precision(precision);
+            }
+        }
+        return chain_num;
+    }
+
+private:
+    void submit(ThreadPool &pool, const vector<string> &chain_list,
+        const size_t i, vector<ParsedFile> &slot_vec)
+    {
+        const string *xname=&chain_list[i];
+        ParsedFile *slot=&slot_vec[i%slot_vec.size()];
+        pool.submit([this,xname,slot](int)
+        {
+            parse_file(*xname, *slot);
+            {
+                lock_guard<mutex> lock(mtx);
+                slot->done=true;
+            }
+            cv_done.notify_all();
+        });
+    }
+
+    /* parse the chains of xname into slot */
+    void parse_file(const string &xname, ParsedFile &slot) const
+    {
+        vector<PDBChain> PDB_lines; // residues of chain
+        vector<size_t> db_chain;    // chain index in db for -infmt 4
+        vector<string> resi_vec;    // residue index, dummy variable
+        vector<char>   seq_tmp;
+        vector<char>   sec_tmp;
+        double **xa;
+        size_t newchainnum,j;
+        int xlen,r;
+
+        if (infmt_opt==4) newchainnum=db->get_chains(xname, db_chain,
+            slot.chainID_list, slot.mol_vec);
+        else newchainnum=get_PDB_lines(xname, PDB_lines, slot.chainID_list,
+            slot.mol_vec, ter_opt, infmt_opt, atom_opt, false, split_opt,
+            het_opt, chain2parse, model2parse);
+        slot.seq_vec.resize(newchainnum);
+        slot.sec_vec.resize(newchainnum);
+        slot.xyz_vec.resize(newchainnum);
+        for (j=0;j<newchainnum;j++)
+        {
+            xlen=(infmt_opt==4)?db->get_len(db_chain[j]):PDB_lines[j].size();
+            int db_mol_type=slot.mol_vec[j];
+            if (mol_opt=="RNA") slot.mol_vec[j]=1;
+            else if (mol_opt=="protein") slot.mol_vec[j]=-1;
+
+            NewArray(&xa, xlen, 3);
+            seq_tmp.assign(xlen+1,'A');
+            sec_tmp.assign(xlen+1,0);
+
+            if (infmt_opt==4) db->read_chain(db_chain[j], xa, &seq_tmp[0],
+                &sec_tmp[0], resi_vec, byresi_opt);
+            else read_PDB(PDB_lines[j], xa, &seq_tmp[0], resi_vec, byresi_opt);
+            resi_vec.clear();
+
+            /* the secondary structure in db is kept unless it changes */
+            if (infmt_opt==4 && (db_mol_type>0)==(slot.mol_vec[j]>0)) ;
+            else if (slot.mol_vec[j]<=0) make_sec(xa, xlen, &sec_tmp[0]);
+            else make_sec(&seq_tmp[0],xa,xlen,&sec_tmp[0],atom_opt);
+
+            slot.xyz_vec[j].assign(xlen,vector<float>(3,0));
+            for (r=0;r<xlen;r++)
+            {
+                slot.xyz_vec[j][r][0]=xa[r][0];
+                slot.xyz_vec[j][r][1]=xa[r][1];
+                slot.xyz_vec[j][r][2]=xa[r][2];
+            }
+            slot.seq_vec[j].swap(seq_tmp);
+            slot.sec_vec[j].swap(sec_tmp);
+
+            DeleteArray(&xa, xlen);
+            if (infmt_opt!=4) PDB_lines[j].clear();
+        }
+    }
+
+    const StructDB *db;
+    const int ter_opt;
+    const int infmt_opt;
+    const string atom_opt;
+    const string mol_opt;
+    const int split_opt;
+    const int het_opt;
+    const int byresi_opt;
+    const vector<string> chain2parse;
+    const vector<string> model2parse;
+
+    mutex mtx;
+    condition_variable cv_done; // a file is parsed
+};
+
+#endif
@@ -15,7 +15,7 @@
 #include <iomanip>
 #include <map>
 
-#include "pstream.h" // For reading gzip and bz2 compressed files
+#include "cif_reader.h" // For reading gzip and bz2 compressed mmCIF files
 
 using namespace std;
 
@@ -65,30 +65,6 @@ string Trim(const string &inputString)
     return result;
 }
 
-/* split a long string into vectors by whitespace 
- * line          - input string
- * line_vec      - output vector 
- * delimiter     - delimiter */
-void split(const string &line, vector<string> &line_vec,
-    const char delimiter=' ')
-{
-    bool within_word = false;
-    for (size_t pos=0;pos<line.size();pos++)
-    {
-        if (line[pos]==delimiter)
-        {
-            within_word = false;
-            continue;
-        }
-        if (!within_word)
-        {
-            within_word = true;
-            line_vec.push_back("");
-        }
-        line_vec.back()+=line[pos];
-    }
-}
-
 void write_mmcif_to_pdb(const string filename,
     const vector<vector<string> >&PDB_lines,
     const vector<string> &chainID_list, const int split_opt)
@@ -236,36 +212,10 @@ size_t get_all_mmcif_lines(const string filename, const string chain_opt,
     const bool hoh_opt,  const bool lig_opt, const bool mse_opt)
 {
     size_t a=0; // atom index
-    string line;
     bool select_atom=false;
     size_t model_idx=0;
     vector<string> tmp_str_vec;
-    
-    int compress_type=0; // uncompressed file
-    ifstream fin;
-    redi::ipstream fin_gz; // if file is compressed
-    if (filename.size()>=3 && 
-        filename.substr(filename.size()-3,3)==".gz")
-    {
-        fin_gz.open("gunzip -c '"+filename+"'");
-        compress_type=1;
-    }
-    else if (filename.size()>=4 && 
-        filename.substr(filename.size()-4,4)==".bz2")
-    {
-        fin_gz.open("bzcat '"+filename+"'");
-        compress_type=2;
-    }
-    else
-    {
-        if (filename=="-") compress_type=-1;
-        else fin.open(filename.c_str());
-    }
 
-    bool loop_ = false; // not reading following content
-    map<string,int> _atom_site;
-    int atom_site_pos;
-    vector<string> line_vec;
     string group_PDB="ATOM  ";
     string alt_id=" ";  // alternative location indicator
     string asym_id="."; // this is similar to chainID, except that
@@ -279,74 +229,14 @@ size_t get_all_mmcif_lines(const string filename, const string chain_opt,
     stringstream i8_stream;
     map<string, string> alt_id_dict; // resi -> alt_id
     string resi_chain;
-    while ((compress_type==-1)?cin.good():(compress_type?fin_gz.good():fin.good()))
+    CIFAtomSiteReader cif;
+    if (!cif.open(filename))
+        PrintErrorAndQuit("Can not open file: "+filename);
+    while (cif.next_row())
     {
-        if  (compress_type==-1) getline(cin, line);
-        else if (compress_type) getline(fin_gz, line);
-        else                    getline(fin, line);
-        if (line.size()==0) continue;
-        if (loop_) loop_ = (line.size()>=2)?(line.compare(0,2,"# ")):(line.compare(0,1,"#"));
-        if (!loop_)
-        {
-            if (line.compare(0,5,"loop_")) continue;
-            while(1)
-            {
-                if (compress_type==-1)
-                {
-                    if (cin.good()) getline(cin, line);
-                    else PrintErrorAndQuit("ERROR! Unexpected end of "+filename);
-                }
-                else if (compress_type)
-                {
-                    if (fin_gz.good()) getline(fin_gz, line);
-                    else PrintErrorAndQuit("ERROR! Unexpected end of "+filename);
-                }
-                else
-                {
-                    if (fin.good()) getline(fin, line);
-                    else PrintErrorAndQuit("ERROR! Unexpected end of "+filename);
-                }
-                if (line.size()) break;
-            }
-            if (line.compare(0,11,"_atom_site.")) continue; 
-           
-            loop_=true;
-            _atom_site.clear();
-            atom_site_pos=0;
-            _atom_site[Trim(line.substr(11))]=atom_site_pos;
-
-            while(1)
-            {
-                if  (compress_type==-1) getline(cin, line);
-                else if (compress_type) getline(fin_gz, line);
-                else                    getline(fin, line);
-                if (line.size()==0) continue;
-                if (line.compare(0,11,"_atom_site.")) break;
-                _atom_site[Trim(line.substr(11))]=++atom_site_pos;
-            }
-
-            if (_atom_site.count("group_PDB")*
-                _atom_site.count("label_atom_id")*
-                _atom_site.count("label_comp_id")*
-               (_atom_site.count("auth_asym_id")+
-                _atom_site.count("label_asym_id"))*
-               (_atom_site.count("auth_seq_id")+
-                _atom_site.count("label_seq_id"))*
-                _atom_site.count("Cartn_x")*
-                _atom_site.count("Cartn_y")*
-                _atom_site.count("Cartn_z")==0)
-            {
-                loop_ = false;
-                cerr<<"Warning! Missing one of the following _atom_site data items: group_PDB, label_atom_id, label_comp_id, auth_asym_id/label_asym_id, auth_seq_id/label_seq_id, Cartn_x, Cartn_y, Cartn_z"<<endl;
-                continue;
-            }
-        }
-
-        line_vec.clear();
-        split(line,line_vec);
-        atom     =line_vec[_atom_site["label_atom_id"]];
-        resn     =line_vec[_atom_site["label_comp_id"]];
-        group_PDB=line_vec[_atom_site["group_PDB"]];
+        atom     =cif.str(CIF_label_atom_id);
+        resn     =cif.str(CIF_label_comp_id);
+        group_PDB=cif.str(CIF_group_PDB);
         if (group_PDB=="ATOM") group_PDB="ATOM  ";
         if (mse_opt && resn=="MSE")
         {
@@ -389,37 +279,37 @@ size_t get_all_mmcif_lines(const string filename, const string chain_opt,
         else if (atom.size()==3) atom=" "+atom;
         else if (atom.size()>=5) atom=atom.substr(0,4);
         
-        if (_atom_site.count("auth_seq_id"))
-             resi=line_vec[_atom_site["auth_seq_id"]];
-        else resi=line_vec[_atom_site["label_seq_id"]];
-        if (_atom_site.count("pdbx_PDB_ins_code") && 
-            line_vec[_atom_site["pdbx_PDB_ins_code"]]!="?")
-            resi+=line_vec[_atom_site["pdbx_PDB_ins_code"]][0];
+        if (cif.has(CIF_auth_seq_id))
+             resi=cif.str(CIF_auth_seq_id);
+        else resi=cif.str(CIF_label_seq_id);
+        if (cif.has(CIF_pdbx_PDB_ins_code) && 
+            !cif.equal(CIF_pdbx_PDB_ins_code,"?"))
+            resi+=cif.str(CIF_pdbx_PDB_ins_code,1);
         else resi+=" ";
         if (resi.size()>5)
         {
-            cerr<<"WARNING! Cannot parse line due to long residue index\n"<<line<<endl;
+            cerr<<"WARNING! Cannot parse line due to long residue index\n"<<cif.line()<<endl;
             continue;
         }
 
-        if (_atom_site.count("auth_asym_id"))
-             asym_id=line_vec[_atom_site["auth_asym_id"]];
-        else asym_id=line_vec[_atom_site["label_asym_id"]];
+        if (cif.has(CIF_auth_asym_id))
+             asym_id=cif.str(CIF_auth_asym_id);
+        else asym_id=cif.str(CIF_label_asym_id);
         if (asym_id==".") asym_id=" ";
         if (chain_opt.size() && asym_id!=chain_opt &&
             !(asym_id==" " && (chain_opt=="_" || chain_opt=="."))) continue;
             
-        if (_atom_site.count("pdbx_PDB_model_num") && 
-            model_index!=line_vec[_atom_site["pdbx_PDB_model_num"]])
+        if (cif.has(CIF_pdbx_PDB_model_num) && 
+            !cif.equal(CIF_pdbx_PDB_model_num, model_index))
         {
             if (PDB_lines.size()) break;
-            model_index=line_vec[_atom_site["pdbx_PDB_model_num"]];
+            model_index=cif.str(CIF_pdbx_PDB_model_num);
             map<string, string>().swap(alt_id_dict);
         }
 
-        if (_atom_site.count("label_alt_id")) // in 39.4 % of entries
+        if (cif.has(CIF_label_alt_id)) // in 39.4 % of entries
         {
-            alt_id=line_vec[_atom_site["label_alt_id"]];
+            alt_id=cif.str(CIF_label_alt_id);
             if (alt_id==".") alt_id=" ";
             else
             {
@@ -444,34 +334,29 @@ size_t get_all_mmcif_lines(const string filename, const string chain_opt,
         i8_stream<<group_PDB
             <<setw(5)<<a<<" "<<atom<<alt_id<<resn<<" "<<asym_id[asym_id.size()-1]
             <<setw(5)<<resi<<"   "
-            <<setw(8)<<line_vec[_atom_site["Cartn_x"]].substr(0,8)
-            <<setw(8)<<line_vec[_atom_site["Cartn_y"]].substr(0,8)
-            <<setw(8)<<line_vec[_atom_site["Cartn_z"]].substr(0,8);
-        if (_atom_site.count("B_iso_or_equiv"))
+            <<setw(8)<<cif.str(CIF_Cartn_x,8)
+            <<setw(8)<<cif.str(CIF_Cartn_y,8)
+            <<setw(8)<<cif.str(CIF_Cartn_z,8);
+        if (cif.has(CIF_B_iso_or_equiv))
         {
-            i8_stream<<"  1.00"<<setw(6)<<line_vec[_atom_site["B_iso_or_equiv"]].substr(0,6);
-            if (_atom_site.count("type_symbol"))
-                i8_stream<<setw(12)<<line_vec[_atom_site["type_symbol"]].substr(0,12);
+            i8_stream<<"  1.00"<<setw(6)<<cif.str(CIF_B_iso_or_equiv,6);
+            if (cif.has(CIF_type_symbol))
+                i8_stream<<setw(12)<<cif.str(CIF_type_symbol,12);
         }
         i8_stream<<endl;
         PDB_lines.back().push_back(i8_stream.str());
         i8_stream.str(string());
     }
+    if (cif.is_truncated())
+        PrintErrorAndQuit("ERROR! Unexpected end of "+filename);
     group_PDB.clear();
-    _atom_site.clear();
-    line_vec.clear();
     alt_id.clear();
     asym_id.clear();
     resn.clear();
     map<string, string>().swap(alt_id_dict);
     resi_chain.clear();
 
-    if (compress_type>=0)
-    {
-        if (compress_type) fin_gz.close();
-        else               fin.close();
-    }
-    line.clear();
+    cif.close();
     chainID_list.push_back("");
     return PDB_lines.size();
 }
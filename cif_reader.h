@@ -0,0 +1,316 @@
+/* Reader of the _atom_site loop of PDBx/mmCIF files, shared by
+ * get_PDB_lines (-infmt 3) and cif2pdb. Uncompressed files are memory-mapped
+ * and other input is read in large blocks. Each row is tokenized in place:
+ * only the positions of the fields up to the last needed data item are
+ * recorded, and nothing is copied unless the caller asks for a string.
+ *
+ * As in the line-based parser it replaces, each row is one line and fields
+ * are separated by spaces. */
+#ifndef TMalign_cif_reader_h
+#define TMalign_cif_reader_h 1
+
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "gzstream.h"
+
+using namespace std;
+
+/* _atom_site data items used by the parsers */
+enum
+{
+    CIF_group_PDB,
+    CIF_label_atom_id,
+    CIF_label_comp_id,
+    CIF_label_alt_id,
+    CIF_auth_asym_id,
+    CIF_label_asym_id,
+    CIF_auth_seq_id,
+    CIF_label_seq_id,
+    CIF_pdbx_PDB_ins_code,
+    CIF_pdbx_PDB_model_num,
+    CIF_Cartn_x,
+    CIF_Cartn_y,
+    CIF_Cartn_z,
+    CIF_B_iso_or_equiv,
+    CIF_type_symbol,
+    CIF_item_num
+};
+
+class CIFAtomSiteReader
+{
+public:
+    CIFAtomSiteReader(): map_data(NULL), map_size(0), in(NULL),
+        pos(0), end(0), in_eof(true), loop_(false), truncated(false)
+    {
+        for (int k=0;k<CIF_item_num;k++) col[k]=-1;
+    }
+
+    ~CIFAtomSiteReader() { close(); }
+
+    /* open filename, which is read from stdin if it is "-" */
+    bool open(const string &filename)
+    {
+        close();
+        if (filename=="-")
+        {
+            in=&cin;
+            in_eof=false;
+            return true;
+        }
+#ifdef GZSTREAM_H_SEEN
+        if (gz_compress_type(filename))
+        {
+            fin_gz.open(filename);
+            if (!fin_gz.is_open()) return false;
+            in=&fin_gz;
+            in_eof=false;
+            return true;
+        }
+#endif
+#ifndef _WIN32
+        int fd=::open(filename.c_str(), O_RDONLY);
+        if (fd<0) return false;
+        struct stat st;
+        bool regular=(fstat(fd, &st)==0 && S_ISREG(st.st_mode));
+        bool empty=(regular && st.st_size==0);
+        if (regular && !empty)
+        {
+            void *p=mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p!=MAP_FAILED)
+            {
+                map_data=(const char *)p;
+                map_size=st.st_size;
+#ifdef MADV_SEQUENTIAL
+                madvise(p, map_size, MADV_SEQUENTIAL);
+#endif
+            }
+        }
+        ::close(fd);
+        if (map_data || empty)
+        {
+            end=map_size;
+            return true;
+        }
+#endif
+        fin.open(filename.c_str(), ios::binary);
+        if (!fin.is_open()) return false;
+        in=&fin;
+        in_eof=false;
+        return true;
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+        if (map_data) munmap((void *)map_data, map_size);
+#endif
+        map_data=NULL;
+        map_size=0;
+        if (fin.is_open()) fin.close();
+#ifdef GZSTREAM_H_SEEN
+        if (fin_gz.is_open()) fin_gz.close();
+#endif
+        in=NULL;
+        pos=end=0;
+        in_eof=true;
+        loop_=false;
+        truncated=false;
+    }
+
+    /* move to the next row of an _atom_site loop that has group_PDB,
+     * label_atom_id, label_comp_id, auth_asym_id or label_asym_id,
+     * auth_seq_id or label_seq_id and Cartn_x/y/z. Return false at the end
+     * of file, or if the file ends right after "loop_" (see truncated) */
+    bool next_row()
+    {
+        while (next_line())
+        {
+            if (line_len==0) continue;
+            if (loop_) loop_=(line_len>=2)?(memcmp(line_ptr,"# ",2)!=0):
+                (line_ptr[0]!='#');
+            if (!loop_)
+            {
+                if (!line_starts("loop_")) continue;
+                do
+                {
+                    if (next_line()) continue;
+                    truncated=true;
+                    return false;
+                } while (line_len==0);
+                if (!line_starts("_atom_site.")) continue;
+
+                loop_=true;
+                int k,atom_site_pos=0;
+                for (k=0;k<CIF_item_num;k++) col[k]=-1;
+                add_item(atom_site_pos);
+                while (1)
+                {
+                    if (!next_line()) return false;
+                    if (line_len==0) continue;
+                    if (!line_starts("_atom_site.")) break;
+                    add_item(++atom_site_pos);
+                }
+
+                if (col[CIF_group_PDB]<0 || col[CIF_label_atom_id]<0 ||
+                    col[CIF_label_comp_id]<0 ||
+                   (col[CIF_auth_asym_id]<0 && col[CIF_label_asym_id]<0) ||
+                   (col[CIF_auth_seq_id]<0  && col[CIF_label_seq_id]<0) ||
+                    col[CIF_Cartn_x]<0 || col[CIF_Cartn_y]<0 ||
+                    col[CIF_Cartn_z]<0)
+                {
+                    loop_ = false;
+                    cerr<<"Warning! Missing one of the following _atom_site data items: group_PDB, label_atom_id, label_comp_id, auth_asym_id/label_asym_id, auth_seq_id/label_seq_id, Cartn_x, Cartn_y, Cartn_z"<<endl;
+                    continue;
+                }
+                max_col=-1;
+                for (k=0;k<CIF_item_num;k++) if (col[k]>max_col) max_col=col[k];
+                field_ptr.resize(max_col+1);
+                field_len.resize(max_col+1);
+            }
+            tokenize();
+            return true;
+        }
+        return false;
+    }
+
+    /* whether the file ended right after "loop_" */
+    bool is_truncated() const { return truncated; }
+
+    /* whether data item is present in the current loop */
+    bool has(const int item) const { return col[item]>=0; }
+
+    /* field of data item in the current row. Empty if it is missing */
+    size_t size(const int item) const
+    {
+        return col[item]>=0?field_len[col[item]]:0;
+    }
+
+    const char *data(const int item) const
+    {
+        return col[item]>=0?field_ptr[col[item]]:"";
+    }
+
+    bool equal(const int item, const char *str) const
+    {
+        size_t len=strlen(str);
+        return size(item)==len && memcmp(data(item), str, len)==0;
+    }
+
+    bool equal(const int item, const string &str) const
+    {
+        return str.compare(0, string::npos, data(item), size(item))==0;
+    }
+
+    /* at most the first n characters of the field */
+    string str(const int item, const size_t n=string::npos) const
+    {
+        return string(data(item), min(size(item), n));
+    }
+
+    /* text of the current row */
+    string line() const { return string(line_ptr, line_len); }
+
+private:
+    /* next line without the trailing '\n'. Return false at end of file */
+    bool next_line()
+    {
+        const char *buf=map_data?map_data:(block.size()?&block[0]:NULL);
+        const char *p=(pos<end)?(const char *)memchr(buf+pos,'\n',end-pos):NULL;
+        while (!p && !in_eof)
+        {
+            /* keep the partial line and read the next block after it */
+            size_t len=end-pos;
+            if (len && pos) memmove(&block[0], &block[pos], len);
+            pos=0;
+            end=len;
+            if (block.size()<2*end+block_size) block.resize(2*end+block_size);
+            in->read(&block[end], block.size()-end);
+            end+=in->gcount();
+            if (!in->good()) in_eof=true;
+            buf=&block[0];
+            p=(pos<end)?(const char *)memchr(buf+pos,'\n',end-pos):NULL;
+        }
+        if (pos>=end) return false;
+        line_ptr=buf+pos;
+        line_len=(p?p:buf+end)-line_ptr;
+        pos+=line_len+(p!=NULL);
+        return true;
+    }
+
+    bool line_starts(const char *str) const
+    {
+        size_t len=strlen(str);
+        return line_len>=len && memcmp(line_ptr, str, len)==0;
+    }
+
+    /* record the column of data item in line "_atom_site.item" */
+    void add_item(const int atom_site_pos)
+    {
+        static const char *item_name[CIF_item_num]={
+            "group_PDB", "label_atom_id", "label_comp_id", "label_alt_id",
+            "auth_asym_id", "label_asym_id", "auth_seq_id", "label_seq_id",
+            "pdbx_PDB_ins_code", "pdbx_PDB_model_num", "Cartn_x", "Cartn_y",
+            "Cartn_z", "B_iso_or_equiv", "type_symbol"};
+        const char *b=line_ptr+11;
+        const char *e=line_ptr+line_len;
+        while (b<e && is_cif_space(*b)) b++;
+        while (e>b && is_cif_space(*(e-1))) e--;
+        for (int k=0;k<CIF_item_num;k++)
+            if (strlen(item_name[k])==(size_t)(e-b) &&
+                memcmp(item_name[k], b, e-b)==0) col[k]=atom_site_pos;
+    }
+
+    static bool is_cif_space(const char c)
+    {
+        return c==' ' || c=='\n' || c=='\r' || c=='\t';
+    }
+
+    /* locate the space-separated fields up to column max_col */
+    void tokenize()
+    {
+        const char *p=line_ptr;
+        const char *e=line_ptr+line_len;
+        int c;
+        for (c=0;c<=max_col;c++)
+        {
+            while (p<e && *p==' ') p++;
+            field_ptr[c]=p;
+            while (p<e && *p!=' ') p++;
+            field_len[c]=p-field_ptr[c];
+        }
+    }
+
+    static const size_t block_size=1<<20;
+
+    const char *map_data;   // memory-mapped file
+    size_t map_size;
+    ifstream fin;
+#ifdef GZSTREAM_H_SEEN
+    gzistream fin_gz;
+#endif
+    istream *in;            // input read in blocks if not memory-mapped
+    vector<char> block;
+    size_t pos, end;        // unread part of map_data or block
+    bool in_eof;
+    const char *line_ptr;
+    size_t line_len;
+
+    bool loop_;             // reading an _atom_site loop
+    bool truncated;
+    int col[CIF_item_num];  // column of each data item, -1 if missing
+    int max_col;
+    vector<const char *> field_ptr;
+    vector<size_t> field_len;
+};
+
+#endif
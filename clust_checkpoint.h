@@ -0,0 +1,186 @@
+/* Checkpoint of the greedy clustering of qTMclust and qTMclust+, which is
+ * written every -ckpt_step chains and read by -resume. It keeps the index
+ * of the next chain to cluster, clust_mem_vec, clust_repr_vec and
+ * clust_repr_map, so that chains clustered before the checkpoint are not
+ * aligned again. The checkpoint is binary:
+ *   header        - ClustCkptHeader
+ *   clust_mem_vec - uint64 * chain_num
+ *   clust_repr_vec- uint64 * repr_num
+ *   clust_repr_map- uint64 (chain, cluster) pairs * map_num
+ * Integers are stored in the byte order of the machine that wrote it. */
+#ifndef TMalign_clust_checkpoint_h
+#define TMalign_clust_checkpoint_h 1
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "basic_fun.h"
+
+using namespace std;
+
+const char ClustCkpt_magic[8]={'Q','T','M','C','K','P','0','1'};
+
+struct ClustCkptHeader
+{
+    char     magic[8];
+    uint64_t fingerprint; // chains and options of the clustering
+    uint64_t chain_num;   // size of clust_mem_vec
+    uint64_t next_i;      // index in chainLen_list of the next chain
+    uint64_t repr_num;    // size of clust_repr_vec
+    uint64_t map_num;     // size of clust_repr_map
+};
+
+/* FNV-1a hash of str, continued from h */
+uint64_t fnv1a_hash(uint64_t h, const string &str)
+{
+    for (size_t c=0;c<str.size();c++)
+    {
+        h^=(unsigned char)str[c];
+        h*=1099511628211ULL;
+    }
+    return h;
+}
+
+/* hash of the chains in clustering order, of their molecule types, of
+ * the initial clusters of -init, of the old clusters of -update and of
+ * the options that change the clusters. A checkpoint is only resumed
+ * with the same value */
+uint64_t clust_fingerprint(const vector<pair<int,size_t> >&chainLen_list,
+    const vector<string>&chainID_list, const vector<int>&mol_vec,
+    const map<string, map<string,bool> >&init_cluster,
+    const double TMcut, const int s_opt, const bool fast_opt,
+    const vector<vector<string> >&old_clust_vec=vector<vector<string> >())
+{
+    stringstream ss;
+    ss<<TMcut<<' '<<s_opt<<' '<<fast_opt<<'\n';
+    uint64_t h=fnv1a_hash(14695981039346656037ULL, ss.str());
+    for (size_t i=0;i<chainLen_list.size();i++)
+    {
+        ss.str(string());
+        ss<<chainID_list[chainLen_list[i].second]<<'\t'
+          <<chainLen_list[i].first<<'\t'
+          <<(mol_vec[chainLen_list[i].second]>0)<<'\n'; // RNA if >0
+        h=fnv1a_hash(h, ss.str());
+    }
+    map<string, map<string,bool> >::const_iterator it;
+    map<string,bool>::const_iterator mem_it;
+    for (it=init_cluster.begin();it!=init_cluster.end();it++)
+    {
+        ss.str(string());
+        ss<<it->first;
+        for (mem_it=it->second.begin();mem_it!=it->second.end();mem_it++)
+            ss<<'\t'<<mem_it->first;
+        ss<<'\n';
+        h=fnv1a_hash(h, ss.str());
+    }
+    for (size_t i=0;i<old_clust_vec.size();i++)
+    {
+        ss.str(string());
+        ss<<'>';
+        for (size_t j=0;j<old_clust_vec[i].size();j++)
+            ss<<old_clust_vec[i][j]<<'\t';
+        ss<<'\n';
+        h=fnv1a_hash(h, ss.str());
+    }
+    return h;
+}
+
+/* write the checkpoint to filename+".tmp" and rename it to filename, so
+ * that an interrupted write does not destroy the previous checkpoint */
+void write_clust_checkpoint(const string &filename,
+    const uint64_t fingerprint, const size_t next_i,
+    const vector<size_t>&clust_mem_vec, const vector<size_t>&clust_repr_vec,
+    const map<size_t,size_t>&clust_repr_map)
+{
+    ClustCkptHeader header;
+    memcpy(header.magic, ClustCkpt_magic, 8);
+    header.fingerprint=fingerprint;
+    header.chain_num=clust_mem_vec.size();
+    header.next_i=next_i;
+    header.repr_num=clust_repr_vec.size();
+    header.map_num=clust_repr_map.size();
+
+    vector<uint64_t> buf;
+    buf.reserve(header.chain_num+header.repr_num+2*header.map_num);
+    buf.assign(clust_mem_vec.begin(),clust_mem_vec.end());
+    buf.insert(buf.end(),clust_repr_vec.begin(),clust_repr_vec.end());
+    for (map<size_t,size_t>::const_iterator it=clust_repr_map.begin();
+        it!=clust_repr_map.end();it++)
+    {
+        buf.push_back(it->first);
+        buf.push_back(it->second);
+    }
+
+    string tmpname=filename+".tmp";
+    ofstream fout(tmpname.c_str(), ios::binary);
+    fout.write((const char *)&header, sizeof(header));
+    if (buf.size()) fout.write((const char *)&buf[0],
+        sizeof(uint64_t)*buf.size());
+    fout.close();
+    if (!fout.good() || rename(tmpname.c_str(), filename.c_str()))
+    {
+        cerr<<"WARNING! Cannot write checkpoint "<<filename<<endl;
+        return;
+    }
+    cout<<"Checkpoint "<<filename<<" written before chain #"<<next_i<<endl;
+}
+
+/* read the checkpoint written by write_clust_checkpoint and return the
+ * index of the next chain to cluster */
+size_t read_clust_checkpoint(const string &filename,
+    const uint64_t fingerprint, vector<size_t>&clust_mem_vec,
+    vector<size_t>&clust_repr_vec, map<size_t,size_t>&clust_repr_map)
+{
+    ifstream fin(filename.c_str(), ios::binary);
+    if (!fin.is_open())
+        PrintErrorAndQuit("ERROR! Cannot read checkpoint "+filename);
+    ClustCkptHeader header;
+    fin.read((char *)&header, sizeof(header));
+    if (!fin.good() || memcmp(header.magic, ClustCkpt_magic, 8))
+        PrintErrorAndQuit("ERROR! "+filename+" is not a qTMclust checkpoint");
+    if (header.fingerprint!=fingerprint ||
+        header.chain_num!=clust_mem_vec.size())
+        PrintErrorAndQuit("ERROR! Checkpoint "+filename+" was written for "
+            "different chains or options");
+
+    vector<uint64_t> buf(header.chain_num+header.repr_num+2*header.map_num);
+    if (buf.size()) fin.read((char *)&buf[0], sizeof(uint64_t)*buf.size());
+    if (!fin.good())
+        PrintErrorAndQuit("ERROR! Unexpected end of checkpoint "+filename);
+    fin.close();
+
+    size_t k=0,c;
+    for (c=0;c<header.chain_num;c++) clust_mem_vec[c]=buf[k++];
+    clust_repr_vec.assign(buf.begin()+k,buf.begin()+k+header.repr_num);
+    k+=header.repr_num;
+    clust_repr_map.clear();
+    for (c=0;c<header.map_num;c++,k+=2) clust_repr_map[buf[k]]=buf[k+1];
+    return header.next_i;
+}
+
+/* continue from checkpoint filename. Structures of the cluster members
+ * clustered before the checkpoint are freed, as in the clustering loop.
+ * Return the index in chainLen_list of the next chain to cluster */
+size_t resume_clust_checkpoint(const string &filename,
+    const uint64_t fingerprint, const vector<pair<int,size_t> >&chainLen_list,
+    vector<size_t>&clust_mem_vec, vector<size_t>&clust_repr_vec,
+    map<size_t,size_t>&clust_repr_map, vector<vector<char> >&seq_vec,
+    vector<vector<char> >&sec_vec, vector<vector<vector<float> > >&xyz_vec)
+{
+    size_t next_i=read_clust_checkpoint(filename, fingerprint,
+        clust_mem_vec, clust_repr_vec, clust_repr_map);
+    for (size_t i=1;i<next_i && i<chainLen_list.size();i++)
+    {
+        size_t chain_i=chainLen_list[i].second;
+        if (xyz_vec[chain_i].size()<=5 || clust_repr_map.count(chain_i))
+            continue;
+        vector<char> ().swap(seq_vec[chain_i]);
+        vector<char> ().swap(sec_vec[chain_i]);
+        vector<vector<float> > ().swap(xyz_vec[chain_i]);
+    }
+    cout<<"Resume from checkpoint "<<filename<<" at chain #"<<next_i
+        <<" with "<<clust_repr_vec.size()<<" clusters"<<endl;
+    return next_i;
+}
+
+#endif
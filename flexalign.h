@@ -1355,22 +1355,12 @@ void output_flexalign_pymol(const string xname, const string yname,
 {
     int compress_type=0; // uncompressed file
     ifstream fin;
-#ifndef REDI_PSTREAM_H_SEEN
+#ifndef GZSTREAM_H_SEEN
     ifstream fin_gz;
 #else
-    redi::ipstream fin_gz; // if file is compressed
-    if (xname.size()>=3 && 
-        xname.substr(xname.size()-3,3)==".gz")
-    {
-        fin_gz.open("gunzip -c "+xname);
-        compress_type=1;
-    }
-    else if (xname.size()>=4 && 
-        xname.substr(xname.size()-4,4)==".bz2")
-    {
-        fin_gz.open("bzcat "+xname);
-        compress_type=2;
-    }
+    gzistream fin_gz; // if file is compressed
+    compress_type=gz_compress_type(xname);
+    if (compress_type) fin_gz.open(xname);
     else
 #endif
         fin.open(xname.c_str());
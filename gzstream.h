@@ -0,0 +1,179 @@
+/* Input stream for gzip and bzip2 compressed files. The file is decompressed
+ * in-process by zlib and libbz2, so that no gunzip or bzcat process is
+ * forked per file. The compression format is detected from the file name
+ * suffix (.gz or .bz2). If compiled with -DNO_ZLIB, the file is piped from
+ * gunzip or bzcat through pstream.h instead, which is not available on
+ * Windows. */
+#ifndef TMalign_gzstream_h
+#define TMalign_gzstream_h 1
+
+#include <stdio.h>
+#include <string.h>
+#include <istream>
+#include <string>
+
+#ifndef NO_ZLIB
+#include <zlib.h>
+#include <bzlib.h>
+#define GZSTREAM_H_SEEN
+#else
+#include "pstream.h"
+#ifdef REDI_PSTREAM_H_SEEN
+#define GZSTREAM_H_SEEN
+#endif
+#endif
+
+using namespace std;
+
+/* 1 for .gz, 2 for .bz2 and 0 for other files */
+inline int gz_compress_type(const string &filename)
+{
+    if (filename.size()>=3 && filename.substr(filename.size()-3,3)==".gz")
+        return 1;
+    if (filename.size()>=4 && filename.substr(filename.size()-4,4)==".bz2")
+        return 2;
+    return 0;
+}
+
+#ifndef NO_ZLIB
+class gzstreambuf : public streambuf
+{
+public:
+    gzstreambuf(): out_buf(NULL), in_buf(NULL), compress_type(0), gz(NULL),
+        fp(NULL), bz_init(false) {}
+
+    ~gzstreambuf()
+    {
+        close();
+        delete [] out_buf;
+        delete [] in_buf;
+    }
+
+    bool open(const string &filename)
+    {
+        close();
+        compress_type=gz_compress_type(filename);
+        if (!out_buf) out_buf=new char[buf_size];
+        if (compress_type==2)
+        {
+            if (!in_buf) in_buf=new char[buf_size];
+            fp=fopen(filename.c_str(), "rb");
+            if (!fp) return false;
+            memset(&bz, 0, sizeof(bz));
+            bz_init=(BZ2_bzDecompressInit(&bz, 0, 0)==BZ_OK);
+            if (!bz_init) return close();
+            bz.next_in=in_buf;
+            bz.avail_in=0;
+        }
+        else
+        {
+            gz=gzopen(filename.c_str(), "rb");
+            if (!gz) return false;
+            gzbuffer(gz, buf_size);
+        }
+        setg(out_buf, out_buf, out_buf);
+        return true;
+    }
+
+    bool close()
+    {
+        if (gz) gzclose(gz);
+        if (bz_init) BZ2_bzDecompressEnd(&bz);
+        if (fp) fclose(fp);
+        gz=NULL;
+        fp=NULL;
+        bz_init=false;
+        setg(out_buf, out_buf, out_buf);
+        return false;
+    }
+
+    bool is_open() const { return gz || fp; }
+
+protected:
+    int_type underflow()
+    {
+        if (gptr()<egptr()) return traits_type::to_int_type(*gptr());
+        int n=0;
+        if (gz) n=gzread(gz, out_buf, buf_size);
+        else if (bz_init) n=bz_read();
+        if (n<=0) return traits_type::eof();
+        setg(out_buf, out_buf, out_buf+n);
+        return traits_type::to_int_type(*gptr());
+    }
+
+private:
+    /* decompress up to buf_size bytes. Concatenated bzip2 streams are
+     * read one after another, like bzcat */
+    int bz_read()
+    {
+        bz.next_out=out_buf;
+        bz.avail_out=buf_size;
+        while (bz.avail_out==buf_size)
+        {
+            if (bz.avail_in==0)
+            {
+                bz.next_in=in_buf;
+                bz.avail_in=fread(in_buf, 1, buf_size, fp);
+                if (bz.avail_in==0) break;
+            }
+            int ret=BZ2_bzDecompress(&bz);
+            if (ret==BZ_STREAM_END)
+            {
+                bz_stream next=bz;
+                BZ2_bzDecompressEnd(&bz);
+                bz_init=(BZ2_bzDecompressInit(&bz, 0, 0)==BZ_OK);
+                if (!bz_init) break;
+                bz.next_in  =next.next_in;
+                bz.avail_in =next.avail_in;
+                bz.next_out =next.next_out;
+                bz.avail_out=next.avail_out;
+            }
+            else if (ret!=BZ_OK) break;
+        }
+        return buf_size-bz.avail_out;
+    }
+
+    static const int buf_size=1<<17;
+    char *out_buf;
+    char *in_buf;
+    int compress_type;
+    gzFile gz;
+    FILE *fp;
+    bz_stream bz;
+    bool bz_init;
+};
+
+/* drop-in replacement for the redi::ipstream previously used to read
+ * compressed files, except that open takes the file name */
+class gzistream : public istream
+{
+public:
+    gzistream(): istream(&buf) {}
+
+    void open(const string &filename)
+    {
+        if (buf.open(filename)) clear();
+        else setstate(ios::failbit);
+    }
+
+    void close() { buf.close(); }
+
+    bool is_open() const { return buf.is_open(); }
+
+private:
+    gzstreambuf buf;
+};
+#elif defined(REDI_PSTREAM_H_SEEN)
+class gzistream : public redi::ipstream
+{
+public:
+    void open(const string &filename)
+    {
+        if (gz_compress_type(filename)==2)
+            redi::ipstream::open("bzcat '"+filename+"'");
+        else redi::ipstream::open("gunzip -c '"+filename+"'");
+    }
+};
+#endif
+
+#endif
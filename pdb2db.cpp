@@ -0,0 +1,250 @@
+#include "sec_str.h"
+#include "struct_db.h"
+
+using namespace std;
+
+void print_help()
+{
+    cout <<
+"Converting PDB or PDBx/mmCIF file(s) into a binary structure database,\n"
+"which is read by USalign, TMscore and qTMclust with -infmt 4.\n"
+"\n"
+"Usage: pdb2db pdb.pdb > pdb.db\n"
+"       pdb2db -dir chain_folder/ chain_list > chain.db\n"
+"       USalign query.pdb chain.db -infmt2 4\n"
+"       USalign query.pdb -dir2 chain.db chain_list -infmt2 4\n"
+"\n"
+"    -dir     Convert all chains listed by 'chain_list' under 'chain_folder'.\n"
+"             Note that the slash is necessary. Structures are named in the\n"
+"             database as in 'chain_list'.\n"
+"             $ pdb2db -dir chain_folder/ chain_list > chain.db\n"
+"\n"
+"    -suffix  (Only when -dir is set, default is empty)\n"
+"             add file name suffix to files listed by chain_list\n"
+"\n"
+"    -atom    4-character atom name used to represent a residue.\n"
+"             Default is \" C3'\" for RNA/DNA and \" CA \" for proteins\n"
+"             (note the spaces before and after CA).\n"
+"\n"
+"    -mol     Molecule type: RNA or protein\n"
+"             Default is detect molecule type automatically\n"
+"\n"
+"    -ter     Strings to mark the end of a chain\n"
+"             3: TER, ENDMDL, END or different chain ID\n"
+"             2: (default) ENDMDL, END, or different chain ID\n"
+"             1: ENDMDL or END\n"
+"             0: end of file\n"
+"\n"
+"    -split   Whether to split PDB file into multiple chains\n"
+"             0: treat the whole structure as one single chain\n"
+"             1: treat each MODEL as a separate chain (-ter should be 0)\n"
+"             2: (default) treat each chain as a seperate chain\n"
+"\n"
+"    -het     Whether to read residues marked as 'HETATM' in addition to 'ATOM  '\n"
+"             0: (default) only align 'ATOM  ' residues\n"
+"             1: align both 'ATOM  ' and 'HETATM' residues\n"
+"\n"
+"    -infmt   Input format\n"
+"            -1: (default) automatically detect PDB or PDBx/mmCIF format\n"
+"             0: PDB format\n"
+"             3: PDBx/mmCIF format\n"
+"\n"
+"    -chain   Chains to parse. Use _ for a chain without chain ID.\n"
+"             Multiple chains can be separated by commas.\n"
+"\n"
+"    -model   Models to parse. Multiple models can be separated by commas.\n"
+"\n"
+"The default -ter and -split are the same as USalign. These options are\n"
+"applied when the database is built and cannot be changed when it is read.\n"
+    <<endl;
+    exit(EXIT_SUCCESS);
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2) print_help();
+
+
+    /**********************/
+    /*    get argument    */
+    /**********************/
+    string xname     = "";
+    int    ter_opt   =2;     // END, or different chainID
+    int    infmt_opt =-1;    // PDB or PDBx/mmCIF format
+    int    split_opt =2;     // split each chains
+    int    het_opt=0;        // do not read HETATM residues
+    string atom_opt  ="auto";// use C alpha atom for protein and C3' for RNA
+    string mol_opt   ="auto";// auto-detect the molecule type as protein/RNA
+    string suffix_opt="";    // set -suffix to empty
+    string dir_opt   ="";    // set -dir to empty
+    vector<string> chain_list; // only when -dir1 is set
+    vector<string> chain2parse;
+    vector<string> model2parse;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if ( !strcmp(argv[i],"-ter") && i < (argc-1) )
+        {
+            ter_opt=atoi(argv[i + 1]); i++;
+        }
+        else if ( !strcmp(argv[i],"-split") && i < (argc-1) )
+        {
+            split_opt=atoi(argv[i + 1]); i++;
+        }
+        else if ( !strcmp(argv[i],"-atom") && i < (argc-1) )
+        {
+            atom_opt=argv[i + 1]; i++;
+        }
+        else if ( !strcmp(argv[i],"-mol") && i < (argc-1) )
+        {
+            mol_opt=argv[i + 1]; i++;
+        }
+        else if ( !strcmp(argv[i],"-dir") && i < (argc-1) )
+        {
+            dir_opt=argv[i + 1]; i++;
+        }
+        else if ( !strcmp(argv[i],"-suffix") && i < (argc-1) )
+        {
+            suffix_opt=argv[i + 1]; i++;
+        }
+        else if ( !strcmp(argv[i],"-infmt") && i < (argc-1) )
+        {
+            infmt_opt=atoi(argv[i + 1]); i++;
+        }
+        else if ( !strcmp(argv[i],"-het") && i < (argc-1) )
+        {
+            het_opt=atoi(argv[i + 1]); i++;
+        }
+        else if (!strcmp(argv[i], "-chain") )
+        {
+            if (i>=(argc-1))
+                PrintErrorAndQuit("ERROR! Missing value for -chain");
+            split(argv[i+1],chain2parse,',');
+            i++;
+        }
+        else if (!strcmp(argv[i], "-model") )
+        {
+            if (i>=(argc-1))
+                PrintErrorAndQuit("ERROR! Missing value for -model");
+            split(argv[i+1],model2parse,',');
+            i++;
+        }
+        else xname=argv[i];
+    }
+
+    if(xname.size()==0||xname=="-h") print_help();
+
+    if (suffix_opt.size() && dir_opt.size()==0)
+        PrintErrorAndQuit("-suffix is only valid if -dir is set");
+    if (infmt_opt!=-1 && infmt_opt!=0 && infmt_opt!=3)
+        PrintErrorAndQuit("ERROR! -infmt can only be -1, 0 or 3");
+    if (mol_opt!="auto" && mol_opt!="protein" && mol_opt!="RNA")
+        PrintErrorAndQuit("ERROR! Molecule type must be either RNA or protein.");
+
+    bool autojustify=(atom_opt=="auto" || atom_opt=="PC4'"); // auto re-pad atom name
+    if (mol_opt=="protein" && atom_opt=="auto")
+        atom_opt=" CA ";
+    else if (mol_opt=="RNA" && atom_opt=="auto")
+        atom_opt=" C3'";
+    if (atom_opt.size()!=4)
+        PrintErrorAndQuit("ERROR! Atom name must have 4 characters, including space.");
+    if (split_opt==1 && ter_opt!=0)
+        PrintErrorAndQuit("-split 1 should be used with -ter 0");
+
+    /* parse file list */
+    if (dir_opt.size()==0)
+        chain_list.push_back(xname);
+    else
+    {
+        ifstream fp(xname.c_str());
+        if (! fp.is_open())
+            PrintErrorAndQuit(("Can not open file: "+xname+'\n').c_str());
+        string line;
+        while (fp.good())
+        {
+            getline(fp, line);
+            if (! line.size()) continue;
+            chain_list.push_back(dir_opt+Trim(line)+suffix_opt);
+        }
+        fp.close();
+        line.clear();
+    }
+
+    /* declare previously global variables */
+    vector<PDBChain> PDB_lines; // residues of chain
+    vector<int> mol_vec;              // molecule type of chain
+    vector<string> chainID_list;      // list of chainID
+    vector<string> resi_vec;          // residue index for chain
+    size_t i;                         // file index
+    int    chain_i;                   // chain index
+    int    xlen;                      // chain length
+    int    xchainnum;                 // number of chains in a PDB file
+    double **xa;                      // coordinates of chain
+    char   *seq, *sec;                // sequence and secondary structure
+
+    StructDBWriter db(cout);
+
+    /* loop over file names */
+    for (i=0;i<chain_list.size();i++)
+    {
+        xname=chain_list[i];
+        xchainnum=get_PDB_lines(xname, PDB_lines, chainID_list, mol_vec,
+            ter_opt, infmt_opt, atom_opt, autojustify, split_opt, het_opt,
+            chain2parse, model2parse);
+        if (!xchainnum)
+        {
+            cerr<<"Warning! Cannot parse file: "<<xname
+                <<". Chain number 0."<<endl;
+            continue;
+        }
+        for (chain_i=0;chain_i<xchainnum;chain_i++)
+        {
+            xlen=PDB_lines[chain_i].size();
+            if (mol_opt=="RNA") mol_vec[chain_i]=1;
+            else if (mol_opt=="protein") mol_vec[chain_i]=-1;
+            if (!xlen)
+            {
+                cerr<<"Warning! Cannot parse file: "<<xname
+                    <<". Chain length 0."<<endl;
+                continue;
+            }
+            else if (xlen<3)
+            {
+                cerr<<"Sequence is too short <3!: "<<xname<<endl;
+                continue;
+            }
+
+            NewArray(&xa, xlen, 3);
+            seq = new char[xlen + 1];
+            sec = new char[xlen + 1];
+            if (read_PDB(PDB_lines[chain_i], xa, seq, resi_vec, 2)==xlen)
+            {
+                if (mol_vec[chain_i]>0)
+                    make_sec(seq, xa, xlen, sec, atom_opt);
+                else make_sec(xa, xlen, sec);
+
+                db.add(xname.substr(dir_opt.size(),
+                    xname.size()-dir_opt.size()-suffix_opt.size()),
+                    chainID_list[chain_i], xlen, mol_vec[chain_i],
+                    xa, seq, sec, resi_vec);
+            }
+            else cerr<<"Warning! Cannot read chain "<<chainID_list[chain_i]
+                <<" of file: "<<xname<<endl;
+
+            DeleteArray(&xa, xlen);
+            delete [] seq;
+            delete [] sec;
+            resi_vec.clear();
+            PDB_lines[chain_i].clear();
+        } // chain_i
+        xname.clear();
+        PDB_lines.clear();
+        chainID_list.clear();
+        mol_vec.clear();
+    } // i
+    db.close();
+    chain_list.clear();
+    vector<string>().swap(chain2parse);
+    vector<string>().swap(model2parse);
+    return 0;
+}
@@ -171,7 +171,7 @@ int main(int argc, char *argv[])
     }
 
     /* declare previously global variables */
-    vector<vector<string> >PDB_lines; // text of chain
+    vector<PDBChain> PDB_lines; // residues of chain
     vector<int> mol_vec;              // molecule type of chain
     vector<string> chainID_list;      // list of chainID1
     int    i;                         // file index
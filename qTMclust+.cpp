@@ -5,6 +5,8 @@
 
 #include "HwRMSD.h"
 #include "TMalign.h"
+#include "chain_reader.h"
+#include "clust_checkpoint.h"
 
 // Standard C++ libraries
 #include <iostream>
@@ -111,6 +113,14 @@ void print_help(bool h_opt=false)
 "\n"
 "    -init    tentative clustering\n"
 "\n"
+"    -ckpt    Write the clustering progress to a checkpoint file every\n"
+"             -ckpt_step chains (default 1000)\n"
+"\n"
+"    -resume  Continue from the checkpoint set by -ckpt. The same chains\n"
+"             and -TMcut, -s, -fast, -init and -mol must be used.\n"
+"             $ qTMclust -dir chain_folder/ chain_list -ckpt clust.ckpt\n"
+"             $ qTMclust -dir chain_folder/ chain_list -ckpt clust.ckpt -resume\n"
+"\n"
 "    -h       Print the full help message, including additional options.\n"
 "\n"
     <<endl;
@@ -188,153 +198,198 @@ struct ThreadArgs {
     const vector<vector<char>>& sec_vec;
     const vector<vector<vector<float>>>& xyz_vec;
     const vector<int>& mol_vec;
-    const map<size_t, size_t>& clust_repr_map;
 
     // 当前查询结构的数据
     size_t chain_i;
     int xlen;
     double** xa;
 
-    // 此线程负责的工作负载
-    vector<size_t> index_vec_chunk; // <-- CORRECTED TYPE
+    // 候选代表结构，每个代表结构是线程池中的一个任务
+    const vector<size_t>& index_vec;
 
     // ===== 共享变量 (在线程中可读写) =====
-    std::atomic<bool>& found_clust;
-    std::mutex& mtx;
-    size_t& assigned_cluster_idx;
+    // index_vec 中第一个命中的位置，未找到时为 index_vec.size()。
+    // TM-align 阶段的命中为达到 TMcut，HwRMSD 阶段为达到 ub_HwRMSD
+    std::atomic<size_t>& found_clust;
 };
 
-void alignment_worker(ThreadArgs args)
+/* record that index_vec[k] is a hit, unless an earlier one is found */
+void set_found_clust(std::atomic<size_t>& found_clust, const size_t k)
 {
-    // 循环处理分配给此线程的每一个候选代表结构
-    for (const auto& chain_j : args.index_vec_chunk)
-    {
-        // 关键的提前退出机制：如果其他线程已经找到了匹配，则此线程停止工作
-        if (args.found_clust.load(std::memory_order_relaxed)) {
-            return;
-        }
-
-        int ylen = args.xyz_vec[chain_j].size();
-
-        // 检查分子类型是否兼容，以及长度是否满足TM-score阈值的理论下限
-        if (args.mol_vec[args.chain_i] * args.mol_vec[chain_j] < 0)    continue;
-        else if (args.s_opt == 2 && args.xlen < args.TMcut * ylen)       continue;
-        else if (args.s_opt == 3 && args.xlen < (2 * args.TMcut - 1) * ylen) continue;
-        else if (args.s_opt == 4 && args.xlen * (2 / args.TMcut - 1) < ylen) continue;
-        else if (args.s_opt == 5 && args.xlen < args.TMcut * args.TMcut * ylen) continue;
-        else if (args.s_opt == 6 && args.xlen * args.xlen < (2 * args.TMcut * args.TMcut - 1) * ylen * ylen) continue;
-
-        // 准备代表结构的坐标数组
-        double** ya;
-        NewArray(&ya, ylen, 3);
-        for (int r = 0; r < ylen; r++) {
-            ya[r][0] = args.xyz_vec[chain_j][r][0];
-            ya[r][1] = args.xyz_vec[chain_j][r][1];
-            ya[r][2] = args.xyz_vec[chain_j][r][2];
-        }
-
-        const double fast_ub = 1000.;
-        double Lave = sqrt((double)args.xlen * ylen);
-        bool current_fast_opt = (args.fast_opt == true || Lave >= fast_ub);
-
-        // 声明TMalign所需的变量
-        double t0[3], u0[3][3];
-        double TM1, TM2, TM3, TM4, TM5;
-        double d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out = 5.0;
-        string seqM, seqxA, seqyA;
-        double rmsd0 = 0.0;
-        int L_ali;
-        double Liden = 0;
-        double TM_ali, rmsd_ali;
-        int n_ali = 0, n_ali8 = 0;
-        vector<double> do_vec;
-
-        // 第一次调用：快速比对
-        TMalign_main(
-            args.xa, ya, &args.seq_vec[args.chain_i][0], &args.seq_vec[chain_j][0], // <-- CORRECTED
-            &args.sec_vec[args.chain_i][0], &args.sec_vec[chain_j][0], // <-- CORRECTED
-            t0, u0, TM1, TM2, TM3, TM4, TM5,
-            d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out,
-            seqM, seqxA, seqyA, do_vec,
-            rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
-            args.xlen, ylen, args.sequence, args.Lnorm_ass, args.d0_scale,
-            args.i_opt, args.a_opt, args.u_opt, args.d_opt, current_fast_opt,
-            args.mol_vec[args.chain_i] + args.mol_vec[chain_j], args.TMcut);
-
-        seqM.clear();
-        seqxA.clear();
-        seqyA.clear();
-        do_vec.clear();
-
-        // 根据-s选项计算TM-score
-        double TM = TM3;
-        if      (args.s_opt == 1) TM = TM2;
-        else if (args.s_opt == 2) TM = TM1;
-        else if (args.s_opt == 3) TM = (TM1 + TM2) / 2;
-        else if (args.s_opt == 4) TM = 2 / (1 / TM1 + 1 / TM2);
-        else if (args.s_opt == 5) TM = sqrt(TM1 * TM2);
-        else if (args.s_opt == 6) TM = sqrt((TM1 * TM1 + TM2 * TM2) / 2);
-
-        // 如果分数很高，或分数已达标且使用的是快速模式，则任务完成
-        if (TM >= args.ub_TMfast || (TM >= args.TMcut && current_fast_opt))
-        {
-            std::lock_guard<std::mutex> lock(args.mtx);
-            if (!args.found_clust.load(std::memory_order_relaxed)) {
-                args.assigned_cluster_idx = args.clust_repr_map.at(chain_j);
-                args.found_clust.store(true, std::memory_order_relaxed);
-            }
-            DeleteArray(&ya, ylen);
-            return;
-        }
+    size_t cur = found_clust.load();
+    while (k < cur && !found_clust.compare_exchange_weak(cur, k));
+}
 
-        // 如果分数太低，则此候选不匹配，继续下一个
-        if (TM < args.lb_TMfast)
-        {
-            DeleteArray(&ya, ylen);
-            continue;
-        }
+/* align the query to representative index_vec[k] with the buffers of the
+ * worker thread. The task is dropped, whether it is still queued or
+ * between the two TMalign_main calls, once an earlier representative in
+ * index_vec is a hit, so that the cluster is the same as a serial search */
+void alignment_task(const ThreadArgs& args, const size_t k,
+    AlignWorkspace& ws, WorkArray<double>& ya_buf)
+{
+    if (k > args.found_clust.load(std::memory_order_relaxed)) return;
+    const size_t chain_j = args.index_vec[k];
+
+    int ylen = args.xyz_vec[chain_j].size();
+
+    // 检查分子类型是否兼容，以及长度是否满足TM-score阈值的理论下限
+    if (args.mol_vec[args.chain_i] * args.mol_vec[chain_j] < 0)    return;
+    else if (args.s_opt == 2 && args.xlen < args.TMcut * ylen)       return;
+    else if (args.s_opt == 3 && args.xlen < (2 * args.TMcut - 1) * ylen) return;
+    else if (args.s_opt == 4 && args.xlen * (2 / args.TMcut - 1) < ylen) return;
+    else if (args.s_opt == 5 && args.xlen < args.TMcut * args.TMcut * ylen) return;
+    else if (args.s_opt == 6 && args.xlen * args.xlen < (2 * args.TMcut * args.TMcut - 1) * ylen * ylen) return;
+
+    // 准备代表结构的坐标数组
+    double** ya = ya_buf.get(ylen, 3);
+    for (int r = 0; r < ylen; r++) {
+        ya[r][0] = args.xyz_vec[chain_j][r][0];
+        ya[r][1] = args.xyz_vec[chain_j][r][1];
+        ya[r][2] = args.xyz_vec[chain_j][r][2];
+    }
 
-        // 第二次调用：如果快速比对分数在中间范围，则执行精确比对
-        TMalign_main(
-            args.xa, ya, &args.seq_vec[args.chain_i][0], &args.seq_vec[chain_j][0], // <-- CORRECTED
-            &args.sec_vec[args.chain_i][0], &args.sec_vec[chain_j][0], // <-- CORRECTED
-            t0, u0, TM1, TM2, TM3, TM4, TM5,
-            d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out,
-            seqM, seqxA, seqyA, do_vec,
-            rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
-            args.xlen, ylen, args.sequence, args.Lnorm_ass, args.d0_scale,
-            args.i_opt, args.a_opt, args.u_opt, args.d_opt, false,
-            args.mol_vec[args.chain_i] + args.mol_vec[chain_j], args.TMcut);
-
-        seqM.clear();
-        seqxA.clear();
-        seqyA.clear();
-        do_vec.clear();
-
-        // 重新计算TM-score
-        if      (args.s_opt == 1) TM = TM2;
-        else if (args.s_opt == 2) TM = TM1;
-        else if (args.s_opt == 3) TM = (TM1 + TM2) / 2;
-        else if (args.s_opt == 4) TM = 2 / (1 / TM1 + 1 / TM2);
-        else if (args.s_opt == 5) TM = sqrt(TM1 * TM2);
-        else if (args.s_opt == 6) TM = sqrt((TM1 * TM1 + TM2 * TM2) / 2);
-
-        // 检查精确比对结果
-        if (TM >= args.TMcut)
-        {
-            std::lock_guard<std::mutex> lock(args.mtx);
-            if (!args.found_clust.load(std::memory_order_relaxed)) {
-                args.assigned_cluster_idx = args.clust_repr_map.at(chain_j);
-                args.found_clust.store(true, std::memory_order_relaxed);
-            }
-            DeleteArray(&ya, ylen);
-            return;
-        }
+    const double fast_ub = 1000.;
+    double Lave = sqrt((double)args.xlen * ylen);
+    bool current_fast_opt = (args.fast_opt == true || Lave >= fast_ub);
+
+    // 声明TMalign所需的变量
+    double t0[3], u0[3][3];
+    double TM1, TM2, TM3, TM4, TM5;
+    double d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out = 5.0;
+    string seqM, seqxA, seqyA;
+    double rmsd0 = 0.0;
+    int L_ali;
+    double Liden = 0;
+    double TM_ali, rmsd_ali;
+    int n_ali = 0, n_ali8 = 0;
+    vector<double> do_vec;
+
+    // 第一次调用：快速比对
+    TMalign_main(
+        args.xa, ya, &args.seq_vec[args.chain_i][0], &args.seq_vec[chain_j][0], // <-- CORRECTED
+        &args.sec_vec[args.chain_i][0], &args.sec_vec[chain_j][0], // <-- CORRECTED
+        t0, u0, TM1, TM2, TM3, TM4, TM5,
+        d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out,
+        seqM, seqxA, seqyA, do_vec,
+        rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
+        args.xlen, ylen, args.sequence, args.Lnorm_ass, args.d0_scale,
+        args.i_opt, args.a_opt, args.u_opt, args.d_opt, current_fast_opt,
+        args.mol_vec[args.chain_i] + args.mol_vec[chain_j], args.TMcut, &ws);
+
+    seqM.clear();
+    seqxA.clear();
+    seqyA.clear();
+    do_vec.clear();
+
+    // 根据-s选项计算TM-score
+    double TM = TM3;
+    if      (args.s_opt == 1) TM = TM2;
+    else if (args.s_opt == 2) TM = TM1;
+    else if (args.s_opt == 3) TM = (TM1 + TM2) / 2;
+    else if (args.s_opt == 4) TM = 2 / (1 / TM1 + 1 / TM2);
+    else if (args.s_opt == 5) TM = sqrt(TM1 * TM2);
+    else if (args.s_opt == 6) TM = sqrt((TM1 * TM1 + TM2 * TM2) / 2);
+
+    // 如果分数很高，或分数已达标且使用的是快速模式，则任务完成
+    if (TM >= args.ub_TMfast || (TM >= args.TMcut && current_fast_opt))
+    {
+        set_found_clust(args.found_clust, k);
+        return;
+    }
 
-        DeleteArray(&ya, ylen);
+    // 如果分数太低，则此候选不匹配
+    if (TM < args.lb_TMfast) return;
+    if (k > args.found_clust.load(std::memory_order_relaxed)) return;
+
+    // 第二次调用：如果快速比对分数在中间范围，则执行精确比对
+    TMalign_main(
+        args.xa, ya, &args.seq_vec[args.chain_i][0], &args.seq_vec[chain_j][0], // <-- CORRECTED
+        &args.sec_vec[args.chain_i][0], &args.sec_vec[chain_j][0], // <-- CORRECTED
+        t0, u0, TM1, TM2, TM3, TM4, TM5,
+        d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out,
+        seqM, seqxA, seqyA, do_vec,
+        rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
+        args.xlen, ylen, args.sequence, args.Lnorm_ass, args.d0_scale,
+        args.i_opt, args.a_opt, args.u_opt, args.d_opt, false,
+        args.mol_vec[args.chain_i] + args.mol_vec[chain_j], args.TMcut, &ws);
+
+    seqM.clear();
+    seqxA.clear();
+    seqyA.clear();
+    do_vec.clear();
+
+    // 重新计算TM-score
+    if      (args.s_opt == 1) TM = TM2;
+    else if (args.s_opt == 2) TM = TM1;
+    else if (args.s_opt == 3) TM = (TM1 + TM2) / 2;
+    else if (args.s_opt == 4) TM = 2 / (1 / TM1 + 1 / TM2);
+    else if (args.s_opt == 5) TM = sqrt(TM1 * TM2);
+    else if (args.s_opt == 6) TM = sqrt((TM1 * TM1 + TM2 * TM2) / 2);
+
+    // 检查精确比对结果
+    if (TM >= args.TMcut)
+    {
+        set_found_clust(args.found_clust, k);
+        return;
     }
 }
 
+#ifdef TMalign_HwRMSD_h
+/* HwRMSD score of the query against representative index_vec[k], which is
+ * saved to TM_vec[k]. If early_stop is set, tasks after the first
+ * representative with a score >=ub_HwRMSD are dropped, because the serial
+ * filter stops there */
+void HwRMSD_task(const ThreadArgs& args, const size_t k,
+    const double ub_HwRMSD, const bool early_stop,
+    const int glocal, const int iter_opt,
+    WorkArray<double>& ya_buf, vector<double>& TM_vec)
+{
+    if (k > args.found_clust.load(std::memory_order_relaxed)) return;
+    const size_t chain_j = args.index_vec[k];
+    int ylen = args.xyz_vec[chain_j].size();
+
+    double** ya = ya_buf.get(ylen, 3);
+    for (int r = 0; r < ylen; r++) {
+        ya[r][0] = args.xyz_vec[chain_j][r][0];
+        ya[r][1] = args.xyz_vec[chain_j][r][1];
+        ya[r][2] = args.xyz_vec[chain_j][r][2];
+    }
+
+    double t0[3], u0[3][3];
+    double TM1, TM2, TM3, TM4, TM5;
+    double d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out = 5.0;
+    string seqM, seqxA, seqyA;
+    double rmsd0 = 0.0;
+    int L_ali;
+    double Liden = 0;
+    double TM_ali, rmsd_ali;
+    int n_ali = 0, n_ali8 = 0;
+    int *invmap = new int[ylen + 1];
+
+    HwRMSD_main(
+        args.xa, ya, &args.seq_vec[args.chain_i][0], &args.seq_vec[chain_j][0],
+        &args.sec_vec[args.chain_i][0], &args.sec_vec[chain_j][0], t0, u0,
+        TM1, TM2, TM3, TM4, TM5, d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out,
+        seqM, seqxA, seqyA, rmsd0, L_ali, Liden, TM_ali, rmsd_ali,
+        n_ali, n_ali8, args.xlen, ylen, args.sequence, args.Lnorm_ass,
+        args.d0_scale, args.i_opt, args.a_opt, args.u_opt, args.d_opt,
+        args.mol_vec[args.chain_i] + args.mol_vec[chain_j],
+        invmap, glocal, iter_opt);
+    delete [] invmap;
+
+    double TM = TM3;
+    if      (args.s_opt == 1) TM = TM2;
+    else if (args.s_opt == 2) TM = TM1;
+    else if (args.s_opt == 3) TM = (TM1 + TM2) / 2;
+    else if (args.s_opt == 4) TM = 2 / (1 / TM1 + 1 / TM2);
+    else if (args.s_opt == 5) TM = sqrt(TM1 * TM2);
+    else if (args.s_opt == 6) TM = sqrt((TM1 * TM1 + TM2 * TM2) / 2);
+    TM_vec[k] = TM;
+
+    if (early_stop && TM >= ub_HwRMSD) set_found_clust(args.found_clust, k);
+}
+#endif
+
 int main(int argc, char *argv[])
 {
     if (argc < 2) print_help();
@@ -371,6 +426,9 @@ int main(int argc, char *argv[])
     string suffix_opt="";    // set -suffix to empty
     string dir_opt   ="";    // set -dir to empty
     int    byresi_opt=0;     // set -byresi to 0
+    string ckpt_opt  ="";    // checkpoint file name
+    size_t ckpt_step =1000;  // number of chains between checkpoints
+    bool   resume_opt=false; // resume from checkpoint
     vector<string> chain_list;
     vector<string> chain2parse;
     vector<string> model2parse;
@@ -462,6 +520,20 @@ int main(int argc, char *argv[])
         {
             het_opt=atoi(argv[i + 1]); i++;
         }
+        else if ( !strcmp(argv[i],"-ckpt") && i < (argc-1) )
+        {
+            ckpt_opt=argv[i + 1]; i++;
+        }
+        else if ( !strcmp(argv[i],"-ckpt_step") && i < (argc-1) )
+        {
+            if (atoi(argv[i + 1])<1)
+                PrintErrorAndQuit("ERROR! -ckpt_step must be >=1");
+            ckpt_step=atoi(argv[i + 1]); i++;
+        }
+        else if ( !strcmp(argv[i],"-resume") )
+        {
+            resume_opt=true;
+        }
         else if ( !strcmp(argv[i],"-init") && i < (argc-1) )
         {
             read_init_cluster(argv[i+1],init_cluster); i++;
@@ -519,6 +591,10 @@ int main(int argc, char *argv[])
         PrintErrorAndQuit("-split 2 should be used with -ter 0 or 1");
     if (split_opt<0 || split_opt>2)
         PrintErrorAndQuit("-split can only be 0, 1 or 2");
+    if (resume_opt && ckpt_opt.size()==0)
+        PrintErrorAndQuit("ERROR! -resume must be used with -ckpt");
+    if (infmt_opt==4)
+        PrintErrorAndQuit("ERROR! -infmt 4 is only supported by qTMclust");
 
     /* read initial alignment file from 'align.txt' */
     if (i_opt) read_user_alignment(sequence, fname_lign, i_opt);
@@ -530,30 +606,20 @@ int main(int argc, char *argv[])
     else file2chainlist(chain_list, xname, dir_opt, suffix_opt);
 
     /* declare previously global variables */
-    vector<vector<string> >PDB_lines; // text of chain
     vector<int>    mol_vec;           // molecule type of chain1, RNA if >0
     vector<string> chainID_list;      // list of chainID
-    size_t xchainnum=0;         // number of chains in a PDB file
     size_t i,j;                 // number of residues/chains in a PDB is
                                 // usually quite limited. Yet, the number of
                                 // files can be very large. size_t is safer
                                 // than int for very long list of files
     int    xlen,ylen;           // chain length
-    double **xa,**ya;           // xyz coordinate
-    vector<string> resi_vec;    // residue index for chain, dummy variable
+    double **xa;                // xyz coordinate
     vector<pair<int,size_t> >chainLen_list; // vector of (length,index) pair
     vector<vector<char> > seq_vec;
     vector<vector<char> > sec_vec;
     vector<vector<vector<float> > >xyz_vec;
 
-    /* parse files */
-    string chain_name;
-    vector<char>  seq_tmp;
-    vector<char>  sec_tmp;
-    vector<float> flt_tmp(3,0);
-    vector<vector<float> >xyz_tmp;
     int r; // residue index
-    size_t newchainnum;
     double ub_HwRMSD=0.90*TMcut+0.10;
     double lb_HwRMSD=0.5*TMcut;
     double ub_TMfast=0.90*TMcut+0.10;
@@ -577,69 +643,31 @@ int main(int argc, char *argv[])
     const int max_repr_num=50;
 #endif
 
-    // print start to screen
-    cout << "Starting read PDB files.\n" << endl;
-    for (i=0;i<chain_list.size();i++)
+    // ======================= [修改点 3] =======================
+    // 根据用户输入或硬件能力，动态决定要使用的线程数
+    unsigned int num_threads;
+    if (max_threads > 0)
     {
-        xname=chain_list[i];
-        newchainnum=get_PDB_lines(xname, PDB_lines, chainID_list,
-            mol_vec, ter_opt, infmt_opt, atom_opt, false, split_opt, het_opt,
-            chain2parse, model2parse);
-        if (!newchainnum)
-        {
-            cerr<<"Warning! Cannot parse file: "<<xname
-                <<". Chain number 0."<<endl;
-            continue;
-        }
-        chain_name=xname.substr(dir_opt.size(),
-            xname.size()-dir_opt.size()-suffix_opt.size());
-        for (j=0;j<newchainnum;j++)
+        num_threads = max_threads;
+    }
+    else
+    {
+        num_threads = std::thread::hardware_concurrency();
+        if (num_threads == 0) // 如果硬件检测失败，提供一个安全的回退值
         {
-            chainID_list[j+xchainnum]=chain_name+chainID_list[j+xchainnum];
-            xlen=PDB_lines[j].size();
-            cout<<"Parsing "<<xname<<'\t'<<chainID_list[j+xchainnum]
-                <<" ("<<xlen<<" residues)."<<endl;
-            if (mol_opt=="RNA") mol_vec[j+xchainnum]=1;
-            else if (mol_opt=="protein") mol_vec[j+xchainnum]=-1;
-
-            NewArray(&xa, xlen, 3);
-            seq_tmp.assign(xlen+1,'A');
-            sec_tmp.assign(xlen+1,0);
-
-            read_PDB(PDB_lines[j], xa, &seq_tmp[0], resi_vec, byresi_opt);
-
-            if (mol_vec[j]<=0) make_sec(xa, xlen, &sec_tmp[0]);
-            else make_sec(&seq_tmp[0],xa,xlen,&sec_tmp[0],atom_opt);
-
-            xyz_tmp.assign(xlen,flt_tmp);
-            for (r=0;r<xlen;r++)
-            {
-                xyz_tmp[r][0]=xa[r][0];
-                xyz_tmp[r][1]=xa[r][1];
-                xyz_tmp[r][2]=xa[r][2];
-            }
-
-            seq_vec.push_back(seq_tmp);
-            sec_vec.push_back(sec_tmp);
-            xyz_vec.push_back(xyz_tmp);
-
-            chainLen_list.push_back(
-                make_pair(PDB_lines[j].size(),j+xchainnum));
-
-            seq_tmp.clear();
-            sec_tmp.clear();
-            xyz_tmp.clear();
-            DeleteArray(&xa, xlen);
-            PDB_lines[j].clear();
+            cout << "Warning: Could not detect number of CPU cores. Defaulting to 1 thread." << endl;
+            num_threads = 1;
         }
-        PDB_lines.clear();
-        xchainnum+=newchainnum;
     }
-    flt_tmp.clear();
-    chain_list.clear();
+    // ==========================================================
 
-    // swap completely destroy the vector and free up the memory capacity
-    vector<vector<string> >().swap(PDB_lines);
+    // print start to screen
+    cout << "Starting read PDB files.\n" << endl;
+    ChainReader reader(NULL, ter_opt, infmt_opt, atom_opt, mol_opt,
+        split_opt, het_opt, byresi_opt, chain2parse, model2parse);
+    reader.read(chain_list, dir_opt, suffix_opt, num_threads, chainID_list,
+        mol_vec, seq_vec, sec_vec, xyz_vec, chainLen_list);
+    chain_list.clear();
     size_t Nstruct=chainLen_list.size();
 
     cout << "Starting sort chains by length.\n"
@@ -655,24 +683,7 @@ int main(int argc, char *argv[])
         <<"Shortest chain "<<chainID_list[chainLen_list.back().second]<<'\t'
         <<chainLen_list.back().first<<" residues."<<endl;
 
-    // ======================= [修改点 3] =======================
-    // 根据用户输入或硬件能力，动态决定要使用的线程数
-    unsigned int num_threads;
-    if (max_threads > 0)
-    {
-        num_threads = max_threads;
-    }
-    else
-    {
-        num_threads = std::thread::hardware_concurrency();
-        if (num_threads == 0) // 如果硬件检测失败，提供一个安全的回退值
-        {
-            cout << "Warning: Could not detect number of CPU cores. Defaulting to 1 thread." << endl;
-            num_threads = 1;
-        }
-    }
     cout << "Using " << num_threads << " threads for parallel computation." << endl;
-    // ==========================================================
 
     /* set the first cluster */
     vector<size_t> clust_mem_vec(Nstruct,-1); // cluster membership
@@ -691,10 +702,29 @@ int main(int argc, char *argv[])
     double Lave;               // average protein length for chain_i and chain_j
     size_t sizePROT;           // number of representatives for current chain
     vector<size_t> index_vec;  // index of cluster representatives for the chain
-    bool found_clust;          // whether current chain hit previous cluster
 
-    for (i=1;i<Nstruct;i++)
+    // 整个聚类过程共用一个线程池，每个线程有自己的比对缓冲区
+    ThreadPool pool(num_threads);
+    AlignWorkspace *ws_vec = new AlignWorkspace[num_threads];
+    WorkArray<double> *ya_vec = new WorkArray<double>[num_threads];
+
+    /* chains before ckpt_i are saved in the checkpoint */
+    uint64_t fingerprint=0;
+    size_t ckpt_i=1;
+    if (ckpt_opt.size()) fingerprint=clust_fingerprint(chainLen_list,
+        chainID_list, mol_vec, init_cluster, TMcut, s_opt, fast_opt);
+    if (resume_opt) ckpt_i=resume_clust_checkpoint(ckpt_opt, fingerprint,
+        chainLen_list, clust_mem_vec, clust_repr_vec, clust_repr_map,
+        seq_vec, sec_vec, xyz_vec);
+
+    for (i=ckpt_i;i<Nstruct;i++)
     {
+        if (ckpt_opt.size() && i>=ckpt_i+ckpt_step)
+        {
+            write_clust_checkpoint(ckpt_opt, fingerprint, i,
+                clust_mem_vec, clust_repr_vec, clust_repr_map);
+            ckpt_i=i;
+        }
         chain_i=chainLen_list[i].second;
         xlen=xyz_vec[chain_i].size();
         if (xlen<=5) // TMalign cannot handle L<=5
@@ -737,9 +767,35 @@ int main(int argc, char *argv[])
             <<"#repr="<<sizePROT<<"/"<<clust_repr_vec.size()<<endl;
 
 #ifdef TMalign_HwRMSD_h
+        /* HwRMSD of all candidate representatives runs on the thread pool.
+         * The scores are then taken in the order of index_vec, exactly as
+         * the serial filter would, including where it stops */
         vector<pair<double,size_t> > HwRMSDscore_list;
+        vector<double> HwRMSD_TM_vec(sizePROT,-1);
         double TM;
         size_t init_count=0;
+        if (sizePROT)
+        {
+            std::atomic<size_t> HwRMSD_stop(sizePROT);
+            ThreadArgs args = {
+                TMcut, ub_TMfast, lb_TMfast,
+                s_opt, fast_opt, i_opt, a_opt, u_opt, d_opt, Lnorm_ass, d0_scale,
+                sequence, seq_vec, sec_vec, xyz_vec, mol_vec,
+                chain_i, xlen, xa, index_vec, HwRMSD_stop
+            };
+            bool early_stop=(init_cluster.count(key)==0);
+            vector<double> *TM_vec=&HwRMSD_TM_vec;
+            for (j=0;j<sizePROT;j++)
+            {
+                size_t k=j;
+                pool.submit([&args, k, ub_HwRMSD, early_stop, glocal,
+                    iter_opt, ya_vec, TM_vec](int tid) {
+                    HwRMSD_task(args, k, ub_HwRMSD, early_stop, glocal,
+                        iter_opt, ya_vec[tid], *TM_vec);
+                });
+            }
+            pool.wait();
+        }
         for (j=0;j<sizePROT;j++)
         {
             chain_j=index_vec[j];
@@ -748,64 +804,11 @@ int main(int argc, char *argv[])
                 HwRMSDscore_list.size()>=init_cluster[key].size() && !init_cluster[key].count(value))
                 continue;
             ylen=xyz_vec[chain_j].size();
-            if (mol_vec[chain_i]*mol_vec[chain_j]<0)    continue;
-            else if (s_opt==2 && xlen<TMcut*ylen)       continue;
-            else if (s_opt==3 && xlen<(2*TMcut-1)*ylen) continue;
-            else if (s_opt==4 && xlen*(2/TMcut-1)<ylen) continue;
-            else if (s_opt==5 && xlen<TMcut*TMcut*ylen) continue;
-            else if (s_opt==6 && xlen*xlen<(2*TMcut*TMcut-1)*ylen*ylen) continue;
 
             if (s_opt<=1) filter_lower_bound(lb_HwRMSD, lb_TMfast, 
                 TMcut, s_opt, mol_vec[chain_i]+mol_vec[chain_j]);
-            
-            //cout<<chainID_list[chain_i]<<" => "<<chainID_list[chain_j]<<endl;
-            
-            NewArray(&ya, ylen, 3);
-            for (r=0;r<ylen;r++)
-            {
-                ya[r][0]=xyz_vec[chain_j][r][0];
-                ya[r][1]=xyz_vec[chain_j][r][1];
-                ya[r][2]=xyz_vec[chain_j][r][2];
-            }
-
-            /* declare variable specific to this pair of HwRMSD */
-            double t0[3], u0[3][3];
-            double TM1, TM2;
-            double TM3, TM4, TM5;     // for s_opt, u_opt, d_opt
-            double d0_0, TM_0;
-            double d0A, d0B, d0u, d0a;
-            double d0_out=5.0;
-            string seqM, seqxA, seqyA;// for output alignment
-            double rmsd0 = 0.0;
-            int L_ali;                // Aligned length in standard_TMscore
-            double Liden=0;
-            double TM_ali, rmsd_ali;  // TMscore and rmsd in standard_TMscore
-            int n_ali=0;
-            int n_ali8=0;
-            int *invmap = new int[ylen+1];
-
-            /* entry function for structure alignment */
-            HwRMSD_main(
-                xa, ya, &seq_vec[chain_i][0], &seq_vec[chain_j][0],
-                &sec_vec[chain_i][0], &sec_vec[chain_j][0], t0, u0,
-                TM1, TM2, TM3, TM4, TM5,
-                d0_0, TM_0, d0A, d0B, d0u,
-                d0a, d0_out, seqM, seqxA, seqyA,
-                rmsd0, L_ali, Liden, TM_ali,
-                rmsd_ali, n_ali, n_ali8, xlen, ylen,
-                sequence, Lnorm_ass,
-                d0_scale, i_opt,
-                a_opt, u_opt, d_opt, mol_vec[chain_i]+mol_vec[chain_j],
-                invmap, glocal, iter_opt);
-
-            TM=TM3; // average length
-            if      (s_opt==1) TM=TM2; // shorter length
-            else if (s_opt==2) TM=TM1; // longer length
-            else if (s_opt==3) TM=(TM1+TM2)/2;     // average TM
-            else if (s_opt==4) TM=2/(1/TM1+1/TM2); // harmonic average
-            else if (s_opt==5) TM=sqrt(TM1*TM2);   // geometric average
-            else if (s_opt==6) TM=sqrt((TM1*TM1+TM2*TM2)/2); // root mean square
 
+            TM=HwRMSD_TM_vec[j];
             Lave=sqrt(xlen*ylen); // geometry average because O(L1*L2)
             if (TM>=lb_HwRMSD || Lave<=fast_lb)
             {
@@ -819,16 +822,10 @@ int main(int argc, char *argv[])
                     HwRMSDscore_list.push_back(make_pair(TM,index_vec[j]));
             }
 
-            /* clean up after each HwRMSD */
-            seqM.clear();
-            seqxA.clear();
-            seqyA.clear();
-            DeleteArray(&ya, ylen);
-            delete [] invmap;
-
             /* if a good hit is guaranteed to be found, stop the loop */
             if (TM>=ub_HwRMSD) break;
         }
+        vector<double>().swap(HwRMSD_TM_vec);
 
         stable_sort(HwRMSDscore_list.begin(),HwRMSDscore_list.end(),
             greater<pair<double,size_t> >());
@@ -860,56 +857,37 @@ int main(int argc, char *argv[])
         // ======================= [修改点 4] =======================
         // 用多线程逻辑替换原有的内层for循环
 
-        std::atomic<bool> found_clust_atomic(false);
-        size_t assigned_cluster_idx = -1;
-        std::mutex mtx;
+        std::atomic<size_t> found_clust_atomic(index_vec.size());
 
         if (!index_vec.empty()) {
-            vector<std::thread> threads;
-            vector<vector<size_t>> chunks(num_threads);
-
-            // 将候选代表列表（index_vec）分配给不同的线程
-            for (size_t k = 0; k < index_vec.size(); ++k) {
-                chunks[k % num_threads].push_back(index_vec[k]);
-            }
-
-            // 准备工作线程所需的参数
+            // 准备任务所需的参数
             double lb_HwRMSD, lb_TMfast;
             filter_lower_bound(lb_HwRMSD, lb_TMfast, TMcut, s_opt, 0); // 用一个通用值初始化
             double ub_TMfast = 0.90 * TMcut + 0.10;
 
-            ThreadArgs base_args = {
+            ThreadArgs args = {
                 TMcut, ub_TMfast, lb_TMfast,
                 s_opt, fast_opt, i_opt, a_opt, u_opt, d_opt, Lnorm_ass, d0_scale,
-                sequence, seq_vec, sec_vec, xyz_vec, mol_vec, clust_repr_map,
-                chain_i, xlen, xa, {}, // index_vec_chunk 将在循环中单独设置
-                found_clust_atomic, mtx, assigned_cluster_idx
+                sequence, seq_vec, sec_vec, xyz_vec, mol_vec,
+                chain_i, xlen, xa, index_vec, found_clust_atomic
             };
 
-            // 创建并启动线程
-            for (unsigned int t = 0; t < num_threads; ++t) {
-                if (!chunks[t].empty()) {
-                    ThreadArgs thread_args = base_args;
-                    thread_args.index_vec_chunk = chunks[t];
-                    threads.emplace_back(alignment_worker, thread_args);
-                }
-            }
-
-            // 等待所有线程完成工作
-            for (auto& th : threads) {
-                if (th.joinable()) {
-                    th.join();
-                }
+            // 每个候选代表结构作为一个任务放入共享队列，空闲线程依次领取
+            for (size_t k = 0; k < index_vec.size(); ++k) {
+                pool.submit([&args, k, ws_vec, ya_vec](int tid) {
+                    alignment_task(args, k, ws_vec[tid], ya_vec[tid]);
+                });
             }
+            pool.wait();
         }
 
         DeleteArray(&xa, xlen);
-        index_vec.clear();
 
         // 根据多线程计算的结果来决定聚类归属
-        if (found_clust_atomic.load())
+        if (found_clust_atomic.load() < index_vec.size())
         {
-            clust_mem_vec[chain_i] = assigned_cluster_idx;
+            clust_mem_vec[chain_i] =
+                clust_repr_map[index_vec[found_clust_atomic.load()]];
             // 成员结构不再用于后续比较，可以释放其内存
             vector<char>().swap(seq_vec[chain_i]);
             vector<char>().swap(sec_vec[chain_i]);
@@ -921,9 +899,13 @@ int main(int argc, char *argv[])
             clust_repr_map[chain_i] = clust_repr_vec.size();
             clust_repr_vec.push_back(chain_i);
         }
+        index_vec.clear();
         // ==========================================================
     }
 
+    delete [] ws_vec;
+    delete [] ya_vec;
+
     /* clean up */
     mol_vec.clear();
     xyz_vec.clear();
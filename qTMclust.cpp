@@ -5,6 +5,8 @@
 
 #include "HwRMSD.h"
 #include "TMalign.h"
+#include "chain_reader.h"
+#include "clust_checkpoint.h"
 
 using namespace std;
 
@@ -31,6 +33,9 @@ void print_extra_help()
 "             1: SPICKER format\n"
 "             2: xyz format\n"
 "             3: PDBx/mmCIF format\n"
+"             4: binary structure database built by pdb2db. Structures are\n"
+"                listed by -dir, or all structures of the database are\n"
+"                clustered if it is given instead of a structure file\n"
 "    -chain   Chains to parse in structure_2. Use _ for a chain without chain ID.\n"
 "             Multiple chains can be separated by commas, e.g.,\n"
 "             USalign -chain1 C,D,E,F 5jdo.pdb -chain2 A,B,C,D 3wtg.pdb -ter 0\n"
@@ -62,6 +67,14 @@ void print_help(bool h_opt=false)
 "             5: geometric average of the two TM-scores\n"
 "             6: root mean square of the two TM-scores\n"
 "\n"
+"    -t       Number of threads used to read structure files and, with\n"
+"             -batch, to align chains. Default is 1.\n"
+"\n"
+"    -batch   Number of chains that are aligned in parallel to the current\n"
+"             cluster representatives before they are clustered one by one.\n"
+"             The clusters are the same as without -batch. Default is 0,\n"
+"             i.e., align one chain at a time.\n"
+"\n"
 "    -o       Output the cluster result to file.\n"
 "             Default is print result to screen.\n"
 "\n"
@@ -86,6 +99,23 @@ void print_help(bool h_opt=false)
 "\n"
 "    -init    tentative clustering\n"
 "\n"
+"    -update  Add chains to the clusters of a previous run written by -o.\n"
+"             Old clusters and their members are kept, and only chains not\n"
+"             in these clusters are aligned, to the old representatives and\n"
+"             to each other. The old representatives must be in chain_list\n"
+"             or in the same -dir. -s, -TMcut and -split should be the same\n"
+"             as the previous run.\n"
+"             $ qTMclust -dir chain_folder/ old_list -o old_clust.txt\n"
+"             $ qTMclust -dir chain_folder/ new_list -update old_clust.txt -o clust.txt\n"
+"\n"
+"    -ckpt    Write the clustering progress to a checkpoint file every\n"
+"             -ckpt_step chains (default 1000)\n"
+"\n"
+"    -resume  Continue from the checkpoint set by -ckpt. The same chains\n"
+"             and -TMcut, -s, -fast, -init, -mol and -update must be used.\n"
+"             $ qTMclust -dir chain_folder/ chain_list -ckpt clust.ckpt\n"
+"             $ qTMclust -dir chain_folder/ chain_list -ckpt clust.ckpt -resume\n"
+"\n"
 "    -h       Print the full help message, including additional options.\n"
 "\n"
     <<endl;
@@ -142,6 +172,383 @@ void read_init_cluster(const string&filename,
     vector<string>().swap(line_vec);
 }
 
+/* read the clusters written by -o. Each line is one cluster, starting with
+ * its representative */
+void read_old_cluster(const string&filename,
+    vector<vector<string> > &old_clust_vec)
+{
+    ifstream fin(filename.c_str());
+    if (!fin.is_open())
+        PrintErrorAndQuit("ERROR! Cannot read cluster file "+filename);
+    string line;
+    vector<string> line_vec;
+    while (getline(fin,line))
+    {
+        split(line,line_vec,'\t');
+        if (line_vec.size()) old_clust_vec.push_back(line_vec);
+        line_vec.clear();
+    }
+    fin.close();
+}
+
+/* alignments of a query chain to representatives, so that a query that
+ * was aligned speculatively is not aligned again when it is clustered */
+struct PairScore
+{
+    bool   has_HwRMSD;
+    double HwRMSD_TM;  // HwRMSD TM-score selected by -s
+    bool   has_TMalign;
+    int    status;     // TMalign_main return value
+    double TM1, TM2, TM3;
+
+    PairScore(): has_HwRMSD(false), has_TMalign(false) {}
+};
+typedef map<size_t,PairScore> PairCache; // representative -> scores
+
+/* data and options shared by the clustering of all chains */
+struct ClustArgs
+{
+    const vector<vector<vector<float> > >&xyz_vec;
+    const vector<vector<char> >&seq_vec;
+    const vector<vector<char> >&sec_vec;
+    const vector<int>&mol_vec;
+    const vector<string>&chainID_list;
+    const vector<size_t>&clust_repr_vec;
+    const map<size_t,size_t>&clust_repr_map;
+    const map<string, map<string,bool> >&init_cluster;
+    const vector<string>&sequence;
+    const size_t Nstruct;
+    const size_t Nold;         // number of old clusters of -update
+    const double TMcut;
+    const int    s_opt;
+    const bool   fast_opt;
+    const int    i_opt;
+    const int    a_opt;
+    const bool   u_opt;
+    const bool   d_opt;
+    const double Lnorm_ass;
+    const double d0_scale;
+};
+
+/* TM-score selected by -s */
+double select_TM(const int s_opt, const double TM1, const double TM2,
+    const double TM3)
+{
+    double TM=TM3; // average length
+    if      (s_opt==1) TM=TM2; // shorter length
+    else if (s_opt==2) TM=TM1; // longer length
+    else if (s_opt==3) TM=(TM1+TM2)/2;     // average TM
+    else if (s_opt==4) TM=2/(1/TM1+1/TM2); // harmonic average
+    else if (s_opt==5) TM=sqrt(TM1*TM2);   // geometric average
+    else if (s_opt==6) TM=sqrt((TM1*TM1+TM2*TM2)/2); // root mean square
+    return TM;
+}
+
+/* Greedy clustering of the i-th longest chain chain_i against the current
+ * representatives in args.clust_repr_vec. Return the cluster of chain_i,
+ * or -1 if chain_i starts a new cluster. Alignments are taken from cache
+ * if possible. Missing alignments are computed and added to cache if
+ * compute is set. Otherwise, -2 is returned at the first missing
+ * alignment. Progress is printed to log unless it is NULL */
+long cluster_chain(const ClustArgs &args, const size_t i,
+    const size_t chain_i, PairCache &cache, const bool compute,
+    ostream *log, AlignWorkspace &ws)
+{
+    const vector<vector<vector<float> > >&xyz_vec=args.xyz_vec;
+    const vector<int>&mol_vec=args.mol_vec;
+    const vector<string>&chainID_list=args.chainID_list;
+    const vector<size_t>&clust_repr_vec=args.clust_repr_vec;
+    const double TMcut=args.TMcut;
+    const int    s_opt=args.s_opt;
+    const bool   fast_opt=args.fast_opt;
+    double ub_HwRMSD=0.90*TMcut+0.10;
+    double lb_HwRMSD=0.5*TMcut;
+    double ub_TMfast=0.90*TMcut+0.10;
+    double lb_TMfast=0.9*TMcut;
+    const double fast_lb=50.;  // proteins shorter than fast_lb never use -fast
+    const double fast_ub=1000.;// proteins longer than fast_ub always use -fast
+    double Lave;               // average protein length for chain_i and chain_j
+    size_t sizePROT;           // number of representatives for current chain
+    vector<size_t> index_vec;  // index of cluster representatives for the chain
+    size_t j,chain_j;
+    int xlen=xyz_vec[chain_i].size();
+    int ylen,r;
+    double **xa=NULL,**ya;
+
+#ifdef TMalign_HwRMSD_h
+    /* These parameters controls HwRMSD filter. iter_opt typically should be
+     * >=3. Many alignments converge within iter_opt=5. Occassionally
+     * some alignments require iter_opt=10. Higher iter_opt takes more time,
+     * even though HwRMSD iter_opt 10 still takes far less time than TMalign
+     * -fast -TMcut 0.5.
+     * After HwRMSD filter, at least min_repr_num and at most max_repr_num
+     * are used for subsequent TMalign. The actual number of representatives
+     * are decided by xlen */
+    const int glocal    =0; // global alignment
+    const int iter_opt  =10;
+    const int min_repr_num=10;
+    const int max_repr_num=50;
+#endif
+
+    // j-1 is index of old cluster. here, we starts from the latest
+    // cluster because proteins with similar length are more likely
+    // to be similar. we cannot use j as index because size_t j cannot
+    // be negative at the end of this loop
+    for (j=clust_repr_vec.size();j>0;j--)
+    {
+        chain_j=clust_repr_vec[j-1];
+        ylen=xyz_vec[chain_j].size();
+        if (j<=args.Nold && ylen<=5) continue; // TMalign cannot handle L<=5
+        else if (mol_vec[chain_i]*mol_vec[chain_j]<0) continue;
+        else if (s_opt==2 && xlen<TMcut*ylen)       continue;
+        else if (s_opt==3 && xlen<(2*TMcut-1)*ylen) continue;
+        else if (s_opt==4 && xlen*(2/TMcut-1)<ylen) continue;
+        else if (s_opt==5 && xlen<TMcut*TMcut*ylen) continue;
+        else if (s_opt==6 && xlen*xlen<(2*TMcut*TMcut-1)*ylen*ylen) continue;
+        index_vec.push_back(chain_j);
+    }
+    sizePROT=index_vec.size();
+
+    string key=chainID_list[chain_i];
+    if (log) *log<<'>'<<chainID_list[chain_i]<<'\t'<<xlen<<'\t'
+        <<setiosflags(ios::fixed)<<setprecision(2)
+        <<100.*i/args.Nstruct<<"%(#"<<i<<")\t"
+        <<"#repr="<<sizePROT<<"/"<<clust_repr_vec.size()<<endl;
+
+#ifdef TMalign_HwRMSD_h
+    map<string, map<string,bool> >::const_iterator init_it=
+        args.init_cluster.find(key);
+    const bool has_init=(init_it!=args.init_cluster.end());
+    vector<pair<double,size_t> > HwRMSDscore_list;
+    double TM;
+    size_t init_count=0;
+    for (j=0;j<sizePROT;j++)
+    {
+        chain_j=index_vec[j];
+        string value=chainID_list[chain_j];
+        if (has_init && init_count>=2 && 
+            HwRMSDscore_list.size()>=init_it->second.size() && !init_it->second.count(value))
+            continue;
+        ylen=xyz_vec[chain_j].size();
+
+        if (s_opt<=1) filter_lower_bound(lb_HwRMSD, lb_TMfast, 
+            TMcut, s_opt, mol_vec[chain_i]+mol_vec[chain_j]);
+
+        PairScore &score=cache[chain_j];
+        if (!score.has_HwRMSD)
+        {
+            if (!compute)
+            {
+                if (xa) DeleteArray(&xa, xlen);
+                return -2;
+            }
+            if (!xa)
+            {
+                NewArray(&xa, xlen, 3);
+                for (r=0;r<xlen;r++)
+                {
+                    xa[r][0]=xyz_vec[chain_i][r][0];
+                    xa[r][1]=xyz_vec[chain_i][r][1];
+                    xa[r][2]=xyz_vec[chain_i][r][2];
+                }
+            }
+            NewArray(&ya, ylen, 3);
+            for (r=0;r<ylen;r++)
+            {
+                ya[r][0]=xyz_vec[chain_j][r][0];
+                ya[r][1]=xyz_vec[chain_j][r][1];
+                ya[r][2]=xyz_vec[chain_j][r][2];
+            }
+
+            /* declare variable specific to this pair of HwRMSD */
+            double t0[3], u0[3][3];
+            double TM1, TM2;
+            double TM3, TM4, TM5;     // for s_opt, u_opt, d_opt
+            double d0_0, TM_0;
+            double d0A, d0B, d0u, d0a;
+            double d0_out=5.0;
+            string seqM, seqxA, seqyA;// for output alignment
+            double rmsd0 = 0.0;
+            int L_ali;                // Aligned length in standard_TMscore
+            double Liden=0;
+            double TM_ali, rmsd_ali;  // TMscore and rmsd in standard_TMscore
+            int n_ali=0;
+            int n_ali8=0;
+            int *invmap = new int[ylen+1];
+
+            /* entry function for structure alignment */
+            HwRMSD_main(
+                xa, ya, &args.seq_vec[chain_i][0], &args.seq_vec[chain_j][0],
+                &args.sec_vec[chain_i][0], &args.sec_vec[chain_j][0], t0, u0,
+                TM1, TM2, TM3, TM4, TM5,
+                d0_0, TM_0, d0A, d0B, d0u,
+                d0a, d0_out, seqM, seqxA, seqyA,
+                rmsd0, L_ali, Liden, TM_ali,
+                rmsd_ali, n_ali, n_ali8, xlen, ylen,
+                args.sequence, args.Lnorm_ass,
+                args.d0_scale, args.i_opt,
+                args.a_opt, args.u_opt, args.d_opt,
+                mol_vec[chain_i]+mol_vec[chain_j],
+                invmap, glocal, iter_opt);
+
+            score.has_HwRMSD=true;
+            score.HwRMSD_TM=select_TM(s_opt, TM1, TM2, TM3);
+
+            /* clean up after each HwRMSD */
+            seqM.clear();
+            seqxA.clear();
+            seqyA.clear();
+            DeleteArray(&ya, ylen);
+            delete [] invmap;
+        }
+        TM=score.HwRMSD_TM;
+
+        Lave=sqrt(xlen*ylen); // geometry average because O(L1*L2)
+        if (TM>=lb_HwRMSD || Lave<=fast_lb)
+        {
+            if (has_init && init_it->second.count(value))
+            {
+                HwRMSDscore_list.push_back(make_pair(TM+1,index_vec[j]));
+                init_count++;
+                if (init_count==init_it->second.size()) break;
+            }
+            else
+                HwRMSDscore_list.push_back(make_pair(TM,index_vec[j]));
+        }
+
+        /* if a good hit is guaranteed to be found, stop the loop */
+        if (TM>=ub_HwRMSD) break;
+    }
+
+    stable_sort(HwRMSDscore_list.begin(),HwRMSDscore_list.end(),
+        greater<pair<double,size_t> >());
+
+    int cur_repr_num_cutoff=min_repr_num;
+    if (xlen<=fast_lb) cur_repr_num_cutoff=max_repr_num;
+    else if (xlen>fast_lb && xlen<fast_ub) cur_repr_num_cutoff+=
+        (fast_ub-xlen)/(fast_ub-fast_lb)*(max_repr_num-min_repr_num);
+    //if (init_count>=2) cur_repr_num_cutoff=init_count;
+
+    index_vec.clear();
+    for (j=0;j<HwRMSDscore_list.size();j++)
+    {
+        TM=HwRMSDscore_list[j].first;
+        chain_j=HwRMSDscore_list[j].second;
+        ylen=xyz_vec[chain_j].size();
+        Lave=sqrt(xlen*ylen); // geometry average because O(L1*L2)
+        if (Lave>fast_lb && TM<TMcut*0.5 && 
+            index_vec.size()>=cur_repr_num_cutoff) break;
+        index_vec.push_back(chain_j);
+        if (log) *log<<"#"<<chain_j<<"\t"<<chainID_list[chain_j]<<"\t"
+            <<setiosflags(ios::fixed)<<setprecision(4)<<TM<<endl;
+    }
+    if (log) *log<<index_vec.size()<<" out of "
+        <<HwRMSDscore_list.size()<<" entries"<<endl;
+    HwRMSDscore_list.clear();
+#endif
+
+    long clust=-1;
+    for (j=0;j<index_vec.size();j++)
+    {
+        chain_j=index_vec[j];
+        ylen=xyz_vec[chain_j].size();
+        if (mol_vec[chain_i]*mol_vec[chain_j]<0)    continue;
+        else if (s_opt==2 && xlen<TMcut*ylen)       continue;
+        else if (s_opt==3 && xlen<(2*TMcut-1)*ylen) continue;
+        else if (s_opt==4 && xlen*(2/TMcut-1)<ylen) continue;
+        else if (s_opt==5 && xlen<TMcut*TMcut*ylen) continue;
+        else if (s_opt==6 && xlen*xlen<(2*TMcut*TMcut-1)*ylen*ylen) continue;
+        if (s_opt<=1) filter_lower_bound(lb_HwRMSD, lb_TMfast,
+            TMcut, s_opt, mol_vec[chain_i]+mol_vec[chain_j]);
+
+        Lave=sqrt(xlen*ylen); // geometry average because O(L1*L2)
+        bool overwrite_fast_opt=(fast_opt==true || Lave>=fast_ub);
+
+        PairScore &score=cache[chain_j];
+        if (!score.has_TMalign)
+        {
+            if (!compute)
+            {
+                clust=-2;
+                break;
+            }
+            if (!xa)
+            {
+                NewArray(&xa, xlen, 3);
+                for (r=0;r<xlen;r++)
+                {
+                    xa[r][0]=xyz_vec[chain_i][r][0];
+                    xa[r][1]=xyz_vec[chain_i][r][1];
+                    xa[r][2]=xyz_vec[chain_i][r][2];
+                }
+            }
+            NewArray(&ya, ylen, 3);
+            for (r=0;r<ylen;r++)
+            {
+                ya[r][0]=xyz_vec[chain_j][r][0];
+                ya[r][1]=xyz_vec[chain_j][r][1];
+                ya[r][2]=xyz_vec[chain_j][r][2];
+            }
+
+            /* declare variable specific to this pair of TMalign */
+            double t0[3], u0[3][3];
+            double TM4, TM5;          // for u_opt, d_opt
+            double d0_0, TM_0;
+            double d0A, d0B, d0u, d0a;
+            double d0_out=5.0;
+            string seqM, seqxA, seqyA;// for output alignment
+            double rmsd0 = 0.0;
+            int L_ali;                // Aligned length in standard_TMscore
+            double Liden=0;
+            double TM_ali, rmsd_ali;  // TMscore and rmsd in standard_TMscore
+            int n_ali=0;
+            int n_ali8=0;
+            vector<double> do_vec;
+
+            /* entry function for structure alignment */
+            score.status=TMalign_main(
+                xa, ya, &args.seq_vec[chain_i][0], &args.seq_vec[chain_j][0],
+                &args.sec_vec[chain_i][0], &args.sec_vec[chain_j][0],
+                t0, u0, score.TM1, score.TM2, score.TM3, TM4, TM5,
+                d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out,
+                seqM, seqxA, seqyA, do_vec,
+                rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
+                xlen, ylen, args.sequence, args.Lnorm_ass, args.d0_scale,
+                args.i_opt, args.a_opt, args.u_opt, args.d_opt,
+                overwrite_fast_opt, mol_vec[chain_i]+mol_vec[chain_j],
+                TMcut, &ws);
+            score.has_TMalign=true;
+
+            seqM.clear();
+            seqxA.clear();
+            seqyA.clear();
+            do_vec.clear();
+            DeleteArray(&ya, ylen);
+        }
+
+        if (log) *log<<score.status<<'\t'<<chainID_list[chain_j]<<'\t'
+            <<setiosflags(ios::fixed)<<setprecision(4)
+            <<score.TM2<<'\t'<<score.TM1<<'\t'<<overwrite_fast_opt<<endl;
+
+        double TM=select_TM(s_opt, score.TM1, score.TM2, score.TM3);
+
+        if (TM<lb_TMfast || 
+           (TM<TMcut && (fast_opt || overwrite_fast_opt==false)))
+            continue;
+
+        if (TM>=ub_TMfast || 
+           (TM>=TMcut && (fast_opt || overwrite_fast_opt==false)))
+        {
+            map<size_t,size_t>::const_iterator it=
+                args.clust_repr_map.find(chain_j);
+            clust=(it==args.clust_repr_map.end())?0:it->second;
+            break;
+        }
+    }
+    if (xa) DeleteArray(&xa, xlen);
+    return clust;
+}
+
 int main(int argc, char *argv[])
 {
     if (argc < 2) print_help();
@@ -178,6 +585,12 @@ int main(int argc, char *argv[])
     string suffix_opt="";    // set -suffix to empty
     string dir_opt   ="";    // set -dir to empty
     int    byresi_opt=0;     // set -byresi to 0
+    int    nthreads  =1;     // number of threads
+    size_t batch_opt =0;     // number of chains aligned speculatively
+    string ckpt_opt  ="";    // checkpoint file name
+    size_t ckpt_step =1000;  // number of chains between checkpoints
+    bool   resume_opt=false; // resume from checkpoint
+    string update_opt="";    // cluster file of a previous run
     vector<string> chain_list;
     vector<string> chain2parse;
     vector<string> model2parse;
@@ -268,6 +681,35 @@ int main(int argc, char *argv[])
         {
             read_init_cluster(argv[i+1],init_cluster); i++;
         }
+        else if ( !strcmp(argv[i],"-update") && i < (argc-1) )
+        {
+            update_opt=argv[i + 1]; i++;
+        }
+        else if ( !strcmp(argv[i],"-t") && i < (argc-1) )
+        {
+            nthreads=atoi(argv[i + 1]); i++;
+            if (nthreads<1) PrintErrorAndQuit("ERROR! -t must be >=1");
+        }
+        else if ( !strcmp(argv[i],"-ckpt") && i < (argc-1) )
+        {
+            ckpt_opt=argv[i + 1]; i++;
+        }
+        else if ( !strcmp(argv[i],"-ckpt_step") && i < (argc-1) )
+        {
+            if (atoi(argv[i + 1])<1)
+                PrintErrorAndQuit("ERROR! -ckpt_step must be >=1");
+            ckpt_step=atoi(argv[i + 1]); i++;
+        }
+        else if ( !strcmp(argv[i],"-resume") )
+        {
+            resume_opt=true;
+        }
+        else if ( !strcmp(argv[i],"-batch") && i < (argc-1) )
+        {
+            if (atoi(argv[i + 1])<0)
+                PrintErrorAndQuit("ERROR! -batch must be >=0");
+            batch_opt=atoi(argv[i + 1]); i++;
+        }
         else if (!strcmp(argv[i], "-chain") )
         {
             if (i>=(argc-1)) 
@@ -309,453 +751,288 @@ int main(int argc, char *argv[])
         PrintErrorAndQuit("-split 2 should be used with -ter 0 or 1");
     if (split_opt<0 || split_opt>2)
         PrintErrorAndQuit("-split can only be 0, 1 or 2");
+    if (resume_opt && ckpt_opt.size()==0)
+        PrintErrorAndQuit("ERROR! -resume must be used with -ckpt");
 
     /* read initial alignment file from 'align.txt' */
     if (i_opt) read_user_alignment(sequence, fname_lign, i_opt);
 
     if (byresi_opt) i_opt=3;
 
+    /* -infmt 4 reads structures from a database built by pdb2db. A
+     * database given without -dir is clustered as if all its structures
+     * were listed by -dir */
+    StructDB db;
+    if (infmt_opt==4)
+    {
+        if (suffix_opt.size())
+            PrintErrorAndQuit("ERROR! -infmt 4 cannot be used with -suffix");
+        if (dir_opt.size()==0)
+        {
+            dir_opt=xname;
+            xname.clear();
+        }
+        if (!db.open(dir_opt)) PrintErrorAndQuit(
+            "ERROR! Cannot read structure database "+dir_opt);
+    }
+
     /* parse file list */
     if (dir_opt.size()==0) chain_list.push_back(xname);
+    else if (infmt_opt==4) db2chainlist(chain_list, xname, db);
     else file2chainlist(chain_list, xname, dir_opt, suffix_opt);
 
     /* declare previously global variables */
-    vector<vector<string> >PDB_lines; // text of chain
     vector<int>    mol_vec;           // molecule type of chain1, RNA if >0
     vector<string> chainID_list;      // list of chainID
-    size_t xchainnum=0;         // number of chains in a PDB file
     size_t i,j;                 // number of residues/chains in a PDB is
                                 // usually quite limited. Yet, the number of
                                 // files can be very large. size_t is safer
                                 // than int for very long list of files
-    int    xlen,ylen;           // chain length
-    double **xa,**ya;           // xyz coordinate
-    vector<string> resi_vec;    // residue index for chain, dummy variable
+    int    xlen;                // chain length
     vector<pair<int,size_t> >chainLen_list; // vector of (length,index) pair
     vector<vector<char> > seq_vec;
     vector<vector<char> > sec_vec;
     vector<vector<vector<float> > >xyz_vec;
-
-    /* parse files */
-    string chain_name;
-    vector<char>  seq_tmp;
-    vector<char>  sec_tmp;
-    vector<float> flt_tmp(3,0);
-    vector<vector<float> >xyz_tmp;
-    int r; // residue index
-    size_t newchainnum;
-    double ub_HwRMSD=0.90*TMcut+0.10;
-    double lb_HwRMSD=0.5*TMcut;
-    double ub_TMfast=0.90*TMcut+0.10;
-    double lb_TMfast=0.9*TMcut;
     if      (s_opt==2 || s_opt==4 || s_opt==5) a_opt=-2; // normalized by longer length, i.e. smaller TM
     else if (s_opt==1 || s_opt==5) a_opt=-1; // normalized by shorter length, i.e. larger TM
     else if (s_opt==3) a_opt= 1; // normalized by average length
 
-#ifdef TMalign_HwRMSD_h
-    /* These parameters controls HwRMSD filter. iter_opt typically should be
-     * >=3. Many alignments converge within iter_opt=5. Occassionally
-     * some alignments require iter_opt=10. Higher iter_opt takes more time,
-     * even though HwRMSD iter_opt 10 still takes far less time than TMalign
-     * -fast -TMcut 0.5.
-     * After HwRMSD filter, at least min_repr_num and at most max_repr_num
-     * are used for subsequent TMalign. The actual number of representatives
-     * are decided by xlen */
-    const int glocal    =0; // global alignment
-    const int iter_opt  =10;
-    const int min_repr_num=10;
-    const int max_repr_num=50;
-#endif
-
-    for (i=0;i<chain_list.size();i++)
+    /* -update: files of old chains are not read again, except the files of
+     * old representatives. A file may hold both old and new chains if it is
+     * split, so that all listed files are read for -split 1 or 2. Chains
+     * in a database are read as listed */
+    vector<vector<string> > old_clust_vec; // representative, then members
+    map<string,size_t> old_chain_map;      // old chain -> old cluster
+    map<string,size_t> old_repr_map;       // old representative -> cluster
+    if (update_opt.size())
     {
-        xname=chain_list[i];
-        newchainnum=get_PDB_lines(xname, PDB_lines, chainID_list,
-            mol_vec, ter_opt, infmt_opt, atom_opt, false, split_opt, het_opt,
-            chain2parse, model2parse);
-        if (!newchainnum)
-        {
-            cerr<<"Warning! Cannot parse file: "<<xname
-                <<". Chain number 0."<<endl;
-            continue;
+        read_old_cluster(update_opt, old_clust_vec);
+        map<string,bool> file_map;  // true for file of old representative
+        vector<string> update_list; // files to read
+        string filename;
+        for (i=0;i<old_clust_vec.size();i++)
+        {
+            for (j=0;j<old_clust_vec[i].size();j++)
+            {
+                old_chain_map[old_clust_vec[i][j]]=i;
+                if (j==0) old_repr_map[old_clust_vec[i][j]]=i;
+                if (infmt_opt==4) continue;
+                filename=old_clust_vec[i][j];
+                if (split_opt) filename=filename.substr(0,filename.rfind(':'));
+                if (j==0)
+                {
+                    if (file_map[filename]) continue;
+                    file_map[filename]=true;
+                    filename=dir_opt+filename+suffix_opt;
+                    if (isfile(filename)) update_list.push_back(filename);
+                }
+                else if (split_opt==0 && !file_map.count(filename))
+                    file_map[filename]=false;
+            }
         }
-        chain_name=xname.substr(dir_opt.size(),
-            xname.size()-dir_opt.size()-suffix_opt.size());
-        for (j=0;j<newchainnum;j++)
+        for (i=0;i<chain_list.size();i++)
         {
-            chainID_list[j+xchainnum]=chain_name+chainID_list[j+xchainnum];
-            xlen=PDB_lines[j].size();
-            cout<<"Parsing "<<xname<<'\t'<<chainID_list[j+xchainnum]
-                <<" ("<<xlen<<" residues)."<<endl;
-            if (mol_opt=="RNA") mol_vec[j+xchainnum]=1;
-            else if (mol_opt=="protein") mol_vec[j+xchainnum]=-1;
-
-            NewArray(&xa, xlen, 3);
-            seq_tmp.assign(xlen+1,'A');
-            sec_tmp.assign(xlen+1,0);
-
-            read_PDB(PDB_lines[j], xa, &seq_tmp[0], resi_vec, byresi_opt);
+            filename=chain_list[i].substr(dir_opt.size(),
+                chain_list[i].size()-dir_opt.size()-suffix_opt.size());
+            if (!file_map.count(filename)) update_list.push_back(chain_list[i]);
+        }
+        chain_list.swap(update_list);
+    }
 
-            if (mol_vec[j]<=0) make_sec(xa, xlen, &sec_tmp[0]);
-            else make_sec(&seq_tmp[0],xa,xlen,&sec_tmp[0],atom_opt);
+    /* parse files */
+    ChainReader reader(&db, ter_opt, infmt_opt, atom_opt, mol_opt,
+        split_opt, het_opt, byresi_opt, chain2parse, model2parse);
+    reader.read(chain_list, dir_opt, suffix_opt, nthreads, chainID_list,
+        mol_vec, seq_vec, sec_vec, xyz_vec, chainLen_list);
+    chain_list.clear();
 
-            xyz_tmp.assign(xlen,flt_tmp);
-            for (r=0;r<xlen;r++)
+    /* -update: old representatives are the first clusters. Other old
+     * chains are not clustered again */
+    vector<size_t> old_repr_vec(old_clust_vec.size(),-1); // chain index
+    size_t chain_i;
+    if (update_opt.size())
+    {
+        vector<pair<int,size_t> > new_list; // new chains
+        map<string,size_t>::iterator it;
+        for (i=0;i<chainLen_list.size();i++)
+        {
+            chain_i=chainLen_list[i].second;
+            it=old_repr_map.find(chainID_list[chain_i]);
+            if (it!=old_repr_map.end() && old_repr_vec[it->second]==(size_t)-1)
+                old_repr_vec[it->second]=chain_i;
+            else if (old_chain_map.count(chainID_list[chain_i]))
             {
-                xyz_tmp[r][0]=xa[r][0];
-                xyz_tmp[r][1]=xa[r][1];
-                xyz_tmp[r][2]=xa[r][2];
+                vector<char> ().swap(seq_vec[chain_i]);
+                vector<char> ().swap(sec_vec[chain_i]);
+                vector<vector<float> > ().swap(xyz_vec[chain_i]);
             }
-
-            seq_vec.push_back(seq_tmp);
-            sec_vec.push_back(sec_tmp);
-            xyz_vec.push_back(xyz_tmp);
-
-            chainLen_list.push_back(
-                make_pair(PDB_lines[j].size(),j+xchainnum));
-
-            seq_tmp.clear();
-            sec_tmp.clear();
-            xyz_tmp.clear();
-            DeleteArray(&xa, xlen);
-            PDB_lines[j].clear();
+            else new_list.push_back(chainLen_list[i]);
         }
-        PDB_lines.clear();
-        xchainnum+=newchainnum;
+        for (j=0;j<old_repr_vec.size();j++)
+            if (old_repr_vec[j]==(size_t)-1) PrintErrorAndQuit(
+                "ERROR! Cannot read representative "+old_clust_vec[j][0]+
+                " of "+update_opt);
+
+        /* sort old clusters by representative length, as for a new run */
+        vector<pair<int,size_t> > old_len_vec; // length, chain index
+        map<size_t,size_t> old_index_map;      // chain index -> old cluster
+        for (j=0;j<old_repr_vec.size();j++)
+        {
+            chain_i=old_repr_vec[j];
+            old_len_vec.push_back(make_pair(xyz_vec[chain_i].size(),chain_i));
+            old_index_map[chain_i]=j;
+        }
+        stable_sort(old_len_vec.begin(),old_len_vec.end(),
+            greater<pair<int,size_t> >());
+        vector<vector<string> > sorted_clust_vec;
+        for (j=0;j<old_len_vec.size();j++)
+        {
+            old_repr_vec[j]=old_len_vec[j].second;
+            sorted_clust_vec.push_back(
+                old_clust_vec[old_index_map[old_repr_vec[j]]]);
+        }
+        old_clust_vec.swap(sorted_clust_vec);
+        chainLen_list.swap(new_list);
+        map<string,size_t>().swap(old_chain_map);
+        map<string,size_t>().swap(old_repr_map);
+        cout<<"Updating "<<old_clust_vec.size()<<" clusters of "
+            <<update_opt<<endl;
     }
-    flt_tmp.clear();
-    chain_list.clear();
-
-    // swap completely destroy the vector and free up the memory capacity
-    vector<vector<string> >().swap(PDB_lines);
     size_t Nstruct=chainLen_list.size();
 
     /* sort by chain length */
     stable_sort(chainLen_list.begin(),chainLen_list.end(),
         greater<pair<int,int> >());
     cout<<"Clustering "<<chainLen_list.size()
-        <<" chains with TM-score cutoff >="<<TMcut<<'\n'
-        <<"Longest chain "<<chainID_list[chainLen_list[0].second]<<'\t'
-        <<chainLen_list[0].first<<" residues.\n"
+        <<" chains with TM-score cutoff >="<<TMcut<<endl;
+    if (Nstruct) cout<<"Longest chain "
+        <<chainID_list[chainLen_list[0].second]<<'\t'<<chainLen_list[0].first<<" residues.\n"
         <<"Shortest chain "<<chainID_list[chainLen_list.back().second]<<'\t'
         <<chainLen_list.back().first<<" residues."<<endl;
 
-    /* set the first cluster */
-    vector<size_t> clust_mem_vec(Nstruct,-1); // cluster membership
+    /* set the first cluster, or the old clusters of -update */
+    vector<size_t> clust_mem_vec(chainID_list.size(),-1); // cluster membership
     vector<size_t> clust_repr_vec; // the same as number of clusters
-    size_t chain_i=chainLen_list[0].second;
-    clust_repr_vec.push_back(chain_i);
-    clust_mem_vec[chain_i]=0;
     map<size_t,size_t> clust_repr_map;
+    size_t start_i=0;              // first chain to cluster
+    for (j=0;j<old_repr_vec.size();j++)
+    {
+        chain_i=old_repr_vec[j];
+        clust_repr_vec.push_back(chain_i);
+        clust_mem_vec[chain_i]=j;
+        clust_repr_map[chain_i]=j;
+    }
+    if (clust_repr_vec.size()==0 && Nstruct)
+    {
+        chain_i=chainLen_list[0].second;
+        clust_repr_vec.push_back(chain_i);
+        clust_mem_vec[chain_i]=0;
+        start_i=1;
+    }
 
-    /* perform alignment */
+    /* perform alignment. With -batch, the next batch_opt chains are first
+     * aligned in parallel to the current representatives. The chains are
+     * then clustered in order with these alignments, so that the clusters
+     * are the same as without -batch. Clustering of a batch stops at the
+     * first chain that needs an alignment to a new representative from the
+     * same batch. The next batch starts from that chain and keeps the
+     * alignments that are already done */
     size_t chain_j;
-    const double fast_lb=50.;  // proteins shorter than fast_lb never use -fast
-    const double fast_ub=1000.;// proteins longer than fast_ub always use -fast
-    double Lave;               // average protein length for chain_i and chain_j
-    size_t sizePROT;           // number of representatives for current chain
-    vector<size_t> index_vec;  // index of cluster representatives for the chain
-    bool found_clust;          // whether current chain hit previous cluster
-
-    for (i=1;i<Nstruct;i++)
+    size_t k;
+    long   clust;              // cluster of current chain, -1 if new cluster
+    AlignWorkspace ws;         // buffers reused by all TMalign_main calls
+    ClustArgs args={xyz_vec, seq_vec, sec_vec, mol_vec, chainID_list,
+        clust_repr_vec, clust_repr_map, init_cluster, sequence, Nstruct,
+        old_repr_vec.size(), TMcut, s_opt, fast_opt, i_opt, a_opt, u_opt,
+        d_opt, Lnorm_ass, d0_scale};
+    map<size_t,PairCache> cache_map; // alignments of chains not clustered
+    ThreadPool *pool=NULL;
+    AlignWorkspace *ws_vec=NULL;     // one per thread
+    stringstream buf;                // progress of a chain in a batch
+    if (batch_opt>1)
     {
-        chain_i=chainLen_list[i].second;
-        xlen=xyz_vec[chain_i].size();
-        if (xlen<=5) // TMalign cannot handle L<=5
-        {
-            clust_mem_vec[chain_i]=clust_repr_vec.size();
-            clust_repr_vec.push_back(clust_repr_vec.size());
-            continue;
-        }
-
-        NewArray(&xa, xlen, 3);
-        for (r=0;r<xlen;r++)
-        {
-            xa[r][0]=xyz_vec[chain_i][r][0];
-            xa[r][1]=xyz_vec[chain_i][r][1];
-            xa[r][2]=xyz_vec[chain_i][r][2];
-        }
+        pool=new ThreadPool(nthreads);
+        ws_vec=new AlignWorkspace[nthreads];
+    }
 
-        // j-1 is index of old cluster. here, we starts from the latest
-        // cluster because proteins with similar length are more likely
-        // to be similar. we cannot use j as index because size_t j cannot
-        // be negative at the end of this loop
-        for (j=clust_repr_vec.size();j>0;j--)
+    /* chains before ckpt_i are saved in the checkpoint */
+    uint64_t fingerprint=0;
+    size_t ckpt_i=start_i;
+    if (ckpt_opt.size()) fingerprint=clust_fingerprint(chainLen_list,
+        chainID_list, mol_vec, init_cluster, TMcut, s_opt, fast_opt,
+        old_clust_vec);
+    if (resume_opt) ckpt_i=resume_clust_checkpoint(ckpt_opt, fingerprint,
+        chainLen_list, clust_mem_vec, clust_repr_vec, clust_repr_map,
+        seq_vec, sec_vec, xyz_vec);
+
+    i=ckpt_i;
+    while (i<Nstruct)
+    {
+        size_t batch_end=min(i+max(batch_opt,(size_t)1),Nstruct);
+        if (batch_opt>1)
         {
-            chain_j=clust_repr_vec[j-1];
-            ylen=xyz_vec[chain_j].size();
-            if (mol_vec[chain_i]*mol_vec[chain_j]<0)    continue;
-            else if (s_opt==2 && xlen<TMcut*ylen)       continue;
-            else if (s_opt==3 && xlen<(2*TMcut-1)*ylen) continue;
-            else if (s_opt==4 && xlen*(2/TMcut-1)<ylen) continue;
-            else if (s_opt==5 && xlen<TMcut*TMcut*ylen) continue;
-            else if (s_opt==6 && xlen*xlen<(2*TMcut*TMcut-1)*ylen*ylen) continue;
-            index_vec.push_back(chain_j);
-        }
-        sizePROT=index_vec.size();
-
-        string key=chainID_list[chain_i];
-        cout<<'>'<<chainID_list[chain_i]<<'\t'<<xlen<<'\t'
-            <<setiosflags(ios::fixed)<<setprecision(2)
-            <<100.*i/Nstruct<<"%(#"<<i<<")\t"
-            <<"#repr="<<sizePROT<<"/"<<clust_repr_vec.size()<<endl;
-
-#ifdef TMalign_HwRMSD_h
-        vector<pair<double,size_t> > HwRMSDscore_list;
-        double TM;
-        size_t init_count=0;
-        for (j=0;j<sizePROT;j++)
-        {
-            chain_j=index_vec[j];
-            string value=chainID_list[chain_j];
-            if (init_cluster.count(key) && init_count>=2 && 
-                HwRMSDscore_list.size()>=init_cluster[key].size() && !init_cluster[key].count(value))
-                continue;
-            ylen=xyz_vec[chain_j].size();
-            if (mol_vec[chain_i]*mol_vec[chain_j]<0)    continue;
-            else if (s_opt==2 && xlen<TMcut*ylen)       continue;
-            else if (s_opt==3 && xlen<(2*TMcut-1)*ylen) continue;
-            else if (s_opt==4 && xlen*(2/TMcut-1)<ylen) continue;
-            else if (s_opt==5 && xlen<TMcut*TMcut*ylen) continue;
-            else if (s_opt==6 && xlen*xlen<(2*TMcut*TMcut-1)*ylen*ylen) continue;
-
-            if (s_opt<=1) filter_lower_bound(lb_HwRMSD, lb_TMfast, 
-                TMcut, s_opt, mol_vec[chain_i]+mol_vec[chain_j]);
-            
-            //cout<<chainID_list[chain_i]<<" => "<<chainID_list[chain_j]<<endl;
-            
-            NewArray(&ya, ylen, 3);
-            for (r=0;r<ylen;r++)
+            for (k=i;k<batch_end;k++)
             {
-                ya[r][0]=xyz_vec[chain_j][r][0];
-                ya[r][1]=xyz_vec[chain_j][r][1];
-                ya[r][2]=xyz_vec[chain_j][r][2];
-            }
-
-            /* declare variable specific to this pair of HwRMSD */
-            double t0[3], u0[3][3];
-            double TM1, TM2;
-            double TM3, TM4, TM5;     // for s_opt, u_opt, d_opt
-            double d0_0, TM_0;
-            double d0A, d0B, d0u, d0a;
-            double d0_out=5.0;
-            string seqM, seqxA, seqyA;// for output alignment
-            double rmsd0 = 0.0;
-            int L_ali;                // Aligned length in standard_TMscore
-            double Liden=0;
-            double TM_ali, rmsd_ali;  // TMscore and rmsd in standard_TMscore
-            int n_ali=0;
-            int n_ali8=0;
-            int *invmap = new int[ylen+1];
-
-            /* entry function for structure alignment */
-            HwRMSD_main(
-                xa, ya, &seq_vec[chain_i][0], &seq_vec[chain_j][0],
-                &sec_vec[chain_i][0], &sec_vec[chain_j][0], t0, u0,
-                TM1, TM2, TM3, TM4, TM5,
-                d0_0, TM_0, d0A, d0B, d0u,
-                d0a, d0_out, seqM, seqxA, seqyA,
-                rmsd0, L_ali, Liden, TM_ali,
-                rmsd_ali, n_ali, n_ali8, xlen, ylen,
-                sequence, Lnorm_ass,
-                d0_scale, i_opt,
-                a_opt, u_opt, d_opt, mol_vec[chain_i]+mol_vec[chain_j],
-                invmap, glocal, iter_opt);
-
-            TM=TM3; // average length
-            if      (s_opt==1) TM=TM2; // shorter length
-            else if (s_opt==2) TM=TM1; // longer length
-            else if (s_opt==3) TM=(TM1+TM2)/2;     // average TM
-            else if (s_opt==4) TM=2/(1/TM1+1/TM2); // harmonic average
-            else if (s_opt==5) TM=sqrt(TM1*TM2);   // geometric average
-            else if (s_opt==6) TM=sqrt((TM1*TM1+TM2*TM2)/2); // root mean square
-
-            Lave=sqrt(xlen*ylen); // geometry average because O(L1*L2)
-            if (TM>=lb_HwRMSD || Lave<=fast_lb)
-            {
-                if (init_cluster.count(key) && init_cluster[key].count(value))
+                chain_i=chainLen_list[k].second;
+                if (xyz_vec[chain_i].size()<=5) continue;
+                PairCache *cache=&cache_map[k];
+                pool->submit([&args,k,chain_i,cache,ws_vec](int tid)
                 {
-                    HwRMSDscore_list.push_back(make_pair(TM+1,index_vec[j]));
-                    init_count++;
-                    if (init_count==init_cluster[key].size()) break;
-                }
-                else
-                    HwRMSDscore_list.push_back(make_pair(TM,index_vec[j]));
+                    cluster_chain(args, k, chain_i, *cache, true, NULL,
+                        ws_vec[tid]);
+                });
             }
-
-            /* clean up after each HwRMSD */
-            seqM.clear();
-            seqxA.clear();
-            seqyA.clear();
-            DeleteArray(&ya, ylen);
-            delete [] invmap;
-
-            /* if a good hit is guaranteed to be found, stop the loop */
-            if (TM>=ub_HwRMSD) break;
-        }
-
-        stable_sort(HwRMSDscore_list.begin(),HwRMSDscore_list.end(),
-            greater<pair<double,size_t> >());
-
-        int cur_repr_num_cutoff=min_repr_num;
-        if (xlen<=fast_lb) cur_repr_num_cutoff=max_repr_num;
-        else if (xlen>fast_lb && xlen<fast_ub) cur_repr_num_cutoff+=
-            (fast_ub-xlen)/(fast_ub-fast_lb)*(max_repr_num-min_repr_num);
-        //if (init_count>=2) cur_repr_num_cutoff=init_count;
-
-        index_vec.clear();
-        for (j=0;j<HwRMSDscore_list.size();j++)
-        {
-            TM=HwRMSDscore_list[j].first;
-            chain_j=HwRMSDscore_list[j].second;
-            ylen=xyz_vec[chain_j].size();
-            Lave=sqrt(xlen*ylen); // geometry average because O(L1*L2)
-            if (Lave>fast_lb && TM<TMcut*0.5 && 
-                index_vec.size()>=cur_repr_num_cutoff) break;
-            index_vec.push_back(chain_j);
-            cout<<"#"<<chain_j<<"\t"<<chainID_list[chain_j]<<"\t"
-                <<setiosflags(ios::fixed)<<setprecision(4)<<TM<<endl;
+            pool->wait();
         }
-        cout<<index_vec.size()<<" out of "
-            <<HwRMSDscore_list.size()<<" entries"<<endl;
-        HwRMSDscore_list.clear();
-#endif
 
-        found_clust=false;
-        for (j=0;j<index_vec.size();j++)
+        for (;i<batch_end;i++)
         {
-            chain_j=index_vec[j];
-            ylen=xyz_vec[chain_j].size();
-            if (mol_vec[chain_i]*mol_vec[chain_j]<0)    continue;
-            else if (s_opt==2 && xlen<TMcut*ylen)       continue;
-            else if (s_opt==3 && xlen<(2*TMcut-1)*ylen) continue;
-            else if (s_opt==4 && xlen*(2/TMcut-1)<ylen) continue;
-            else if (s_opt==5 && xlen<TMcut*TMcut*ylen) continue;
-            else if (s_opt==6 && xlen*xlen<(2*TMcut*TMcut-1)*ylen*ylen) continue;
-            if (s_opt<=1) filter_lower_bound(lb_HwRMSD, lb_TMfast,
-                TMcut, s_opt, mol_vec[chain_i]+mol_vec[chain_j]);
-
-            NewArray(&ya, ylen, 3);
-            for (r=0;r<ylen;r++)
+            if (ckpt_opt.size() && i>=ckpt_i+ckpt_step)
             {
-                ya[r][0]=xyz_vec[chain_j][r][0];
-                ya[r][1]=xyz_vec[chain_j][r][1];
-                ya[r][2]=xyz_vec[chain_j][r][2];
+                write_clust_checkpoint(ckpt_opt, fingerprint, i,
+                    clust_mem_vec, clust_repr_vec, clust_repr_map);
+                ckpt_i=i;
             }
-
-            Lave=sqrt(xlen*ylen); // geometry average because O(L1*L2)
-            bool overwrite_fast_opt=(fast_opt==true || Lave>=fast_ub);
-            
-            /* declare variable specific to this pair of TMalign */
-            double t0[3], u0[3][3];
-            double TM1, TM2;
-            double TM3, TM4, TM5;     // for s_opt, u_opt, d_opt
-            double d0_0, TM_0;
-            double d0A, d0B, d0u, d0a;
-            double d0_out=5.0;
-            string seqM, seqxA, seqyA;// for output alignment
-            double rmsd0 = 0.0;
-            int L_ali;                // Aligned length in standard_TMscore
-            double Liden=0;
-            double TM_ali, rmsd_ali;  // TMscore and rmsd in standard_TMscore
-            int n_ali=0;
-            int n_ali8=0;
-            vector<double> do_vec;
-            
-            /* entry function for structure alignment */
-            int status=TMalign_main(
-                xa, ya, &seq_vec[chain_i][0], &seq_vec[chain_j][0],
-                &sec_vec[chain_i][0], &sec_vec[chain_j][0],
-                t0, u0, TM1, TM2, TM3, TM4, TM5,
-                d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out,
-                seqM, seqxA, seqyA, do_vec,
-                rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
-                xlen, ylen, sequence, Lnorm_ass, d0_scale,
-                i_opt, a_opt, u_opt, d_opt, overwrite_fast_opt,
-                mol_vec[chain_i]+mol_vec[chain_j],TMcut);
-
-            cout<<status<<'\t'<<chainID_list[chain_j]<<'\t'
-                <<setiosflags(ios::fixed)<<setprecision(4)
-                <<TM2<<'\t'<<TM1<<'\t'<<overwrite_fast_opt<<endl;
-
-            seqM.clear();
-            seqxA.clear();
-            seqyA.clear();
-            do_vec.clear();
-
-            double TM=TM3; // average length
-            if      (s_opt==1) TM=TM2; // shorter length
-            else if (s_opt==2) TM=TM1; // longer length
-            else if (s_opt==3) TM=(TM1+TM2)/2;     // average TM
-            else if (s_opt==4) TM=2/(1/TM1+1/TM2); // harmonic average
-            else if (s_opt==5) TM=sqrt(TM1*TM2);   // geometric average
-            else if (s_opt==6) TM=sqrt((TM1*TM1+TM2*TM2)/2); // root mean square
-
-            if (TM<lb_TMfast || 
-               (TM<TMcut && (fast_opt || overwrite_fast_opt==false)))
+            chain_i=chainLen_list[i].second;
+            xlen=xyz_vec[chain_i].size();
+            if (xlen<=5) // TMalign cannot handle L<=5
             {
-                DeleteArray(&ya, ylen);
+                clust_mem_vec[chain_i]=clust_repr_vec.size();
+                clust_repr_vec.push_back(clust_repr_vec.size());
                 continue;
             }
 
-            if (TM>=ub_TMfast || 
-               (TM>=TMcut && (fast_opt || overwrite_fast_opt==false)))
+            if (batch_opt>1)
             {
-                clust_mem_vec[chain_i]=clust_repr_map[chain_j];
-                DeleteArray(&ya, ylen);
-                found_clust=true;
-                break;
+                buf.str(string());
+                clust=cluster_chain(args, i, chain_i, cache_map[i], false,
+                    &buf, ws);
+                if (clust==-2) break;
+                cout<<buf.str()<<flush;
             }
+            else clust=cluster_chain(args, i, chain_i, cache_map[i], true,
+                &cout, ws);
+            cache_map.erase(i);
 
-            if (TM<lb_TMfast && overwrite_fast_opt==false)
+            if (clust<0) // new cluster
             {
-                TMalign_main(
-                    xa, ya, &seq_vec[chain_i][0], &seq_vec[chain_j][0],
-                    &sec_vec[chain_i][0], &sec_vec[chain_j][0],
-                    t0, u0, TM1, TM2, TM3, TM4, TM5,
-                    d0_0, TM_0, d0A, d0B, d0u, d0a, d0_out,
-                    seqM, seqxA, seqyA, do_vec,
-                    rmsd0, L_ali, Liden, TM_ali, rmsd_ali, n_ali, n_ali8,
-                    xlen, ylen, sequence, Lnorm_ass, d0_scale,
-                    i_opt, a_opt, u_opt, d_opt, false,
-                    mol_vec[chain_i]+mol_vec[chain_j],TMcut);
-                seqM.clear();
-                seqxA.clear();
-                seqyA.clear();
-                do_vec.clear();
-                DeleteArray(&ya, ylen);
-                
-                TM=TM3;                // average length
-                if      (s_opt==1) TM=TM2; // shorter length
-                else if (s_opt==2) TM=TM1; // longer length
-                else if (s_opt==3) TM=(TM1+TM2)/2;     // average TM
-                else if (s_opt==4) TM=2/(1/TM1+1/TM2); // harmonic average
-                else if (s_opt==5) TM=sqrt(TM1*TM2);   // geometric average
-                else if (s_opt==6) TM=sqrt((TM1*TM1+TM2*TM2)/2); // root mean square
-                cout<<"*\t"<<chainID_list[chain_j]<<'\t'<<TM2<<'\t'<<TM1<<endl;
-                if (TM>=TMcut)
-                {
-                    clust_mem_vec[chain_i]=clust_repr_map[chain_j];
-                    found_clust=true;
-                    break;
-                }
+                clust_mem_vec[chain_i]=clust_repr_vec.size();
+                clust_repr_map[chain_i]=clust_repr_vec.size();
+                clust_repr_vec.push_back(chain_i);
+            }
+            else // member structures are not used further
+            {
+                clust_mem_vec[chain_i]=clust;
+                vector<char> ().swap(seq_vec[chain_i]);
+                vector<char> ().swap(sec_vec[chain_i]);
+                vector<vector<float> > ().swap(xyz_vec[chain_i]);
             }
         }
-        DeleteArray(&xa, xlen);
-        index_vec.clear();
-
-        if (!found_clust) // new cluster
-        {
-            clust_mem_vec[chain_i]=clust_repr_vec.size();
-            clust_repr_map[chain_i]=clust_repr_vec.size();
-            clust_repr_vec.push_back(chain_i);
-        }
-        else // member structures are not used further
-        {
-            vector<char> ().swap(seq_vec[chain_i]);
-            vector<char> ().swap(sec_vec[chain_i]);
-            vector<vector<float> > ().swap(xyz_vec[chain_i]);
-        }
+    }
+    if (pool)
+    {
+        delete pool;
+        delete [] ws_vec;
     }
 
     /* clean up */
@@ -770,6 +1047,8 @@ int main(int argc, char *argv[])
     {
         chain_j=clust_repr_vec[j]; // cluster representative
         txt<<chainID_list[chain_j];
+        if (j<old_clust_vec.size()) for (k=1;k<old_clust_vec[j].size();k++)
+            txt<<'\t'<<old_clust_vec[j][k];
         for (chain_i=0;chain_i<clust_mem_vec.size();chain_i++)
         {
             if (chain_i!=chain_j && clust_mem_vec[chain_i]==j)
@@ -791,6 +1070,7 @@ int main(int argc, char *argv[])
     clust_mem_vec.clear();
     chainID_list.clear();
     clust_repr_map.clear();
+    vector<vector<string> >().swap(old_clust_vec);
     vector<string>().swap(chain2parse);
     vector<string>().swap(model2parse);
     map<string, map<string,bool> >().swap(init_cluster);
@@ -16,31 +16,31 @@ int se_main(
     const int xlen, const int ylen, const vector<string> &sequence,
     const double Lnorm_ass, const double d0_scale, const bool i_opt,
     const bool a_opt, const int u_opt, const bool d_opt, const int mol_type,
-    const int outfmt_opt, int *invmap, const int hinge=0)
+    const int outfmt_opt, int *invmap, const int hinge=0,
+    AlignWorkspace *ws=NULL)
 {
     double D0_MIN;        //for d0
     double Lnorm;         //normalization length
     double score_d8,d0,d0_search,dcu0;//for TMscore search
-    double **score;       // Input score table for dynamic programming
-    bool   **path;        // for dynamic programming  
     double **val;         // for dynamic programming  
 
+    AlignWorkspace local_ws;  // only used if the caller has no workspace
+    if (ws==NULL) ws=&local_ws;
     int *m1=NULL;
     int *m2=NULL;
     double d;
     if (outfmt_opt<2)
     {
-        m1=new int[xlen]; //alignd index in x
-        m2=new int[ylen]; //alignd index in y
+        m1=ws->m1.get(xlen); //alignd index in x
+        m2=ws->m2.get(ylen); //alignd index in y
     }
 
     /***********************/
     /* allocate memory     */
     /***********************/
-    NewArray(&score, xlen+1, ylen+1);
-    NewArray(&path, xlen+1, ylen+1);
-    NewArray(&val, xlen+1, ylen+1);
-    int *invmap0          = new int[ylen+1];
+    PathMatrix &path=ws->path.get(xlen+1, ylen+1); // DP traceback
+    val  =ws->val.get(xlen+1, ylen+1);
+    int *invmap0          = ws->invmap0.get(ylen+1);
     int i,j;
     if (hinge==0) for (j=0;j<=ylen;j++) invmap0[j]=-1;
     else for (j=0;j<ylen;j++) invmap0[j]=invmap[j];
@@ -79,7 +79,8 @@ int se_main(
 
     /* perform alignment */
     if (hinge==0) for(j=0; j<ylen; j++) invmap[j]=-1;
-    if (!i_opt) NWDP_SE(path, val, xa, ya, xlen, ylen, d0*d0, 0, invmap, hinge);
+    if (!i_opt) NWDP_SE(path, val, xa, ya, xlen, ylen, d0*d0, 0, invmap, hinge,
+        ws);
     else
     {
         int i1 = -1;// in C version, index starts from zero, not from one
@@ -149,10 +150,6 @@ int se_main(
     if (outfmt_opt>=2)
     {
         if (hinge) seqM_char.clear();    
-        delete []invmap0;
-        DeleteArray(&score, xlen+1);
-        DeleteArray(&path, xlen+1);
-        DeleteArray(&val, xlen+1);
         return 0;
     }
 
@@ -229,12 +226,5 @@ int se_main(
         }
     }
 
-    /* free memory */
-    delete [] invmap0;
-    delete [] m1;
-    delete [] m2;
-    DeleteArray(&score, xlen+1);
-    DeleteArray(&path, xlen+1);
-    DeleteArray(&val, xlen+1);
     return 0; // zero for no exception
 }
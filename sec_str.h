@@ -0,0 +1,193 @@
+/* Secondary structure assignment of protein and RNA chains, used by the
+ * alignment programs and by pdb2db */
+#ifndef TMalign_sec_str_h
+#define TMalign_sec_str_h 1
+
+#include "basic_fun.h"
+
+char sec_str(double dis13, double dis14, double dis15,
+            double dis24, double dis25, double dis35)
+{
+    char s='C';
+    
+    double delta=2.1;
+    if (fabs(dis15-6.37)<delta && fabs(dis14-5.18)<delta && 
+        fabs(dis25-5.18)<delta && fabs(dis13-5.45)<delta &&
+        fabs(dis24-5.45)<delta && fabs(dis35-5.45)<delta)
+    {
+        s='H'; //helix                        
+        return s;
+    }
+
+    delta=1.42;
+    if (fabs(dis15-13  )<delta && fabs(dis14-10.4)<delta &&
+        fabs(dis25-10.4)<delta && fabs(dis13-6.1 )<delta &&
+        fabs(dis24-6.1 )<delta && fabs(dis35-6.1 )<delta)
+    {
+        s='E'; //strand
+        return s;
+    }
+
+    if (dis15 < 8) s='T'; //turn
+    return s;
+}
+
+
+/* secondary structure assignment for protein:
+ * 1->coil, 2->helix, 3->turn, 4->strand */
+void make_sec(double **x, int len, char *sec)
+{
+    int j1, j2, j3, j4, j5;
+    double d13, d14, d15, d24, d25, d35;
+    for(int i=0; i<len; i++)
+    {     
+        sec[i]='C';
+        j1=i-2;
+        j2=i-1;
+        j3=i;
+        j4=i+1;
+        j5=i+2;        
+        
+        if(j1>=0 && j5<len)
+        {
+            d13=sqrt(dist(x[j1], x[j3]));
+            d14=sqrt(dist(x[j1], x[j4]));
+            d15=sqrt(dist(x[j1], x[j5]));
+            d24=sqrt(dist(x[j2], x[j4]));
+            d25=sqrt(dist(x[j2], x[j5]));
+            d35=sqrt(dist(x[j3], x[j5]));
+            sec[i]=sec_str(d13, d14, d15, d24, d25, d35);            
+        }    
+    } 
+    sec[len]=0;
+}
+
+/* a c d b: a paired to b, c paired to d */
+bool overlap(const int a1,const int b1,const int c1,const int d1,
+             const int a2,const int b2,const int c2,const int d2)
+{
+    return (a2>=a1&&a2<=c1)||(c2>=a1&&c2<=c1)||
+           (d2>=a1&&d2<=c1)||(b2>=a1&&b2<=c1)||
+           (a2>=d1&&a2<=b1)||(c2>=d1&&c2<=b1)||
+           (d2>=d1&&d2<=b1)||(b2>=d1&&b2<=b1);
+}
+
+/* find base pairing stacks in RNA*/
+void sec_str(int len,char *seq, const vector<vector<bool> >&bp, 
+    int a, int b,int &c, int &d)
+{
+    int i;
+    
+    for (i=0;i<len;i++)
+    {
+        if (a+i<len-3 && b-i>0)
+        {
+            if (a+i<b-i && bp[a+i][b-i]) continue;
+            break;
+        }
+    }
+    c=a+i-1;d=b-i+1;
+}
+
+/* secondary structure assignment for RNA:
+ * 1->unpair, 2->paired with upstream, 3->paired with downstream */
+void make_sec(char *seq, double **x, int len, char *sec,const string atom_opt)
+{
+    int ii,jj,i,j;
+
+    float lb=12.5; // lower bound for " C3'"
+    float ub=15.0; // upper bound for " C3'"
+    if     (atom_opt==" C4'") {lb=14.0;ub=16.0;}
+    else if(atom_opt==" C5'") {lb=16.0;ub=18.0;}
+    else if(atom_opt==" O3'") {lb=13.5;ub=16.5;}
+    else if(atom_opt==" O5'") {lb=15.5;ub=18.5;}
+    else if(atom_opt==" P  ") {lb=16.5;ub=21.0;}
+
+    float dis;
+    vector<bool> bp_tmp(len,false);
+    vector<vector<bool> > bp(len,bp_tmp);
+    bp_tmp.clear();
+    for (i=0; i<len; i++)
+    {
+        sec[i]='.';
+        for (j=i+1; j<len; j++)
+        {
+            if (((seq[i]=='u'||seq[i]=='t')&&(seq[j]=='a'             ))||
+                ((seq[i]=='a'             )&&(seq[j]=='u'||seq[j]=='t'))||
+                ((seq[i]=='g'             )&&(seq[j]=='c'||seq[j]=='u'))||
+                ((seq[i]=='c'||seq[i]=='u')&&(seq[j]=='g'             )))
+            {
+                dis=sqrt(dist(x[i], x[j]));
+                bp[j][i]=bp[i][j]=(dis>lb && dis<ub);
+            }
+        }
+    }
+    
+    // From 5' to 3': A0_var C0_var D0_var B0_var: A0_var paired to B0_var, C0_var paired to D0_var
+    vector<int> A0_var,B0_var,C0_var,D0_var;
+    for (i=0; i<len-2; i++)
+    {
+        for (j=i+3; j<len; j++)
+        {
+            if (!bp[i][j]) continue;
+            if (i>0 && j+1<len && bp[i-1][j+1]) continue;
+            if (!bp[i+1][j-1]) continue;
+            sec_str(len,seq, bp, i,j,ii,jj);
+            if (jj<i || j<ii)
+            {
+                ii=i;
+                jj=j;
+            }
+            A0_var.push_back(i);
+            B0_var.push_back(j);
+            C0_var.push_back(ii);
+            D0_var.push_back(jj);
+        }
+    }
+    
+    //int sign;
+    for (i=0;i<A0_var.size();i++)
+    {
+        /*
+        sign=0;
+        if(C0_var[i]-A0_var[i]<=1)
+        {
+            for(j=0;j<A0_var.size();j++)
+            {
+                if(i==j) continue;
+
+                if((A0_var[j]>=A0_var[i]&&A0_var[j]<=C0_var[i])||
+                   (C0_var[j]>=A0_var[i]&&C0_var[j]<=C0_var[i])||
+                   (D0_var[j]>=A0_var[i]&&D0_var[j]<=C0_var[i])||
+                   (B0_var[j]>=A0_var[i]&&B0_var[j]<=C0_var[i])||
+                   (A0_var[j]>=D0_var[i]&&A0_var[j]<=B0_var[i])||
+                   (C0_var[j]>=D0_var[i]&&C0_var[j]<=B0_var[i])||
+                   (D0_var[j]>=D0_var[i]&&D0_var[j]<=B0_var[i])||
+                   (B0_var[j]>=D0_var[i]&&B0_var[j]<=B0_var[i]))
+                {
+                    sign=-1;
+                    break;
+                }
+            }
+        }
+        if(sign!=0) continue;
+        */
+
+        for (j=0;;j++)
+        {
+            if(A0_var[i]+j>C0_var[i]) break;
+            sec[A0_var[i]+j]='<';
+            sec[D0_var[i]+j]='>';
+        }
+    }
+    sec[len]=0;
+
+    /* clean up */
+    A0_var.clear();
+    B0_var.clear();
+    C0_var.clear();
+    D0_var.clear();
+    bp.clear();
+}
+
+#endif
@@ -0,0 +1,382 @@
+/* SIMD kernels for the TM-score search engine (TMscore8_search) and for the
+ * score matrix of the coordinate versions of NWDP_TM, NWDP_SE and
+ * NWDP_TM_dimer.
+ *
+ * Coordinates of the aligned residue pairs are kept in structure-of-arrays
+ * layout xs[0..2][0..n-1], so that 4 (AVX2) or 8 (AVX-512) residue pairs
+ * are superposed and scored per instruction. The kernel is selected at run
+ * time according to the CPU, or by simd_opt. The AVX2 and AVX-512 kernels
+ * do not use FMA and evaluate every expression in the same order as the
+ * scalar kernel, which in turn follows transform() and dist(), so that all
+ * three kernels give identical distances and scores with GCC, even with
+ * -ffast-math. Compilers that ignore "#pragma GCC optimize" below may
+ * reorder the scalar arithmetic, which changes the last bit, i.e. a relative
+ * difference below 1e-15 in the distance of a residue pair and below 1e-12
+ * in a TM-score.
+ */
+#ifndef TMalign_simd_score_h
+#define TMalign_simd_score_h 1
+
+#include "basic_fun.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TMalign_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/* SIMD kernel used by rotate_score8:
+ * -1 - (default) detect the best kernel supported by the CPU
+ *  0 - scalar
+ *  1 - AVX2
+ *  2 - AVX-512 */
+int simd_opt=-1;
+
+/* return the fastest kernel supported by the CPU */
+int detect_simd_level()
+{
+#ifdef TMalign_SIMD_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return 2;
+    if (__builtin_cpu_supports("avx2")) return 1;
+#endif
+    return 0;
+}
+
+/* return the fastest kernel supported by the CPU, or simd_opt if the
+ * CPU supports it */
+int get_simd_level()
+{
+    static const int simd_level=detect_simd_level(); // thread-safe in C++11
+    if (simd_opt>=0 && simd_opt<simd_level) return simd_opt;
+    return simd_level;
+}
+
+/* copy coordinates x[0..n-1][0..2] into xs[0..2][0..n-1] */
+void coord2soa(double **x, const int n, double **xs)
+{
+    for (int i=0;i<n;i++)
+    {
+        xs[0][i]=x[i][0];
+        xs[1][i]=x[i][1];
+        xs[2][i]=x[i][2];
+    }
+}
+
+/* evaluate the kernels below in the order in which they are written, so that
+ * they give the same results. Otherwise, -ffast-math may reorder the scalar
+ * kernel, and contract mul and add into FMA in the AVX-512 kernel */
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off", "no-associative-math")
+#endif
+
+/* scalar kernel of rotate_score8 for residue pairs start...n-1 */
+void rotate_score8_scalar(double **xs, double **ys, const int start,
+    const int n, double t[3], double u[3][3], const int score_sum_method,
+    const double score_d8_cut, const double d02, double *di, double *term)
+{
+    double xx0, xx1, xx2, d1, d2, d3;
+    for (int i=start;i<n;i++)
+    {
+        xx0=t[0]+(u[0][0]*xs[0][i]+u[0][1]*xs[1][i]+u[0][2]*xs[2][i]);
+        xx1=t[1]+(u[1][0]*xs[0][i]+u[1][1]*xs[1][i]+u[1][2]*xs[2][i]);
+        xx2=t[2]+(u[2][0]*xs[0][i]+u[2][1]*xs[1][i]+u[2][2]*xs[2][i]);
+        d1=xx0-ys[0][i];
+        d2=xx1-ys[1][i];
+        d3=xx2-ys[2][i];
+        di[i]=(d1*d1+d2*d2+d3*d3);
+        if (score_sum_method!=8 || di[i]<=score_d8_cut)
+             term[i]=1/(1+di[i]/d02);
+        else term[i]=0;
+    }
+}
+
+#ifdef TMalign_SIMD_X86
+__attribute__((target("avx2")))
+void rotate_score8_avx2(double **xs, double **ys, const int n,
+    double t[3], double u[3][3], const int score_sum_method,
+    const double score_d8_cut, const double d02, double *di, double *term)
+{
+    const __m256d t0=_mm256_set1_pd(t[0]);
+    const __m256d t1=_mm256_set1_pd(t[1]);
+    const __m256d t2=_mm256_set1_pd(t[2]);
+    const __m256d u00=_mm256_set1_pd(u[0][0]);
+    const __m256d u01=_mm256_set1_pd(u[0][1]);
+    const __m256d u02=_mm256_set1_pd(u[0][2]);
+    const __m256d u10=_mm256_set1_pd(u[1][0]);
+    const __m256d u11=_mm256_set1_pd(u[1][1]);
+    const __m256d u12=_mm256_set1_pd(u[1][2]);
+    const __m256d u20=_mm256_set1_pd(u[2][0]);
+    const __m256d u21=_mm256_set1_pd(u[2][1]);
+    const __m256d u22=_mm256_set1_pd(u[2][2]);
+    const __m256d one=_mm256_set1_pd(1.0);
+    const __m256d vd02=_mm256_set1_pd(d02);
+    const __m256d cut=_mm256_set1_pd(score_sum_method==8?score_d8_cut:
+        HUGE_VAL);
+    __m256d x0, x1, x2, xx, d1, d2, d3, d, s;
+    int i;
+    for (i=0;i+4<=n;i+=4)
+    {
+        x0=_mm256_loadu_pd(xs[0]+i);
+        x1=_mm256_loadu_pd(xs[1]+i);
+        x2=_mm256_loadu_pd(xs[2]+i);
+        xx=_mm256_add_pd(t0,_mm256_add_pd(_mm256_add_pd(
+            _mm256_mul_pd(u00,x0),_mm256_mul_pd(u01,x1)),
+            _mm256_mul_pd(u02,x2)));
+        d1=_mm256_sub_pd(xx,_mm256_loadu_pd(ys[0]+i));
+        xx=_mm256_add_pd(t1,_mm256_add_pd(_mm256_add_pd(
+            _mm256_mul_pd(u10,x0),_mm256_mul_pd(u11,x1)),
+            _mm256_mul_pd(u12,x2)));
+        d2=_mm256_sub_pd(xx,_mm256_loadu_pd(ys[1]+i));
+        xx=_mm256_add_pd(t2,_mm256_add_pd(_mm256_add_pd(
+            _mm256_mul_pd(u20,x0),_mm256_mul_pd(u21,x1)),
+            _mm256_mul_pd(u22,x2)));
+        d3=_mm256_sub_pd(xx,_mm256_loadu_pd(ys[2]+i));
+        d=_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(d1,d1),
+            _mm256_mul_pd(d2,d2)),_mm256_mul_pd(d3,d3));
+        _mm256_storeu_pd(di+i,d);
+        s=_mm256_div_pd(one,_mm256_add_pd(one,_mm256_div_pd(d,vd02)));
+        s=_mm256_and_pd(s,_mm256_cmp_pd(d,cut,_CMP_LE_OQ));
+        _mm256_storeu_pd(term+i,s);
+    }
+    rotate_score8_scalar(xs, ys, i, n, t, u, score_sum_method,
+        score_d8_cut, d02, di, term);
+}
+
+__attribute__((target("avx512f")))
+void rotate_score8_avx512(double **xs, double **ys, const int n,
+    double t[3], double u[3][3], const int score_sum_method,
+    const double score_d8_cut, const double d02, double *di, double *term)
+{
+    const __m512d t0=_mm512_set1_pd(t[0]);
+    const __m512d t1=_mm512_set1_pd(t[1]);
+    const __m512d t2=_mm512_set1_pd(t[2]);
+    const __m512d u00=_mm512_set1_pd(u[0][0]);
+    const __m512d u01=_mm512_set1_pd(u[0][1]);
+    const __m512d u02=_mm512_set1_pd(u[0][2]);
+    const __m512d u10=_mm512_set1_pd(u[1][0]);
+    const __m512d u11=_mm512_set1_pd(u[1][1]);
+    const __m512d u12=_mm512_set1_pd(u[1][2]);
+    const __m512d u20=_mm512_set1_pd(u[2][0]);
+    const __m512d u21=_mm512_set1_pd(u[2][1]);
+    const __m512d u22=_mm512_set1_pd(u[2][2]);
+    const __m512d one=_mm512_set1_pd(1.0);
+    const __m512d vd02=_mm512_set1_pd(d02);
+    const __m512d cut=_mm512_set1_pd(score_sum_method==8?score_d8_cut:
+        HUGE_VAL);
+    __m512d x0, x1, x2, xx, d1, d2, d3, d, s;
+    __mmask8 m=0xFF;
+    int i;
+    for (i=0;i<n;i+=8)
+    {
+        if (n-i<8) m=(__mmask8)((1u<<(n-i))-1);
+        x0=_mm512_maskz_loadu_pd(m,xs[0]+i);
+        x1=_mm512_maskz_loadu_pd(m,xs[1]+i);
+        x2=_mm512_maskz_loadu_pd(m,xs[2]+i);
+        xx=_mm512_add_pd(t0,_mm512_add_pd(_mm512_add_pd(
+            _mm512_mul_pd(u00,x0),_mm512_mul_pd(u01,x1)),
+            _mm512_mul_pd(u02,x2)));
+        d1=_mm512_sub_pd(xx,_mm512_maskz_loadu_pd(m,ys[0]+i));
+        xx=_mm512_add_pd(t1,_mm512_add_pd(_mm512_add_pd(
+            _mm512_mul_pd(u10,x0),_mm512_mul_pd(u11,x1)),
+            _mm512_mul_pd(u12,x2)));
+        d2=_mm512_sub_pd(xx,_mm512_maskz_loadu_pd(m,ys[1]+i));
+        xx=_mm512_add_pd(t2,_mm512_add_pd(_mm512_add_pd(
+            _mm512_mul_pd(u20,x0),_mm512_mul_pd(u21,x1)),
+            _mm512_mul_pd(u22,x2)));
+        d3=_mm512_sub_pd(xx,_mm512_maskz_loadu_pd(m,ys[2]+i));
+        d=_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(d1,d1),
+            _mm512_mul_pd(d2,d2)),_mm512_mul_pd(d3,d3));
+        _mm512_mask_storeu_pd(di+i,m,d);
+        s=_mm512_div_pd(one,_mm512_add_pd(one,_mm512_div_pd(d,vd02)));
+        s=_mm512_maskz_mov_pd(_mm512_cmp_pd_mask(d,cut,_CMP_LE_OQ),s);
+        _mm512_mask_storeu_pd(term+i,m,s);
+    }
+}
+#endif
+
+/* scalar kernel of score_row_TM for residues start...n-1 of ys */
+void score_row_TM_scalar(const double xx[3], double **ys, const int start,
+    const int n, const double d02, double *score)
+{
+    double d1, d2, d3, dij;
+    for (int j=start;j<n;j++)
+    {
+        d1=xx[0]-ys[0][j];
+        d2=xx[1]-ys[1][j];
+        d3=xx[2]-ys[2][j];
+        dij=(d1*d1+d2*d2+d3*d3);
+        score[j]=1.0/(1+dij/d02);
+    }
+}
+
+#ifdef TMalign_SIMD_X86
+__attribute__((target("avx2")))
+void score_row_TM_avx2(const double xx[3], double **ys, const int n,
+    const double d02, double *score)
+{
+    const __m256d x0=_mm256_set1_pd(xx[0]);
+    const __m256d x1=_mm256_set1_pd(xx[1]);
+    const __m256d x2=_mm256_set1_pd(xx[2]);
+    const __m256d one=_mm256_set1_pd(1.0);
+    const __m256d vd02=_mm256_set1_pd(d02);
+    __m256d d1, d2, d3, d;
+    int j;
+    for (j=0;j+4<=n;j+=4)
+    {
+        d1=_mm256_sub_pd(x0,_mm256_loadu_pd(ys[0]+j));
+        d2=_mm256_sub_pd(x1,_mm256_loadu_pd(ys[1]+j));
+        d3=_mm256_sub_pd(x2,_mm256_loadu_pd(ys[2]+j));
+        d=_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(d1,d1),
+            _mm256_mul_pd(d2,d2)),_mm256_mul_pd(d3,d3));
+        _mm256_storeu_pd(score+j,
+            _mm256_div_pd(one,_mm256_add_pd(one,_mm256_div_pd(d,vd02))));
+    }
+    score_row_TM_scalar(xx, ys, j, n, d02, score);
+}
+
+__attribute__((target("avx512f")))
+void score_row_TM_avx512(const double xx[3], double **ys, const int n,
+    const double d02, double *score)
+{
+    const __m512d x0=_mm512_set1_pd(xx[0]);
+    const __m512d x1=_mm512_set1_pd(xx[1]);
+    const __m512d x2=_mm512_set1_pd(xx[2]);
+    const __m512d one=_mm512_set1_pd(1.0);
+    const __m512d vd02=_mm512_set1_pd(d02);
+    __m512d d1, d2, d3, d;
+    __mmask8 m=0xFF;
+    for (int j=0;j<n;j+=8)
+    {
+        if (n-j<8) m=(__mmask8)((1u<<(n-j))-1);
+        d1=_mm512_sub_pd(x0,_mm512_maskz_loadu_pd(m,ys[0]+j));
+        d2=_mm512_sub_pd(x1,_mm512_maskz_loadu_pd(m,ys[1]+j));
+        d3=_mm512_sub_pd(x2,_mm512_maskz_loadu_pd(m,ys[2]+j));
+        d=_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(d1,d1),
+            _mm512_mul_pd(d2,d2)),_mm512_mul_pd(d3,d3));
+        _mm512_mask_storeu_pd(score+j,m,
+            _mm512_div_pd(one,_mm512_add_pd(one,_mm512_div_pd(d,vd02))));
+    }
+}
+#endif
+
+/* scalar kernel of score_pair_TM for pairs start...n-1 */
+void score_pair_TM_scalar(double **xs, double **ys, const int start,
+    const int n, const double d02, double *score)
+{
+    double d1, d2, d3, dij;
+    for (int i=start;i<n;i++)
+    {
+        d1=xs[0][i]-ys[0][i];
+        d2=xs[1][i]-ys[1][i];
+        d3=xs[2][i]-ys[2][i];
+        dij=(d1*d1+d2*d2+d3*d3);
+        score[i]=1.0/(1+dij/d02);
+    }
+}
+
+#ifdef TMalign_SIMD_X86
+__attribute__((target("avx2")))
+void score_pair_TM_avx2(double **xs, double **ys, const int n,
+    const double d02, double *score)
+{
+    const __m256d one=_mm256_set1_pd(1.0);
+    const __m256d vd02=_mm256_set1_pd(d02);
+    __m256d d1, d2, d3, d;
+    int i;
+    for (i=0;i+4<=n;i+=4)
+    {
+        d1=_mm256_sub_pd(_mm256_loadu_pd(xs[0]+i),_mm256_loadu_pd(ys[0]+i));
+        d2=_mm256_sub_pd(_mm256_loadu_pd(xs[1]+i),_mm256_loadu_pd(ys[1]+i));
+        d3=_mm256_sub_pd(_mm256_loadu_pd(xs[2]+i),_mm256_loadu_pd(ys[2]+i));
+        d=_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(d1,d1),
+            _mm256_mul_pd(d2,d2)),_mm256_mul_pd(d3,d3));
+        _mm256_storeu_pd(score+i,
+            _mm256_div_pd(one,_mm256_add_pd(one,_mm256_div_pd(d,vd02))));
+    }
+    score_pair_TM_scalar(xs, ys, i, n, d02, score);
+}
+
+__attribute__((target("avx512f")))
+void score_pair_TM_avx512(double **xs, double **ys, const int n,
+    const double d02, double *score)
+{
+    const __m512d one=_mm512_set1_pd(1.0);
+    const __m512d vd02=_mm512_set1_pd(d02);
+    __m512d d1, d2, d3, d;
+    __mmask8 m=0xFF;
+    for (int i=0;i<n;i+=8)
+    {
+        if (n-i<8) m=(__mmask8)((1u<<(n-i))-1);
+        d1=_mm512_sub_pd(_mm512_maskz_loadu_pd(m,xs[0]+i),
+                         _mm512_maskz_loadu_pd(m,ys[0]+i));
+        d2=_mm512_sub_pd(_mm512_maskz_loadu_pd(m,xs[1]+i),
+                         _mm512_maskz_loadu_pd(m,ys[1]+i));
+        d3=_mm512_sub_pd(_mm512_maskz_loadu_pd(m,xs[2]+i),
+                         _mm512_maskz_loadu_pd(m,ys[2]+i));
+        d=_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(d1,d1),
+            _mm512_mul_pd(d2,d2)),_mm512_mul_pd(d3,d3));
+        _mm512_mask_storeu_pd(score+i,m,
+            _mm512_div_pd(one,_mm512_add_pd(one,_mm512_div_pd(d,vd02))));
+    }
+}
+#endif
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC pop_options
+#endif
+
+/* Superpose xs onto ys by t, u and compute, for each residue pair i,
+ * the squared distance di[i] and the TM-score term term[i], which is 0 for
+ * pairs beyond score_d8 if score_sum_method==8.
+ * xs, ys - coordinates in SoA layout, xs[0..2][0..n-1] */
+void rotate_score8(double **xs, double **ys, const int n,
+    double t[3], double u[3][3], const int score_sum_method,
+    const double score_d8, const double d0, double *di, double *term)
+{
+    const double score_d8_cut=score_d8*score_d8;
+    const double d02=d0*d0;
+#ifdef TMalign_SIMD_X86
+    int simd_level=get_simd_level();
+    if (simd_level==2) rotate_score8_avx512(xs, ys, n, t, u,
+        score_sum_method, score_d8_cut, d02, di, term);
+    else if (simd_level==1) rotate_score8_avx2(xs, ys, n, t, u,
+        score_sum_method, score_d8_cut, d02, di, term);
+    else
+#endif
+    rotate_score8_scalar(xs, ys, 0, n, t, u, score_sum_method,
+        score_d8_cut, d02, di, term);
+}
+
+/* TM-score term score[j]=1/(1+dij/d02) between xx and each residue j of
+ * ys[0..2][0..n-1], where dij is the squared distance. This fills one row
+ * of the score matrix of the coordinate version of NWDP_TM */
+void score_row_TM(const double xx[3], double **ys, const int n,
+    const double d02, double *score)
+{
+#ifdef TMalign_SIMD_X86
+    int simd_level=get_simd_level();
+    if (simd_level==2) score_row_TM_avx512(xx, ys, n, d02, score);
+    else if (simd_level==1) score_row_TM_avx2(xx, ys, n, d02, score);
+    else
+#endif
+    score_row_TM_scalar(xx, ys, 0, n, d02, score);
+}
+
+
+/* TM-score term score[i]=1/(1+dij/d02) of each pair i of xs[0..2][0..n-1]
+ * and ys[0..2][0..n-1], where dij is the squared distance. This fills one
+ * anti-diagonal of the score matrix in NWDP_wavefront */
+void score_pair_TM(double **xs, double **ys, const int n,
+    const double d02, double *score)
+{
+#ifdef TMalign_SIMD_X86
+    int simd_level=get_simd_level();
+    if (simd_level==2) score_pair_TM_avx512(xs, ys, n, d02, score);
+    else if (simd_level==1) score_pair_TM_avx2(xs, ys, n, d02, score);
+    else
+#endif
+    score_pair_TM_scalar(xs, ys, 0, n, d02, score);
+}
+
+#endif
@@ -0,0 +1,340 @@
+/* Binary structure database written by pdb2db and read with -infmt 4.
+ * It holds the parsed chains of many structure files, so that large
+ * libraries are not parsed from PDB or PDBx/mmCIF text at every run.
+ *
+ * The file is a sequence of chain records, followed by the chain index,
+ * the name table and a footer:
+ *   chain record  - int32 coordinates in 1/1000 Angstrom (3*len), which
+ *                   are exactly the 3 decimals of the PDB format, then
+ *                   sequence (len), secondary structure (len) and residue
+ *                   index (6*len, columns 23-27 and 22 of the ATOM line)
+ *   chain index   - one StructDBChain per chain. Chains of the same
+ *                   structure file are consecutive
+ *   name table    - NUL-terminated file names and chain IDs
+ *   footer        - StructDBFooter
+ * Integers are stored in the byte order of the machine that built the
+ * database. */
+#ifndef TMalign_struct_db_h
+#define TMalign_struct_db_h 1
+
+#include <stdint.h>
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "basic_fun.h"
+
+using namespace std;
+
+const char StructDB_magic[8]={'U','S','D','B','0','0','0','1'};
+const int  StructDB_resi_size=6; // residue index width per residue
+/* bytes per residue in a chain record: coordinates, sequence, secondary
+ * structure and residue index */
+const int  StructDB_residue_size=3*sizeof(int32_t)+2+StructDB_resi_size;
+
+struct StructDBChain
+{
+    uint64_t offset;     // offset of the chain record in the file
+    int32_t  len;        // number of residues
+    int32_t  mol_type;   // RNA if >0
+    uint64_t name;       // offset of the file name in the name table
+    uint64_t chainID;    // offset of the chain ID in the name table
+};
+
+struct StructDBFooter
+{
+    uint64_t index_offset; // offset of the chain index
+    uint64_t chain_num;    // number of chains
+    uint64_t name_offset;  // offset of the name table
+    char     magic[8];
+};
+
+/* append chains to a database written to out */
+class StructDBWriter
+{
+public:
+    StructDBWriter(ostream &out): out(out), offset(0) {}
+
+    void add(const string &name, const string &chainID, const int len,
+        const int mol_type, double **xa, const char *seq, const char *sec,
+        const vector<string> &resi_vec)
+    {
+        StructDBChain chain;
+        chain.offset=offset;
+        chain.len=len;
+        chain.mol_type=mol_type;
+        chain.name=add_name(name);
+        chain.chainID=add_name(chainID);
+        chain_vec.push_back(chain);
+
+        vector<int32_t> xyz(3*len);
+        size_t r,k;
+        for (r=0;r<(size_t)len;r++) for (k=0;k<3;k++)
+            xyz[3*r+k]=(int32_t)floor(xa[r][k]*1000+0.5);
+        string resi(StructDB_resi_size*len,' ');
+        for (r=0;r<(size_t)len && r<resi_vec.size();r++)
+            resi.replace(StructDB_resi_size*r,
+                min(resi_vec[r].size(),(size_t)StructDB_resi_size),
+                resi_vec[r], 0, StructDB_resi_size);
+        write(&xyz[0], sizeof(int32_t)*xyz.size());
+        write(seq, len);
+        write(sec, len);
+        write(resi.c_str(), resi.size());
+        pad();
+    }
+
+    /* write the index, the name table and the footer */
+    void close()
+    {
+        StructDBFooter footer;
+        footer.index_offset=offset;
+        footer.chain_num=chain_vec.size();
+        if (chain_vec.size())
+            write(&chain_vec[0], sizeof(StructDBChain)*chain_vec.size());
+        footer.name_offset=offset;
+        write(names.c_str(), names.size());
+        pad();
+        memcpy(footer.magic, StructDB_magic, 8);
+        write(&footer, sizeof(footer));
+        out.flush();
+    }
+
+private:
+    uint64_t add_name(const string &name)
+    {
+        map<string,uint64_t>::iterator it=name_map.find(name);
+        if (it!=name_map.end()) return it->second;
+        uint64_t pos=names.size();
+        names+=name;
+        names+='\0';
+        name_map[name]=pos;
+        return pos;
+    }
+
+    void write(const void *buf, const size_t size)
+    {
+        out.write((const char *)buf, size);
+        offset+=size;
+    }
+
+    /* keep records 8-byte aligned */
+    void pad()
+    {
+        static const char zero[8]={0,0,0,0,0,0,0,0};
+        if (offset%8) write(zero, 8-offset%8);
+    }
+
+    ostream &out;
+    uint64_t offset;
+    vector<StructDBChain> chain_vec;
+    string names;
+    map<string,uint64_t> name_map;
+};
+
+/* read-only database, which is memory-mapped where available */
+class StructDB
+{
+public:
+    StructDB(): data(NULL), size(0), chain(NULL), chain_num(0),
+        names(NULL) {}
+
+    ~StructDB() { close(); }
+
+    /* open database filename. Return false if it is not a database */
+    bool open(const string &filename)
+    {
+        close();
+        path=filename;
+#ifdef _WIN32
+        ifstream fin(filename.c_str(), ios::binary);
+        if (!fin.is_open()) return false;
+        buffer.assign(istreambuf_iterator<char>(fin),
+            istreambuf_iterator<char>());
+        fin.close();
+        size=buffer.size();
+        data=size?&buffer[0]:NULL;
+#else
+        int fd=::open(filename.c_str(), O_RDONLY);
+        if (fd<0) return false;
+        struct stat st;
+        if (fstat(fd, &st)==0 && st.st_size>0)
+        {
+            void *p=mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+            if (p!=MAP_FAILED)
+            {
+                data=(const char *)p;
+                size=st.st_size;
+            }
+        }
+        ::close(fd);
+#endif
+        StructDBFooter footer;
+        if (size<sizeof(footer)) return fail();
+        memcpy(&footer, data+size-sizeof(footer), sizeof(footer));
+        if (memcmp(footer.magic, StructDB_magic, 8) ||
+            footer.index_offset+footer.chain_num*sizeof(StructDBChain)>
+            footer.name_offset || footer.name_offset>size-sizeof(footer))
+            return fail();
+        chain=(const StructDBChain *)(data+footer.index_offset);
+        chain_num=footer.chain_num;
+        names=data+footer.name_offset;
+
+        /* the name table must end with NUL, so that every name offset
+         * below its size points to a terminated string */
+        uint64_t name_size=size-sizeof(footer)-footer.name_offset;
+        if (chain_num && (name_size==0 || names[name_size-1]))
+            return fail();
+
+        /* chains of the same file are consecutive */
+        size_t c;
+        for (c=0;c<chain_num;c++)
+        {
+            if (chain[c].len<0 || chain[c].offset>footer.index_offset ||
+                (uint64_t)chain[c].len>(footer.index_offset-chain[c].offset)/
+                StructDB_residue_size || chain[c].name>=name_size ||
+                chain[c].chainID>=name_size) return fail();
+            if (c && chain[c].name==chain[c-1].name)
+                file_map[names+chain[c].name].second++;
+            else
+            {
+                file_map[names+chain[c].name]=make_pair(c,1);
+                file_list.push_back(names+chain[c].name);
+            }
+        }
+        return true;
+    }
+
+    void close()
+    {
+#ifdef _WIN32
+        vector<char>().swap(buffer);
+#else
+        if (data) munmap((void *)data, size);
+#endif
+        data=NULL;
+        size=0;
+        chain=NULL;
+        chain_num=0;
+        names=NULL;
+        file_map.clear();
+        file_list.clear();
+    }
+
+    /* structure files in the order in which they were added */
+    const vector<string> &get_file_list() const { return file_list; }
+
+    /* database file name. Structure names in chain lists start with it */
+    const string &get_path() const { return path; }
+
+    /* append the chains of structure filename, which may start with the
+     * database file name, to chain_idx, chainID_list and mol_vec, like
+     * get_PDB_lines. Return the number of chains */
+    size_t get_chains(const string &filename, vector<size_t> &chain_idx,
+        vector<string> &chainID_list, vector<int> &mol_vec) const
+    {
+        string name=filename;
+        if (name.compare(0, path.size(), path)==0 &&
+            file_map.find(name)==file_map.end()) name=name.substr(path.size());
+        map<string,pair<size_t,size_t> >::const_iterator it=
+            file_map.find(name);
+        if (it==file_map.end()) return 0;
+        for (size_t c=it->second.first;
+            c<it->second.first+it->second.second;c++)
+        {
+            chain_idx.push_back(c);
+            chainID_list.push_back(names+chain[c].chainID);
+            mol_vec.push_back(chain[c].mol_type);
+        }
+        return it->second.second;
+    }
+
+    int get_len(const size_t c) const { return chain[c].len; }
+
+    /* read chain c like read_PDB. sec may be NULL */
+    int read_chain(const size_t c, double **a, char *seq, char *sec,
+        vector<string> &resi_vec, const int read_resi) const
+    {
+        const int len=chain[c].len;
+        const char *p=data+chain[c].offset;
+        const int32_t *xyz=(const int32_t *)p;
+        /* Dividing by 1000 gives the same value as parsing the 3 decimals
+         * of the PDB format. The divisor is volatile so that -ffast-math
+         * does not replace the division by a less accurate multiplication
+         * with 0.001 */
+        volatile double scale=1000;
+        int r;
+        for (r=0;r<len;r++)
+        {
+            a[r][0]=xyz[3*r  ]/scale;
+            a[r][1]=xyz[3*r+1]/scale;
+            a[r][2]=xyz[3*r+2]/scale;
+        }
+        p+=sizeof(int32_t)*3*len;
+        memcpy(seq, p, len);
+        seq[len]='\0';
+        p+=len;
+        if (sec)
+        {
+            memcpy(sec, p, len);
+            sec[len]='\0';
+        }
+        p+=len;
+        for (r=0;r<len && read_resi;r++,p+=StructDB_resi_size)
+        {
+            if (read_resi>=2) resi_vec.push_back(string(p,6));
+            else resi_vec.push_back(string(p,5));
+        }
+        return len;
+    }
+
+private:
+    bool fail()
+    {
+        close();
+        return false;
+    }
+
+    string path;
+    const char *data;
+    size_t size;
+    const StructDBChain *chain;
+    size_t chain_num;
+    const char *names;
+    map<string,pair<size_t,size_t> > file_map; // first chain, chain number
+    vector<string> file_list;
+#ifdef _WIN32
+    vector<char> buffer;
+#endif
+};
+
+/* list structure files for -infmt 4. Like file2chainlist, each name is
+ * the database file name followed by the name of the structure file in
+ * the database, so that removing the -dir prefix gives the file name.
+ * If listname is empty, all structure files of the database are listed */
+void db2chainlist(vector<string>&chain_list, const string &listname,
+    const StructDB &db)
+{
+    if (listname.size()==0)
+    {
+        const vector<string> &file_list=db.get_file_list();
+        for (size_t i=0;i<file_list.size();i++)
+            chain_list.push_back(db.get_path()+file_list[i]);
+        return;
+    }
+    ifstream fp(listname.c_str());
+    if (! fp.is_open())
+        PrintErrorAndQuit(("Can not open file: "+listname+'\n').c_str());
+    string line;
+    while (fp.good())
+    {
+        getline(fp, line);
+        if (! line.size()) continue;
+        chain_list.push_back(db.get_path()+Trim(line));
+    }
+    fp.close();
+}
+
+#endif
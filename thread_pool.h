@@ -0,0 +1,91 @@
+/* Fixed-size pool of worker threads used by the multithreaded batch modes.
+ * Tasks are taken from a shared FIFO queue by workers that live as long as
+ * the pool, so that threads are not created and joined for every task. */
+#ifndef TMalign_thread_pool_h
+#define TMalign_thread_pool_h 1
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+class ThreadPool
+{
+public:
+    /* start nthreads workers */
+    ThreadPool(const int nthreads)
+    {
+        busy=0;
+        stop=false;
+        for (int tid=0;tid<nthreads;tid++)
+            workers.push_back(thread(&ThreadPool::worker, this, tid));
+    }
+
+    /* finish all queued tasks and join the workers */
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            stop=true;
+        }
+        cv_task.notify_all();
+        for (size_t t=0;t<workers.size();t++) workers[t].join();
+    }
+
+    int size() const { return workers.size(); }
+
+    /* queue a task. task(tid) is called with the index of the worker
+     * thread, which can be used to select per-thread buffers */
+    void submit(const function<void(int)> &task)
+    {
+        {
+            lock_guard<mutex> lock(mtx);
+            tasks.push_back(task);
+        }
+        cv_task.notify_one();
+    }
+
+    /* block until the queue is empty and no task is running */
+    void wait()
+    {
+        unique_lock<mutex> lock(mtx);
+        while (tasks.size() || busy) cv_done.wait(lock);
+    }
+
+private:
+    void worker(const int tid)
+    {
+        function<void(int)> task;
+        while (true)
+        {
+            {
+                unique_lock<mutex> lock(mtx);
+                while (!stop && tasks.empty()) cv_task.wait(lock);
+                if (tasks.empty()) return; // stop is set
+                task=tasks.front();
+                tasks.pop_front();
+                busy++;
+            }
+            task(tid);
+            {
+                lock_guard<mutex> lock(mtx);
+                busy--;
+            }
+            cv_done.notify_all();
+        }
+    }
+
+    vector<thread> workers;
+    deque<function<void(int)> > tasks;
+    mutex mtx;
+    condition_variable cv_task; // a task is queued or the pool stops
+    condition_variable cv_done; // a task is finished
+    size_t busy;                // number of running tasks
+    bool stop;
+};
+
+#endif